@@ -33,6 +33,14 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+const char* const SHARED_BLOCK_NAME = "wyShared";
+const GLuint SHARED_BLOCK_BINDING = 0;
+
+const char* const FRAGMENT_OUTPUT_PREFIX = "wyFragData";
+const GLuint FRAGMENT_OUTPUT_COUNT = 4;
+
+///////////////////////////////////////////////////////////////////////
+
 WENDY_CHECKFORMAT(1, bool checkGL(const char* format, ...));
 
 GLenum convertToGL(IndexBuffer::Type type);
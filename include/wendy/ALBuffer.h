@@ -72,6 +72,21 @@ public:
                             Context& context,
                             const Sample& data);
   static Ref<Buffer> read(Context& context, const String& sampleName);
+  /*! Queues asynchronous reading of a buffer.  The sample is decoded on a
+   *  worker thread of the specified loader and the buffer is created when
+   *  the loader is updated.
+   *  @param[in] loader The loader to queue the reading on.
+   *  @param[in] context The OpenAL context within which to create the
+   *  buffer.
+   *  @param[in] sampleName The name of the sample to use.
+   *  @param[in] callback The function to call with the buffer once it has
+   *  been created, or an empty function.
+   *  @return The identifier of the loading job.
+   */
+  static ResourceLoader::JobID readAsync(ResourceLoader& loader,
+                                         Context& context,
+                                         const String& sampleName,
+                                         const std::function<void (Buffer&)>& callback);
 private:
   Buffer(const ResourceInfo& info, Context& context);
   Buffer(const Buffer& source);
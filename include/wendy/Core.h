@@ -28,6 +28,7 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
 
 #include <cstdarg>
 #include <cstddef>
@@ -310,9 +311,10 @@ private:
 class RefBase
 {
 protected:
-  static bool unreferenced(RefObject* object);
   static void increment(RefObject* object);
-  static void decrement(RefObject* object);
+  /*! @return @c true if the last reference to the object was removed.
+   */
+  static bool decrement(RefObject* object);
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -321,6 +323,10 @@ protected:
  *
  *  @remarks No, there are no visible knobs on this class. Use the Ref class to
  *  point to objects derived from RefObject to enable reference counting.
+ *
+ *  @remarks The reference count is atomic, so references to an object may be
+ *  added and removed on several threads at once.  A thread may still only add
+ *  a reference to an object it knows to be alive.
  */
 class RefObject
 {
@@ -339,7 +345,7 @@ public:
    */
   RefObject& operator = (const RefObject& source);
 private:
-  uint count;
+  std::atomic<uint> count;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -402,8 +408,7 @@ public:
 
     if (object)
     {
-      decrement(object);
-      if (unreferenced(object))
+      if (decrement(object))
         delete static_cast<RefObject*>(object);
     }
 
@@ -55,10 +55,17 @@ private:
     ITEM_FRAMERATE,
     ITEM_STATECHANGES,
     ITEM_OPERATIONS,
+    ITEM_DRAWCALLS,
+    ITEM_SUBMITTIME,
+    ITEM_INSTANCES,
+    ITEM_UNIFORMS,
     ITEM_VERTICES,
     ITEM_POINTS,
     ITEM_LINES,
     ITEM_TRIANGLES,
+    ITEM_BUFFERSWITCHES,
+    ITEM_VERTEXARRAYS,
+    ITEM_OCCLUSIONQUERIES,
     ITEM_TEXTURES,
     ITEM_VERTEXBUFFERS,
     ITEM_INDEXBUFFERS,
@@ -67,6 +74,7 @@ private:
   };
   void updateCountItem(Item item, const char* unit, size_t count);
   void updateCountSizeItem(Item item, const char* unit, size_t count, size_t size);
+  void updateCountSkipItem(Item item, const char* unit, size_t count, size_t skipped);
   Panel* root;
   UI::Label* labels[ITEM_COUNT];
 };
@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy deferred renderer
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+#ifndef WENDY_DEFERRED_H
+#define WENDY_DEFERRED_H
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/RenderPool.h>
+#include <wendy/RenderSystem.h>
+#include <wendy/RenderState.h>
+#include <wendy/RenderLight.h>
+#include <wendy/RenderScene.h>
+
+#include <wendy/Forward.h>
+
+///////////////////////////////////////////////////////////////////////
+
+namespace wendy
+{
+  namespace deferred
+  {
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Deferred renderer configuration.
+ *  @ingroup renderer
+ */
+class Config
+{
+public:
+  /*! Constructor.
+   *  @param[in] pool The geometry pool to use.
+   */
+  Config(render::GeometryPool& pool);
+  /*! The geometry pool to be used by the renderer.
+   */
+  Ref<render::GeometryPool> pool;
+  /*! The shared program state to be used by the renderer.
+   */
+  Ref<forward::SharedProgramState> state;
+  /*! The light grid to be used by the renderer, or @c NULL to have the
+   *  renderer create one with the default cluster counts.
+   */
+  Ref<render::LightGrid> lightGrid;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Deferred renderer.
+ *  @ingroup renderer
+ *
+ *  The opaque queue of a scene is rendered into a G-buffer using the
+ *  techniques of type @c deferred for the default phase.  Their fragment
+ *  shaders write the albedo color and specular intensity to @c wyFragData0
+ *  and the normalized view space normal to @c wyFragData1.
+ *
+ *  Point lights and spotlights are then accumulated from the light grid in a
+ *  single full screen pass, which also writes the depth of the G-buffer to
+ *  the current framebuffer.  Directional lights are added in one full screen
+ *  pass each.  Finally the blended queue is rendered on top using the forward
+ *  renderer, so blended materials need no deferred techniques.
+ */
+class Renderer : public render::System
+{
+public:
+  /*! Renders the specified scene to the current framebuffer using the
+   *  specified camera.
+   */
+  void render(const render::Scene& scene, const Camera& camera);
+  /*! @return The light grid used by this renderer.
+   */
+  render::LightGrid& getLightGrid() const;
+  /*! @return The shared program state object used by this renderer.
+   */
+  forward::SharedProgramState& getSharedProgramState();
+  /*! Creates a renderer object using the specified geometry pool and the
+   *  specified configuration.
+   *  @return The newly constructed renderer object, or @c NULL if an error
+   *  occurred.
+   */
+  static Ref<Renderer> create(const Config& config);
+private:
+  Renderer(render::GeometryPool& pool);
+  bool init(const Config& config);
+  bool initPass(render::Pass& pass, const char* fragmentShaderName);
+  bool updateGBuffer(uint width, uint height);
+  void renderLights(const render::Scene& scene, const Camera& camera);
+  Ref<forward::Renderer> forward;
+  Ref<forward::SharedProgramState> state;
+  Ref<render::LightGrid> lightGrid;
+  Ref<GL::TextureFramebuffer> framebuffer;
+  Ref<GL::Texture> colorTexture;
+  Ref<GL::Texture> normalTexture;
+  Ref<GL::Texture> depthTexture;
+  Ref<GL::VertexBuffer> quad;
+  render::Pass lightPass;
+  render::Pass directionalPass;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+  } /*namespace deferred*/
+} /*namespace wendy*/
+
+///////////////////////////////////////////////////////////////////////
+#endif /*WENDY_DEFERRED_H*/
+///////////////////////////////////////////////////////////////////////
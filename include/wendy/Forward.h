@@ -29,6 +29,7 @@
 #include <wendy/RenderPool.h>
 #include <wendy/RenderSystem.h>
 #include <wendy/RenderState.h>
+#include <wendy/RenderLight.h>
 #include <wendy/RenderScene.h>
 
 ///////////////////////////////////////////////////////////////////////
@@ -40,11 +41,44 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+enum
+{
+  SHARED_LIGHT_DATA = render::SHARED_STATE_CUSTOM_BASE,
+  SHARED_LIGHT_CLUSTERS,
+  SHARED_LIGHT_INDICES,
+  SHARED_LIGHT_GRID_SIZE,
+  SHARED_LIGHT_GRID_DEPTH,
+
+  SHARED_FORWARD_CUSTOM_BASE
+};
+
+///////////////////////////////////////////////////////////////////////
+
 /*! @brief Shared program state for the forward renderer.
  *  @ingroup renderer
+ *
+ *  In addition to the common shared state, this exposes the light grid of
+ *  the renderer, if any, to shaders.  See wendy/LightGrid.glsl for how to use
+ *  it.
  */
 class SharedProgramState : public render::SharedProgramState
 {
+public:
+  SharedProgramState();
+  bool reserveSupported(GL::Context& context) const;
+  /*! @return The light grid exposed by this state, or @c NULL if none.
+   */
+  render::LightGrid* getLightGrid() const;
+  /*! Sets the light grid exposed by this state.  This must be called again
+   *  whenever the grid has been reassigned.
+   */
+  void setLightGrid(render::LightGrid* newGrid);
+protected:
+  void updateTo(GL::Sampler& sampler);
+  void updateBlock(GL::Context& context);
+private:
+  Ref<render::LightGrid> grid;
+  uint gridGeneration;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -65,12 +99,32 @@ public:
   /*! The shared program state to be used by the renderer.
    */
   Ref<SharedProgramState> state;
+  /*! The light grid to be used by the renderer, or @c NULL to not assign
+   *  lights to clusters.
+   */
+  Ref<render::LightGrid> lightGrid;
 };
 
 ///////////////////////////////////////////////////////////////////////
 
 /*! @brief Forward renderer.
  *  @ingroup renderer
+ *
+ *  Passes whose program declares the @c vec4 attributes @c wyInstanceM0
+ *  through @c wyInstanceM3 are rendered instanced.  Consecutive sorted
+ *  operations using the same pass and primitive range are merged into a
+ *  single draw, with the columns of each model matrix supplied through those
+ *  attributes.  Instancing is opt-in per program; the shipped
+ *  @c wendy/InstancedModel.vs is an instanced model vertex shader.
+ *
+ *  Where the context supports multi-draw, consecutive sorted operations using
+ *  the same pass and the same vertex and index buffers are merged into a
+ *  single call even when their ranges differ.  Each range becomes a draw
+ *  command whose base instance selects its model matrices.
+ *
+ *  Where the context lacks instanced arrays, operations of instanced passes
+ *  are drawn one at a time with the model matrix set as constant attribute
+ *  values.
  */
 class Renderer : public render::System
 {
@@ -79,6 +133,14 @@ public:
    *  specified camera.
    */
   void render(const render::Scene& scene, const Camera& camera);
+  /*! Renders the operations of the specified queue to the current
+   *  framebuffer using the specified camera.  Unlike when rendering a whole
+   *  scene, no lights are assigned to the light grid.
+   */
+  void render(const render::Queue& queue, const Camera& camera);
+  /*! @return The light grid used by this renderer, or @c NULL if it has none.
+   */
+  render::LightGrid* getLightGrid() const;
   /*! @return The shared program state object used by this renderer.
    */
   SharedProgramState& getSharedProgramState();
@@ -91,9 +153,18 @@ public:
 private:
   Renderer(render::GeometryPool& pool);
   bool init(const Config& config);
+  void applyCamera(const Camera& camera);
   void renderOperations(const render::Queue& queue);
+  bool renderInstances(const render::OperationList& operations,
+                       const uint32* indices,
+                       size_t count);
+  bool renderMultiple(const render::OperationList& operations,
+                      const uint32* indices,
+                      size_t count);
   void releaseObjects();
   Ref<SharedProgramState> state;
+  Ref<render::LightGrid> lightGrid;
+  std::vector<GL::DrawCommand> commands;
 };
 
 ///////////////////////////////////////////////////////////////////////
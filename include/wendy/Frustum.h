@@ -48,6 +48,62 @@ enum FrustumPlane
   FRUSTUM_FAR
 };
 
+/*! The plane mask containing all frustum planes.
+ */
+const uint ALL_FRUSTUM_PLANES = 0x3f;
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Bounding spheres in structure-of-arrays form.
+ *
+ *  This is the input to the batch intersection test of Frustum, which tests
+ *  several spheres against each plane at once.
+ */
+class SphereBatch
+{
+public:
+  /*! Appends the specified sphere to this batch.
+   */
+  void add(const Sphere& sphere);
+  /*! Removes all spheres from this batch.
+   */
+  void clear();
+  /*! @return The number of spheres in this batch.
+   */
+  size_t getCount() const;
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  std::vector<float> radius;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Bounding boxes in structure-of-arrays form.
+ *
+ *  This is the input to the batch intersection test of Frustum, which tests
+ *  several boxes against each plane at once.
+ */
+class AABBBatch
+{
+public:
+  /*! Appends the specified bounding box to this batch.
+   */
+  void add(const AABB& box);
+  /*! Removes all bounding boxes from this batch.
+   */
+  void clear();
+  /*! @return The number of bounding boxes in this batch.
+   */
+  size_t getCount() const;
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  std::vector<float> sizeX;
+  std::vector<float> sizeY;
+  std::vector<float> sizeZ;
+};
+
 ///////////////////////////////////////////////////////////////////////
 
 /*! @brief 3D view frustum.
@@ -86,6 +142,42 @@ public:
    *  @remarks Even partial intersection counts.
    */
   bool intersects(const AABB& box) const;
+  /*! Checks whether this frustum intersects the specified bounding box,
+   *  testing only the specified planes.
+   *  @param[in,out] planeMask The planes to test, as bits indexed by
+   *  FrustumPlane.  On return, the planes the box straddles.  Anything inside
+   *  the box is entirely inside the remaining planes and need not be tested
+   *  against them.
+   *  @param[in,out] firstPlane The plane to test first.  On return, the plane
+   *  that rejected the box, if any.  Keeping it for the next test of the same
+   *  box usually rejects it again with a single plane test.
+   *
+   *  @remarks Even partial intersection counts.
+   */
+  bool intersects(const AABB& box, uint& planeMask, uint& firstPlane) const;
+  /*! Checks whether this frustum intersects the specified bounding box.
+   *
+   *  Unlike the plane tests, which accept boxes straddling two planes outside
+   *  the frustum, this is an exact separating axis test.  It is considerably
+   *  more expensive.
+   *
+   *  @remarks Even partial intersection counts.
+   */
+  bool intersectsExactly(const AABB& box) const;
+  /*! Checks which of the spheres in the specified batch intersect this
+   *  frustum.
+   *  @param[in] batch The spheres to test.
+   *  @param[out] masks The visibility masks, where bit (i % 32) of element
+   *  (i / 32) is set if sphere i intersects this frustum.
+   */
+  void intersects(const SphereBatch& batch, std::vector<uint32>& masks) const;
+  /*! Checks which of the bounding boxes in the specified batch intersect this
+   *  frustum.
+   *  @param[in] batch The bounding boxes to test.
+   *  @param[out] masks The visibility masks, where bit (i % 32) of element
+   *  (i / 32) is set if box i intersects this frustum.
+   */
+  void intersects(const AABBBatch& batch, std::vector<uint32>& masks) const;
   /*! Transforms the planes of this frustum by the specified transform.
    */
   void transformBy(const Transform3& transform);
@@ -105,6 +197,10 @@ public:
   /*! The planes of this frustum.
    */
   Plane planes[6];
+  /*! The corners of this frustum, with the near corners first.  These are
+   *  only used by the exact intersection test.
+   */
+  vec3 corners[8];
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -105,9 +105,25 @@ public:
    *  @return The base address of the vertices.
    */
   void* lock(LockType type = LOCK_WRITE_ONLY);
+  /*! Locks the specified range of this vertex buffer for reading and writing.
+   *  @param[in] type The desired type of lock.
+   *  @param[in] start The index of the first vertex to lock.
+   *  @param[in] count The number of vertices to lock.
+   *  @param[in] synchronized @c false to skip waiting for the GPU to finish
+   *  reading the range.  The caller must then guarantee that it no longer
+   *  does, for example with a Fence.
+   *  @return The address of the first locked vertex, or @c NULL if an error
+   *  occurred.
+   */
+  void* lock(LockType type, size_t start, size_t count, bool synchronized = true);
   /*! Unlocks this vertex buffer, finalizing any changes.
    */
   void unlock();
+  /*! Discards the contents of this vertex buffer.  This lets the driver
+   *  allocate fresh storage instead of waiting for the GPU to finish reading
+   *  the previous contents.
+   */
+  void discard();
   /*! Copies the specified data into this vertex buffer, starting at the
    *  specified offset.
    *  @param[in] source The base address of the source data.
@@ -115,6 +131,19 @@ public:
    *  @param[in] start The index of the first vertex to be written to.
    */
   void copyFrom(const void* source, size_t count, size_t start = 0);
+  /*! Copies vertices from the specified vertex buffer into this vertex
+   *  buffer.  The copy is performed by the GPU, without reading the
+   *  vertices back.
+   *  @param[in] source The vertex buffer to copy from.  It must have the same
+   *  format as, and be distinct from, this vertex buffer.
+   *  @param[in] count The number of vertices to copy.
+   *  @param[in] sourceStart The index of the first vertex to read from.
+   *  @param[in] start The index of the first vertex to be written to.
+   */
+  void copyFrom(const VertexBuffer& source,
+                size_t count,
+                size_t sourceStart,
+                size_t start);
   /*! Copies the specified number of bytes from this vertex buffer, starting
    *  at the specified offset.
    *  @param[in,out] target The base address of the destination buffer.
@@ -202,9 +231,25 @@ public:
    *  @return The base address of the index elements.
    */
   void* lock(LockType type = LOCK_WRITE_ONLY);
+  /*! Locks the specified range of this index buffer for reading and writing.
+   *  @param[in] type The desired type of lock.
+   *  @param[in] start The index of the first index to lock.
+   *  @param[in] count The number of indices to lock.
+   *  @param[in] synchronized @c false to skip waiting for the GPU to finish
+   *  reading the range.  The caller must then guarantee that it no longer
+   *  does, for example with a Fence.
+   *  @return The address of the first locked index, or @c NULL if an error
+   *  occurred.
+   */
+  void* lock(LockType type, size_t start, size_t count, bool synchronized = true);
   /*! Unlocks this index buffer, finalizing any changes.
    */
   void unlock();
+  /*! Discards the contents of this index buffer.  This lets the driver
+   *  allocate fresh storage instead of waiting for the GPU to finish reading
+   *  the previous contents.
+   */
+  void discard();
   /*! Copies the specified data into this index buffer, starting at the
    *  specified offset.
    *  @param[in] source The base address of the source data.
@@ -212,6 +257,18 @@ public:
    *  @param[in] start The index of the first index to be written to.
    */
   void copyFrom(const void* source, size_t count, size_t start = 0);
+  /*! Copies indices from the specified index buffer into this index buffer.
+   *  The copy is performed by the GPU, without reading the indices back.
+   *  @param[in] source The index buffer to copy from.  It must have the same
+   *  type as, and be distinct from, this index buffer.
+   *  @param[in] count The number of indices to copy.
+   *  @param[in] sourceStart The index of the first index to read from.
+   *  @param[in] start The index of the first index to be written to.
+   */
+  void copyFrom(const IndexBuffer& source,
+                size_t count,
+                size_t sourceStart,
+                size_t start);
   /*! Copies the specified number of bytes from this index buffer, starting
    *  at the specified offset.
    *  @param[in,out] target The base address of the destination buffer.
@@ -413,6 +470,14 @@ public:
                  size_t start,
                  size_t count,
                  size_t base = 0);
+  /*! @return @c true if this primitive range refers to the same primitives
+   *  in the same buffers as the specified range, or @c false otherwise.
+   */
+  bool operator == (const PrimitiveRange& other) const;
+  /*! @return @c true if this primitive range does not refer to the same
+   *  primitives as the specified range, or @c false otherwise.
+   */
+  bool operator != (const PrimitiveRange& other) const;
   /*! @return @c true if this primitive range contains zero primitives,
    *  otherwise @c false.
    */
@@ -441,6 +506,71 @@ private:
 
 ///////////////////////////////////////////////////////////////////////
 
+/*! @brief Indexed draw command.
+ *  @ingroup opengl
+ *
+ *  This is laid out as expected by indirect drawing, and is used with
+ *  Context::renderMultiple.
+ */
+class DrawCommand
+{
+public:
+  /*! The number of indices to render.
+   */
+  uint32 count;
+  /*! The number of instances to render.
+   */
+  uint32 instanceCount;
+  /*! The index of the first index to render.
+   */
+  uint32 start;
+  /*! The value added to each index before fetching vertices.
+   */
+  int32 base;
+  /*! The index, relative to the instance range, of the first instance.
+   */
+  uint32 baseInstance;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief GPU command stream fence.
+ *  @ingroup opengl
+ *
+ *  A fence is signaled once the GPU has finished executing every command
+ *  issued before it was created.
+ */
+class Fence : public RefObject
+{
+public:
+  /*! Destructor.
+   */
+  ~Fence();
+  /*! @return @c true if the GPU has passed this fence, or @c false otherwise.
+   */
+  bool isSignaled() const;
+  /*! Blocks until the GPU has passed this fence.
+   */
+  void wait() const;
+  /*! Inserts a fence into the command stream of the specified context.
+   *  @return The newly created fence, or @c NULL if an error occurred.
+   */
+  static Ref<Fence> create(Context& context);
+  /*! @return @c true if fences are supported by the current context, or @c
+   *  false otherwise.
+   */
+  static bool isSupported();
+private:
+  Fence(Context& context);
+  Fence(const Fence& source);
+  Fence& operator = (const Fence& source);
+  bool init();
+  Context& context;
+  void* syncID;
+};
+
+///////////////////////////////////////////////////////////////////////
+
 /*! @brief Vertex range scoped lock helper template.
  *  @ingroup opengl
  */
@@ -617,17 +747,17 @@ public:
    */
   enum Attachment
   {
-    /*! The first (default) color buffer, referenced by @c gl_FragColor or @c
-     *  gl_FragData[0].
+    /*! The first (default) color buffer, referenced in GLSL by the first
+     *  fragment output or by @c wyFragData0.
      */
     COLOR_BUFFER0,
-    /*! The second color buffer, referenced in GLSL by @c gl_FragData[1].
+    /*! The second color buffer, referenced in GLSL by @c wyFragData1.
      */
     COLOR_BUFFER1,
-    /*! The third color buffer, referenced in GLSL by @c gl_FragData[2].
+    /*! The third color buffer, referenced in GLSL by @c wyFragData2.
      */
     COLOR_BUFFER2,
-    /*! The fourth color buffer, referenced in GLSL by @c gl_FragData[3].
+    /*! The fourth color buffer, referenced in GLSL by @c wyFragData3.
      */
     COLOR_BUFFER3,
     /*! The depth buffer, referenced in GLSL by @c gl_FragDepth.
@@ -34,6 +34,7 @@
 #include <wendy/Timer.h>
 
 #include <deque>
+#include <unordered_map>
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -357,12 +358,33 @@ public:
     uint pointCount;
     uint lineCount;
     uint triangleCount;
+    uint instanceCount;
+    uint uniformUploadCount;
+    uint skippedUniformUploadCount;
+    uint vertexBufferSwitchCount;
+    uint indexBufferSwitchCount;
+    uint drawCallCount;
+    uint vertexArrayHitCount;
+    uint vertexArrayMissCount;
+    uint occlusionQueryCount;
+    uint occlusionQueryStallCount;
+    Time submitDuration;
     Time duration;
   };
   Stats();
   void addFrame();
   void addStateChange();
-  void addPrimitives(PrimitiveType type, uint vertexCount);
+  void addUniformUpload();
+  void addSkippedUniformUpload();
+  void addVertexBufferSwitch();
+  void addIndexBufferSwitch();
+  void addDrawCall();
+  void addVertexArrayHit();
+  void addVertexArrayMiss();
+  void addOcclusionQuery();
+  void addOcclusionQueryStall();
+  void addSubmitTime(Time time);
+  void addPrimitives(PrimitiveType type, uint vertexCount, uint instanceCount = 1);
   void addTexture(size_t size);
   void removeTexture(size_t size);
   void addVertexBuffer(size_t size);
@@ -403,8 +425,26 @@ private:
 class SharedProgramState : public RefObject
 {
 public:
+  /*! Constructor.
+   */
+  SharedProgramState();
   virtual void updateTo(Uniform& uniform) = 0;
   virtual void updateTo(Sampler& uniform) = 0;
+  /*! Writes the current values of all shared uniform block members to the
+   *  specified context.
+   */
+  virtual void updateBlock(Context& context) = 0;
+  /*! @return The generation of the shared uniform block members of this
+   *  state.  The context only calls updateBlock when this has changed.
+   */
+  uint getBlockGeneration() const;
+protected:
+  /*! Marks the shared uniform block members of this state as changed.
+   */
+  void invalidateBlock();
+private:
+  uint blockGeneration;
+  static uint nextBlockGeneration;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -469,6 +509,49 @@ public:
               uint start,
               uint count,
               uint base = 0);
+  /*! Renders one instance of the specified primitive range for each vertex
+   *  in the specified instance range, using the current GLSL program.
+   *
+   *  Program attributes not found in the vertex format of the primitive range
+   *  are sourced from the instance range, advancing once per instance.
+   *  @pre A GLSL program must be set before calling this method.
+   *  @pre Instancing must be supported by this context.
+   */
+  void render(const PrimitiveRange& range, const VertexRange& instances);
+  /*! Renders a single instance of the specified primitive range, using the
+   *  current GLSL program, with its instance attributes set to the columns
+   *  of the specified model matrix.
+   *
+   *  This is the fallback for instanced programs on contexts without
+   *  instanced arrays.
+   *  @pre A GLSL program must be set before calling this method.
+   */
+  void render(const PrimitiveRange& range, const mat4& instanceTransform);
+  /*! Renders the specified draw commands with a single call, using the
+   *  specified vertex and index buffers and the current GLSL program.
+   *
+   *  Program attributes not found in the vertex format are sourced from the
+   *  instance range, starting at the base instance of each command.
+   *  @pre A GLSL program must be set before calling this method.
+   *  @pre Multi-draw must be supported by this context.
+   */
+  void renderMultiple(PrimitiveType type,
+                      VertexBuffer& vertexBuffer,
+                      IndexBuffer& indexBuffer,
+                      const DrawCommand* commands,
+                      uint count,
+                      const VertexRange& instances);
+  /*! @return @c true if this context supports rendering several draw
+   *  commands with a single call, or @c false otherwise.
+   *  @remarks This requires @c GL_ARB_multi_draw_indirect and @c
+   *  GL_ARB_base_instance.
+   */
+  bool isMultiDrawSupported() const;
+  /*! @return @c true if this context supports sourcing attributes from an
+   *  instance range, or @c false otherwise.
+   *  @remarks This requires OpenGL 3.3 or @c GL_ARB_instanced_arrays.
+   */
+  bool isInstancingSupported() const;
   /*! Makes Context::update to return when in manual refresh mode, forcing
    *  a new iteration of the render loop.
    */
@@ -488,6 +571,18 @@ public:
   /*! Reserves the specified non-sampler uniform signature as shared.
    */
   void createSharedUniform(const char* name, UniformType type, int ID);
+  /*! Reserves the specified non-sampler uniform signature as a member of the
+   *  shared uniform block.  Block members are uploaded once to a uniform
+   *  buffer shared by all programs instead of to each program individually.
+   */
+  void createSharedBlockUniform(const char* name, UniformType type, int ID);
+  /*! Sets the value of the specified shared uniform block member.
+   *  @param[in] ID The shared ID of the block member.
+   *  @param[in] data The new value, in the same layout as Uniform::copyFrom.
+   *  @param[in] generation The generation of the value.  If non-zero and equal
+   *  to the generation of the current value, the call is a no-op.
+   */
+  void setSharedBlockUniform(int ID, const void* data, uint generation);
   /*! @return The shared ID of the specified sampler uniform signature.
    */
   int getSharedSamplerID(const char* name, SamplerType type) const;
@@ -502,7 +597,8 @@ public:
    *  @param[in] newState The new state object.
    */
   void setCurrentSharedProgramState(SharedProgramState* newState);
-  /*! @return GLSL declarations of all shared samplers and uniforms.
+  /*! @return GLSL declarations of all shared samplers and uniforms,
+   *  including the shared uniform block.
    */
   const char* getSharedProgramStateDeclaration() const;
   /*! @return The window mode of this context.
@@ -634,11 +730,54 @@ private:
   bool init(const WindowConfig& wc, const ContextConfig& cc);
   void applyState(const RenderState& newState);
   void forceState(const RenderState& newState);
+  void setCurrentInstanceRange(const VertexRange& newRange);
+  bool bindAttributes();
+  void applySharedBlock();
+  int getSharedBlockOffset(const char* name) const;
+  void updateDeclaration();
+  bool specifyAttributes(bool instancesOnly);
+  void resetVertexArray();
+  void removeVertexArrays(const void* object);
+  void draw(PrimitiveType type,
+            uint start,
+            uint count,
+            uint base,
+            uint instanceCount);
   static void sizeCallback(void* window, int width, int height);
   static int closeCallback(void* window);
   static void refreshCallback(void* window);
   class SharedSampler;
   class SharedUniform;
+  /*! @internal
+   *  @brief Combination of program and buffers with a cached vertex array.
+   */
+  struct VertexArrayKey
+  {
+    bool operator == (const VertexArrayKey& other) const;
+    bool references(const void* object) const;
+    const Program* program;
+    const VertexBuffer* vertexBuffer;
+    const IndexBuffer* indexBuffer;
+    const VertexBuffer* instanceBuffer;
+  };
+  /*! @internal
+   */
+  struct VertexArrayKeyHash
+  {
+    size_t operator () (const VertexArrayKey& key) const;
+  };
+  /*! @internal
+   *  @brief Cached vertex array object.
+   */
+  struct VertexArray
+  {
+    size_t instanceStart;
+    uint arrayID;
+  };
+  typedef std::unordered_map<VertexArrayKey, VertexArray, VertexArrayKeyHash> VertexArrayMap;
+  friend class VertexBuffer;
+  friend class IndexBuffer;
+  friend class Program;
   ResourceCache& cache;
   Signal0<void> finishSignal;
   Signal0<bool> closeRequestSignal;
@@ -663,11 +802,26 @@ private:
   Ref<Program> currentProgram;
   Ref<VertexBuffer> currentVertexBuffer;
   Ref<IndexBuffer> currentIndexBuffer;
+  Ref<VertexBuffer> currentInstanceBuffer;
+  size_t currentInstanceStart;
+  uint currentVertexArray;
+  uint commandBufferID;
+  uint blockBufferID;
+  bool multiDrawSupported;
+  bool instancingSupported;
+  bool dirtyBlock;
   Ref<Framebuffer> currentFramebuffer;
   Ref<SharedProgramState> currentSharedState;
+  const SharedProgramState* blockState;
+  uint blockGeneration;
   Ref<DefaultFramebuffer> defaultFramebuffer;
   std::vector<SharedSampler> samplers;
   std::vector<SharedUniform> uniforms;
+  std::vector<int> blockMembers;
+  VertexArrayMap vertexArrays;
+  std::vector<uint8> blockData;
+  String uniformDeclaration;
+  String blockDeclaration;
   String declaration;
   Stats* stats;
 };
@@ -107,9 +107,9 @@ class Attribute
   friend class Context;
 public:
   /*! Binds this attribute to the specified stride and offset of the
-   *  current vertex buffer.
+   *  current vertex buffer, with elements of the specified type.
    */
-  void bind(size_t stride, size_t offset);
+  void bind(size_t stride, size_t offset, VertexComponent::Type type);
   /*! @return @c true if the name of this attribute matches the specified
    *  string, or @c false otherwise.
    */
@@ -162,6 +162,9 @@ class Sampler
   friend class Program;
 public:
   /*! Binds this sampler to the specified texture unit.
+   *
+   *  @remarks The texture unit is cached and the binding is only issued if it
+   *  differs from the one last set.
    */
   void bind(uint unit);
   /*! @return @c true if the name of this sampler matches the specified string,
@@ -188,10 +191,13 @@ public:
    */
   static const char* getTypeName(SamplerType type);
 private:
+  Sampler();
   String name;
   SamplerType type;
   int location;
   int sharedID;
+  int unit;
+  Context* context;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -224,8 +230,20 @@ public:
    *
    *  @remarks It is the responsibility of the caller to ensure that the source
    *  data type matches.
+   *  @remarks The value is cached and only uploaded if it differs from the
+   *  one last uploaded.
    */
   void copyFrom(const void* data);
+  /*! Copies a new value for this uniform from the specified address, unless
+   *  this uniform already holds the value of the specified generation.
+   *  @param[in] data The address of the value to use.
+   *  @param[in] generation The generation of the value to use.  Each distinct
+   *  value must have a distinct, non-zero generation.
+   *
+   *  @remarks This lets shared program state skip uploads without comparing
+   *  values.
+   */
+  void copyFrom(const void* data, uint generation);
   /*! @return @c true if the name of this uniform matches the specified string,
    *  or @c false otherwise.
    */
@@ -262,22 +280,42 @@ public:
    */
   static const char* getTypeName(UniformType type);
 private:
+  Uniform();
+  void upload(const void* data);
   String name;
   UniformType type;
   int location;
   int sharedID;
+  bool cached;
+  uint generation;
+  float cache[16];
+  Context* context;
 };
 
 ///////////////////////////////////////////////////////////////////////
 
 /*! @brief GLSL program.
  *  @ingroup opengl
+ *
+ *  Fragment shader outputs named @c wyFragData0 through @c wyFragData3 are
+ *  written to the color buffer of the same number, for rendering to several
+ *  color buffers of a TextureFramebuffer at once.
+ *
+ *  Vertex attributes of type @c vec4 named @c wyInstanceM0 through @c
+ *  wyInstanceM3 hold the columns of a per-instance model matrix.  Programs
+ *  declaring them are instanced and can be rendered either from an instance
+ *  range or, on contexts without instanced arrays, one instance at a time.
  */
 class Program : public Resource
 {
   friend class Context;
 public:
   ~Program();
+  /*! @return @c true if this program declares any of the instance
+   *  attributes, or @c false otherwise.
+   *  @remarks This is determined once when the program is linked.
+   */
+  bool isInstanced() const;
   Attribute* findAttribute(const char* name);
   const Attribute* findAttribute(const char* name) const;
   Sampler* findSampler(const char* name);
@@ -305,17 +343,21 @@ private:
   Program(const ResourceInfo& info, Context& context);
   Program(const Program& source);
   bool init(Shader& vertexShader, Shader& fragmentShader);
+  bool retrieveSharedBlock(uint blockIndex, int maxNameLength);
   bool retrieveUniforms();
   bool retrieveAttributes();
   void bind();
-  void unbind();
   Program& operator = (const Program& source);
   bool isValid() const;
+  bool isInstanceAttribute(const Attribute& attribute) const;
   String getInfoLog() const;
   Context& context;
   Ref<Shader> vertexShader;
   Ref<Shader> fragmentShader;
   uint programID;
+  bool sharedBlock;
+  uint instanceAttributeCount;
+  int instanceLocations[4];
   std::vector<Attribute> attributes;
   std::vector<Sampler> samplers;
   std::vector<Uniform> uniforms;
@@ -64,6 +64,9 @@ public:
   bool hasResultAvailable() const;
   /*! @return The latest results of this query, or zero if it is active or has
    *  never been active.
+   *
+   *  @remarks If the result is not yet available, this blocks until it is.
+   *  Such stalls are recorded in the statistics of the context.
    */
   uint getResult() const;
   /*! Creates an occlusion query.
@@ -295,6 +295,23 @@ public:
   static Ref<Texture> read(Context& context,
                            const TextureParams& params,
                            const String& imageName);
+  /*! Queues asynchronous reading of a texture.  The image is decoded on a
+   *  worker thread of the specified loader and the texture is created when
+   *  the loader is updated.
+   *  @param[in] loader The loader to queue the reading on.
+   *  @param[in] context The OpenGL context within which to create the
+   *  texture.
+   *  @param[in] params The creation parameters for the texture.
+   *  @param[in] imageName The name of the image to use.
+   *  @param[in] callback The function to call with the texture once it has
+   *  been created, or an empty function.
+   *  @return The identifier of the loading job.
+   */
+  static ResourceLoader::JobID readAsync(ResourceLoader& loader,
+                                         Context& context,
+                                         const TextureParams& params,
+                                         const String& imageName,
+                                         const std::function<void (Texture&)>& callback);
 private:
   Texture(const ResourceInfo& info, Context& context);
   Texture(const Texture& source);
@@ -93,12 +93,20 @@ public:
   Mesh(const ResourceInfo& info);
   /*! Merges all the sections in this mesh and assigns the specified material
    *  name to the resulting section.
-   *  @remarks Duplicate vertices and triangles are not merged.
+   *  @remarks Duplicate vertices and triangles are not merged.  Use @ref
+   *  weldVertices to merge duplicate vertices.
    */
   void mergeSections(const char* materialName);
   /*! Returns the section with the specified material name.
    */
   MeshSection* findSection(const char* materialName);
+  /*! Merges vertices whose position, normal and texture coordinate all fall
+   *  into the same cell of a grid with the specified cell size, and updates
+   *  the triangles to refer to the merged vertices.
+   *  @remarks The first vertex to fall into a cell is the one kept, so the
+   *  relative order of the remaining vertices is preserved.
+   */
+  void weldVertices(float epsilon = 0.001f);
   /*! Generates and stores triangle and vertex normals for this
    *  mesh, according to the specified generation mode.
    */
@@ -115,10 +123,54 @@ public:
   /*! @return @c true if this mesh is valid, otherwise @c false.
    */
   bool isValid() const;
+  /*! Optimizes this mesh for rendering by running, in order, @ref
+   *  optimizeVertexCache, @ref optimizeOverdraw and @ref
+   *  optimizeVertexFetch.
+   */
+  void optimize(float overdrawThreshold = 1.05f);
+  /*! Reorders the triangles of each section to make better use of the
+   *  post-transform vertex cache.
+   */
+  void optimizeVertexCache();
+  /*! Reorders clusters of triangles within each section so that those facing
+   *  outward from the center of the mesh are drawn first, to reduce overdraw.
+   *  @param[in] threshold The factor by which the ACMR of each cluster may
+   *  exceed that of its section.  Higher values give smaller clusters, and
+   *  more freedom to reduce overdraw at the expense of vertex cache use.
+   *  @remarks This should be run after @ref optimizeVertexCache.
+   */
+  void optimizeOverdraw(float threshold = 1.05f);
+  /*! Reorders the vertices of this mesh in the order they are first used by
+   *  its triangles.  Vertices not used by any triangle are moved last.
+   */
+  void optimizeVertexFetch();
+  /*! Calculates the vertex cache statistics of this mesh, as rendered with a
+   *  16 entry FIFO post-transform cache.
+   *  @param[out] ACMR The average cache miss ratio, i.e. the number of
+   *  vertices transformed per triangle.
+   *  @param[out] ATVR The average transformed vertex ratio, i.e. the number
+   *  of vertices transformed per vertex used.
+   */
+  void calculateCacheStats(float& ACMR, float& ATVR) const;
+  /*! Generates a simplified version of the sections of this mesh by
+   *  collapsing edges in order of increasing quadric error, until no more than
+   *  the specified number of triangles remain or no further edge can be
+   *  collapsed.
+   *  @param[out] result The simplified sections, in the same order as those
+   *  of this mesh and referring to its vertices.
+   *  @param[in] targetTriangleCount The desired number of triangles.
+   *  @remarks Edges are only collapsed onto existing vertices, so the
+   *  simplified sections can share the vertices of the original.  Vertices
+   *  on borders and attribute seams are never moved.
+   */
+  void simplify(std::vector<MeshSection>& result, size_t targetTriangleCount) const;
   /*! @return The number of triangles in all sections of this mesh.
    */
   size_t getTriangleCount() const;
-  static Ref<Mesh> read(ResourceCache& cache, const String& name);
+  /*! Reads the specified mesh, parsing OBJ files on the specified number of
+   *  threads.  See MeshReader for details.
+   */
+  static Ref<Mesh> read(ResourceCache& cache, const String& name, uint threadCount = 1);
   typedef std::vector<MeshVertex> VertexList;
   /*! The list of sections in this mesh.
    */
@@ -130,17 +182,31 @@ public:
 
 ///////////////////////////////////////////////////////////////////////
 
+/*! @brief Mesh reader.
+ *
+ *  Reads meshes in either the Wavefront OBJ format or the binary mesh
+ *  format written by @ref MeshWriter::writeBinary.
+ *
+ *  The first time an OBJ file is read, its parsed contents are written to a
+ *  binary cache file next to it, with @c .mesh appended to its name.  As long
+ *  as the OBJ file keeps the size and modification time it had when the cache
+ *  file was written, later reads load the cache instead of parsing it.
+ *
+ *  OBJ files are split into chunks parsed in parallel, on up to the number
+ *  of threads given to the reader including the calling one.  Readers used
+ *  from threads that are themselves part of a pool, such as the workers of a
+ *  ResourceLoader, should keep the default of one thread.
+ */
 class MeshReader : public ResourceReader<Mesh>
 {
 public:
-  MeshReader(ResourceCache& cache);
+  MeshReader(ResourceCache& cache, uint threadCount = 1);
   using ResourceReader<Mesh>::read;
   Ref<Mesh> read(const String& name, const Path& path);
 private:
-  String parseName(const char** text);
-  int parseInteger(const char** text);
-  float parseFloat(const char** text);
-  bool interesting(const char** text);
+  Ref<Mesh> readBinary(const String& name, const Path& path, const Path& dataPath);
+  Ref<Mesh> readText(const String& name, const Path& path);
+  uint threadCount;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -148,7 +214,12 @@ private:
 class MeshWriter
 {
 public:
+  /*! Writes the specified mesh in the Wavefront OBJ format.
+   */
   bool write(const Path& path, const Mesh& mesh);
+  /*! Writes the specified mesh in the binary mesh format.
+   */
+  bool writeBinary(const Path& path, const Mesh& mesh);
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,121 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy core library
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+#ifndef WENDY_OCCLUSION_H
+#define WENDY_OCCLUSION_H
+///////////////////////////////////////////////////////////////////////
+
+namespace wendy
+{
+
+///////////////////////////////////////////////////////////////////////
+
+class AABB;
+class Sphere;
+class Camera;
+class Mesh;
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Software depth buffer for occlusion culling.
+ *
+ *  Occluder meshes are rasterized on the CPU into a low resolution depth
+ *  buffer, which is then used to reject bounding volumes entirely hidden
+ *  behind them.  A second level stores the farthest depth of each tile of
+ *  pixels, so most volumes are accepted or rejected without touching the
+ *  individual pixels.
+ *
+ *  Occluders are rendered without any conservative adjustment, so they should
+ *  lie entirely inside the geometry they stand for.
+ */
+class OcclusionBuffer
+{
+public:
+  /*! Constructor.
+   *  @param[in] width The desired width, in pixels.  This is rounded up to a
+   *  whole number of tiles.
+   *  @param[in] height The desired height, in pixels.  This is rounded up to a
+   *  whole number of tiles.
+   */
+  OcclusionBuffer(uint width = 256, uint height = 128);
+  /*! Clears this buffer and prepares it for rendering occluders as seen by
+   *  the specified camera.
+   */
+  void clear(const Camera& camera);
+  /*! Renders the front faces of the specified mesh into this buffer.
+   *  @param[in] mesh The occluder mesh to render.
+   *  @param[in] transform The local-to-world transform of the mesh.
+   */
+  void addOccluder(const Mesh& mesh, const Transform3& transform);
+  /*! Updates the tile level of this buffer.  This must be done after the last
+   *  occluder has been added and before any visibility tests.
+   */
+  void buildHierarchy();
+  /*! Checks whether any part of the specified bounding box may be visible.
+   *
+   *  @remarks Boxes crossing the near plane are always considered visible.
+   */
+  bool isVisible(const AABB& box) const;
+  /*! Checks whether any part of the specified sphere may be visible.
+   *
+   *  @remarks Spheres crossing the near plane are always considered visible.
+   */
+  bool isVisible(const Sphere& sphere) const;
+  /*! @return The normalized device depth at the specified pixel, where 1 is
+   *  the far plane and also the value of pixels not covered by any occluder.
+   */
+  float getDepth(uint x, uint y) const;
+  /*! @return The width of this buffer, in pixels.
+   */
+  uint getWidth() const;
+  /*! @return The height of this buffer, in pixels.
+   */
+  uint getHeight() const;
+  /*! @return The number of visibility tests since the last clear.
+   */
+  uint getTestCount() const;
+  /*! @return The number of visibility tests since the last clear that found
+   *  the volume hidden.
+   */
+  uint getCulledCount() const;
+private:
+  void addPolygon(const vec4* vertices, uint count);
+  void addTriangle(const vec3& a, const vec3& b, const vec3& c);
+  uint width;
+  uint height;
+  mat4 viewProjection;
+  std::vector<float> depths;
+  std::vector<float> tileDepths;
+  std::vector<vec4> positions;
+  mutable uint testCount;
+  mutable uint culledCount;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+} /*namespace wendy*/
+
+///////////////////////////////////////////////////////////////////////
+#endif /*WENDY_OCCLUSION_H*/
+///////////////////////////////////////////////////////////////////////
@@ -99,6 +99,10 @@ public:
    *  @c false.
    */
   bool isDirectory() const;
+  /*! @return The time, in seconds since the epoch, at which the file or
+   *  directory was last modified, or zero if it does not exist.
+   */
+  Time getModificationTime() const;
   /*! @return A path object representing the parent directory of this
    *  path object.
    *  @remarks The root directory is its own parent.
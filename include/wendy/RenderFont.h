@@ -68,6 +68,21 @@ public:
    *  @param text The text to render.
    */
   void drawText(const vec2& penPosition, const vec4& color, const char* text);
+  /*! Writes the glyph quads of the specified text, as a triangle list, to
+   *  the specified vertices.
+   *  @param[out] vertices The vertices to write to.  There must be room for
+   *  six vertices per character.
+   *  @param[in] penPosition The pen position to start at.
+   *  @param[in] text The text to realize.
+   *  @return The number of vertices written.
+   */
+  uint realizeVertices(Vertex2ft2fv* vertices,
+                       const vec2& penPosition,
+                       const char* text) const;
+  /*! Renders the specified range of glyph vertices, as written by @ref
+   *  realizeVertices, in the specified color.
+   */
+  void drawVertices(const GL::PrimitiveRange& range, const vec4& color);
   /*! @return The width, in pixels, of the character cell for this font.
    */
   float getWidth() const;
@@ -109,7 +124,6 @@ private:
   float descender;
   UniformStateIndex colorIndex;
   Pass pass;
-  std::vector<Vertex2ft2fv> vertices;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -69,6 +69,144 @@ private:
  */
 typedef std::vector<Ref<Light>> LightList;
 
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Clustered light assignment.
+ *  @ingroup renderer
+ *
+ *  This divides the view frustum of a camera into a grid of clusters, evenly
+ *  in window space and exponentially in depth, and assigns to each cluster
+ *  the point lights and spotlights whose bounds reach it.
+ */
+class LightClusters
+{
+public:
+  /*! Constructor.
+   *  @param[in] countX The number of clusters along the x-axis of the window.
+   *  @param[in] countY The number of clusters along the y-axis of the window.
+   *  @param[in] countZ The number of clusters along the depth of the frustum.
+   */
+  LightClusters(uint countX = 16, uint countY = 8, uint countZ = 24);
+  /*! Assigns the point lights and spotlights of the specified list to the
+   *  clusters of the view frustum of the specified camera.  Directional
+   *  lights affect every cluster and are left out.
+   */
+  void assign(const LightList& lights, const Camera& camera);
+  /*! @return The number of clusters along the x-axis of the window.
+   */
+  uint getCountX() const;
+  /*! @return The number of clusters along the y-axis of the window.
+   */
+  uint getCountY() const;
+  /*! @return The number of clusters along the depth of the frustum.
+   */
+  uint getCountZ() const;
+  /*! @return The number of lights in the most recent assignment.
+   */
+  uint getLightCount() const;
+  /*! @return The total number of cluster light indices in the most recent
+   *  assignment.
+   */
+  uint getIndexCount() const;
+  /*! @return The number of lights assigned to the specified cluster.
+   */
+  uint getClusterLightCount(uint x, uint y, uint z) const;
+  /*! @return The indices of the lights assigned to the specified cluster,
+   *  in the order they appeared in the assigned list, after any directional
+   *  lights and lights outside the frustum have been removed.
+   */
+  const uint32* getClusterLights(uint x, uint y, uint z) const;
+  /*! @return The scale which, applied to the logarithm of a view space
+   *  depth, together with the depth bias gives its cluster slice.
+   */
+  float getDepthScale() const;
+  /*! @return The bias which, added to the logarithm of a view space depth
+   *  multiplied by the depth scale, gives its cluster slice.
+   */
+  float getDepthBias() const;
+protected:
+  /*! The view space position and radius, color and type, and direction of
+   *  each assigned light, three elements per light.
+   */
+  std::vector<vec4> lightData;
+  /*! The offset into the index list of the lights of each cluster, plus the
+   *  total number of indices.
+   */
+  std::vector<uint32> offsets;
+  /*! The light indices of all clusters.
+   */
+  std::vector<uint32> indices;
+private:
+  void updateClusterBounds(const mat4& projection, float nearZ, float sliceNearZ, float farZ);
+  uint countX;
+  uint countY;
+  uint countZ;
+  float depthScale;
+  float depthBias;
+  mat4 projection;
+  float farZ;
+  std::vector<vec3> minimums;
+  std::vector<vec3> maximums;
+  std::vector<uint32> pairs;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Clustered light assignment on the GPU.
+ *  @ingroup renderer
+ *
+ *  This uploads the result of the light cluster assignment to textures,
+ *  which shaders can read through the shared program state of the forward
+ *  renderer using the functions in wendy/LightGrid.glsl, so that each
+ *  fragment only evaluates the lights of its own cluster.
+ */
+class LightGrid : public RefObject, public LightClusters
+{
+public:
+  /*! Uploads the most recent assignment to the textures of this grid.
+   *  @return @c true if successful, or @c false if an error occurred.
+   */
+  bool upload();
+  /*! @return The texture holding the view space properties of the assigned
+   *  lights, or @c NULL if nothing has been uploaded.
+   */
+  GL::Texture* getLightTexture() const;
+  /*! @return The texture holding the light index range of each cluster, or @c
+   *  NULL if nothing has been uploaded.
+   */
+  GL::Texture* getClusterTexture() const;
+  /*! @return The texture holding the light index list, or @c NULL if nothing
+   *  has been uploaded.
+   */
+  GL::Texture* getIndexTexture() const;
+  /*! @return The context used by this grid.
+   */
+  GL::Context& getContext() const;
+  /*! Creates a light grid.
+   *  @param[in] context The context within which to create the textures.
+   *  @param[in] countX The number of clusters along the x-axis of the window.
+   *  @param[in] countY The number of clusters along the y-axis of the window.
+   *  @param[in] countZ The number of clusters along the depth of the frustum.
+   *  @return The newly created light grid, or @c NULL if an error occurred.
+   */
+  static Ref<LightGrid> create(GL::Context& context,
+                               uint countX = 16,
+                               uint countY = 8,
+                               uint countZ = 24);
+private:
+  LightGrid(GL::Context& context, uint countX, uint countY, uint countZ);
+  bool updateTexture(Ref<GL::Texture>& texture,
+                     const PixelFormat& format,
+                     uint width,
+                     uint height,
+                     const void* data);
+  GL::Context& context;
+  std::vector<float> staging;
+  Ref<GL::Texture> lightTexture;
+  Ref<GL::Texture> clusterTexture;
+  Ref<GL::Texture> indexTexture;
+};
+
 ///////////////////////////////////////////////////////////////////////
 
   } /*namespace render*/
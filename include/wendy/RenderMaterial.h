@@ -110,6 +110,19 @@ public:
    *  @return The loaded material, or @c NULL if an error occurred.
    */
   static Ref<Material> read(System& system, const String& name);
+  /*! Queues decoding of the images used by the samplers of the specified
+   *  material on the specified loader, so that reading the material once
+   *  they have finished only creates its programs and textures.  Only the
+   *  techniques for the type of the specified system are considered.
+   *  @param[in] loader The loader to queue the decoding on.
+   *  @param[in] system The system the material will be read for.
+   *  @param[in] name The name of the material.
+   *  @return The identifiers of the queued jobs.
+   *  @remarks The material file itself is parsed on the calling thread.
+   */
+  static ResourceLoader::JobList prefetchImages(ResourceLoader& loader,
+                                                System& system,
+                                                const String& name);
 private:
   Material(const ResourceInfo& info);
   Technique techniques[2];
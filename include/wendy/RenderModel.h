@@ -52,10 +52,14 @@ class ModelSection
 public:
   /*! Constructor.
    */
-  ModelSection(const GL::IndexRange& range, Material* material);
-  /*! @return The range of indices used by this geometry.
+  ModelSection(uint start, uint count, Material* material);
+  /*! @return The first index used by this geometry, relative to the index
+   *  range of its model.
    */
-  const GL::IndexRange& getIndexRange() const;
+  uint getStart() const;
+  /*! @return The number of indices used by this geometry.
+   */
+  uint getCount() const;
   /*! @return The %render material used by this geometry.
    */
   Material* getMaterial() const;
@@ -63,7 +67,8 @@ public:
    */
   void setMaterial(Material* newMaterial);
 private:
-  GL::IndexRange range;
+  uint start;
+  uint count;
   Ref<Material> material;
 };
 
@@ -80,59 +85,145 @@ typedef std::vector<ModelSection> ModelSectionList;
  *
  *  This class represents a single model consisting of one or more
  *  sections.  Each section is a range of triangles sharing a material.
+ *
+ *  A model may have several levels of detail, each a simplified version of
+ *  the previous with half as many triangles, all sharing the same vertex and
+ *  index buffers.  The level rendered is selected by the projected size of
+ *  the model on screen.  Levels of detail are only generated for model files
+ *  that request them with the @c levels attribute of their root element.
+ *
+ *  Model files may also request that the triangles and vertices of their
+ *  mesh be reordered for the post-transform vertex cache and for reduced
+ *  overdraw, with the @c optimize attribute of their root element.  This is
+ *  done on a copy of the mesh as the model is created, and should not be used
+ *  for blended geometry whose triangles must be drawn in file order.
+ *
+ *  Model files requesting compressed vertices with the @c compressed
+ *  attribute of their root element must use materials whose vertex shaders
+ *  accept the Vertex2sn2ht4sv format, such as @c wendy/CompressedModel.vs.
+ *
+ *  The vertices and indices of a model are allocated from the static
+ *  geometry arena of its render system, and so share buffers with other
+ *  models.
  */
 class Model : public Renderable, public Resource
 {
 public:
   typedef std::map<String, Ref<Material>> MaterialMap;
+  /*! Destructor.
+   */
+  ~Model();
   void enqueue(Scene& scene, const Camera& camera, const Transform3& transform) const;
+  /*! Enqueues the level of detail selected by @ref selectLevel.
+   *  @param[in,out] level The level of detail previously selected for this
+   *  instance of the model, which is updated to the newly selected one.
+   */
+  void enqueue(Scene& scene,
+               const Camera& camera,
+               const Transform3& transform,
+               uint& level) const;
+  /*! Selects the level of detail to use for the specified instance of this
+   *  model, by the fraction of the viewport height covered by its bounding
+   *  sphere.  To avoid popping when that fraction lies close to a boundary
+   *  between levels, the previous level is kept until the fraction moves
+   *  some distance past the boundary.
+   *  @param[in] camera The camera the model is viewed through.
+   *  @param[in] transform The transform of the instance.
+   *  @param[in] previousLevel The level previously selected for the instance.
+   *  @return The selected level of detail.
+   */
+  uint selectLevel(const Camera& camera,
+                   const Transform3& transform,
+                   uint previousLevel) const;
   /*! @return The bounding AABB of this model.
    */
   const AABB& getBoundingAABB() const;
   /*! @return The bounding sphere of this model.
    */
   const Sphere& getBoundingSphere() const;
-  /*! @return The list of geometries in this model.
+  /*! @return The number of levels of detail in this model.
    */
-  const ModelSectionList& getSections();
-  /*! @return The vertex buffer used by this model.
+  uint getLevelCount() const;
+  /*! @return The list of geometries in the specified level of detail of this
+   *  model.
    */
-  GL::VertexBuffer& getVertexBuffer();
-  /*! @return The vertex buffer used by this model.
+  const ModelSectionList& getSections(uint level = 0) const;
+  /*! @return The transform from the positions in the vertex buffer of this
+   *  model to model space.  This is the identity transform unless the model
+   *  has compressed vertices.
    */
-  const GL::VertexBuffer& getVertexBuffer() const;
-  /*! @return The index buffer used by this model.
+  const Transform3& getVertexTransform() const;
+  /*! @return The range of vertices used by this model.
+   *  @remarks The range may move when other models are destroyed.
    */
-  GL::IndexBuffer& getIndexBuffer();
-  /*! @return The index buffer used by this model.
+  GL::VertexRange getVertexRange() const;
+  /*! @return The range of indices used by this model, which refer to
+   *  vertices relative to the start of its vertex range.
+   *  @remarks The range may move when other models are destroyed.
    */
-  const GL::IndexBuffer& getIndexBuffer() const;
+  GL::IndexRange getIndexRange() const;
   /*! Creates a model from the specified mesh.
    *  @param[in] info The resource info for the texture.
    *  @param[in] system The render system within which to create the texture.
    *  @param[in] data The mesh to use.
    *  @param[in] materials The materials to use.
+   *  @param[in] levelCount The maximum number of levels of detail to
+   *  generate, including the full detail mesh.  Fewer levels are generated if
+   *  the mesh cannot be simplified further.
+   *  @param[in] compressed Whether to store vertices in the compressed
+   *  Vertex2sn2ht4sv format instead of as 32-bit floats.  The vertex shaders
+   *  of the materials must then declare @c vec2 @c vNormal, @c vec2 @c
+   *  vTexCoord and @c vec4 @c vPosition, and decode the normals.  See
+   *  @c wendy/CompressedModel.vs.
+   *  @param[in] optimized Whether to reorder the triangles and vertices of a
+   *  copy of the mesh for the post-transform vertex cache and for reduced
+   *  overdraw.  See Mesh::optimize.
    *  @return The newly created model, or @c NULL if an error
    *  occurred.
    */
   static Ref<Model> create(const ResourceInfo& info,
                            System& system,
                            const Mesh& data,
-                           const MaterialMap& materials);
+                           const MaterialMap& materials,
+                           uint levelCount = 1,
+                           bool compressed = false,
+                           bool optimized = false);
   /*! Creates a model specification using the specified file.
    *  @param[in] context The OpenGL context within which to create the texture.
    *  @param[in] path The path of the specification file to use.
    *  @return The newly created model, or @c NULL if an error occurred.
    */
   static Ref<Model> read(System& system, const String& name);
+  /*! Queues asynchronous reading of a model.  The mesh and the images of
+   *  the materials are decoded on worker threads of the specified loader and
+   *  the model, along with its materials, is created when the loader is
+   *  updated.  The model and material files themselves are parsed on the
+   *  calling thread.
+   *  @param[in] loader The loader to queue the reading on.
+   *  @param[in] system The render system within which to create the model.
+   *  @param[in] name The name of the model.
+   *  @param[in] callback The function to call with the model once it has
+   *  been created, or an empty function.
+   *  @return The identifier of the loading job.
+   */
+  static ResourceLoader::JobID readAsync(ResourceLoader& loader,
+                                         System& system,
+                                         const String& name,
+                                         const std::function<void (Model&)>& callback);
 private:
   Model(const ResourceInfo& info);
   Model(const Model& source);
   Model& operator = (const Model& source);
-  bool init(System& system, const Mesh& data, const MaterialMap& materials);
-  ModelSectionList sections;
-  Ref<GL::VertexBuffer> vertexBuffer;
-  Ref<GL::IndexBuffer> indexBuffer;
+  bool init(System& system,
+            const Mesh& data,
+            const MaterialMap& materials,
+            uint levelCount,
+            bool compressed,
+            bool optimized);
+  std::vector<ModelSectionList> levels;
+  Transform3 vertexTransform;
+  Ref<GeometryArena> arena;
+  uint block;
   Sphere boundingSphere;
   AABB boundingAABB;
 };
@@ -43,6 +43,15 @@ namespace wendy
 
 /*! @brief Geometry pool.
  *  @ingroup renderer
+ *
+ *  Transient geometry is allocated from one ring buffer per vertex format and
+ *  index type.  Each ring is divided into one region per buffered frame, and
+ *  a region is only reused once the GPU has passed the fence set at the end
+ *  of the frame that last wrote to it.  Where fences are not supported, the
+ *  rings are orphaned at the start of each frame instead.
+ *
+ *  Since the GPU is never reading a freshly allocated range, it can be
+ *  locked without synchronization and written in place.
  */
 class GeometryPool : public Trackable, public RefObject
 {
@@ -73,6 +82,37 @@ public:
   bool allocateVertices(GL::VertexRange& range,
                         uint count,
                         const VertexFormat& format);
+  /*! Allocates and locks a range of temporary indices of the specified type.
+   *  @param[out] range The newly allocated index range.
+   *  @param[in] count The number of indices to allocate.
+   *  @param[in] type The type of indices to allocate.
+   *  @return The address of the first allocated index, or @c NULL if an
+   *  error occurred.
+   *
+   *  @remarks The range must be unlocked with GL::IndexRange::unlock before
+   *  it is rendered.
+   *  @remarks The allocated index range is only valid until the end of the
+   *  current frame.
+   */
+  void* lockIndices(GL::IndexRange& range,
+                    uint count,
+                    GL::IndexBuffer::Type type);
+  /*! Allocates and locks a range of temporary vertices of the specified
+   *  format.
+   *  @param[out] range The newly allocated vertex range.
+   *  @param[in] count The number of vertices to allocate.
+   *  @param[in] format The format of vertices to allocate.
+   *  @return The address of the first allocated vertex, or @c NULL if an
+   *  error occurred.
+   *
+   *  @remarks The range must be unlocked with GL::VertexRange::unlock before
+   *  it is rendered.
+   *  @remarks The allocated vertex range is only valid until the end of the
+   *  current frame.
+   */
+  void* lockVertices(GL::VertexRange& range,
+                     uint count,
+                     const VertexFormat& format);
   /*! @return The OpenGL context used by this pool.
    */
   GL::Context& getContext() const;
@@ -87,23 +127,142 @@ private:
   bool init(size_t granularity);
   /*! @internal
    */
-  struct IndexBufferSlot
+  struct IndexRing
   {
     Ref<GL::IndexBuffer> indexBuffer;
-    uint available;
+    uint capacity;
+    uint used;
   };
   /*! @internal
    */
-  struct VertexBufferSlot
+  struct VertexRing
   {
+    uint32 hash;
     Ref<GL::VertexBuffer> vertexBuffer;
-    uint available;
+    uint capacity;
+    uint used;
   };
+  IndexRing* findIndexRing(uint count, GL::IndexBuffer::Type type);
+  VertexRing* findVertexRing(uint count, const VertexFormat& format);
+  uint getRingCapacity(uint current, uint count) const;
   void onContextFinish();
   GL::Context& context;
   size_t granularity;
-  std::vector<IndexBufferSlot> indexBufferPool;
-  std::vector<VertexBufferSlot> vertexBufferPool;
+  bool fenced;
+  uint frame;
+  std::vector<Ref<GL::Fence>> fences;
+  IndexRing indexRings[GL::IndexBuffer::UINT32 + 1];
+  std::vector<VertexRing> vertexRings;
+  std::vector<Ref<GL::IndexBuffer>> retiredIndexBuffers;
+  std::vector<Ref<GL::VertexBuffer>> retiredVertexBuffers;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Static geometry arena.
+ *  @ingroup renderer
+ *
+ *  Static geometry is suballocated in blocks from a few large buffers per
+ *  vertex format and index type, so that geometry of different models can be
+ *  rendered without switching buffers.  The indices of a block are relative
+ *  to its first vertex and are meant to be rendered with that vertex as the
+ *  base vertex.
+ *
+ *  Releasing a block only marks its space as free.  The remaining blocks of
+ *  a buffer are moved together by @ref defragment, which is called when the
+ *  context finishes a frame for every buffer where at least half the space
+ *  is occupied by released blocks.  The ranges of a block are therefore only
+ *  valid until the end of the current frame, and should be retrieved again
+ *  each time the block is rendered.
+ */
+class GeometryArena : public Trackable, public RefObject
+{
+public:
+  /*! Allocates a block of static geometry.
+   *  @param[in] format The format of vertices to allocate.
+   *  @param[in] vertexCount The number of vertices to allocate.
+   *  @param[in] indexType The type of indices to allocate.
+   *  @param[in] indexCount The number of indices to allocate, or zero to
+   *  allocate no indices.
+   *  @return The ID of the newly allocated block, or zero if an error
+   *  occurred.
+   */
+  uint allocate(const VertexFormat& format,
+                uint vertexCount,
+                GL::IndexBuffer::Type indexType,
+                uint indexCount);
+  /*! Releases the specified block.  Its space is reused once the other
+   *  blocks of its buffers have been moved together, or once they have all
+   *  been released.
+   */
+  void release(uint block);
+  /*! Moves together the allocated blocks of every buffer with any space
+   *  left by released blocks.  The blocks are copied by the GPU into fresh
+   *  buffers, so the ranges of every block in those buffers change.
+   *
+   *  @remarks This must only be called between frames, when no render
+   *  operations referring to the ranges of blocks remain to be rendered.
+   */
+  void defragment();
+  /*! @return The current vertex range of the specified block.
+   */
+  GL::VertexRange getVertexRange(uint block) const;
+  /*! @return The current index range of the specified block.
+   */
+  GL::IndexRange getIndexRange(uint block) const;
+  /*! @return The OpenGL context used by this arena.
+   */
+  GL::Context& getContext() const;
+  /*! Creates a static geometry arena.
+   *  @param[in] context The OpenGL context to be used.
+   *  @param[in] bufferSize The desired size, in bytes, of each buffer.
+   *  Blocks larger than this get a buffer of their own.
+   *  @return The newly created geometry arena.
+   */
+  static Ref<GeometryArena> create(GL::Context& context, size_t bufferSize = 4194304);
+private:
+  GeometryArena(GL::Context& context, size_t bufferSize);
+  /*! @internal
+   */
+  struct VertexRegion
+  {
+    uint32 hash;
+    Ref<GL::VertexBuffer> vertexBuffer;
+    uint used;
+    uint released;
+  };
+  /*! @internal
+   */
+  struct IndexRegion
+  {
+    Ref<GL::IndexBuffer> indexBuffer;
+    uint used;
+    uint released;
+  };
+  /*! @internal
+   */
+  struct Block
+  {
+    uint vertexRegion;
+    uint vertexStart;
+    uint vertexCount;
+    uint indexRegion;
+    uint indexStart;
+    uint indexCount;
+    bool allocated;
+  };
+  uint findVertexRegion(const VertexFormat& format, uint count);
+  uint findIndexRegion(GL::IndexBuffer::Type type, uint count);
+  void defragment(bool all);
+  bool compactVertexRegion(uint region);
+  bool compactIndexRegion(uint region);
+  void onContextFinish();
+  GL::Context& context;
+  size_t bufferSize;
+  std::vector<VertexRegion> vertexRegions;
+  std::vector<IndexRegion> indexRegions;
+  std::vector<Block> blocks;
+  std::vector<uint> freeBlocks;
 };
 
 ///////////////////////////////////////////////////////////////////////
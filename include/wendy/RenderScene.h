@@ -30,6 +30,8 @@
 #include <wendy/GLTexture.h>
 #include <wendy/GLBuffer.h>
 
+#include <unordered_set>
+
 ///////////////////////////////////////////////////////////////////////
 
 namespace wendy
@@ -47,7 +49,10 @@ class Scene;
 
 #pragma pack(push, 1)
 
-/*! @ingroup renderer
+/*! @brief Render operation sort key.
+ *  @ingroup renderer
+ *
+ *  @remarks Only the low 48 bits of a sort key are used.
  */
 class SortKey
 {
@@ -62,7 +67,6 @@ public:
     uint64 value;
     struct
     {
-      unsigned index : 16;
       unsigned depth : 24;
       unsigned state : 16;
       unsigned layer : 8;
@@ -80,6 +84,12 @@ typedef std::vector<uint64> SortKeyList;
 
 ///////////////////////////////////////////////////////////////////////
 
+/*! @ingroup renderer
+ */
+typedef std::vector<uint32> OperationIndexList;
+
+///////////////////////////////////////////////////////////////////////
+
 /*! @brief Render operation in the 3D pipeline.
  *  @ingroup renderer
  *
@@ -119,9 +129,8 @@ typedef std::vector<Operation> OperationList;
  *  @ingroup renderer
  *
  *  @remarks To avoid thrashing the heap, keep your queue objects around
- *  between frames when possible.
- *
- *  @remarks Each queue can only contain 65536 render operations.
+ *  between frames when possible.  This also lets the queue use the order of
+ *  the previous frame as a starting point when sorting.
  */
 class Queue
 {
@@ -132,18 +141,32 @@ public:
   /*! Adds a render operation in this render queue.
    */
   void addOperation(const Operation& operation, SortKey key);
+  /*! Appends all render operations in the specified queue to this queue,
+   *  preserving the order in which they were added.
+   */
+  void addOperations(const Queue& other);
   /*! Destroys all render operations in this render queue.
    */
   void removeOperations();
   /*! @return The render operations in this render queue.
    */
   const OperationList& getOperations() const;
-  /*! @return The sor keys in this render queue.
+  /*! @return The sort keys in this render queue, in the same order as the
+   *  render operations.
    */
   const SortKeyList& getSortKeys() const;
+  /*! @return The indices of the render operations in this render queue,
+   *  ordered by ascending sort key.  Operations with equal keys are kept in
+   *  the order they were added.
+   */
+  const OperationIndexList& getSortedIndices() const;
 private:
+  bool refineOrder() const;
+  void radixSort() const;
   OperationList operations;
-  mutable SortKeyList keys;
+  SortKeyList keys;
+  mutable OperationIndexList order;
+  mutable OperationIndexList scratch;
   mutable bool sorted;
 };
 
@@ -155,17 +178,36 @@ class Scene
 {
 public:
   Scene(GeometryPool& pool, Phase phase = PHASE_DEFAULT);
+  /*! Creates a scene without a geometry pool.  Such a scene can only
+   *  collect the operations of renderables that allocate no temporary
+   *  geometry.
+   */
+  Scene(Phase phase = PHASE_DEFAULT);
   void addOperation(const Operation& operation, float depth, uint8 layer = 0);
+  /*! Appends the render operations and lights of the specified scene to this
+   *  scene, as if they had been added to this scene directly.
+   */
+  void addScene(const Scene& other);
   void createOperations(const mat4& transform,
                         const GL::PrimitiveRange& range,
                         const Material& material,
                         float depth);
   void removeOperations();
+  /*! Attaches the specified light to this scene.  Attaching a light more
+   *  than once has no further effect.
+   */
   void attachLight(Light& light);
   void detachLights();
+  /*! @return The lights attached to this scene, each listed once in the
+   *  order they were first attached.
+   */
   const LightList& getLights() const;
   const vec3& getAmbientIntensity() const;
   void setAmbientIntensity(const vec3& newIntensity);
+  /*! @return @c true if this scene has a geometry pool, or @c false
+   *  otherwise.
+   */
+  bool hasGeometryPool() const;
   GeometryPool& getGeometryPool() const;
   Queue& getOpaqueQueue();
   const Queue& getOpaqueQueue() const;
@@ -179,6 +221,7 @@ private:
   Queue opaqueQueue;
   Queue blendedQueue;
   LightList lights;
+  std::unordered_set<const Light*> lightSet;
   vec3 ambient;
 };
 
@@ -201,6 +244,14 @@ public:
    *  be created.
    *  @param[in] camera The camera for which operations are requested.
    *  @param[in] transform The local-to-world transform.
+   *
+   *  @remarks This may be called from several threads at once, each with a
+   *  scene of its own, when enqueued by a scene graph using more than one
+   *  thread.  Implementations called that way must only modify the specified
+   *  scene and must not lock geometry from its pool, as the pool is shared
+   *  with the other threads.  The camera may be read freely, as its lazily
+   *  computed view transform and frustum are computed before any threads are
+   *  started.
    */
   virtual void enqueue(Scene& scene,
                        const Camera& camera,
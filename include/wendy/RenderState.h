@@ -148,7 +148,13 @@ public:
 protected:
   virtual void updateTo(GL::Uniform& uniform);
   virtual void updateTo(GL::Sampler& uniform);
+  virtual void updateBlock(GL::Context& context);
+  /*! @return A new, globally unique generation for a shared uniform value.
+   */
+  static uint allocateGeneration();
 private:
+  void invalidate(int ID);
+  void invalidateProjection();
   bool dirtyModelView;
   bool dirtyViewProj;
   bool dirtyModelViewProj;
@@ -166,6 +172,8 @@ private:
   float viewportWidth;
   float viewportHeight;
   float time;
+  uint generations[SHARED_STATE_CUSTOM_BASE];
+  static uint nextGeneration;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -46,11 +46,15 @@ class System : public RefObject
 public:
   enum Type
   {
-    FORWARD
+    FORWARD,
+    DEFERRED
   };
   ResourceCache& getCache() const;
   GL::Context& getContext() const;
   GeometryPool& getGeometryPool() const;
+  /*! @return The arena from which static geometry is allocated.
+   */
+  GeometryArena& getGeometryArena() const;
   Type getType() const;
 protected:
   System(GeometryPool& pool, Type type);
@@ -58,6 +62,7 @@ private:
   System(const System& source);
   System& operator = (const System& source);
   Ref<GeometryPool> pool;
+  Ref<GeometryArena> arena;
   Type type;
 };
 
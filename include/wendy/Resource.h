@@ -27,6 +27,12 @@
 ///////////////////////////////////////////////////////////////////////
 
 #include <fstream>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -39,6 +45,29 @@ class ResourceCache;
 
 ///////////////////////////////////////////////////////////////////////
 
+/*! @brief Stable handle to a named resource.
+ *
+ *  Handles let hot paths look up resources without hashing names.  A handle
+ *  stays safe to use after its resource has been destroyed, at which point it
+ *  no longer resolves to anything.
+ */
+class ResourceHandle
+{
+public:
+  /*! Constructor.  Creates a null handle.
+   */
+  ResourceHandle();
+  bool operator == (const ResourceHandle& other) const;
+  bool operator != (const ResourceHandle& other) const;
+  /*! @return @c true if this handle was never bound to a resource.
+   */
+  bool isNull() const;
+  uint index;
+  uint generation;
+};
+
+///////////////////////////////////////////////////////////////////////
+
 class ResourceInfo
 {
 public:
@@ -62,10 +91,15 @@ public:
   ResourceCache& getCache() const;
   const String& getName() const;
   const Path& getPath() const;
+  /*! @return The stable handle of this resource, or a null handle if it is
+   *  unnamed.
+   */
+  ResourceHandle getHandle() const;
 private:
   ResourceCache& cache;
   String name;
   Path path;
+  ResourceHandle handle;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -77,7 +111,20 @@ public:
   ~ResourceCache();
   bool addSearchPath(const Path& path);
   void removeSearchPath(const Path& path);
+  /*! @return The resource with the specified name, or @c NULL if no such
+   *  resource exists.
+   *  @remarks The returned resource is not referenced, so threads other than
+   *  the one owning it should use @ref findOrReserve instead.
+   */
   Resource* findResource(const String& name) const;
+  /*! @return The resource referred to by the specified handle, or @c NULL
+   *  if it has been destroyed.
+   */
+  Resource* findResource(ResourceHandle handle) const;
+  /*! @return The handle of the resource with the specified name, or a null
+   *  handle if no such resource exists.
+   */
+  ResourceHandle findHandle(const String& name) const;
   template <typename T>
   T* find(const String& name) const
   {
@@ -94,11 +141,54 @@ public:
 
     return cast;
   }
+  template <typename T>
+  T* find(ResourceHandle handle) const
+  {
+    Resource* cached = findResource(handle);
+    if (!cached)
+      return NULL;
+
+    T* cast = dynamic_cast<T*>(cached);
+    if (!cast)
+    {
+      logError("Resource \'%s\' exists as another type",
+               cached->getName().c_str());
+      return NULL;
+    }
+
+    return cast;
+  }
+  /*! Finds and references the resource with the specified name or, if no
+   *  such resource exists, reserves the name for the calling thread.  Other
+   *  threads calling this method for a reserved name wait until it has been
+   *  released, so that only one of them creates the resource.
+   *  @return The found resource, or @c NULL if the name was reserved, in
+   *  which case the caller must release it with @ref releaseReservation.
+   */
+  Ref<Resource> findOrReserve(const String& name);
+  /*! Releases a name reserved by @ref findOrReserve, after the resource has
+   *  been created or its creation has failed.
+   */
+  void releaseReservation(const String& name);
   Path findFile(const String& name) const;
   const PathList& getSearchPaths() const;
 private:
+  /*! @internal
+   */
+  struct Slot
+  {
+    Resource* resource;
+    uint generation;
+  };
+  ResourceHandle addResource(Resource& resource);
+  void removeResource(Resource& resource);
   PathList paths;
-  std::vector<Resource*> resources;
+  mutable std::mutex mutex;
+  std::unordered_map<String, uint> names;
+  std::vector<Slot> slots;
+  std::vector<uint> freeSlots;
+  std::unordered_set<String> reserved;
+  std::condition_variable reservedCondition;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -113,23 +203,190 @@ public:
   }
   Ref<T> read(const String& name)
   {
-    if (T* cached = cache.find<T>(name))
-      return cached;
+    // The lookup and creation must be atomic, as loader threads may be
+    // reading the same resource
+    Ref<Resource> cached = cache.findOrReserve(name);
+    if (cached)
+    {
+      T* cast = dynamic_cast<T*>(cached.getObject());
+      if (!cast)
+        logError("Resource \'%s\' exists as another type", name.c_str());
+
+      return cast;
+    }
+
+    Ref<T> result;
 
     const Path path = cache.findFile(name);
     if (path.isEmpty())
-    {
       logError("Failed to find resource \'%s\'", name.c_str());
-      return NULL;
-    }
+    else
+      result = read(name, path);
 
-    return read(name, path);
+    cache.releaseReservation(name);
+    return result;
   }
   virtual Ref<T> read(const String& name, const Path& path) = 0;
 protected:
   ResourceCache& cache;
 };
 
+/*! @brief Asynchronous resource loading pipeline.
+ *
+ *  Loading is split into jobs of up to two stages.  The decode stage runs on
+ *  a worker thread and may only create CPU-side resources, such as images,
+ *  meshes and samples.  The finish stage runs on the thread calling @ref
+ *  update, which should be the one owning the GL and AL contexts, and is
+ *  where objects such as textures and buffers are created.
+ *
+ *  A job may depend on other jobs, in which case it is not decoded until
+ *  they have all finished, and the resources they decoded are kept alive
+ *  until it has finished.  A job whose dependency failed fails as well.
+ *
+ *  A named job added while an earlier job of the same name is unfinished is
+ *  merged into that job, so a resource prefetched by several jobs is decoded
+ *  only once.
+ *
+ *  @remarks Cached resources that jobs may read must stay referenced until
+ *  those jobs have finished.  Releasing the last reference to such a resource
+ *  could destroy it while a worker thread is adding its own reference.
+ */
+class ResourceLoader
+{
+public:
+  /*! Decode stage function.  Returns the decoded resource, or @c NULL if
+   *  decoding failed.
+   */
+  typedef std::function<Ref<Resource> ()> DecodeFunc;
+  /*! Finish stage function.  Receives the resource returned by the decode
+   *  stage, if any, and returns @c true if the job succeeded.
+   */
+  typedef std::function<bool (Resource*)> FinishFunc;
+  /*! Job identifier.  Zero is never a valid job.
+   *
+   *  The slot of a job that finished successfully is reused by later jobs
+   *  once no unfinished job depends on it, much like resource handles.  Its
+   *  identifier then refers to a finished, successful job.  Failed jobs keep
+   *  their slots so that their outcome stays known.
+   */
+  typedef uint64 JobID;
+  typedef std::vector<JobID> JobList;
+  /*! Constructor.
+   *  @param[in] cache The resource cache to load into.
+   *  @param[in] threadCount The number of worker threads to decode on.  If
+   *  zero, decoding is performed by @ref update on the calling thread.
+   */
+  ResourceLoader(ResourceCache& cache, uint threadCount);
+  /*! Destructor.  Discards all jobs that have not yet started decoding and
+   *  waits for the worker threads to exit.
+   */
+  ~ResourceLoader();
+  /*! Adds a job.
+   *  @param[in] decode The decode stage, or an empty function if the job
+   *  has none.
+   *  @param[in] finish The finish stage, or an empty function if the job
+   *  has none.
+   *  @param[in] dependencies The jobs that must finish before this one is
+   *  decoded.
+   *  @return The identifier of the added job.
+   */
+  JobID addJob(const DecodeFunc& decode,
+               const FinishFunc& finish,
+               const JobList& dependencies = JobList());
+  /*! Adds a named job, unless a job of the same name has been added and has
+   *  not yet finished, in which case the identifier of that job is returned
+   *  and the specified stages and dependencies are discarded.  Jobs sharing
+   *  a name must therefore be interchangeable.
+   *  @return The identifier of the added or existing job.
+   */
+  JobID addJob(const String& name,
+               const DecodeFunc& decode,
+               const FinishFunc& finish,
+               const JobList& dependencies = JobList());
+  /*! Adds a job decoding the named resource of the specified type into the
+   *  cache, keeping it alive until the jobs depending on this one have
+   *  finished.
+   */
+  template <typename T>
+  JobID prefetch(const String& name, const JobList& dependencies = JobList())
+  {
+    ResourceCache& target = cache;
+
+    return addJob(name,
+                  [&target, name]() -> Ref<Resource> { return T::read(target, name).getObject(); },
+                  FinishFunc(),
+                  dependencies);
+  }
+  /*! Runs the finish stage of all decoded jobs on the calling thread.
+   */
+  void update();
+  /*! Runs @ref update until the specified job has finished.
+   *  @return @c true if the job succeeded, or @c false if it failed.
+   */
+  bool wait(JobID ID);
+  /*! Runs @ref update until all jobs have finished.
+   */
+  void waitAll();
+  /*! @return @c true if the specified job has finished.
+   */
+  bool isFinished(JobID ID) const;
+  /*! @return @c true if the specified job has finished and succeeded.
+   */
+  bool hasSucceeded(JobID ID) const;
+  /*! @return The number of jobs that have not yet finished.
+   */
+  uint getPendingCount() const;
+  /*! @return The resource cache loaded into by this loader.
+   */
+  ResourceCache& getCache() const;
+private:
+  /*! @internal
+   */
+  enum JobState
+  {
+    JOB_BLOCKED,
+    JOB_QUEUED,
+    JOB_DECODED,
+    JOB_FINISHED
+  };
+  /*! @internal
+   */
+  struct Job
+  {
+    String name;
+    DecodeFunc decode;
+    FinishFunc finish;
+    Ref<Resource> resource;
+    JobList dependencies;
+    JobList dependents;
+    JobState state;
+    uint blockers;
+    uint holders;
+    uint generation;
+    bool succeeded;
+  };
+  ResourceLoader(const ResourceLoader& source);
+  ResourceLoader& operator = (const ResourceLoader& source);
+  void work();
+  Job& getJob(JobID ID);
+  const Job* findJob(JobID ID) const;
+  void schedule(JobID ID);
+  void complete(JobID ID, bool succeeded);
+  void release(JobID ID);
+  ResourceCache& cache;
+  std::vector<std::thread> threads;
+  mutable std::mutex mutex;
+  std::condition_variable queuedCondition;
+  std::condition_variable decodedCondition;
+  std::vector<Job> jobs;
+  std::vector<uint> freeJobs;
+  std::unordered_map<String, JobID> named;
+  JobList queued;
+  JobList decoded;
+  uint pending;
+  bool stopping;
+};
+
 ///////////////////////////////////////////////////////////////////////
 
 } /*namespace wendy*/
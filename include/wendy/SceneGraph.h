@@ -40,6 +40,8 @@ namespace wendy
 
 class Node;
 class Graph;
+class SpatialIndex;
+class TransformHierarchy;
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -52,6 +54,7 @@ class Graph;
 class Node
 {
   friend class Graph;
+  friend class TransformHierarchy;
 public:
   typedef std::vector<Node*> List;
   /*! Constructor.
@@ -110,6 +113,27 @@ public:
    *  child nodes.
    */
   const Sphere& getTotalBounds() const;
+  /*! @return The occluder mesh of this node, or @c NULL if it has none.
+   */
+  Mesh* getOccluder() const;
+  /*! @return @c true if the @ref enqueue implementation of this node may be
+   *  called on a worker thread, or @c false otherwise.  The default is @c
+   *  false.
+   *  @remarks Node types returning @c true must follow the threading rules of
+   *  render::Renderable::enqueue.  The children of this node must also allow
+   *  it for its subtree to be enqueued on a worker thread.
+   */
+  virtual bool isConcurrent() const;
+  /*! Sets the occluder mesh of this node, used by the occlusion culling of
+   *  its scene graph.
+   *  @param[in] newOccluder The desired occluder mesh, in the local space of
+   *  this node, or @c NULL to not use this node as an occluder.
+   *
+   *  @remarks The occluder must lie entirely inside the geometry rendered by
+   *  this node and its children, or visible nodes may be culled.
+   *  @remarks Only the occluders of root nodes are used.
+   */
+  void setOccluder(Mesh* newOccluder);
 protected:
   /*! Called when the scene graph is updated.  This is the correct place to put
    *  per-frame operations which affect the transform or bounds.
@@ -124,8 +148,10 @@ protected:
 private:
   Node(const Node& source);
   Node& operator = (const Node& source);
+  Transform3& editLocalTransform();
   void invalidateBounds();
   void invalidateWorldTransform();
+  void invalidateProxy();
   void setGraph(Graph* newGraph);
   bool needsUpdate;
   Node* parent;
@@ -134,9 +160,156 @@ private:
   Transform3 local;
   mutable Transform3 world;
   mutable bool dirtyWorld;
+  mutable uint worldGeneration;
   Sphere localBounds;
   mutable Sphere totalBounds;
   mutable bool dirtyBounds;
+  Ref<Mesh> occluder;
+  Ptr<GL::OcclusionQuery> query;
+  bool queryPending;
+  bool occluded;
+  uint queryFrame;
+  uint nextQueryFrame;
+  int proxy;
+  mutable bool dirtyProxy;
+  int slot;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Flat transform hierarchy.
+ *  @ingroup scene
+ *
+ *  This stores the local and world transforms of all nodes in a scene graph
+ *  as parallel arrays in topological order, i.e. every parent precedes its
+ *  children, so that all dirty world transforms can be recomputed in a single
+ *  linear pass.  Nodes attached to a graph using this hierarchy act as
+ *  handles to their slots.
+ */
+class TransformHierarchy
+{
+public:
+  /*! Constructor.
+   */
+  TransformHierarchy();
+  /*! Creates a slot for the specified node, using its current local
+   *  transform.
+   *  @param[in] node The node to create a slot for.
+   *  @param[in] parent The slot of the parent of the node, or -1 if it is a
+   *  root node.
+   *  @return The newly created slot.
+   *
+   *  @remarks The parent slot must have been created before the child.
+   */
+  int createSlot(Node& node, int parent);
+  /*! Destroys the specified slot, copying its local transform back into the
+   *  node that owned it.
+   */
+  void destroySlot(int slot);
+  /*! Marks the world transform of the specified slot, and by extension those
+   *  of its descendants, as out of date.
+   */
+  void invalidate(int slot);
+  /*! Recomputes all out of date world transforms in a single pass.
+   */
+  void update();
+  /*! @return @c true if the world transform of the specified slot or any of
+   *  its ancestors is out of date, otherwise @c false.
+   */
+  bool isDirty(int slot) const;
+  /*! @return @c true if any world transform is out of date, otherwise @c
+   *  false.
+   */
+  bool isChanged() const;
+  /*! @return The generation of this hierarchy, which changes whenever a slot
+   *  is created or invalidated.
+   */
+  uint getGeneration() const;
+  Transform3& getLocalTransform(int slot);
+  const Transform3& getLocalTransform(int slot) const;
+  /*! @return The world transform of the specified slot as of the last
+   *  update.
+   */
+  const Transform3& getWorldTransform(int slot) const;
+  /*! @return The number of slots, including unused ones.
+   */
+  size_t getSlotCount() const;
+private:
+  void compact();
+  std::vector<Node*> nodes;
+  std::vector<int> parents;
+  std::vector<Transform3> locals;
+  std::vector<Transform3> worlds;
+  std::vector<uint8> dirty;
+  size_t unused;
+  size_t first;
+  bool changed;
+  uint generation;
+};
+
+///////////////////////////////////////////////////////////////////////
+
+/*! @brief Dynamic bounding volume hierarchy.
+ *  @ingroup scene
+ *
+ *  This is an incrementally maintained, height balanced tree of axis-aligned
+ *  boxes, used by the scene graph to find root nodes intersecting a volume in
+ *  logarithmic time.  Each leaf box is enlarged slightly beyond the bounds it
+ *  was created with, so that small movements don't require reinsertion.
+ */
+class SpatialIndex
+{
+public:
+  /*! Constructor.
+   */
+  SpatialIndex();
+  /*! Creates a proxy for the specified node with the specified world space
+   *  bounds.
+   *  @return The identifier of the newly created proxy.
+   */
+  int createProxy(Node& node, const Sphere& bounds);
+  /*! Destroys the specified proxy.
+   */
+  void destroyProxy(int proxy);
+  /*! Updates the world space bounds of the specified proxy, reinserting it
+   *  into the tree only if it has moved outside its enlarged box.
+   */
+  void moveProxy(int proxy, const Sphere& bounds);
+  /*! Appends the nodes whose bounds intersect the specified sphere.
+   */
+  void query(const Sphere& sphere, Node::List& nodes) const;
+  /*! Appends the nodes whose bounds intersect the specified frustum.
+   */
+  void query(const Frustum& frustum, Node::List& nodes) const;
+  /*! @return The height of the tree, or zero if it is empty.
+   */
+  int getHeight() const;
+private:
+  /*! @internal
+   */
+  struct Proxy
+  {
+    bool isLeaf() const { return left == -1; }
+    vec3 minimum;
+    vec3 maximum;
+    Sphere bounds;
+    Node* node;
+    int parent;
+    int left;
+    int right;
+    int height;
+    mutable uint firstPlane;
+  };
+  int allocateProxy();
+  void freeProxy(int proxy);
+  void insertLeaf(int leaf);
+  void removeLeaf(int leaf);
+  void refit(int proxy);
+  int balance(int proxy);
+  void collect(int proxy, Node::List& nodes) const;
+  std::vector<Proxy> proxies;
+  int root;
+  int unused;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -151,17 +324,142 @@ class Graph
 {
   friend class Node;
 public:
+  /*! Constructor.
+   *  @param[in] flatTransforms @c true to keep the transforms of all nodes in
+   *  a flat TransformHierarchy, updated in a single pass by @ref update,
+   *  instead of propagating them recursively through the nodes.
+   */
+  Graph(bool flatTransforms = false);
   ~Graph();
+  /*! Recomputes out of date world transforms if this graph uses flat
+   *  transforms, then updates all nodes requesting it.
+   */
   void update();
+  /*! Culls the nodes of this graph against the frustum of the specified
+   *  camera and collects render operations for the visible ones.
+   *
+   *  @remarks If the thread count is greater than one, the visible root nodes
+   *  are split into contiguous ranges enqueued into separate scenes, which
+   *  are then appended to the specified scene in order, so the resulting
+   *  operations are identical to the serial path.  Ranges of nodes whose
+   *  subtrees are concurrent are enqueued on persistent worker threads, while
+   *  the others are enqueued on the calling thread.  See Node::isConcurrent.
+   */
   void enqueue(render::Scene& scene, const Camera& camera) const;
   void query(const Sphere& sphere, Node::List& nodes) const;
   void query(const Frustum& frustum, Node::List& nodes) const;
   void addRootNode(Node& node);
   void destroyRootNodes();
   const Node::List& getNodes() const;
+  /*! @return The maximum number of threads used by @ref enqueue.
+   */
+  uint getThreadCount() const;
+  /*! Sets the maximum number of threads used by @ref enqueue.
+   *
+   *  @remarks When using more than one thread, only nodes whose subtrees
+   *  are concurrent are enqueued on worker threads.  See Node::isConcurrent.
+   */
+  void setThreadCount(uint newCount);
+  /*! @return @c true if @ref enqueue culls nodes hidden behind the occluders
+   *  of other visible nodes, or @c false otherwise.
+   */
+  bool hasOcclusionCulling() const;
+  /*! Enables or disables occlusion culling of the nodes of this graph.
+   *  @param[in] enabled @c true to enable occlusion culling, or @c false to
+   *  disable it.
+   */
+  void setOcclusionCulling(bool enabled);
+  /*! @return The occlusion buffer used for the most recent call to @ref
+   *  enqueue, or @c NULL if occlusion culling is disabled.
+   */
+  const OcclusionBuffer* getOcclusionBuffer() const;
+  /*! @return @c true if @ref enqueue culls nodes found hidden by hardware
+   *  occlusion queries, or @c false otherwise.
+   */
+  bool hasOcclusionQueries() const;
+  /*! Enables or disables culling of the nodes of this graph with hardware
+   *  occlusion queries issued by @ref issueOcclusionQueries.
+   *  @param[in] enabled @c true to enable occlusion queries, or @c false to
+   *  disable them.
+   */
+  void setOcclusionQueries(bool enabled);
+  /*! Collects the results of earlier occlusion queries that have become
+   *  available and issues new ones for the nodes due for testing.  This
+   *  should be called once per frame, after the scene collected by @ref
+   *  enqueue has been rendered with the same camera, while its depth buffer
+   *  is still current.
+   *  @param[in] system The render system the scene was rendered with.
+   *  @param[in] camera The camera the scene was rendered with.
+   *  @return @c true if successful, or @c false if an error occurred.
+   *
+   *  @remarks Queries are only read once their results are available, so a
+   *  previously hidden node is drawn again one or more frames after it
+   *  becomes visible, but rendering never waits for the GPU.  Hidden nodes
+   *  are queried every frame, whereas visible ones are only queried every
+   *  few frames.
+   *  @remarks Nodes entering the frustum are assumed to be visible until
+   *  queried.
+   */
+  bool issueOcclusionQueries(render::System& system, const Camera& camera);
 private:
+  /*! @internal
+   *  @brief Persistent worker threads for @ref enqueue.
+   */
+  class Workers
+  {
+  public:
+    typedef std::function<void ()> Task;
+    typedef std::vector<Task> TaskList;
+    Workers(uint count);
+    ~Workers();
+    /*! Performs the specified tasks on the worker threads and the calling
+     *  thread, returning once all of them have finished.
+     */
+    void run(const TaskList& tasks);
+  private:
+    Workers(const Workers& source);
+    Workers& operator = (const Workers& source);
+    void work();
+    void perform(std::unique_lock<std::mutex>& lock);
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    const TaskList* tasks;
+    size_t next;
+    size_t remaining;
+    bool stopping;
+  };
+  /*! @internal
+   */
+  struct Range
+  {
+    Node::List::const_iterator first;
+    Node::List::const_iterator last;
+    bool concurrent;
+  };
+  void invalidateProxy(Node& node);
+  void updateProxies() const;
+  bool initQueries(render::System& system);
+  static bool isConcurrentTree(const Node& node);
+  static void enqueueNodes(Node::List::const_iterator first,
+                           Node::List::const_iterator last,
+                           render::Scene& scene,
+                           const Camera& camera);
   Node::List roots;
   Node::List updated;
+  mutable Node::List invalidated;
+  mutable SpatialIndex index;
+  Ptr<TransformHierarchy> transforms;
+  uint threadCount;
+  mutable Ptr<Workers> workers;
+  mutable std::vector<render::Scene> scenes;
+  mutable Ptr<OcclusionBuffer> occlusion;
+  bool queries;
+  uint queryFrame;
+  Ref<render::SharedProgramState> queryState;
+  Ref<GL::VertexBuffer> queryBox;
+  render::Pass queryPass;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -174,6 +472,7 @@ public:
   LightNode();
   render::Light* getLight() const;
   void setLight(render::Light* newLight);
+  bool isConcurrent() const;
 protected:
   void update();
   void enqueue(render::Scene& scene, const Camera& camera) const;
@@ -193,11 +492,13 @@ public:
   void setCastsShadows(bool enabled);
   render::Model* getModel() const;
   void setModel(render::Model* newModel);
+  bool isConcurrent() const;
 protected:
   void enqueue(render::Scene& scene, const Camera& camera) const;
 private:
   Ref<render::Model> model;
   bool shadowCaster;
+  mutable uint level;
 };
 
 ///////////////////////////////////////////////////////////////////////
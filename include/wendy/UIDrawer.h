@@ -147,12 +147,21 @@ private:
  *  @ingroup ui
  *
  *  This class provides drawing for widgets.
+ *
+ *  Drawing between @ref begin and @ref end is batched.  Consecutive
+ *  primitives that share the same render state are accumulated and submitted
+ *  with a single draw call when the state changes, when the clipping area
+ *  changes or when drawing ends.
  */
 class Drawer : public RefObject
 {
 public:
   void begin();
   void end();
+  /*! Submits all batched drawing.  Call this before rendering directly to the
+   *  context between @ref begin and @ref end.
+   */
+  void flush();
   /*! Pushes a clipping area onto the clip stack. The current
    *  clipping area then becomes the specified area as clipped by the
    *  previously current clipping area.
@@ -205,23 +214,39 @@ public:
   static Ref<Drawer> create(render::GeometryPool& pool);
 private:
   Drawer(render::GeometryPool& pool);
+  /*! @internal
+   */
+  enum BatchType
+  {
+    BATCH_NONE,
+    BATCH_POINTS,
+    BATCH_LINES,
+    BATCH_TRIANGLES,
+    BATCH_ELEMENTS,
+    BATCH_BLIT,
+    BATCH_TEXT
+  };
   bool init();
   void drawElement(const Rect& area, const Rect& mapping);
-  void setDrawingState(const vec4& color, bool wireframe);
+  Vertex4fc2fv* allocateSolid(BatchType type, uint count);
+  Vertex2ft2fv* allocateMapped(BatchType type,
+                               uint count,
+                               GL::Texture* texture,
+                               render::Font* font,
+                               const vec4& color);
   RectClipStackf clipAreaStack;
-  Ref<GL::VertexBuffer> vertexBuffer;
-  Ref<GL::IndexBuffer> indexBuffer;
-  GL::PrimitiveRange range;
+  BatchType batchType;
+  Ref<GL::Texture> batchTexture;
+  Ref<render::Font> batchFont;
+  vec4 batchColor;
+  std::vector<Vertex4fc2fv> solidVertices;
+  std::vector<Vertex2ft2fv> mappedVertices;
   Ref<Theme> theme;
   Ref<render::GeometryPool> pool;
   Ref<render::Font> currentFont;
   render::Pass drawPass;
   render::Pass blitPass;
   render::Pass elementPass;
-  render::UniformStateIndex elementPosIndex;
-  render::UniformStateIndex elementSizeIndex;
-  render::UniformStateIndex texPosIndex;
-  render::UniformStateIndex texSizeIndex;
   Ref<render::SharedProgramState> state;
 };
 
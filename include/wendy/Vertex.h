@@ -46,7 +46,14 @@ public:
   {
     /*! Component elements are 32-bit floating-point (float).
      */
-    FLOAT32
+    FLOAT32,
+    /*! Component elements are 16-bit floating-point (half).
+     */
+    FLOAT16,
+    /*! Component elements are 16-bit signed integers, normalized to the
+     *  range [-1, 1] when read by shaders.
+     */
+    SNORM16
   };
   /*! Constructor.
    */
@@ -72,6 +79,11 @@ public:
   /*! @return The number of elements in this component.
    */
   size_t getElementCount() const;
+  /*! @return @c true if shaders read the elements of this component as
+   *  floating-point values, or @c false otherwise.  Half float and
+   *  normalized elements are converted as they are fetched.
+   */
+  bool isReadAsFloat() const;
 private:
   String name;
   size_t count;
@@ -112,8 +124,13 @@ public:
   String asString() const;
   size_t getSize() const;
   size_t getComponentCount() const;
+  /*! @return A hash of the layout of this format, suitable as a lookup key.
+   *  Equal formats always have equal hashes.
+   */
+  uint32 getHash() const;
 private:
   std::vector<VertexComponent> components;
+  uint32 hash;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -152,6 +169,18 @@ public:
 
 ///////////////////////////////////////////////////////////////////////
 
+/*! @brief Predefined vertex format.
+ */
+class Vertex4fc2fv
+{
+public:
+  vec4 color;
+  vec2 position;
+  static const VertexFormat format;
+};
+
+///////////////////////////////////////////////////////////////////////
+
 /*! @brief Predefined vertex format.
  */
 class Vertex2ft2fv
@@ -202,6 +231,32 @@ public:
 
 ///////////////////////////////////////////////////////////////////////
 
+/*! @brief Predefined compressed vertex format.
+ *
+ *  The normal is octahedron encoded, see @ref encodeNormal, and the position
+ *  is normalized to the range [-1, 1], with a @c w of one.  The decoding of
+ *  normals is left to the vertex shader, which may include @c
+ *  wendy/VertexDecode.glsl for this.
+ */
+class Vertex2sn2ht4sv
+{
+public:
+  /*! Encodes the specified unit vector with the octahedron mapping
+   *  described by Cigolle et al., 'A Survey of Efficient Representations for
+   *  Independent Unit Vectors'.
+   */
+  static i16vec2 encodeNormal(const vec3& normal);
+  /*! Encodes the specified position, which must be within the range [-1, 1].
+   */
+  static i16vec4 encodePosition(const vec3& position);
+  i16vec2 normal;
+  hvec2 texCoord;
+  i16vec4 position;
+  static const VertexFormat format;
+};
+
+///////////////////////////////////////////////////////////////////////
+
 } /*namespace wendy*/
 
 ///////////////////////////////////////////////////////////////////////
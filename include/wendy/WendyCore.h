@@ -56,6 +56,7 @@
 
 #include <wendy/Image.h>
 #include <wendy/Mesh.h>
+#include <wendy/Occlusion.h>
 
 ///////////////////////////////////////////////////////////////////////
 #endif /*WENDY_WENDYCORE_H*/
@@ -44,6 +44,7 @@
 #include <wendy/RenderModel.h>
 
 #include <wendy/Forward.h>
+#include <wendy/Deferred.h>
 
 #else
 #error "Render module not enabled"
@@ -0,0 +1,23 @@
+
+#version 150
+
+#include "wendy/VertexDecode.glsl"
+
+// Vertex shader for models with compressed vertices, in the Vertex2sn2ht4sv
+// format.  The position decoding is part of the model matrix, which scales
+// uniformly, so only the normal needs decoding here.
+
+in vec2 vNormal;
+in vec2 vTexCoord;
+in vec4 vPosition;
+
+out vec3 normal;
+out vec2 texCoord;
+
+void main()
+{
+  normal = normalize(mat3(wyMV) * decodeNormal(vNormal));
+  texCoord = vTexCoord;
+
+  gl_Position = wyMVP * vPosition;
+}
@@ -0,0 +1,25 @@
+
+#version 150
+
+#include "wendy/GBuffer.glsl"
+
+// View space direction towards the light
+uniform vec3 direction;
+uniform vec3 color;
+
+in vec2 texCoord;
+in vec2 clipPosition;
+
+out vec4 fragment;
+
+void main()
+{
+  Surface surface;
+  float depth;
+
+  if (!fetchSurface(texCoord, clipPosition, surface, depth))
+    discard;
+
+  fragment = vec4(shadeSurface(surface, direction, color), 1.0);
+}
+
@@ -0,0 +1,54 @@
+
+#version 150
+
+#include "wendy/LightGrid.glsl"
+#include "wendy/GBuffer.glsl"
+
+uniform vec3 ambient;
+
+in vec2 texCoord;
+in vec2 clipPosition;
+
+out vec4 fragment;
+
+void main()
+{
+  Surface surface;
+  float depth;
+
+  if (!fetchSurface(texCoord, clipPosition, surface, depth))
+    discard;
+
+  vec3 result = surface.albedo * ambient;
+
+  int first, count;
+  findLightRange(texCoord, -surface.position.z, first, count);
+
+  for (int i = 0;  i < count;  i++)
+  {
+    vec3 position, color, direction;
+    float radius;
+    int type;
+
+    fetchLight(fetchLightIndex(first + i), position, radius, color, type, direction);
+
+    vec3 offset = position - surface.position;
+    float lightDistance = length(offset);
+    if (lightDistance >= radius)
+      continue;
+
+    vec3 incident = offset / lightDistance;
+
+    float attenuation = 1.0 - lightDistance / radius;
+    attenuation *= attenuation;
+
+    if (type == LIGHT_SPOTLIGHT)
+      attenuation *= max(dot(-incident, direction), 0.0);
+
+    result += shadeSurface(surface, incident, color * attenuation);
+  }
+
+  fragment = vec4(result, 1.0);
+  gl_FragDepth = depth;
+}
+
@@ -0,0 +1,16 @@
+
+#version 150
+
+in vec2 vPosition;
+
+out vec2 texCoord;
+out vec2 clipPosition;
+
+void main()
+{
+  texCoord = (vPosition * 0.5 + 0.5) * vec2(wyViewportWidth, wyViewportHeight);
+  clipPosition = vPosition;
+
+  gl_Position = vec4(vPosition, 0.0, 1.0);
+}
+
@@ -0,0 +1,54 @@
+// Functions for reading and shading the G-buffer of the deferred renderer
+
+uniform sampler2DRect colorBuffer;
+uniform sampler2DRect normalBuffer;
+uniform sampler2DRect depthBuffer;
+uniform mat4 inverseProjection;
+
+// Specular exponent used for all surfaces
+const float SPECULAR_EXPONENT = 32.0;
+
+// View space properties of the surface at a single G-buffer texel
+struct Surface
+{
+  vec3 albedo;
+  float specular;
+  vec3 normal;
+  vec3 position;
+};
+
+// Reads the surface at the specified G-buffer texel and clip space position,
+// or returns false if no surface was rendered there
+bool fetchSurface(vec2 texCoord, vec2 clipPosition, out Surface surface, out float depth)
+{
+  depth = texture(depthBuffer, texCoord).r;
+  if (depth == 1.0)
+    return false;
+
+  vec4 color = texture(colorBuffer, texCoord);
+  surface.albedo = color.rgb;
+  surface.specular = color.a;
+  surface.normal = normalize(texture(normalBuffer, texCoord).xyz);
+
+  vec4 position = inverseProjection * vec4(clipPosition, depth * 2.0 - 1.0, 1.0);
+  surface.position = position.xyz / position.w;
+
+  return true;
+}
+
+// Returns the light reflected towards the camera by the specified surface
+// from light of the specified color arriving from the specified view space
+// direction
+vec3 shadeSurface(Surface surface, vec3 direction, vec3 color)
+{
+  float diffuse = dot(surface.normal, direction);
+  if (diffuse <= 0.0)
+    return vec3(0.0);
+
+  vec3 halfway = normalize(direction - normalize(surface.position));
+  float specular = surface.specular *
+                   pow(max(dot(surface.normal, halfway), 0.0), SPECULAR_EXPONENT);
+
+  return color * (surface.albedo * diffuse + specular);
+}
+
@@ -0,0 +1,28 @@
+
+#version 150
+
+// Vertex shader for models rendered instanced by the forward renderer.  The
+// model matrix is read from per-instance attributes instead of the shared
+// wyM uniform, so the model-view matrices are built here.
+
+in vec3 vPosition;
+in vec3 vNormal;
+in vec2 vTexCoord;
+
+in vec4 wyInstanceM0;
+in vec4 wyInstanceM1;
+in vec4 wyInstanceM2;
+in vec4 wyInstanceM3;
+
+out vec3 normal;
+out vec2 texCoord;
+
+void main()
+{
+  mat4 model = mat4(wyInstanceM0, wyInstanceM1, wyInstanceM2, wyInstanceM3);
+
+  normal = normalize(mat3(wyV * model) * vNormal);
+  texCoord = vTexCoord;
+
+  gl_Position = wyVP * model * vec4(vPosition, 1.0);
+}
@@ -0,0 +1,69 @@
+
+// Functions for reading the light grid exposed by the shared program state of
+// the forward renderer, as assigned by render::LightGrid
+
+// Width of the light and index textures, which must match the one in
+// RenderLight.cpp
+const int LIGHT_TEXTURE_WIDTH = 1024;
+
+// Light types, matching render::Light::Type
+const int LIGHT_POINT = 1;
+const int LIGHT_SPOTLIGHT = 2;
+
+// Returns the range of the light index list affecting the fragment at the
+// specified viewport position and positive view space depth
+void findLightRange(vec2 position, float depth, out int first, out int count)
+{
+  if (wyLightGridSize.w == 0.0)
+  {
+    first = 0;
+    count = 0;
+    return;
+  }
+
+  ivec3 size = ivec3(wyLightGridSize.xyz);
+
+  ivec3 cluster;
+  cluster.xy = ivec2(position * wyLightGridSize.xy /
+                     vec2(wyViewportWidth, wyViewportHeight));
+  cluster.z = int(floor(log(max(depth, 1e-6)) * wyLightGridDepth.x + wyLightGridDepth.y));
+  cluster = clamp(cluster, ivec3(0), size - 1);
+
+  vec4 range = texelFetch(wyLightClusters, ivec2(cluster.x, cluster.z * size.y + cluster.y));
+
+  first = int(range.r);
+  count = int(range.a);
+}
+
+// Returns the light at the specified position in the light index list
+int fetchLightIndex(int index)
+{
+  ivec2 texel = ivec2(index % LIGHT_TEXTURE_WIDTH, index / LIGHT_TEXTURE_WIDTH);
+  return int(texelFetch(wyLightIndices, texel).r);
+}
+
+// Returns the view space properties of the specified light, where the type is
+// one of the light type constants above
+void fetchLight(int light,
+                out vec3 position,
+                out float radius,
+                out vec3 color,
+                out int type,
+                out vec3 direction)
+{
+  int base = light * 3;
+
+  vec4 data0 = texelFetch(wyLightData, ivec2(base % LIGHT_TEXTURE_WIDTH,
+                                             base / LIGHT_TEXTURE_WIDTH));
+  vec4 data1 = texelFetch(wyLightData, ivec2((base + 1) % LIGHT_TEXTURE_WIDTH,
+                                             (base + 1) / LIGHT_TEXTURE_WIDTH));
+  vec4 data2 = texelFetch(wyLightData, ivec2((base + 2) % LIGHT_TEXTURE_WIDTH,
+                                             (base + 2) / LIGHT_TEXTURE_WIDTH));
+
+  position = data0.xyz;
+  radius = data0.w;
+  color = data1.rgb;
+  type = int(data1.a);
+  direction = data2.xyz;
+}
+
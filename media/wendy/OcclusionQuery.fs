@@ -0,0 +1,10 @@
+
+#version 150
+
+out vec4 fragment;
+
+void main()
+{
+  fragment = vec4(1.0);
+}
+
@@ -0,0 +1,10 @@
+
+#version 150
+
+in vec3 vPosition;
+
+void main()
+{
+  gl_Position = wyMVP * vec4(vPosition, 1.0);
+}
+
@@ -0,0 +1,16 @@
+
+// Decodes an octahedron encoded unit vector, as written by
+// Vertex2sn2ht4sv::encodeNormal
+vec3 decodeNormal(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+
+  if (n.z < 0.0)
+  {
+    vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    n.xy = (1.0 - abs(n.yx)) * signs;
+  }
+
+  return normalize(n);
+}
+
@@ -154,6 +154,31 @@ Ref<Buffer> Buffer::read(Context& context, const String& sampleName)
   return create(ResourceInfo(cache, name), context, *data);
 }
 
+ResourceLoader::JobID Buffer::readAsync(ResourceLoader& loader,
+                                        Context& context,
+                                        const String& sampleName,
+                                        const std::function<void (Buffer&)>& callback)
+{
+  ResourceLoader::JobList dependencies;
+  dependencies.push_back(loader.prefetch<Sample>(sampleName));
+
+  // The sample is now decoded and cached, so reading only creates the buffer
+
+  auto finish = [&context, sampleName, callback](Resource*) -> bool
+  {
+    Ref<Buffer> buffer = read(context, sampleName);
+    if (!buffer)
+      return false;
+
+    if (callback)
+      callback(*buffer);
+
+    return true;
+  };
+
+  return loader.addJob(ResourceLoader::DecodeFunc(), finish, dependencies);
+}
+
 Buffer::Buffer(const ResourceInfo& info, Context& initContext):
   Resource(info),
   context(initContext),
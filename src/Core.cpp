@@ -356,19 +356,14 @@ const char* Exception::what() const throw()
 
 ///////////////////////////////////////////////////////////////////////
 
-bool RefBase::unreferenced(RefObject* object)
-{
-  return object->count == 0;
-}
-
 void RefBase::increment(RefObject* object)
 {
   object->count++;
 }
 
-void RefBase::decrement(RefObject* object)
+bool RefBase::decrement(RefObject* object)
 {
-  object->count--;
+  return --object->count == 0;
 }
 
 ///////////////////////////////////////////////////////////////////////
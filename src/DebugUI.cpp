@@ -134,10 +134,27 @@ void Interface::update()
     updateCountItem(ITEM_FRAMERATE, "fps", (size_t) (stats->getFrameRate() + 0.5f));
     updateCountItem(ITEM_STATECHANGES, "states / f", frame.stateChangeCount);
     updateCountItem(ITEM_OPERATIONS, "operations / f", frame.operationCount);
+    updateCountItem(ITEM_DRAWCALLS, "draws / f", frame.drawCallCount);
+    labels[ITEM_SUBMITTIME]->setText(format("%.2f ms submit / f",
+                                            frame.submitDuration * 1000.0).c_str());
+    updateCountItem(ITEM_INSTANCES, "instances / f", frame.instanceCount);
+    updateCountSkipItem(ITEM_UNIFORMS,
+                        "uniforms / f",
+                        frame.uniformUploadCount,
+                        frame.skippedUniformUploadCount);
     updateCountItem(ITEM_VERTICES, "vertices / f", frame.vertexCount);
     updateCountItem(ITEM_POINTS, "points / f", frame.pointCount);
     updateCountItem(ITEM_LINES, "lines / f", frame.lineCount);
     updateCountItem(ITEM_TRIANGLES, "triangles / f", frame.triangleCount);
+    updateCountItem(ITEM_BUFFERSWITCHES,
+                    "buffer switches / f",
+                    frame.vertexBufferSwitchCount + frame.indexBufferSwitchCount);
+    labels[ITEM_VERTEXARRAYS]->setText(format("%u VAOs / f (%u created)",
+                                              frame.vertexArrayHitCount + frame.vertexArrayMissCount,
+                                              frame.vertexArrayMissCount).c_str());
+    labels[ITEM_OCCLUSIONQUERIES]->setText(format("%u queries / f (%u stalled)",
+                                                  frame.occlusionQueryCount,
+                                                  frame.occlusionQueryStallCount).c_str());
 
     updateCountItem(ITEM_PROGRAMS, "programs", stats->getProgramCount());
     updateCountSizeItem(ITEM_TEXTURES,
@@ -192,6 +209,17 @@ void Interface::updateCountSizeItem(Item item,
                                suffix(size)).c_str());
 }
 
+void Interface::updateCountSkipItem(Item item,
+                                    const char* unit,
+                                    size_t count,
+                                    size_t skipped)
+{
+  labels[item]->setText(format("%u %s (%u skipped)",
+                               (uint) count,
+                               unit,
+                               (uint) skipped).c_str());
+}
+
 ///////////////////////////////////////////////////////////////////////
 
   } /*namespace debug*/
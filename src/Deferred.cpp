@@ -0,0 +1,360 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy deferred renderer
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Timer.h>
+#include <wendy/Profile.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+
+#include <wendy/RenderPool.h>
+#include <wendy/RenderState.h>
+#include <wendy/RenderMaterial.h>
+#include <wendy/RenderLight.h>
+#include <wendy/RenderScene.h>
+
+#include <wendy/Forward.h>
+#include <wendy/Deferred.h>
+
+///////////////////////////////////////////////////////////////////////
+
+namespace wendy
+{
+  namespace deferred
+  {
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const Vertex2fv quadVertices[] =
+{
+  { vec2(-1.f, -1.f) },
+  { vec2( 1.f, -1.f) },
+  { vec2(-1.f,  1.f) },
+  { vec2( 1.f,  1.f) }
+};
+
+Ref<GL::Texture> createBuffer(GL::Context& context,
+                              const PixelFormat& format,
+                              uint width,
+                              uint height)
+{
+  ResourceCache& cache = context.getCache();
+
+  Ref<Image> image = Image::create(ResourceInfo(cache), format, width, height);
+  if (!image)
+    return NULL;
+
+  GL::TextureParams params(GL::TEXTURE_RECT);
+  params.mipmapped = false;
+
+  Ref<GL::Texture> texture = GL::Texture::create(ResourceInfo(cache),
+                                                 context,
+                                                 params,
+                                                 *image);
+  if (!texture)
+    return NULL;
+
+  texture->setFilterMode(GL::FILTER_NEAREST);
+  return texture;
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+Config::Config(render::GeometryPool& initPool):
+  pool(&initPool)
+{
+}
+
+///////////////////////////////////////////////////////////////////////
+
+void Renderer::render(const render::Scene& scene, const Camera& camera)
+{
+  ProfileNodeCall call("deferred::Renderer::render");
+
+  GL::Context& context = getContext();
+
+  Ref<GL::Framebuffer> target = &context.getCurrentFramebuffer();
+  const Recti viewportArea = context.getViewportArea();
+
+  if (!updateGBuffer(viewportArea.size.x, viewportArea.size.y))
+  {
+    logError("Failed to update G-buffer for deferred renderer");
+    return;
+  }
+
+  {
+    ProfileNodeCall call("deferred::Renderer::render::geometry");
+
+    context.setCurrentFramebuffer(*framebuffer);
+    context.setViewportArea(Recti(ivec2(0), viewportArea.size));
+    context.clearBuffers();
+
+    forward->render(scene.getOpaqueQueue(), camera);
+
+    context.setCurrentFramebuffer(*target);
+    context.setViewportArea(viewportArea);
+  }
+
+  {
+    ProfileNodeCall call("deferred::Renderer::render::lights");
+
+    lightGrid->assign(scene.getLights(), camera);
+    if (!lightGrid->upload())
+      logError("Failed to upload light grid");
+
+    state->setLightGrid(lightGrid);
+
+    renderLights(scene, camera);
+  }
+
+  forward->render(scene.getBlendedQueue(), camera);
+}
+
+render::LightGrid& Renderer::getLightGrid() const
+{
+  return *lightGrid;
+}
+
+forward::SharedProgramState& Renderer::getSharedProgramState()
+{
+  return *state;
+}
+
+Ref<Renderer> Renderer::create(const Config& config)
+{
+  if (!config.pool)
+  {
+    logError("Cannot create deferred renderer without a geometry pool");
+    return NULL;
+  }
+
+  Ptr<Renderer> renderer(new Renderer(*config.pool));
+  if (!renderer->init(config))
+    return NULL;
+
+  return renderer.detachObject();
+}
+
+Renderer::Renderer(render::GeometryPool& pool):
+  render::System(pool, render::System::DEFERRED)
+{
+}
+
+bool Renderer::init(const Config& config)
+{
+  GL::Context& context = getContext();
+
+  if (config.state)
+    state = config.state;
+  else
+    state = new forward::SharedProgramState();
+
+  // The light grid is assigned here rather than by the forward renderer, as
+  // that only ever renders single queues
+
+  forward::Config forwardConfig(*config.pool);
+  forwardConfig.state = state;
+
+  forward = forward::Renderer::create(forwardConfig);
+  if (!forward)
+    return false;
+
+  if (config.lightGrid)
+    lightGrid = config.lightGrid;
+  else
+  {
+    lightGrid = render::LightGrid::create(context);
+    if (!lightGrid)
+      return false;
+  }
+
+  framebuffer = GL::TextureFramebuffer::create(context);
+  if (!framebuffer)
+    return false;
+
+  quad = GL::VertexBuffer::create(context,
+                                  sizeof(quadVertices) / sizeof(quadVertices[0]),
+                                  Vertex2fv::format,
+                                  GL::VertexBuffer::STATIC);
+  if (!quad)
+    return false;
+
+  quad->copyFrom(quadVertices, quad->getCount());
+
+  if (!initPass(lightPass, "wendy/DeferredLighting.fs"))
+    return false;
+
+  // Writing depth requires depth testing to be enabled, so it is made to
+  // always pass instead
+  lightPass.setDepthFunction(GL::ALLOW_ALWAYS);
+  lightPass.setDepthWriting(true);
+
+  if (!initPass(directionalPass, "wendy/DeferredDirectional.fs"))
+    return false;
+
+  directionalPass.setDepthTesting(false);
+  directionalPass.setDepthWriting(false);
+  directionalPass.setBlendFactors(GL::BLEND_ONE, GL::BLEND_ONE);
+
+  return true;
+}
+
+bool Renderer::initPass(render::Pass& pass, const char* fragmentShaderName)
+{
+  GL::Context& context = getContext();
+
+  Ref<GL::Program> program = GL::Program::read(context,
+                                               "wendy/DeferredLighting.vs",
+                                               fragmentShaderName);
+  if (!program)
+  {
+    logError("Failed to load deferred lighting program");
+    return false;
+  }
+
+  GL::ProgramInterface interface;
+  interface.addSampler("colorBuffer", GL::SAMPLER_RECT);
+  interface.addSampler("normalBuffer", GL::SAMPLER_RECT);
+  interface.addSampler("depthBuffer", GL::SAMPLER_RECT);
+  interface.addUniform("inverseProjection", GL::UNIFORM_MAT4);
+  interface.addAttributes(Vertex2fv::format);
+
+  if (!interface.matches(*program, true))
+  {
+    logError("Deferred lighting program \'%s\' does not conform to the required interface",
+             program->getName().c_str());
+    return false;
+  }
+
+  pass.setProgram(program);
+  pass.setCullMode(GL::CULL_NONE);
+  pass.setMultisampling(false);
+
+  return true;
+}
+
+bool Renderer::updateGBuffer(uint width, uint height)
+{
+  if (colorTexture &&
+      colorTexture->getWidth() == width &&
+      colorTexture->getHeight() == height)
+  {
+    return true;
+  }
+
+  GL::Context& context = getContext();
+
+  // The members are only replaced once every buffer has been created and
+  // attached, so that a failure is retried on the next frame
+
+  Ref<GL::Texture> color = createBuffer(context, PixelFormat::RGBA8, width, height);
+  if (!color)
+    return false;
+
+  Ref<GL::Texture> normal = createBuffer(context, PixelFormat::RGBA16F, width, height);
+  if (!normal)
+    return false;
+
+  Ref<GL::Texture> depth = createBuffer(context, PixelFormat::DEPTH24, width, height);
+  if (!depth)
+    return false;
+
+  if (!framebuffer->setBuffer(GL::TextureFramebuffer::COLOR_BUFFER0,
+                              &color->getImage()) ||
+      !framebuffer->setBuffer(GL::TextureFramebuffer::COLOR_BUFFER1,
+                              &normal->getImage()) ||
+      !framebuffer->setBuffer(GL::TextureFramebuffer::DEPTH_BUFFER,
+                              &depth->getImage()))
+  {
+    return false;
+  }
+
+  colorTexture = color;
+  normalTexture = normal;
+  depthTexture = depth;
+
+  lightPass.setSamplerState("colorBuffer", colorTexture);
+  lightPass.setSamplerState("normalBuffer", normalTexture);
+  lightPass.setSamplerState("depthBuffer", depthTexture);
+
+  directionalPass.setSamplerState("colorBuffer", colorTexture);
+  directionalPass.setSamplerState("normalBuffer", normalTexture);
+  directionalPass.setSamplerState("depthBuffer", depthTexture);
+
+  return true;
+}
+
+void Renderer::renderLights(const render::Scene& scene, const Camera& camera)
+{
+  GL::Context& context = getContext();
+  context.setCurrentSharedProgramState(state);
+
+  const mat4 inverseProjection = inverse(camera.getProjectionMatrix());
+  const GL::PrimitiveRange range(GL::TRIANGLE_STRIP, *quad);
+
+  lightPass.setUniformState("inverseProjection", inverseProjection);
+  lightPass.setUniformState("ambient", scene.getAmbientIntensity());
+  lightPass.apply();
+
+  context.render(range);
+
+  const mat4 view = camera.getViewTransform();
+  const render::LightList& lights = scene.getLights();
+
+  directionalPass.setUniformState("inverseProjection", inverseProjection);
+
+  for (auto l = lights.begin();  l != lights.end();  l++)
+  {
+    const render::Light& light = **l;
+    if (light.getType() != render::Light::DIRECTIONAL)
+      continue;
+
+    // The shader expects the direction towards the light
+    directionalPass.setUniformState("direction", normalize(mat3(view) * -light.getDirection()));
+    directionalPass.setUniformState("color", light.getColor());
+    directionalPass.apply();
+
+    context.render(range);
+  }
+
+  context.setCurrentSharedProgramState(NULL);
+}
+
+///////////////////////////////////////////////////////////////////////
+
+  } /*namespace deferred*/
+} /*namespace wendy*/
+
+///////////////////////////////////////////////////////////////////////
@@ -43,6 +43,8 @@
 
 #include <wendy/Forward.h>
 
+#include <glm/gtc/type_ptr.hpp>
+
 ///////////////////////////////////////////////////////////////////////
 
 namespace wendy
@@ -52,6 +54,117 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+namespace
+{
+
+class InstanceVertex
+{
+public:
+  mat4 transform;
+  static VertexFormat format;
+};
+
+VertexFormat InstanceVertex::format("4f:wyInstanceM0 4f:wyInstanceM1 4f:wyInstanceM2 4f:wyInstanceM3");
+
+bool isSameBuffers(const GL::PrimitiveRange& first, const GL::PrimitiveRange& second)
+{
+  return first.getType() == second.getType() &&
+         first.getVertexBuffer() == second.getVertexBuffer() &&
+         first.getIndexBuffer() == second.getIndexBuffer();
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+SharedProgramState::SharedProgramState():
+  gridGeneration(allocateGeneration())
+{
+}
+
+bool SharedProgramState::reserveSupported(GL::Context& context) const
+{
+  if (!render::SharedProgramState::reserveSupported(context))
+    return false;
+
+  context.createSharedSampler("wyLightData", GL::SAMPLER_RECT, SHARED_LIGHT_DATA);
+  context.createSharedSampler("wyLightClusters", GL::SAMPLER_RECT, SHARED_LIGHT_CLUSTERS);
+  context.createSharedSampler("wyLightIndices", GL::SAMPLER_RECT, SHARED_LIGHT_INDICES);
+
+  context.createSharedBlockUniform("wyLightGridSize", GL::UNIFORM_VEC4, SHARED_LIGHT_GRID_SIZE);
+  context.createSharedBlockUniform("wyLightGridDepth", GL::UNIFORM_VEC2, SHARED_LIGHT_GRID_DEPTH);
+
+  return true;
+}
+
+render::LightGrid* SharedProgramState::getLightGrid() const
+{
+  return grid;
+}
+
+void SharedProgramState::setLightGrid(render::LightGrid* newGrid)
+{
+  grid = newGrid;
+  gridGeneration = allocateGeneration();
+  invalidateBlock();
+}
+
+void SharedProgramState::updateTo(GL::Sampler& sampler)
+{
+  switch (sampler.getSharedID())
+  {
+    // Without a grid the light count is zero and the samplers are never read
+    case SHARED_LIGHT_DATA:
+    {
+      if (grid)
+        grid->getContext().setCurrentTexture(grid->getLightTexture());
+      return;
+    }
+
+    case SHARED_LIGHT_CLUSTERS:
+    {
+      if (grid)
+        grid->getContext().setCurrentTexture(grid->getClusterTexture());
+      return;
+    }
+
+    case SHARED_LIGHT_INDICES:
+    {
+      if (grid)
+        grid->getContext().setCurrentTexture(grid->getIndexTexture());
+      return;
+    }
+  }
+
+  render::SharedProgramState::updateTo(sampler);
+}
+
+void SharedProgramState::updateBlock(GL::Context& context)
+{
+  render::SharedProgramState::updateBlock(context);
+
+  vec4 size;
+  vec2 depth;
+
+  if (grid)
+  {
+    size = vec4(float(grid->getCountX()),
+                float(grid->getCountY()),
+                float(grid->getCountZ()),
+                float(grid->getLightCount()));
+    depth = vec2(grid->getDepthScale(), grid->getDepthBias());
+  }
+
+  context.setSharedBlockUniform(SHARED_LIGHT_GRID_SIZE,
+                                value_ptr(size),
+                                gridGeneration);
+  context.setSharedBlockUniform(SHARED_LIGHT_GRID_DEPTH,
+                                value_ptr(depth),
+                                gridGeneration);
+}
+
+///////////////////////////////////////////////////////////////////////
+
 Config::Config(render::GeometryPool& initPool):
   pool(&initPool)
 {
@@ -66,25 +179,48 @@ void Renderer::render(const render::Scene& scene, const Camera& camera)
   GL::Context& context = getContext();
   context.setCurrentSharedProgramState(state);
 
-  const Recti& viewportArea = context.getViewportArea();
-  state->setViewportSize(float(viewportArea.size.x),
-                         float(viewportArea.size.y));
+  applyCamera(camera);
 
-  state->setProjectionMatrix(camera.getProjectionMatrix());
-  state->setViewMatrix(camera.getViewTransform());
-
-  if (camera.isPerspective())
+  if (lightGrid)
   {
-    state->setCameraProperties(camera.getTransform().position,
-                               camera.getFOV(),
-                               camera.getAspectRatio(),
-                               camera.getNearZ(),
-                               camera.getFarZ());
+    ProfileNodeCall call("forward::Renderer::render::lights");
+
+    lightGrid->assign(scene.getLights(), camera);
+    if (!lightGrid->upload())
+      logError("Failed to upload light grid");
+
+    state->setLightGrid(lightGrid);
   }
 
+  const Time start = Timer::getCurrentTime();
+
   renderOperations(scene.getOpaqueQueue());
   renderOperations(scene.getBlendedQueue());
 
+  if (GL::Stats* stats = context.getStats())
+    stats->addSubmitTime(Timer::getCurrentTime() - start);
+
+  context.setCurrentSharedProgramState(NULL);
+
+  releaseObjects();
+}
+
+void Renderer::render(const render::Queue& queue, const Camera& camera)
+{
+  ProfileNodeCall call("forward::Renderer::render");
+
+  GL::Context& context = getContext();
+  context.setCurrentSharedProgramState(state);
+
+  applyCamera(camera);
+
+  const Time start = Timer::getCurrentTime();
+
+  renderOperations(queue);
+
+  if (GL::Stats* stats = context.getStats())
+    stats->addSubmitTime(Timer::getCurrentTime() - start);
+
   context.setCurrentSharedProgramState(NULL);
 
   releaseObjects();
@@ -95,6 +231,11 @@ SharedProgramState& Renderer::getSharedProgramState()
   return *state;
 }
 
+render::LightGrid* Renderer::getLightGrid() const
+{
+  return lightGrid;
+}
+
 Ref<Renderer> Renderer::create(const Config& config)
 {
   if (!config.pool)
@@ -126,25 +267,181 @@ bool Renderer::init(const Config& config)
 
   state->reserveSupported(context);
 
+  lightGrid = config.lightGrid;
+
   return true;
 }
 
+void Renderer::applyCamera(const Camera& camera)
+{
+  GL::Context& context = getContext();
+
+  const Recti& viewportArea = context.getViewportArea();
+  state->setViewportSize(float(viewportArea.size.x),
+                         float(viewportArea.size.y));
+
+  state->setProjectionMatrix(camera.getProjectionMatrix());
+  state->setViewMatrix(camera.getViewTransform());
+
+  if (camera.isPerspective())
+  {
+    state->setCameraProperties(camera.getTransform().position,
+                               camera.getFOV(),
+                               camera.getAspectRatio(),
+                               camera.getNearZ(),
+                               camera.getFarZ());
+  }
+}
+
 void Renderer::renderOperations(const render::Queue& queue)
 {
   GL::Context& context = getContext();
-  const render::SortKeyList& keys = queue.getSortKeys();
+  const render::OperationIndexList& indices = queue.getSortedIndices();
   const render::OperationList& operations = queue.getOperations();
 
-  for (auto k = keys.begin();  k != keys.end();  k++)
+  for (size_t i = 0;  i < indices.size();  )
   {
-    const render::SortKey key(*k);
-    const render::Operation& op = operations[key.index];
+    const render::Operation& op = operations[indices[i]];
+
+    GL::Program* program = op.state->getProgram();
+    const bool instanced = program && program->isInstanced();
+
+    if (instanced && context.isInstancingSupported())
+    {
+      size_t end = i + 1;
+
+      if (context.isMultiDrawSupported() && op.range.getIndexBuffer())
+      {
+        // Merge the run of operations sharing both pass and buffers
+        while (end < indices.size())
+        {
+          const render::Operation& next = operations[indices[end]];
+          if (next.state != op.state || !isSameBuffers(next.range, op.range))
+            break;
+
+          end++;
+        }
+
+        if (!renderMultiple(operations, &indices[i], end - i))
+          return;
+      }
+      else
+      {
+        // Merge the run of operations sharing both pass and geometry
+        while (end < indices.size())
+        {
+          const render::Operation& next = operations[indices[end]];
+          if (next.state != op.state || next.range != op.range)
+            break;
+
+          end++;
+        }
+
+        if (!renderInstances(operations, &indices[i], end - i))
+          return;
+      }
+
+      i = end;
+    }
+    else
+    {
+      state->setModelMatrix(op.transform);
+      op.state->apply();
+
+      if (instanced)
+        context.render(op.range, op.transform);
+      else
+        context.render(op.range);
+
+      i++;
+    }
+  }
+}
 
-    state->setModelMatrix(op.transform);
-    op.state->apply();
+bool Renderer::renderInstances(const render::OperationList& operations,
+                               const uint32* indices,
+                               size_t count)
+{
+  GL::VertexRange range;
 
-    context.render(op.range);
+  InstanceVertex* instances = (InstanceVertex*)
+    getGeometryPool().lockVertices(range, count, InstanceVertex::format);
+  if (!instances)
+  {
+    logError("Failed to allocate instance transforms");
+    return false;
   }
+
+  for (size_t i = 0;  i < count;  i++)
+    instances[i].transform = operations[indices[i]].transform;
+
+  range.unlock();
+
+  const render::Operation& first = operations[indices[0]];
+
+  state->setModelMatrix(first.transform);
+  first.state->apply();
+
+  getContext().render(first.range, range);
+  return true;
+}
+
+bool Renderer::renderMultiple(const render::OperationList& operations,
+                              const uint32* indices,
+                              size_t count)
+{
+  // Runs of operations with the same range become a single instanced command
+  commands.clear();
+
+  for (size_t i = 0;  i < count;  i++)
+  {
+    const GL::PrimitiveRange& range = operations[indices[i]].range;
+
+    if (i > 0 && range == operations[indices[i - 1]].range)
+    {
+      commands.back().instanceCount++;
+      continue;
+    }
+
+    GL::DrawCommand command;
+    command.count = uint32(range.getCount());
+    command.instanceCount = 1;
+    command.start = uint32(range.getStart());
+    command.base = int32(range.getBase());
+    command.baseInstance = uint32(i);
+    commands.push_back(command);
+  }
+
+  if (commands.size() == 1)
+    return renderInstances(operations, indices, count);
+
+  GL::VertexRange range;
+
+  InstanceVertex* instances = (InstanceVertex*)
+    getGeometryPool().lockVertices(range, count, InstanceVertex::format);
+  if (!instances)
+  {
+    logError("Failed to allocate instance transforms");
+    return false;
+  }
+
+  for (size_t i = 0;  i < count;  i++)
+    instances[i].transform = operations[indices[i]].transform;
+
+  range.unlock();
+
+  const render::Operation& first = operations[indices[0]];
+
+  state->setModelMatrix(first.transform);
+  first.state->apply();
+
+  getContext().renderMultiple(first.range.getType(),
+                              *first.range.getVertexBuffer(),
+                              *first.range.getIndexBuffer(),
+                              &commands[0],
+                              uint(commands.size()),
+                              range);
+  return true;
 }
 
 void Renderer::releaseObjects()
@@ -32,6 +32,11 @@
 #include <wendy/AABB.h>
 #include <wendy/Frustum.h>
 
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define WENDY_USE_SSE 1
+#endif
+
 ///////////////////////////////////////////////////////////////////////
 
 namespace wendy
@@ -39,6 +44,56 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+void SphereBatch::add(const Sphere& sphere)
+{
+  x.push_back(sphere.center.x);
+  y.push_back(sphere.center.y);
+  z.push_back(sphere.center.z);
+  radius.push_back(sphere.radius);
+}
+
+void SphereBatch::clear()
+{
+  x.clear();
+  y.clear();
+  z.clear();
+  radius.clear();
+}
+
+size_t SphereBatch::getCount() const
+{
+  return x.size();
+}
+
+///////////////////////////////////////////////////////////////////////
+
+void AABBBatch::add(const AABB& box)
+{
+  x.push_back(box.center.x);
+  y.push_back(box.center.y);
+  z.push_back(box.center.z);
+  sizeX.push_back(abs(box.size.x));
+  sizeY.push_back(abs(box.size.y));
+  sizeZ.push_back(abs(box.size.z));
+}
+
+void AABBBatch::clear()
+{
+  x.clear();
+  y.clear();
+  z.clear();
+  sizeX.clear();
+  sizeY.clear();
+  sizeZ.clear();
+}
+
+size_t AABBBatch::getCount() const
+{
+  return x.size();
+}
+
+///////////////////////////////////////////////////////////////////////
+
 Frustum::Frustum()
 {
 }
@@ -117,10 +172,231 @@ bool Frustum::intersects(const AABB& box) const
   return true;
 }
 
+bool Frustum::intersects(const AABB& box, uint& planeMask, uint& firstPlane) const
+{
+  const vec3 extent = abs(box.size);
+
+  for (uint i = 0;  i < 6;  i++)
+  {
+    const uint index = (firstPlane + i) % 6;
+    if (!(planeMask & (1 << index)))
+      continue;
+
+    const Plane& plane = planes[index];
+
+    const float distance = dot(plane.normal, box.center);
+    const float radius = dot(abs(plane.normal), extent);
+
+    if (distance - radius >= plane.distance)
+    {
+      firstPlane = index;
+      return false;
+    }
+
+    if (distance + radius < plane.distance)
+      planeMask &= ~(1 << index);
+  }
+
+  return true;
+}
+
+bool Frustum::intersectsExactly(const AABB& box) const
+{
+  if (!intersects(box))
+    return false;
+
+  // The planes of this frustum have been tested, so what remains are the face
+  // normals of the box and the cross products of the edges of both
+
+  float minX, minY, minZ, maxX, maxY, maxZ;
+  box.getBounds(minX, minY, minZ, maxX, maxY, maxZ);
+
+  const vec3 minimum(minX, minY, minZ);
+  const vec3 maximum(maxX, maxY, maxZ);
+
+  for (uint i = 0;  i < 3;  i++)
+  {
+    bool below = true, above = true;
+
+    for (uint j = 0;  j < 8;  j++)
+    {
+      if (corners[j][i] >= minimum[i])
+        below = false;
+      if (corners[j][i] <= maximum[i])
+        above = false;
+    }
+
+    if (below || above)
+      return false;
+  }
+
+  const vec3 edges[6] =
+  {
+    corners[4] - corners[0],
+    corners[5] - corners[1],
+    corners[6] - corners[2],
+    corners[7] - corners[3],
+    corners[1] - corners[0],
+    corners[3] - corners[0]
+  };
+
+  const vec3 extent = abs(box.size);
+
+  for (uint i = 0;  i < 6;  i++)
+  {
+    for (uint j = 0;  j < 3;  j++)
+    {
+      vec3 unit(0.f);
+      unit[j] = 1.f;
+
+      const vec3 axis = cross(unit, edges[i]);
+      if (dot(axis, axis) < 1e-12f)
+        continue;
+
+      float lower = dot(axis, corners[0]), upper = lower;
+
+      for (uint k = 1;  k < 8;  k++)
+      {
+        const float distance = dot(axis, corners[k]);
+        lower = min(lower, distance);
+        upper = max(upper, distance);
+      }
+
+      const float center = dot(axis, box.center);
+      const float radius = dot(abs(axis), extent);
+
+      if (center + radius < lower || center - radius > upper)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+void Frustum::intersects(const SphereBatch& batch, std::vector<uint32>& masks) const
+{
+  const size_t count = batch.getCount();
+  masks.assign((count + 31) / 32, 0);
+
+  size_t i = 0;
+
+#if WENDY_USE_SSE
+  __m128 nx[6], ny[6], nz[6], nd[6];
+
+  for (uint p = 0;  p < 6;  p++)
+  {
+    nx[p] = _mm_set1_ps(planes[p].normal.x);
+    ny[p] = _mm_set1_ps(planes[p].normal.y);
+    nz[p] = _mm_set1_ps(planes[p].normal.z);
+    nd[p] = _mm_set1_ps(planes[p].distance);
+  }
+
+  const __m128 all = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+
+  for (;  i + 4 <= count;  i += 4)
+  {
+    const __m128 x = _mm_loadu_ps(&batch.x[i]);
+    const __m128 y = _mm_loadu_ps(&batch.y[i]);
+    const __m128 z = _mm_loadu_ps(&batch.z[i]);
+    const __m128 r = _mm_loadu_ps(&batch.radius[i]);
+
+    __m128 visible = all;
+
+    for (uint p = 0;  p < 6;  p++)
+    {
+      __m128 distance = _mm_mul_ps(x, nx[p]);
+      distance = _mm_add_ps(distance, _mm_mul_ps(y, ny[p]));
+      distance = _mm_add_ps(distance, _mm_mul_ps(z, nz[p]));
+      distance = _mm_sub_ps(distance, r);
+
+      visible = _mm_and_ps(visible, _mm_cmple_ps(distance, nd[p]));
+      if (!_mm_movemask_ps(visible))
+        break;
+    }
+
+    masks[i / 32] |= uint32(_mm_movemask_ps(visible)) << (i % 32);
+  }
+#endif
+
+  for (;  i < count;  i++)
+  {
+    const Sphere sphere(vec3(batch.x[i], batch.y[i], batch.z[i]), batch.radius[i]);
+
+    if (intersects(sphere))
+      masks[i / 32] |= 1u << (i % 32);
+  }
+}
+
+void Frustum::intersects(const AABBBatch& batch, std::vector<uint32>& masks) const
+{
+  const size_t count = batch.getCount();
+  masks.assign((count + 31) / 32, 0);
+
+  size_t i = 0;
+
+#if WENDY_USE_SSE
+  __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], nd[6];
+
+  for (uint p = 0;  p < 6;  p++)
+  {
+    nx[p] = _mm_set1_ps(planes[p].normal.x);
+    ny[p] = _mm_set1_ps(planes[p].normal.y);
+    nz[p] = _mm_set1_ps(planes[p].normal.z);
+    ax[p] = _mm_set1_ps(abs(planes[p].normal.x));
+    ay[p] = _mm_set1_ps(abs(planes[p].normal.y));
+    az[p] = _mm_set1_ps(abs(planes[p].normal.z));
+    nd[p] = _mm_set1_ps(planes[p].distance);
+  }
+
+  const __m128 all = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+
+  for (;  i + 4 <= count;  i += 4)
+  {
+    const __m128 x = _mm_loadu_ps(&batch.x[i]);
+    const __m128 y = _mm_loadu_ps(&batch.y[i]);
+    const __m128 z = _mm_loadu_ps(&batch.z[i]);
+    const __m128 sx = _mm_loadu_ps(&batch.sizeX[i]);
+    const __m128 sy = _mm_loadu_ps(&batch.sizeY[i]);
+    const __m128 sz = _mm_loadu_ps(&batch.sizeZ[i]);
+
+    __m128 visible = all;
+
+    for (uint p = 0;  p < 6;  p++)
+    {
+      // Distance from the plane to the box corner furthest along its normal
+      __m128 distance = _mm_mul_ps(x, nx[p]);
+      distance = _mm_add_ps(distance, _mm_mul_ps(y, ny[p]));
+      distance = _mm_add_ps(distance, _mm_mul_ps(z, nz[p]));
+      distance = _mm_sub_ps(distance, _mm_mul_ps(sx, ax[p]));
+      distance = _mm_sub_ps(distance, _mm_mul_ps(sy, ay[p]));
+      distance = _mm_sub_ps(distance, _mm_mul_ps(sz, az[p]));
+
+      visible = _mm_and_ps(visible, _mm_cmplt_ps(distance, nd[p]));
+      if (!_mm_movemask_ps(visible))
+        break;
+    }
+
+    masks[i / 32] |= uint32(_mm_movemask_ps(visible)) << (i % 32);
+  }
+#endif
+
+  for (;  i < count;  i++)
+  {
+    const AABB box(vec3(batch.x[i], batch.y[i], batch.z[i]),
+                   vec3(batch.sizeX[i], batch.sizeY[i], batch.sizeZ[i]));
+
+    if (intersects(box))
+      masks[i / 32] |= 1u << (i % 32);
+  }
+}
+
 void Frustum::transformBy(const Transform3& transform)
 {
   for (size_t i = 0;  i < 6;  i++)
     planes[i].transformBy(transform);
+
+  for (size_t i = 0;  i < 8;  i++)
+    transform.transformVector(corners[i]);
 }
 
 void Frustum::setPerspective(float FOV, float aspectRatio, float nearZ, float farZ)
@@ -146,6 +422,12 @@ void Frustum::setPerspective(float FOV, float aspectRatio, float nearZ, float fa
 
   planes[FRUSTUM_NEAR].set(vec3(0.f, 0.f, 1.f), -nearZ);
   planes[FRUSTUM_FAR].set(vec3(0.f, 0.f, -1.f), farZ);
+
+  for (size_t i = 0;  i < 4;  i++)
+  {
+    corners[i] = points[i + 1] * (nearZ / distance);
+    corners[i + 4] = points[i + 1] * (farZ / distance);
+  }
 }
 
 void Frustum::setOrtho(const AABB& volume)
@@ -168,6 +450,15 @@ void Frustum::setOrtho(float minX, float minY, float minZ,
   planes[FRUSTUM_LEFT].set(vec3(-1.f, 0.f, 0.f), -minX);
   planes[FRUSTUM_NEAR].set(vec3(0.f, 0.f, 1.f), maxZ);
   planes[FRUSTUM_FAR].set(vec3(0.f, 0.f, -1.f), -minZ);
+
+  corners[0] = vec3(minX, maxY, maxZ);
+  corners[1] = vec3(maxX, maxY, maxZ);
+  corners[2] = vec3(maxX, minY, maxZ);
+  corners[3] = vec3(minX, minY, maxZ);
+  corners[4] = vec3(minX, maxY, minZ);
+  corners[5] = vec3(maxX, maxY, minZ);
+  corners[6] = vec3(maxX, minY, minZ);
+  corners[7] = vec3(minX, minY, minZ);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -64,6 +64,30 @@ GLenum convertToGL(LockType type)
   panic("Invalid lock type %u", type);
 }
 
+GLbitfield convertToMapBits(LockType type, bool synchronized)
+{
+  GLbitfield bits;
+
+  switch (type)
+  {
+    case LOCK_READ_ONLY:
+      return GL_MAP_READ_BIT;
+    case LOCK_WRITE_ONLY:
+      bits = GL_MAP_WRITE_BIT;
+      break;
+    case LOCK_READ_WRITE:
+      bits = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT;
+      break;
+    default:
+      panic("Invalid lock type %u", type);
+  }
+
+  if (!synchronized)
+    bits |= GL_MAP_UNSYNCHRONIZED_BIT;
+
+  return bits;
+}
+
 GLenum convertToGL(IndexBuffer::Usage usage)
 {
   switch (usage)
@@ -155,6 +179,8 @@ VertexBuffer::~VertexBuffer()
   if (locked)
     logWarning("Vertex buffer destroyed while locked");
 
+  context.removeVertexArrays(this);
+
   if (bufferID)
     glDeleteBuffers(1, &bufferID);
 
@@ -183,6 +209,38 @@ void* VertexBuffer::lock(LockType type)
   return mapping;
 }
 
+void* VertexBuffer::lock(LockType type, size_t start, size_t rangeCount, bool synchronized)
+{
+  if (locked)
+  {
+    logError("Vertex buffer already locked");
+    return NULL;
+  }
+
+  if (start + rangeCount > count)
+  {
+    logError("Cannot lock vertices beyond the end of vertex buffer");
+    return NULL;
+  }
+
+  context.setCurrentVertexBuffer(this);
+
+  const size_t size = format.getSize();
+
+  void* mapping = glMapBufferRange(GL_ARRAY_BUFFER,
+                                   start * size,
+                                   rangeCount * size,
+                                   convertToMapBits(type, synchronized));
+  if (mapping == NULL)
+  {
+    checkGL("Failed to lock vertex buffer range");
+    return NULL;
+  }
+
+  locked = true;
+  return mapping;
+}
+
 void VertexBuffer::unlock()
 {
   if (!locked)
@@ -199,6 +257,23 @@ void VertexBuffer::unlock()
   locked = false;
 }
 
+void VertexBuffer::discard()
+{
+  if (locked)
+  {
+    logError("Cannot discard locked vertex buffer");
+    return;
+  }
+
+  context.setCurrentVertexBuffer(this);
+
+  glBufferData(GL_ARRAY_BUFFER, getSize(), NULL, convertToGL(usage));
+
+#if WENDY_DEBUG
+  checkGL("Error during discard of vertex buffer");
+#endif
+}
+
 void VertexBuffer::copyFrom(const void* source, size_t sourceCount, size_t start)
 {
   if (locked)
@@ -223,6 +298,46 @@ void VertexBuffer::copyFrom(const void* source, size_t sourceCount, size_t start
 #endif
 }
 
+void VertexBuffer::copyFrom(const VertexBuffer& source,
+                            size_t sourceCount,
+                            size_t sourceStart,
+                            size_t start)
+{
+  if (locked || source.locked)
+  {
+    logError("Cannot copy data between locked vertex buffers");
+    return;
+  }
+
+  if (&source == this || source.format != format)
+  {
+    logError("Cannot copy vertices from a vertex buffer of another format");
+    return;
+  }
+
+  if (start + sourceCount > count || sourceStart + sourceCount > source.count)
+  {
+    logError("Too many vertices copied between vertex buffers");
+    return;
+  }
+
+  // The copy targets are not tracked by the context, so using them leaves
+  // its vertex buffer binding intact
+  glBindBuffer(GL_COPY_READ_BUFFER, source.bufferID);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, bufferID);
+
+  const size_t size = format.getSize();
+  glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                      GL_COPY_WRITE_BUFFER,
+                      sourceStart * size,
+                      start * size,
+                      sourceCount * size);
+
+#if WENDY_DEBUG
+  checkGL("Error during copy between vertex buffers");
+#endif
+}
+
 void VertexBuffer::copyTo(void* target, size_t targetCount, size_t start)
 {
   if (locked)
@@ -336,6 +451,8 @@ IndexBuffer::~IndexBuffer()
   if (locked)
     logWarning("Index buffer destroyed while locked");
 
+  context.removeVertexArrays(this);
+
   if (bufferID)
     glDeleteBuffers(1, &bufferID);
 
@@ -364,6 +481,38 @@ void* IndexBuffer::lock(LockType type)
   return mapping;
 }
 
+void* IndexBuffer::lock(LockType lockType, size_t start, size_t rangeCount, bool synchronized)
+{
+  if (locked)
+  {
+    logError("Index buffer already locked");
+    return NULL;
+  }
+
+  if (start + rangeCount > count)
+  {
+    logError("Cannot lock indices beyond the end of index buffer");
+    return NULL;
+  }
+
+  context.setCurrentIndexBuffer(this);
+
+  const size_t size = getTypeSize(type);
+
+  void* mapping = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER,
+                                   start * size,
+                                   rangeCount * size,
+                                   convertToMapBits(lockType, synchronized));
+  if (mapping == NULL)
+  {
+    checkGL("Failed to lock index buffer range");
+    return NULL;
+  }
+
+  locked = true;
+  return mapping;
+}
+
 void IndexBuffer::unlock()
 {
   if (!locked)
@@ -380,6 +529,23 @@ void IndexBuffer::unlock()
   locked = false;
 }
 
+void IndexBuffer::discard()
+{
+  if (locked)
+  {
+    logError("Cannot discard locked index buffer");
+    return;
+  }
+
+  context.setCurrentIndexBuffer(this);
+
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, getSize(), NULL, convertToGL(usage));
+
+#if WENDY_DEBUG
+  checkGL("Error during discard of index buffer");
+#endif
+}
+
 void IndexBuffer::copyFrom(const void* source, size_t sourceCount, size_t start)
 {
   if (locked)
@@ -404,6 +570,46 @@ void IndexBuffer::copyFrom(const void* source, size_t sourceCount, size_t start)
 #endif
 }
 
+void IndexBuffer::copyFrom(const IndexBuffer& source,
+                           size_t sourceCount,
+                           size_t sourceStart,
+                           size_t start)
+{
+  if (locked || source.locked)
+  {
+    logError("Cannot copy data between locked index buffers");
+    return;
+  }
+
+  if (&source == this || source.type != type)
+  {
+    logError("Cannot copy indices from an index buffer of another type");
+    return;
+  }
+
+  if (start + sourceCount > count || sourceStart + sourceCount > source.count)
+  {
+    logError("Too many indices copied between index buffers");
+    return;
+  }
+
+  // The copy targets are not tracked by the context, so using them leaves
+  // its index buffer binding intact
+  glBindBuffer(GL_COPY_READ_BUFFER, source.bufferID);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, bufferID);
+
+  const size_t size = getTypeSize(type);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                      GL_COPY_WRITE_BUFFER,
+                      sourceStart * size,
+                      start * size,
+                      sourceCount * size);
+
+#if WENDY_DEBUG
+  checkGL("Error during copy between index buffers");
+#endif
+}
+
 void IndexBuffer::copyTo(void* target, size_t targetCount, size_t start)
 {
   if (locked)
@@ -559,11 +765,7 @@ void* VertexRange::lock(LockType type) const
     return NULL;
   }
 
-  uint8* vertices = (uint8*) vertexBuffer->lock(type);
-  if (!vertices)
-    return NULL;
-
-  return vertices + start * vertexBuffer->getFormat().getSize();
+  return vertexBuffer->lock(type, start, count);
 }
 
 void VertexRange::unlock() const
@@ -643,11 +845,7 @@ void* IndexRange::lock(LockType type) const
     return NULL;
   }
 
-  uint8* indices = (uint8*) indexBuffer->lock(type);
-  if (!indices)
-    return NULL;
-
-  return indices + start * IndexBuffer::getTypeSize(indexBuffer->getType());
+  return indexBuffer->lock(type, start, count);
 }
 
 void IndexRange::unlock() const
@@ -789,6 +987,21 @@ PrimitiveRange::PrimitiveRange(PrimitiveType initType,
 {
 }
 
+bool PrimitiveRange::operator == (const PrimitiveRange& other) const
+{
+  return type == other.type &&
+         vertexBuffer == other.vertexBuffer &&
+         indexBuffer == other.indexBuffer &&
+         start == other.start &&
+         count == other.count &&
+         base == other.base;
+}
+
+bool PrimitiveRange::operator != (const PrimitiveRange& other) const
+{
+  return !(*this == other);
+}
+
 bool PrimitiveRange::isEmpty() const
 {
   if (vertexBuffer == NULL)
@@ -829,6 +1042,90 @@ size_t PrimitiveRange::getBase() const
 
 ///////////////////////////////////////////////////////////////////////
 
+Fence::~Fence()
+{
+  if (syncID)
+    glDeleteSync((GLsync) syncID);
+}
+
+bool Fence::isSignaled() const
+{
+  GLint status;
+  glGetSynciv((GLsync) syncID, GL_SYNC_STATUS, 1, NULL, &status);
+  return status == GL_SIGNALED;
+}
+
+void Fence::wait() const
+{
+  // Flush on the first attempt so the fence is guaranteed to be reached
+  GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+  for (;;)
+  {
+    const GLenum result = glClientWaitSync((GLsync) syncID, flags, 1000000);
+    if (result != GL_TIMEOUT_EXPIRED)
+    {
+      if (result == GL_WAIT_FAILED)
+        checkGL("Failed to wait for fence");
+
+      return;
+    }
+
+    flags = 0;
+  }
+}
+
+Ref<Fence> Fence::create(Context& context)
+{
+  Ref<Fence> fence(new Fence(context));
+  if (!fence->init())
+    return NULL;
+
+  return fence;
+}
+
+bool Fence::isSupported()
+{
+  return GLEW_VERSION_3_2 || GLEW_ARB_sync;
+}
+
+Fence::Fence(Context& initContext):
+  context(initContext),
+  syncID(NULL)
+{
+}
+
+Fence::Fence(const Fence& source):
+  context(source.context)
+{
+  panic("Fences may not be copied");
+}
+
+bool Fence::init()
+{
+  if (!isSupported())
+  {
+    logError("Fences are not supported by this context");
+    return false;
+  }
+
+  syncID = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  if (!syncID)
+  {
+    checkGL("Failed to create fence");
+    return false;
+  }
+
+  return true;
+}
+
+Fence& Fence::operator = (const Fence& source)
+{
+  panic("Fences may not be assigned");
+}
+
+///////////////////////////////////////////////////////////////////////
+
 template <>
 IndexRangeLock<uint8>::IndexRangeLock(IndexRange& initRange):
   range(initRange),
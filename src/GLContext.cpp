@@ -43,6 +43,7 @@
 #include <GL/glfw3.h>
 
 #include <algorithm>
+#include <cstring>
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -56,6 +57,10 @@ namespace wendy
 namespace
 {
 
+typedef void (APIENTRY *MultiDrawElementsIndirectFunc)(GLenum, GLenum, const GLvoid*, GLsizei, GLsizei);
+
+MultiDrawElementsIndirectFunc multiDrawElementsIndirect = NULL;
+
 const char* getMessageSourceName(GLenum source)
 {
   switch (source)
@@ -306,48 +311,61 @@ GLenum convertToGL(Operation operation)
   panic("Invalid stencil operation %u", operation);
 }
 
+// All attribute types are floating-point, so any component read as floats
+// matches an attribute with the same number of elements
+
 bool isCompatible(const Attribute& attribute, const VertexComponent& component)
 {
-  switch (attribute.getType())
-  {
-    case ATTRIBUTE_FLOAT:
-    {
-      if (component.getType() == VertexComponent::FLOAT32 &&
-          component.getElementCount() == 1)
-        return true;
-
-      break;
-    }
-
-    case ATTRIBUTE_VEC2:
-    {
-      if (component.getType() == VertexComponent::FLOAT32 &&
-          component.getElementCount() == 2)
-        return true;
-
-      break;
-    }
-
-    case ATTRIBUTE_VEC3:
-    {
-      if (component.getType() == VertexComponent::FLOAT32 &&
-          component.getElementCount() == 3)
-        return true;
+  if (!component.isReadAsFloat())
+    return false;
 
-      break;
-    }
+  return attribute.getElementCount() == component.getElementCount();
+}
 
-    case ATTRIBUTE_VEC4:
-    {
-      if (component.getType() == VertexComponent::FLOAT32 &&
-          component.getElementCount() == 4)
-        return true;
+uint getColumnCount(UniformType type)
+{
+  switch (type)
+  {
+    case UNIFORM_MAT2:
+      return 2;
+    case UNIFORM_MAT3:
+      return 3;
+    case UNIFORM_MAT4:
+      return 4;
+    default:
+      return 1;
+  }
+}
 
-      break;
-    }
+// Returns the std140 base alignment of the specified uniform type
+size_t getBlockAlignment(UniformType type)
+{
+  switch (type)
+  {
+    case UNIFORM_FLOAT:
+      return 4;
+    case UNIFORM_VEC2:
+      return 8;
+    default:
+      return 16;
   }
+}
 
-  return false;
+// Returns the std140 size of the specified uniform type, where each matrix
+// column is padded to a vec4
+size_t getBlockSize(UniformType type)
+{
+  switch (type)
+  {
+    case UNIFORM_FLOAT:
+      return 4;
+    case UNIFORM_VEC2:
+      return 8;
+    case UNIFORM_VEC3:
+      return 12;
+    default:
+      return 16 * getColumnCount(type);
+  }
 }
 
 void setBooleanState(uint state, bool value)
@@ -541,31 +559,93 @@ void Stats::addStateChange()
   frame.stateChangeCount++;
 }
 
-void Stats::addPrimitives(PrimitiveType type, uint vertexCount)
+void Stats::addUniformUpload()
+{
+  Frame& frame = frames.front();
+  frame.uniformUploadCount++;
+}
+
+void Stats::addSkippedUniformUpload()
+{
+  Frame& frame = frames.front();
+  frame.skippedUniformUploadCount++;
+}
+
+void Stats::addVertexBufferSwitch()
+{
+  Frame& frame = frames.front();
+  frame.vertexBufferSwitchCount++;
+}
+
+void Stats::addIndexBufferSwitch()
+{
+  Frame& frame = frames.front();
+  frame.indexBufferSwitchCount++;
+}
+
+void Stats::addDrawCall()
+{
+  Frame& frame = frames.front();
+  frame.drawCallCount++;
+}
+
+void Stats::addVertexArrayHit()
+{
+  Frame& frame = frames.front();
+  frame.vertexArrayHitCount++;
+}
+
+void Stats::addVertexArrayMiss()
+{
+  Frame& frame = frames.front();
+  frame.vertexArrayMissCount++;
+}
+
+void Stats::addOcclusionQuery()
+{
+  Frame& frame = frames.front();
+  frame.occlusionQueryCount++;
+}
+
+void Stats::addOcclusionQueryStall()
+{
+  Frame& frame = frames.front();
+  frame.occlusionQueryStallCount++;
+}
+
+void Stats::addSubmitTime(Time time)
+{
+  Frame& frame = frames.front();
+  frame.submitDuration += time;
+}
+
+void Stats::addPrimitives(PrimitiveType type, uint vertexCount, uint instanceCount)
 {
   Frame& frame = frames.front();
-  frame.vertexCount += vertexCount;
   frame.operationCount++;
+  frame.instanceCount += instanceCount;
+
+  frame.vertexCount += vertexCount * instanceCount;
 
   switch (type)
   {
     case POINT_LIST:
-      frame.pointCount += vertexCount;
+      frame.pointCount += vertexCount * instanceCount;
       break;
     case LINE_LIST:
-      frame.lineCount += vertexCount / 2;
+      frame.lineCount += vertexCount / 2 * instanceCount;
       break;
     case LINE_STRIP:
-      frame.lineCount += vertexCount - 1;
+      frame.lineCount += (vertexCount - 1) * instanceCount;
       break;
     case TRIANGLE_LIST:
-      frame.triangleCount += vertexCount / 3;
+      frame.triangleCount += vertexCount / 3 * instanceCount;
       break;
     case TRIANGLE_STRIP:
-      frame.triangleCount += vertexCount - 2;
+      frame.triangleCount += (vertexCount - 2) * instanceCount;
       break;
     case TRIANGLE_FAN:
-      frame.triangleCount += vertexCount - 2;
+      frame.triangleCount += (vertexCount - 2) * instanceCount;
       break;
     default:
       panic("Invalid primitive type %u", type);
@@ -677,12 +757,47 @@ Stats::Frame::Frame():
   pointCount(0),
   lineCount(0),
   triangleCount(0),
+  instanceCount(0),
+  uniformUploadCount(0),
+  skippedUniformUploadCount(0),
+  vertexBufferSwitchCount(0),
+  indexBufferSwitchCount(0),
+  drawCallCount(0),
+  vertexArrayHitCount(0),
+  vertexArrayMissCount(0),
+  occlusionQueryCount(0),
+  occlusionQueryStallCount(0),
+  submitDuration(0.0),
   duration(0.0)
 {
 }
 
 ///////////////////////////////////////////////////////////////////////
 
+SharedProgramState::SharedProgramState()
+{
+  invalidateBlock();
+}
+
+uint SharedProgramState::getBlockGeneration() const
+{
+  return blockGeneration;
+}
+
+void SharedProgramState::invalidateBlock()
+{
+  // Generations are unique across all states, so that the context never
+  // mistakes a new state for the one it last updated from
+  if (!++nextBlockGeneration)
+    nextBlockGeneration++;
+
+  blockGeneration = nextBlockGeneration;
+}
+
+uint SharedProgramState::nextBlockGeneration = 0;
+
+///////////////////////////////////////////////////////////////////////
+
 class Context::SharedSampler
 {
 public:
@@ -702,19 +817,54 @@ public:
 class Context::SharedUniform
 {
 public:
-  SharedUniform(const char* name, UniformType type, int ID):
+  SharedUniform(const char* name, UniformType type, int ID, int offset = -1):
     name(name),
     type(type),
-    ID(ID)
+    ID(ID),
+    offset(offset),
+    generation(0)
   {
   }
   String name;
   UniformType type;
   int ID;
+  int offset;
+  uint generation;
 };
 
 ///////////////////////////////////////////////////////////////////////
 
+bool Context::VertexArrayKey::operator == (const VertexArrayKey& other) const
+{
+  return program == other.program &&
+         vertexBuffer == other.vertexBuffer &&
+         indexBuffer == other.indexBuffer &&
+         instanceBuffer == other.instanceBuffer;
+}
+
+bool Context::VertexArrayKey::references(const void* object) const
+{
+  return program == object ||
+         vertexBuffer == object ||
+         indexBuffer == object ||
+         instanceBuffer == object;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+size_t Context::VertexArrayKeyHash::operator () (const VertexArrayKey& key) const
+{
+  std::hash<const void*> hasher;
+
+  size_t hash = hasher(key.program);
+  hash = hash * 31 + hasher(key.vertexBuffer);
+  hash = hash * 31 + hasher(key.indexBuffer);
+  hash = hash * 31 + hasher(key.instanceBuffer);
+  return hash;
+}
+
+///////////////////////////////////////////////////////////////////////
+
 Context::~Context()
 {
   if (defaultFramebuffer)
@@ -724,6 +874,19 @@ Context::~Context()
   setCurrentIndexBuffer(NULL);
   setCurrentProgram(NULL);
 
+  // A context that failed to initialize has no vertex array to reset
+  if (currentVertexArray)
+    resetVertexArray();
+
+  for (auto a = vertexArrays.begin();  a != vertexArrays.end();  a++)
+    glDeleteVertexArrays(1, &a->second.arrayID);
+
+  if (commandBufferID)
+    glDeleteBuffers(1, &commandBufferID);
+
+  if (blockBufferID)
+    glDeleteBuffers(1, &blockBufferID);
+
   for (size_t i = 0;  i < textureUnits.size();  i++)
   {
     setActiveTextureUnit(i);
@@ -825,8 +988,9 @@ void Context::render(const PrimitiveRange& range)
 
   setCurrentVertexBuffer(range.getVertexBuffer());
   setCurrentIndexBuffer(range.getIndexBuffer());
+  setCurrentInstanceRange(VertexRange());
 
-  render(range.getType(), range.getStart(), range.getCount(), range.getBase());
+  draw(range.getType(), range.getStart(), range.getCount(), range.getBase(), 0);
 }
 
 void Context::render(PrimitiveType type,
@@ -834,78 +998,126 @@ void Context::render(PrimitiveType type,
                      uint count,
                      uint base)
 {
-  ProfileNodeCall call("GL::Context::render");
+  setCurrentInstanceRange(VertexRange());
 
-  if (!currentProgram)
+  draw(type, start, count, base, 0);
+}
+
+void Context::render(const PrimitiveRange& range, const VertexRange& instances)
+{
+  if (range.isEmpty())
   {
-    logError("Cannot render without a current shader program");
+    logWarning("Rendering empty primitive range with shader program \'%s\'",
+               currentProgram->getName().c_str());
     return;
   }
 
-  if (!currentVertexBuffer)
+  assert(instancingSupported);
+
+  if (!instances.getVertexBuffer() || !instances.getCount())
   {
-    logError("Cannot render without a current vertex buffer");
+    logWarning("Rendering empty instance range with shader program \'%s\'",
+               currentProgram->getName().c_str());
     return;
   }
 
-  if (dirtyBinding)
-  {
-    const VertexFormat& format = currentVertexBuffer->getFormat();
+  setCurrentVertexBuffer(range.getVertexBuffer());
+  setCurrentIndexBuffer(range.getIndexBuffer());
+  setCurrentInstanceRange(instances);
 
-    if (currentProgram->getAttributeCount() > format.getComponentCount())
-    {
-      logError("Shader program \'%s\' has more attributes than vertex format has components",
+  draw(range.getType(),
+       range.getStart(),
+       range.getCount(),
+       range.getBase(),
+       instances.getCount());
+}
+
+void Context::render(const PrimitiveRange& range, const mat4& instanceTransform)
+{
+  if (range.isEmpty())
+  {
+    logWarning("Rendering empty primitive range with shader program \'%s\'",
                currentProgram->getName().c_str());
-      return;
-    }
+    return;
+  }
 
-    for (size_t i = 0;  i < currentProgram->getAttributeCount();  i++)
-    {
-      Attribute& attribute = currentProgram->getAttribute(i);
+  // Disabled attribute arrays take the current generic attribute value, which
+  // is context state rather than part of any vertex array object
+  for (uint i = 0;  i < 4;  i++)
+  {
+    const int location = currentProgram->instanceLocations[i];
+    if (location != -1)
+      glVertexAttrib4fv(location, &instanceTransform[i][0]);
+  }
 
-      const VertexComponent* component = format.findComponent(attribute.getName().c_str());
-      if (!component)
-      {
-        logError("Attribute \'%s\' of program \'%s\' has no corresponding vertex format component",
-                 attribute.getName().c_str(),
-                 currentProgram->getName().c_str());
-        return;
-      }
+  render(range);
+}
 
-      if (!isCompatible(attribute, *component))
-      {
-        logError("Attribute \'%s\' of shader program \'%s\' has incompatible type",
-                 attribute.getName().c_str(),
-                 currentProgram->getName().c_str());
-        return;
-      }
+void Context::renderMultiple(PrimitiveType type,
+                             VertexBuffer& vertexBuffer,
+                             IndexBuffer& indexBuffer,
+                             const DrawCommand* commands,
+                             uint count,
+                             const VertexRange& instances)
+{
+  ProfileNodeCall call("GL::Context::renderMultiple");
 
-      attribute.bind(format.getSize(), component->getOffset());
-    }
+  assert(multiDrawSupported);
 
-    dirtyBinding = false;
+  if (!count)
+  {
+    logWarning("Rendering empty draw command list with shader program \'%s\'",
+               currentProgram->getName().c_str());
+    return;
   }
 
-#if WENDY_DEBUG
-  if (!currentProgram->isValid())
+  setCurrentVertexBuffer(&vertexBuffer);
+  setCurrentIndexBuffer(&indexBuffer);
+  setCurrentInstanceRange(instances);
+
+  if (!bindAttributes())
     return;
+
+  applySharedBlock();
+
+  if (!commandBufferID)
+    glGenBuffers(1, &commandBufferID);
+
+  // Respecifying the whole buffer lets the driver orphan the storage still
+  // used by earlier calls instead of waiting for them
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferID);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER,
+               sizeof(DrawCommand) * count,
+               commands,
+               GL_STREAM_DRAW);
+
+  multiDrawElementsIndirect(convertToGL(type),
+                            convertToGL(indexBuffer.getType()),
+                            NULL,
+                            count,
+                            0);
+
+#if WENDY_DEBUG
+  checkGL("Failed to render draw commands");
 #endif
 
-  if (currentIndexBuffer)
+  if (stats)
   {
-    const size_t size = IndexBuffer::getTypeSize(currentIndexBuffer->getType());
+    stats->addDrawCall();
 
-    glDrawElementsBaseVertex(convertToGL(type),
-                             count,
-                             convertToGL(currentIndexBuffer->getType()),
-                             (GLvoid*) (size * start),
-                             base);
+    for (uint i = 0;  i < count;  i++)
+      stats->addPrimitives(type, commands[i].count, commands[i].instanceCount);
   }
-  else
-    glDrawArrays(convertToGL(type), start, count);
+}
 
-  if (stats)
-    stats->addPrimitives(type, count);
+bool Context::isMultiDrawSupported() const
+{
+  return multiDrawSupported;
+}
+
+bool Context::isInstancingSupported() const
+{
+  return instancingSupported;
 }
 
 void Context::refresh()
@@ -951,7 +1163,8 @@ void Context::createSharedSampler(const char* name, SamplerType type, int ID)
   if (getSharedSamplerID(name, type) != INVALID_SHARED_STATE_ID)
     return;
 
-  declaration += format("uniform %s %s;\n", Sampler::getTypeName(type), name);
+  uniformDeclaration += format("uniform %s %s;\n", Sampler::getTypeName(type), name);
+  updateDeclaration();
 
   samplers.push_back(SharedSampler(name, type, ID));
 }
@@ -963,11 +1176,81 @@ void Context::createSharedUniform(const char* name, UniformType type, int ID)
   if (getSharedUniformID(name, type) != INVALID_SHARED_STATE_ID)
     return;
 
-  declaration += format("uniform %s %s;\n", Uniform::getTypeName(type), name);
+  uniformDeclaration += format("uniform %s %s;\n", Uniform::getTypeName(type), name);
+  updateDeclaration();
 
   uniforms.push_back(SharedUniform(name, type, ID));
 }
 
+void Context::createSharedBlockUniform(const char* name, UniformType type, int ID)
+{
+  assert(ID != INVALID_SHARED_STATE_ID);
+
+  if (getSharedUniformID(name, type) != INVALID_SHARED_STATE_ID)
+    return;
+
+  const size_t alignment = getBlockAlignment(type);
+
+  size_t offset = 0;
+
+  for (auto u = uniforms.begin();  u != uniforms.end();  u++)
+  {
+    if (u->offset != -1)
+      offset = max(offset, u->offset + getBlockSize(u->type));
+  }
+
+  offset = (offset + alignment - 1) & ~(alignment - 1);
+
+  // The size of a std140 block is rounded up to a multiple of a vec4
+  blockData.resize((offset + getBlockSize(type) + 15) & ~15, 0);
+  dirtyBlock = true;
+
+  blockDeclaration += format("  %s %s;\n", Uniform::getTypeName(type), name);
+  updateDeclaration();
+
+  if (blockMembers.size() <= size_t(ID))
+    blockMembers.resize(ID + 1, -1);
+
+  blockMembers[ID] = (int) uniforms.size();
+  uniforms.push_back(SharedUniform(name, type, ID, (int) offset));
+
+  // The new member has not been written by any state yet
+  blockState = NULL;
+}
+
+void Context::setSharedBlockUniform(int ID, const void* data, uint generation)
+{
+  if (ID < 0 || size_t(ID) >= blockMembers.size() || blockMembers[ID] == -1)
+  {
+    logError("Shared uniform %i is not a member of the shared uniform block", ID);
+    return;
+  }
+
+  SharedUniform& uniform = uniforms[blockMembers[ID]];
+
+  if (generation && uniform.generation == generation)
+    return;
+
+  const uint columnCount = getColumnCount(uniform.type);
+  const float* source = (const float*) data;
+
+  if (columnCount > 1)
+  {
+    // Matrices are square, and each column is padded to a vec4
+    for (uint i = 0;  i < columnCount;  i++)
+    {
+      std::memcpy(&blockData[uniform.offset + i * 16],
+                  source + i * columnCount,
+                  columnCount * sizeof(float));
+    }
+  }
+  else
+    std::memcpy(&blockData[uniform.offset], source, getBlockSize(uniform.type));
+
+  uniform.generation = generation;
+  dirtyBlock = true;
+}
+
 int Context::getSharedSamplerID(const char* name, SamplerType type) const
 {
   for (auto s = samplers.begin(); s != samplers.end(); s++)
@@ -1113,9 +1396,6 @@ void Context::setCurrentProgram(Program* newProgram)
 {
   if (newProgram != currentProgram)
   {
-    if (currentProgram)
-      currentProgram->unbind();
-
     currentProgram = newProgram;
     dirtyBinding = true;
 
@@ -1143,6 +1423,9 @@ void Context::setCurrentVertexBuffer(VertexBuffer* newVertexBuffer)
     else
       glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+    if (stats)
+      stats->addVertexBufferSwitch();
+
 #if WENDY_DEBUG
     if (!checkGL("Failed to make index buffer current"))
       return;
@@ -1162,11 +1445,22 @@ void Context::setCurrentIndexBuffer(IndexBuffer* newIndexBuffer)
     currentIndexBuffer = newIndexBuffer;
     dirtyBinding = true;
 
+    // The element array binding is part of the vertex array object state, so
+    // the cached object must not be bound while it is changed
+    if (currentVertexArray)
+    {
+      glBindVertexArray(0);
+      currentVertexArray = 0;
+    }
+
     if (currentIndexBuffer)
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, currentIndexBuffer->bufferID);
     else
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
+    if (stats)
+      stats->addIndexBufferSwitch();
+
 #if WENDY_DEBUG
     if (!checkGL("Failed to apply index buffer"))
       return;
@@ -1335,6 +1629,15 @@ Context::Context(ResourceCache& initCache):
   dirtyState(true),
   cullingInverted(false),
   activeTextureUnit(0),
+  currentInstanceStart(0),
+  currentVertexArray(0),
+  commandBufferID(0),
+  blockBufferID(0),
+  multiDrawSupported(false),
+  instancingSupported(false),
+  dirtyBlock(false),
+  blockState(NULL),
+  blockGeneration(0),
   stats(NULL)
 {
 }
@@ -1430,6 +1733,25 @@ bool Context::init(const WindowConfig& wc, const ContextConfig& cc)
       glDebugMessageCallbackARB(debugCallback, NULL);
       glDebugMessageControlARB(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
     }
+
+    instancingSupported = GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays;
+
+    if (!instancingSupported)
+      log("Instanced arrays not supported; instances will be drawn one at a time");
+
+    // Our version of GLEW predates multi-draw indirect, so load it manually
+    if (instancingSupported &&
+        glfwExtensionSupported("GL_ARB_multi_draw_indirect") &&
+        glfwExtensionSupported("GL_ARB_base_instance"))
+    {
+      multiDrawElementsIndirect = (MultiDrawElementsIndirectFunc)
+        glfwGetProcAddress("glMultiDrawElementsIndirect");
+
+      multiDrawSupported = multiDrawElementsIndirect != NULL;
+    }
+
+    if (!multiDrawSupported)
+      log("Multi-draw indirect not supported; draws will not be merged");
   }
 
   // All extensions are there; figure out their limits
@@ -1486,6 +1808,360 @@ bool Context::init(const WindowConfig& wc, const ContextConfig& cc)
   return true;
 }
 
+void Context::setCurrentInstanceRange(const VertexRange& newRange)
+{
+  if (newRange.getVertexBuffer() != currentInstanceBuffer ||
+      (currentInstanceBuffer && newRange.getStart() != currentInstanceStart))
+  {
+    currentInstanceBuffer = newRange.getVertexBuffer();
+    currentInstanceStart = newRange.getStart();
+    dirtyBinding = true;
+  }
+}
+
+bool Context::bindAttributes()
+{
+  if (!currentProgram)
+  {
+    logError("Cannot render without a current shader program");
+    return false;
+  }
+
+  if (!currentVertexBuffer)
+  {
+    logError("Cannot render without a current vertex buffer");
+    return false;
+  }
+
+  if (dirtyBinding)
+  {
+    VertexArrayKey key;
+    key.program = currentProgram;
+    key.vertexBuffer = currentVertexBuffer;
+    key.indexBuffer = currentIndexBuffer;
+    key.instanceBuffer = currentInstanceBuffer;
+
+    auto entry = vertexArrays.find(key);
+
+    if (entry != vertexArrays.end())
+    {
+      VertexArray* array = &entry->second;
+
+      glBindVertexArray(array->arrayID);
+      currentVertexArray = array->arrayID;
+
+      // Instance ranges move through their buffer from draw to draw, so only
+      // the instanced attribute pointers may need to be respecified
+      if (currentInstanceBuffer && array->instanceStart != currentInstanceStart)
+      {
+        specifyAttributes(true);
+        array->instanceStart = currentInstanceStart;
+      }
+
+      if (stats)
+        stats->addVertexArrayHit();
+    }
+    else
+    {
+      const VertexFormat& format = currentVertexBuffer->getFormat();
+
+      size_t componentCount = format.getComponentCount();
+      if (currentInstanceBuffer)
+        componentCount += currentInstanceBuffer->getFormat().getComponentCount();
+      else
+        componentCount += currentProgram->instanceAttributeCount;
+
+      if (currentProgram->getAttributeCount() > componentCount)
+      {
+        logError("Shader program '%s' has more attributes than vertex format has components",
+                 currentProgram->getName().c_str());
+        return false;
+      }
+
+      VertexArray newArray;
+      newArray.instanceStart = currentInstanceStart;
+      newArray.arrayID = 0;
+
+      glGenVertexArrays(1, &newArray.arrayID);
+      glBindVertexArray(newArray.arrayID);
+      currentVertexArray = newArray.arrayID;
+
+      if (currentIndexBuffer)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, currentIndexBuffer->bufferID);
+
+      if (!specifyAttributes(false))
+      {
+        resetVertexArray();
+        glDeleteVertexArrays(1, &newArray.arrayID);
+        return false;
+      }
+
+#if WENDY_DEBUG
+      if (!checkGL("Failed to create vertex array object for shader program '%s'",
+                   currentProgram->getName().c_str()))
+      {
+        resetVertexArray();
+        glDeleteVertexArrays(1, &newArray.arrayID);
+        return false;
+      }
+#endif
+
+      vertexArrays[key] = newArray;
+
+      if (stats)
+        stats->addVertexArrayMiss();
+    }
+
+    dirtyBinding = false;
+  }
+
+#if WENDY_DEBUG
+  if (!currentProgram->isValid())
+    return false;
+#endif
+
+  return true;
+}
+
+bool Context::specifyAttributes(bool instancesOnly)
+{
+  const VertexFormat& format = currentVertexBuffer->getFormat();
+
+  for (size_t i = 0;  i < currentProgram->getAttributeCount();  i++)
+  {
+    Attribute& attribute = currentProgram->getAttribute(i);
+
+    const VertexComponent* component = format.findComponent(attribute.getName().c_str());
+    if (component)
+    {
+      if (instancesOnly)
+        continue;
+
+      if (!isCompatible(attribute, *component))
+      {
+        logError("Attribute '%s' of shader program '%s' has incompatible type",
+                 attribute.getName().c_str(),
+                 currentProgram->getName().c_str());
+        return false;
+      }
+
+      glEnableVertexAttribArray(attribute.location);
+      attribute.bind(format.getSize(),
+                     component->getOffset(),
+                     component->getType());
+      continue;
+    }
+
+    if (currentInstanceBuffer)
+    {
+      const VertexFormat& instanceFormat = currentInstanceBuffer->getFormat();
+
+      component = instanceFormat.findComponent(attribute.getName().c_str());
+      if (component)
+      {
+        if (!isCompatible(attribute, *component))
+        {
+          logError("Instance attribute '%s' of shader program '%s' has incompatible type",
+                   attribute.getName().c_str(),
+                   currentProgram->getName().c_str());
+          return false;
+        }
+
+        if (!instancesOnly)
+        {
+          glEnableVertexAttribArray(attribute.location);
+
+          if (GLEW_VERSION_3_3)
+            glVertexAttribDivisor(attribute.location, 1);
+          else
+            glVertexAttribDivisorARB(attribute.location, 1);
+        }
+
+        // The attribute pointer captures the buffer bound at the time of the
+        // call, so the instance buffer only needs to be bound temporarily
+        glBindBuffer(GL_ARRAY_BUFFER, currentInstanceBuffer->bufferID);
+        attribute.bind(instanceFormat.getSize(),
+                       instanceFormat.getSize() * currentInstanceStart +
+                       component->getOffset(),
+                       component->getType());
+        glBindBuffer(GL_ARRAY_BUFFER, currentVertexBuffer->bufferID);
+        continue;
+      }
+    }
+
+    // Without an instance range, instance attributes keep the generic value
+    // set by the single instance fallback
+    if (!currentInstanceBuffer && currentProgram->isInstanceAttribute(attribute))
+      continue;
+
+    logError("Attribute '%s' of program '%s' has no corresponding vertex format component",
+             attribute.getName().c_str(),
+             currentProgram->getName().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void Context::applySharedBlock()
+{
+  if (!currentProgram->sharedBlock)
+    return;
+
+  if (!currentSharedState)
+  {
+    logError("Program \'%s\' uses the shared uniform block without a current shared program state",
+             currentProgram->getName().c_str());
+  }
+  else if (currentSharedState != blockState ||
+           currentSharedState->getBlockGeneration() != blockGeneration)
+  {
+    currentSharedState->updateBlock(*this);
+
+    blockState = currentSharedState;
+    blockGeneration = currentSharedState->getBlockGeneration();
+  }
+
+  if (!dirtyBlock)
+  {
+    if (stats)
+      stats->addSkippedUniformUpload();
+
+    return;
+  }
+
+  if (!blockBufferID)
+    glGenBuffers(1, &blockBufferID);
+
+  // Respecifying the whole buffer lets the driver orphan the storage still
+  // used by earlier draws instead of waiting for them
+  glBindBuffer(GL_UNIFORM_BUFFER, blockBufferID);
+  glBufferData(GL_UNIFORM_BUFFER, blockData.size(), &blockData[0], GL_STREAM_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, SHARED_BLOCK_BINDING, blockBufferID);
+
+#if WENDY_DEBUG
+  checkGL("Failed to update shared uniform block");
+#endif
+
+  dirtyBlock = false;
+
+  if (stats)
+    stats->addUniformUpload();
+}
+
+int Context::getSharedBlockOffset(const char* name) const
+{
+  for (auto u = uniforms.begin();  u != uniforms.end();  u++)
+  {
+    if (u->offset != -1 && u->name == name)
+      return u->offset;
+  }
+
+  return -1;
+}
+
+void Context::updateDeclaration()
+{
+  declaration = uniformDeclaration;
+
+  if (!blockDeclaration.empty())
+  {
+    declaration += format("layout(std140) uniform %s\n{\n", SHARED_BLOCK_NAME);
+    declaration += blockDeclaration;
+    declaration += "};\n";
+  }
+}
+
+void Context::resetVertexArray()
+{
+  glBindVertexArray(0);
+  currentVertexArray = 0;
+  dirtyBinding = true;
+
+  // The default vertex array object has its own element array binding
+  if (currentIndexBuffer)
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, currentIndexBuffer->bufferID);
+  else
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Context::removeVertexArrays(const void* object)
+{
+  auto a = vertexArrays.begin();
+
+  while (a != vertexArrays.end())
+  {
+    if (a->first.references(object))
+    {
+      if (a->second.arrayID == currentVertexArray)
+        resetVertexArray();
+
+      glDeleteVertexArrays(1, &a->second.arrayID);
+      a = vertexArrays.erase(a);
+    }
+    else
+      a++;
+  }
+}
+
+void Context::draw(PrimitiveType type,
+                   uint start,
+                   uint count,
+                   uint base,
+                   uint instanceCount)
+{
+  ProfileNodeCall call("GL::Context::render");
+
+  if (!bindAttributes())
+    return;
+
+  applySharedBlock();
+
+  if (instanceCount)
+  {
+    if (currentIndexBuffer)
+    {
+      const size_t size = IndexBuffer::getTypeSize(currentIndexBuffer->getType());
+
+      glDrawElementsInstancedBaseVertex(convertToGL(type),
+                                        count,
+                                        convertToGL(currentIndexBuffer->getType()),
+                                        (GLvoid*) (size * start),
+                                        instanceCount,
+                                        base);
+    }
+    else
+      glDrawArraysInstanced(convertToGL(type), start, count, instanceCount);
+
+    if (stats)
+    {
+      stats->addDrawCall();
+      stats->addPrimitives(type, count, instanceCount);
+    }
+  }
+  else
+  {
+    if (currentIndexBuffer)
+    {
+      const size_t size = IndexBuffer::getTypeSize(currentIndexBuffer->getType());
+
+      glDrawElementsBaseVertex(convertToGL(type),
+                               count,
+                               convertToGL(currentIndexBuffer->getType()),
+                               (GLvoid*) (size * start),
+                               base);
+    }
+    else
+      glDrawArrays(convertToGL(type), start, count);
+
+    if (stats)
+    {
+      stats->addDrawCall();
+      stats->addPrimitives(type, count);
+    }
+  }
+}
+
 void Context::applyState(const RenderState& newState)
 {
   if (stats)
@@ -124,6 +124,10 @@ GLenum convertToGL(VertexComponent::Type type)
   {
     case VertexComponent::FLOAT32:
       return GL_FLOAT;
+    case VertexComponent::FLOAT16:
+      return GL_HALF_FLOAT;
+    case VertexComponent::SNORM16:
+      return GL_SHORT;
   }
 
   panic("Invalid vertex component type %u", type);
@@ -54,19 +54,13 @@ namespace wendy
 namespace
 {
 
-GLenum getElementType(AttributeType type)
+const char* instanceAttributeNames[] =
 {
-  switch (type)
-  {
-    case ATTRIBUTE_FLOAT:
-    case ATTRIBUTE_VEC2:
-    case ATTRIBUTE_VEC3:
-    case ATTRIBUTE_VEC4:
-      return GL_FLOAT;
-  }
-
-  panic("Invalid GLSL attribute type %u", type);
-}
+  "wyInstanceM0",
+  "wyInstanceM1",
+  "wyInstanceM2",
+  "wyInstanceM3"
+};
 
 bool isSupportedAttributeType(GLenum type)
 {
@@ -420,12 +414,12 @@ uint Attribute::getElementCount() const
   panic("Invalid GLSL attribute type %u", type);
 }
 
-void Attribute::bind(size_t stride, size_t offset)
+void Attribute::bind(size_t stride, size_t offset, VertexComponent::Type type)
 {
   glVertexAttribPointer(location,
                         getElementCount(),
-                        getElementType(type),
-                        GL_FALSE,
+                        convertToGL(type),
+                        type == VertexComponent::SNORM16,
                         stride,
                         (const void*) offset);
 
@@ -453,9 +447,23 @@ const char* Attribute::getTypeName(AttributeType type)
 
 ///////////////////////////////////////////////////////////////////////
 
-void Sampler::bind(uint unit)
+void Sampler::bind(uint newUnit)
 {
-  glUniform1i(location, unit);
+  Stats* stats = context->getStats();
+
+  if (unit == int(newUnit))
+  {
+    if (stats)
+      stats->addSkippedUniformUpload();
+
+    return;
+  }
+
+  glUniform1i(location, newUnit);
+  unit = newUnit;
+
+  if (stats)
+    stats->addUniformUpload();
 
 #if WENDY_DEBUG
   checkGL("Failed to set sampler \'%s\'", name.c_str());
@@ -487,6 +495,12 @@ int Sampler::getSharedID() const
   return sharedID;
 }
 
+Sampler::Sampler():
+  unit(-1),
+  context(NULL)
+{
+}
+
 const char* Sampler::getTypeName(SamplerType type)
 {
   switch (type)
@@ -510,34 +524,41 @@ const char* Sampler::getTypeName(SamplerType type)
 
 void Uniform::copyFrom(const void* data)
 {
-  switch (type)
+  Stats* stats = context->getStats();
+
+  const size_t size = getElementCount() * sizeof(float);
+
+  generation = 0;
+
+  if (cached && std::memcmp(cache, data, size) == 0)
   {
-    case UNIFORM_FLOAT:
-      glUniform1fv(location, 1, (const float*) data);
-      break;
-    case UNIFORM_VEC2:
-      glUniform2fv(location, 1, (const float*) data);
-      break;
-    case UNIFORM_VEC3:
-      glUniform3fv(location, 1, (const float*) data);
-      break;
-    case UNIFORM_VEC4:
-      glUniform4fv(location, 1, (const float*) data);
-      break;
-    case UNIFORM_MAT2:
-      glUniformMatrix2fv(location, 1, GL_FALSE, (const float*) data);
-      break;
-    case UNIFORM_MAT3:
-      glUniformMatrix3fv(location, 1, GL_FALSE, (const float*) data);
-      break;
-    case UNIFORM_MAT4:
-      glUniformMatrix4fv(location, 1, GL_FALSE, (const float*) data);
-      break;
+    if (stats)
+      stats->addSkippedUniformUpload();
+
+    return;
   }
 
-#if WENDY_DEBUG
-  checkGL("Failed to set uniform \'%s\'", name.c_str());
-#endif
+  upload(data);
+
+  std::memcpy(cache, data, size);
+  cached = true;
+
+  if (stats)
+    stats->addUniformUpload();
+}
+
+void Uniform::copyFrom(const void* data, uint newGeneration)
+{
+  if (generation && generation == newGeneration)
+  {
+    if (Stats* stats = context->getStats())
+      stats->addSkippedUniformUpload();
+
+    return;
+  }
+
+  copyFrom(data);
+  generation = newGeneration;
 }
 
 bool Uniform::operator == (const char* string) const
@@ -609,6 +630,45 @@ int Uniform::getSharedID() const
   return sharedID;
 }
 
+Uniform::Uniform():
+  cached(false),
+  generation(0),
+  context(NULL)
+{
+}
+
+void Uniform::upload(const void* data)
+{
+  switch (type)
+  {
+    case UNIFORM_FLOAT:
+      glUniform1fv(location, 1, (const float*) data);
+      break;
+    case UNIFORM_VEC2:
+      glUniform2fv(location, 1, (const float*) data);
+      break;
+    case UNIFORM_VEC3:
+      glUniform3fv(location, 1, (const float*) data);
+      break;
+    case UNIFORM_VEC4:
+      glUniform4fv(location, 1, (const float*) data);
+      break;
+    case UNIFORM_MAT2:
+      glUniformMatrix2fv(location, 1, GL_FALSE, (const float*) data);
+      break;
+    case UNIFORM_MAT3:
+      glUniformMatrix3fv(location, 1, GL_FALSE, (const float*) data);
+      break;
+    case UNIFORM_MAT4:
+      glUniformMatrix4fv(location, 1, GL_FALSE, (const float*) data);
+      break;
+  }
+
+#if WENDY_DEBUG
+  checkGL("Failed to set uniform \'%s\'", name.c_str());
+#endif
+}
+
 const char* Uniform::getTypeName(UniformType type)
 {
   switch (type)
@@ -636,6 +696,8 @@ const char* Uniform::getTypeName(UniformType type)
 
 Program::~Program()
 {
+  context.removeVertexArrays(this);
+
   if (programID)
     glDeleteProgram(programID);
 
@@ -643,6 +705,11 @@ Program::~Program()
     stats->removeProgram();
 }
 
+bool Program::isInstanced() const
+{
+  return instanceAttributeCount > 0;
+}
+
 Attribute* Program::findAttribute(const char* name)
 {
   auto a = std::find(attributes.begin(), attributes.end(), name);
@@ -795,8 +862,12 @@ Ref<Program> Program::read(Context& context,
 Program::Program(const ResourceInfo& info, Context& initContext):
   Resource(info),
   context(initContext),
-  programID(0)
+  programID(0),
+  sharedBlock(false),
+  instanceAttributeCount(0)
 {
+  std::fill(instanceLocations, instanceLocations + 4, -1);
+
   if (Stats* stats = context.getStats())
     stats->addProgram();
 }
@@ -840,6 +911,12 @@ bool Program::init(Shader& initVertexShader, Shader& initFragmentShader)
   glAttachShader(programID, vertexShader->shaderID);
   glAttachShader(programID, fragmentShader->shaderID);
 
+  for (GLuint i = 0;  i < FRAGMENT_OUTPUT_COUNT;  i++)
+  {
+    const String name = format("%s%u", FRAGMENT_OUTPUT_PREFIX, i);
+    glBindFragDataLocation(programID, i, name.c_str());
+  }
+
   glLinkProgram(programID);
 
   const String infoLog = getInfoLog();
@@ -874,6 +951,48 @@ bool Program::init(Shader& initVertexShader, Shader& initFragmentShader)
   return true;
 }
 
+bool Program::retrieveSharedBlock(uint blockIndex, int maxNameLength)
+{
+  GLint memberCount;
+  glGetActiveUniformBlockiv(programID, blockIndex,
+                            GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS,
+                            &memberCount);
+  if (!memberCount)
+    return true;
+
+  std::vector<GLint> indices(memberCount);
+  glGetActiveUniformBlockiv(programID, blockIndex,
+                            GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES,
+                            &indices[0]);
+
+  std::vector<GLint> offsets(memberCount);
+  glGetActiveUniformsiv(programID, memberCount,
+                        (const GLuint*) &indices[0],
+                        GL_UNIFORM_OFFSET,
+                        &offsets[0]);
+
+  std::vector<char> memberName(maxNameLength + 1);
+
+  // The context writes the whole block from a single copy, so the layout
+  // chosen by the driver must match the one it computed
+  for (int i = 0;  i < memberCount;  i++)
+  {
+    glGetActiveUniformName(programID, indices[i],
+                           maxNameLength + 1, NULL,
+                           &memberName[0]);
+
+    if (context.getSharedBlockOffset(&memberName[0]) != offsets[i])
+    {
+      logError("Shared uniform block member \'%s\' of program \'%s\' is not at its shared offset",
+               &memberName[0],
+               getName().c_str());
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool Program::retrieveUniforms()
 {
   GLint uniformCount;
@@ -886,12 +1005,32 @@ bool Program::retrieveUniforms()
 
   char* uniformName = new char [maxNameLength + 1];
 
+  const GLuint blockIndex = glGetUniformBlockIndex(programID, SHARED_BLOCK_NAME);
+  if (blockIndex != GL_INVALID_INDEX)
+  {
+    if (!retrieveSharedBlock(blockIndex, maxNameLength))
+    {
+      delete [] uniformName;
+      return false;
+    }
+
+    glUniformBlockBinding(programID, blockIndex, SHARED_BLOCK_BINDING);
+    sharedBlock = true;
+  }
+
   for (int i = 0;  i < uniformCount;  i++)
   {
     GLsizei nameLength;
     GLint uniformSize;
     GLenum uniformType;
 
+    // Members of uniform blocks are backed by buffers, not program state
+    const GLuint index = i;
+    GLint uniformBlockIndex;
+    glGetActiveUniformsiv(programID, 1, &index, GL_UNIFORM_BLOCK_INDEX, &uniformBlockIndex);
+    if (uniformBlockIndex != -1)
+      continue;
+
     glGetActiveUniform(programID,
                        i,
                        maxNameLength + 1,
@@ -916,6 +1055,7 @@ bool Program::retrieveUniforms()
       uniform.type = convertUniformType(uniformType);
       uniform.location = glGetUniformLocation(programID, uniformName);
       uniform.sharedID = context.getSharedUniformID(uniform.name.c_str(), uniform.type);
+      uniform.context = &context;
     }
     else if (isSupportedSamplerType(uniformType))
     {
@@ -925,6 +1065,7 @@ bool Program::retrieveUniforms()
       sampler.type = convertSamplerType(uniformType);
       sampler.location = glGetUniformLocation(programID, uniformName);
       sampler.sharedID = context.getSharedSamplerID(sampler.name.c_str(), sampler.type);
+      sampler.context = &context;
     }
     else
       logWarning("Skipping uniform \'%s\' of unsupported type", uniformName);
@@ -982,6 +1123,27 @@ bool Program::retrieveAttributes()
 
   delete [] attributeName;
 
+  // The instance attributes are looked up here once, as the renderers check
+  // for them on every operation
+  for (uint i = 0;  i < 4;  i++)
+  {
+    const Attribute* attribute = findAttribute(instanceAttributeNames[i]);
+    if (!attribute)
+      continue;
+
+    if (attribute->getType() != ATTRIBUTE_VEC4)
+    {
+      logError("Instance attribute \'%s\' of program \'%s\' must be of type %s",
+               attribute->getName().c_str(),
+               getName().c_str(),
+               Attribute::getTypeName(ATTRIBUTE_VEC4));
+      return false;
+    }
+
+    instanceLocations[i] = attribute->location;
+    instanceAttributeCount++;
+  }
+
   if (!checkGL("Failed to retrieve attributes for program \'%s\'",
                getName().c_str()))
   {
@@ -994,20 +1156,21 @@ bool Program::retrieveAttributes()
 void Program::bind()
 {
   glUseProgram(programID);
-
-  for (auto a = attributes.begin();  a != attributes.end();  a++)
-    glEnableVertexAttribArray(a->location);
 }
 
-void Program::unbind()
+Program& Program::operator = (const Program& source)
 {
-  for (auto a = attributes.begin();  a != attributes.end();  a++)
-    glDisableVertexAttribArray(a->location);
+  return *this;
 }
 
-Program& Program::operator = (const Program& source)
+bool Program::isInstanceAttribute(const Attribute& attribute) const
 {
-  return *this;
+  if (attribute.location == -1)
+    return false;
+
+  return std::find(instanceLocations,
+                   instanceLocations + 4,
+                   attribute.location) != instanceLocations + 4;
 }
 
 bool Program::isValid() const
@@ -1202,7 +1365,7 @@ bool ProgramInterface::matches(const VertexFormat& format, bool verbose) const
     if (!component)
       return false;
 
-    if (component->getType() != VertexComponent::FLOAT32)
+    if (!component->isReadAsFloat())
       return false;
 
     if ((component->getElementCount() == 1 && a->second != ATTRIBUTE_FLOAT) ||
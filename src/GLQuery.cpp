@@ -27,6 +27,8 @@
 
 #include <wendy/GLTexture.h>
 #include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
 #include <wendy/GLQuery.h>
 
 #define GLEW_STATIC
@@ -68,6 +70,9 @@ void OcclusionQuery::begin()
 
   active = true;
 
+  if (Stats* stats = context.getStats())
+    stats->addOcclusionQuery();
+
 #if WENDY_DEBUG
   checkGL("OpenGL error during occlusion query begin");
 #endif
@@ -119,6 +124,16 @@ uint OcclusionQuery::getResult() const
     return 0;
   }
 
+  if (Stats* stats = context.getStats())
+  {
+    // Reading a result that is not yet available blocks until the GPU has
+    // caught up with this query
+    int available;
+    glGetQueryObjectiv(queryID, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      stats->addOcclusionQueryStall();
+  }
+
   uint result;
   glGetQueryObjectuiv(queryID, GL_QUERY_RESULT, &result);
 
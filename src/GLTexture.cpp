@@ -628,6 +628,32 @@ Ref<Texture> Texture::read(Context& context,
   return create(ResourceInfo(cache, name), context, params, *data);
 }
 
+ResourceLoader::JobID Texture::readAsync(ResourceLoader& loader,
+                                         Context& context,
+                                         const TextureParams& params,
+                                         const String& imageName,
+                                         const std::function<void (Texture&)>& callback)
+{
+  ResourceLoader::JobList dependencies;
+  dependencies.push_back(loader.prefetch<Image>(imageName));
+
+  // The image is now decoded and cached, so reading only creates the texture
+
+  auto finish = [&context, params, imageName, callback](Resource*) -> bool
+  {
+    Ref<Texture> texture = read(context, params, imageName);
+    if (!texture)
+      return false;
+
+    if (callback)
+      callback(*texture);
+
+    return true;
+  };
+
+  return loader.addJob(ResourceLoader::DecodeFunc(), finish, dependencies);
+}
+
 Texture::Texture(const ResourceInfo& info, Context& initContext):
   Resource(info),
   context(initContext),
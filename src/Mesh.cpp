@@ -32,11 +32,32 @@
 #include <wendy/Resource.h>
 #include <wendy/Mesh.h>
 
+#include <algorithm>
 #include <limits>
+#include <thread>
+#include <unordered_map>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <cctype>
 
+#if WENDY_HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#if WENDY_HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#if WENDY_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if WENDY_HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #include <glm/gtx/compatibility.hpp>
 #include <glm/gtx/epsilon.hpp>
 
@@ -50,6 +71,50 @@ namespace wendy
 namespace
 {
 
+// Vertex attributes are welded by quantizing them to a grid with cells the
+// size of the welding epsilon and hashing the resulting integer keys, so
+// attributes falling into the same cell are considered equal
+
+template <size_t N>
+struct WeldKey
+{
+  bool operator == (const WeldKey& other) const;
+  int64 values[N];
+};
+
+template <size_t N>
+bool WeldKey<N>::operator == (const WeldKey& other) const
+{
+  return std::memcmp(values, other.values, sizeof(values)) == 0;
+}
+
+template <size_t N>
+struct WeldKeyHash
+{
+  size_t operator () (const WeldKey<N>& key) const;
+};
+
+template <size_t N>
+size_t WeldKeyHash<N>::operator () (const WeldKey<N>& key) const
+{
+  // FNV-1a over the quantized values
+
+  uint64 hash = 14695981039346656037ull;
+
+  for (size_t i = 0;  i < N;  i++)
+  {
+    hash ^= uint64(key.values[i]);
+    hash *= 1099511628211ull;
+  }
+
+  return size_t(hash ^ (hash >> 32));
+}
+
+inline int64 quantize(float value, float epsilon)
+{
+  return int64(std::floor(value / epsilon + 0.5f));
+}
+
 class VertexTool
 {
 public:
@@ -79,11 +144,21 @@ private:
     std::vector<VertexLayer> layers;
   };
   typedef std::vector<Vertex> VertexList;
+  typedef WeldKey<6> LayerKey;
+  typedef WeldKey<3> TexcoordKey;
+  LayerKey createLayerKey(uint32 vertexIndex,
+                          const vec3& normal,
+                          const vec2& texcoord) const;
+  TexcoordKey createTexcoordKey(uint32 vertexIndex, const vec2& texcoord) const;
   VertexList vertices;
+  std::unordered_map<LayerKey, uint32, WeldKeyHash<6>> layerIndices;
+  std::unordered_map<TexcoordKey, uint32, WeldKeyHash<3>> texcoordIndices;
   uint32 targetCount;
   NormalMode mode;
 };
 
+const float VERTEX_TOOL_EPSILON = 0.001f;
+
 VertexTool::VertexTool():
   targetCount(0),
   mode(PRESERVE_NORMALS)
@@ -99,6 +174,10 @@ VertexTool::VertexTool(const Mesh::VertexList& initVertices):
 
 void VertexTool::importPositions(const Mesh::VertexList& initVertices)
 {
+  layerIndices.clear();
+  texcoordIndices.clear();
+  targetCount = 0;
+
   vertices.resize(initVertices.size());
   for (size_t i = 0;  i < vertices.size();  i++)
     vertices[i].position = initVertices[i].position;
@@ -108,57 +187,57 @@ uint32 VertexTool::addAttributeLayer(uint32 vertexIndex,
                                      const vec3& normal,
                                      const vec2& texcoord)
 {
-  Vertex& vertex = vertices[vertexIndex];
+  // Non-finite attributes never compare equal to anything, so they always
+  // get a layer of their own
 
-  if (mode == PRESERVE_NORMALS)
-  {
-    for (auto l = vertex.layers.begin();  l != vertex.layers.end();  l++)
-    {
-      if (all(equalEpsilon(l->normal, normal, 0.001f)) &&
-          all(equalEpsilon(l->texcoord, texcoord, 0.001f)))
-      {
-        return l->index;
-      }
-    }
+  const bool finiteNormal = all(isfinite(normal));
+  const bool finiteTexcoord = all(isfinite(texcoord));
 
-    vertex.layers.push_back(VertexLayer());
-    VertexLayer& layer = vertex.layers.back();
+  LayerKey layerKey;
 
-    layer.normal = normal;
-    layer.texcoord = texcoord;
-    layer.index = targetCount++;
+  if (finiteNormal && finiteTexcoord)
+  {
+    layerKey = createLayerKey(vertexIndex, normal, texcoord);
 
-    return layer.index;
+    auto existing = layerIndices.find(layerKey);
+    if (existing != layerIndices.end())
+      return existing->second;
   }
+
+  uint32 index;
+
+  if (mode == PRESERVE_NORMALS || !finiteTexcoord)
+    index = targetCount++;
   else
   {
-    size_t index;
-    bool discontinuous = true;
+    // Layers with the same texture coordinate share a target vertex, as its
+    // normal will be the sum of theirs
 
-    for (auto l = vertex.layers.begin();  l != vertex.layers.end();  l++)
-    {
-      if (all(equalEpsilon(l->texcoord, texcoord, 0.001f)))
-      {
-        if (all(equalEpsilon(l->normal, normal, 0.001f)))
-          return l->index;
+    const TexcoordKey texcoordKey = createTexcoordKey(vertexIndex, texcoord);
 
-        discontinuous = false;
-        index = l->index;
-      }
+    auto shared = texcoordIndices.find(texcoordKey);
+    if (shared == texcoordIndices.end())
+    {
+      index = targetCount++;
+      texcoordIndices[texcoordKey] = index;
     }
+    else
+      index = shared->second;
+  }
 
-    if (discontinuous)
-      index = targetCount++;
+  Vertex& vertex = vertices[vertexIndex];
 
-    vertex.layers.push_back(VertexLayer());
-    VertexLayer& layer = vertex.layers.back();
+  vertex.layers.push_back(VertexLayer());
+  VertexLayer& layer = vertex.layers.back();
 
-    layer.normal = normal;
-    layer.texcoord = texcoord;
-    layer.index = index;
+  layer.normal = normal;
+  layer.texcoord = texcoord;
+  layer.index = index;
 
-    return index;
-  }
+  if (finiteNormal && finiteTexcoord)
+    layerIndices[layerKey] = index;
+
+  return index;
 }
 
 void VertexTool::realizeVertices(Mesh::VertexList& result) const
@@ -195,6 +274,30 @@ void VertexTool::setNormalMode(NormalMode newMode)
   mode = newMode;
 }
 
+VertexTool::LayerKey VertexTool::createLayerKey(uint32 vertexIndex,
+                                                const vec3& normal,
+                                                const vec2& texcoord) const
+{
+  LayerKey key;
+  key.values[0] = vertexIndex;
+  key.values[1] = quantize(normal.x, VERTEX_TOOL_EPSILON);
+  key.values[2] = quantize(normal.y, VERTEX_TOOL_EPSILON);
+  key.values[3] = quantize(normal.z, VERTEX_TOOL_EPSILON);
+  key.values[4] = quantize(texcoord.x, VERTEX_TOOL_EPSILON);
+  key.values[5] = quantize(texcoord.y, VERTEX_TOOL_EPSILON);
+  return key;
+}
+
+VertexTool::TexcoordKey VertexTool::createTexcoordKey(uint32 vertexIndex,
+                                                      const vec2& texcoord) const
+{
+  TexcoordKey key;
+  key.values[0] = vertexIndex;
+  key.values[1] = quantize(texcoord.x, VERTEX_TOOL_EPSILON);
+  key.values[2] = quantize(texcoord.y, VERTEX_TOOL_EPSILON);
+  return key;
+}
+
 struct Triplet
 {
   uint32 vertex;
@@ -215,47 +318,1474 @@ struct FaceGroup
   String name;
 };
 
-} /*namespace*/
+const size_t OBJ_MIN_CHUNK_SIZE = 1 << 20;
 
-///////////////////////////////////////////////////////////////////////
+struct FaceRun
+{
+  FaceRun();
+  FaceList faces;
+  String name;
+  bool named;
+  uint firstLine;
+};
 
-void MeshTriangle::setIndices(uint32 a, uint32 b, uint32 c)
+FaceRun::FaceRun():
+  named(false),
+  firstLine(0)
 {
-  indices[0] = a;
-  indices[1] = b;
-  indices[2] = c;
 }
 
-///////////////////////////////////////////////////////////////////////
+struct ObjWarning
+{
+  String command;
+  uint line;
+};
 
-Mesh::Mesh(const ResourceInfo& info):
-  Resource(info)
+// A chunk of lines of an OBJ file and the data parsed from it
+//
+// Face indices in OBJ files are absolute, so chunks can be parsed
+// independently.  The faces of a chunk are kept in runs, each started by a
+// 'usemtl' command, except for the first run which continues the group that
+// was current at the end of the previous chunk.  Line numbers are relative
+// to the start of the chunk.
+
+struct ObjChunk
+{
+  ObjChunk();
+  const char* start;
+  const char* end;
+  std::vector<vec3> positions;
+  std::vector<vec3> normals;
+  std::vector<vec2> texcoords;
+  std::vector<FaceRun> runs;
+  std::vector<ObjWarning> warnings;
+  String error;
+  uint errorLine;
+  uint lineCount;
+  bool failed;
+};
+
+ObjChunk::ObjChunk():
+  start(NULL),
+  end(NULL),
+  errorLine(0),
+  lineCount(0),
+  failed(false)
 {
 }
 
-void Mesh::mergeSections(const char* materialName)
+const double powersOfTen[] =
 {
-  sections[0].materialName = materialName;
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-  for (size_t i = 1;  i < sections.size();  i++)
+inline bool isSpace(char c)
+{
+  return std::isspace((unsigned char) c) != 0;
+}
+
+inline bool isDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+inline void skipSpace(const char** text, const char* end)
+{
+  while (*text < end && isSpace(**text))
+    (*text)++;
+}
+
+// Copies the remainder of the line into a terminated buffer, for handing
+// the cases the fast paths below do not handle to the C library
+
+const char* copyToken(char* buffer, size_t size, const char* text, const char* end)
+{
+  const size_t length = std::min(size_t(end - text), size - 1);
+  std::memcpy(buffer, text, length);
+  buffer[length] = '\0';
+  return buffer;
+}
+
+bool matches(const char* token, size_t length, const char* literal)
+{
+  return std::strlen(literal) == length && std::memcmp(token, literal, length) == 0;
+}
+
+const char* parseName(const char** text, const char* end, size_t* length)
+{
+  skipSpace(text, end);
+
+  const char* name = *text;
+
+  while (*text < end && (std::isalnum((unsigned char) **text) || **text == '_'))
+    (*text)++;
+
+  *length = *text - name;
+  if (!*length)
+    throw Exception("Expected but missing name");
+
+  return name;
+}
+
+int parseInteger(const char** text, const char* end)
+{
+  skipSpace(text, end);
+
+  const char* c = *text;
+  bool negative = false;
+
+  if (c < end && (*c == '-' || *c == '+'))
+    negative = (*c++ == '-');
+
+  // Take the fast path only for plain decimal integers that fit in an int
+
+  const char* digits = c;
+  int64 value = 0;
+
+  while (c < end && isDigit(*c) && c - digits < 10)
+    value = value * 10 + (*c++ - '0');
+
+  const bool octalOrHex = c - digits > 1 && *digits == '0';
+
+  if (c > digits && !octalOrHex && value <= INT_MAX &&
+      (c == end || (!isDigit(*c) && *c != 'x' && *c != 'X')))
   {
-    sections[0].triangles.insert(sections[0].triangles.end(),
-                                 sections[i].triangles.begin(),
-                                 sections[i].triangles.end());
+    *text = c;
+    return int(negative ? -value : value);
   }
 
-  sections.resize(1);
+  char buffer[64];
+  const char* token = copyToken(buffer, sizeof(buffer), *text, end);
+
+  char* tokenEnd;
+
+  const int result = std::strtol(token, &tokenEnd, 0);
+  if (tokenEnd == token)
+    throw Exception("Expected but missing integer value");
+
+  *text += tokenEnd - token;
+  return result;
 }
 
-MeshSection* Mesh::findSection(const char* materialName)
+float parseFloat(const char** text, const char* end)
 {
-  for (auto s = sections.begin();  s != sections.end();  s++)
+  skipSpace(text, end);
+
+  const char* c = *text;
+  bool negative = false;
+
+  if (c < end && (*c == '-' || *c == '+'))
+    negative = (*c++ == '-');
+
+  // Take the fast path only where the result is exactly what the C library
+  // would produce, i.e. where both the mantissa and the power of ten are
+  // exactly representable as doubles
+
+  uint64 mantissa = 0;
+  int significant = 0;
+  int exponent = 0;
+  bool any = false;
+
+  while (c < end && isDigit(*c))
   {
-    if (s->materialName == materialName)
-      return &(*s);
+    if (mantissa || *c != '0')
+    {
+      mantissa = mantissa * 10 + (*c - '0');
+      significant++;
+    }
+
+    any = true;
+    c++;
+  }
+
+  if (c < end && *c == '.')
+  {
+    c++;
+
+    while (c < end && isDigit(*c))
+    {
+      if (mantissa || *c != '0')
+      {
+        mantissa = mantissa * 10 + (*c - '0');
+        significant++;
+      }
+
+      exponent--;
+      any = true;
+      c++;
+    }
+  }
+
+  bool exact = any && significant <= 15;
+
+  if (exact && c < end && (*c == 'e' || *c == 'E'))
+  {
+    const char* e = c + 1;
+    bool negativeExponent = false;
+
+    if (e < end && (*e == '-' || *e == '+'))
+      negativeExponent = (*e++ == '-');
+
+    int value = 0;
+    const char* digits = e;
+
+    while (e < end && isDigit(*e) && e - digits < 4)
+      value = value * 10 + (*e++ - '0');
+
+    if (e == digits || (e < end && isDigit(*e)))
+      exact = false;
+    else
+    {
+      exponent += negativeExponent ? -value : value;
+      c = e;
+    }
+  }
+
+  if (exact && c < end && (std::isalpha((unsigned char) *c) || *c == '.'))
+    exact = false;
+
+  if (exact && mantissa && (exponent < -22 || exponent > 22))
+    exact = false;
+
+  if (exact)
+  {
+    double value = double(mantissa);
+
+    if (mantissa)
+    {
+      if (exponent < 0)
+        value /= powersOfTen[-exponent];
+      else
+        value *= powersOfTen[exponent];
+    }
+
+    *text = c;
+    return float(negative ? -value : value);
+  }
+
+  char buffer[128];
+  const char* token = copyToken(buffer, sizeof(buffer), *text, end);
+
+  char* tokenEnd;
+
+  const float result = float(std::strtod(token, &tokenEnd));
+  if (tokenEnd == token)
+    throw Exception("Expected but missing float value");
+
+  *text += tokenEnd - token;
+  return result;
+}
+
+void parseObjChunk(ObjChunk& chunk)
+{
+  std::vector<Triplet> triplets;
+
+  const char* text = chunk.start;
+  uint lineNumber = 0;
+
+  while (text < chunk.end)
+  {
+    const char* lineEnd = std::find(text, chunk.end, '\n');
+    ++lineNumber;
+
+    if (text < lineEnd && !isSpace(*text) && *text != '#' && *text != '\0')
+    {
+      try
+      {
+        size_t length;
+        const char* command = parseName(&text, lineEnd, &length);
+
+        if (matches(command, length, "g") ||
+            matches(command, length, "o") ||
+            matches(command, length, "s") ||
+            matches(command, length, "mtllib"))
+        {
+          // Silently ignore group and object names, smoothing and .mtl
+          // material files
+        }
+        else if (matches(command, length, "v"))
+        {
+          vec3 vertex;
+
+          vertex.x = parseFloat(&text, lineEnd);
+          vertex.y = parseFloat(&text, lineEnd);
+          vertex.z = parseFloat(&text, lineEnd);
+          chunk.positions.push_back(vertex);
+        }
+        else if (matches(command, length, "vt"))
+        {
+          vec2 texcoord;
+
+          texcoord.x = parseFloat(&text, lineEnd);
+          texcoord.y = parseFloat(&text, lineEnd);
+          chunk.texcoords.push_back(texcoord);
+        }
+        else if (matches(command, length, "vn"))
+        {
+          vec3 normal;
+
+          normal.x = parseFloat(&text, lineEnd);
+          normal.y = parseFloat(&text, lineEnd);
+          normal.z = parseFloat(&text, lineEnd);
+          chunk.normals.push_back(normalize(normal));
+        }
+        else if (matches(command, length, "usemtl"))
+        {
+          const char* materialName = parseName(&text, lineEnd, &length);
+
+          chunk.runs.push_back(FaceRun());
+          chunk.runs.back().name.assign(materialName, length);
+          chunk.runs.back().named = true;
+          chunk.runs.back().firstLine = lineNumber;
+        }
+        else if (matches(command, length, "f"))
+        {
+          if (chunk.runs.empty())
+          {
+            chunk.runs.push_back(FaceRun());
+            chunk.runs.back().firstLine = lineNumber;
+          }
+
+          FaceList& faces = chunk.runs.back().faces;
+
+          triplets.clear();
+
+          while (text < lineEnd && *text != '\0')
+          {
+            triplets.push_back(Triplet());
+            Triplet& triplet = triplets.back();
+
+            triplet.vertex = parseInteger(&text, lineEnd);
+            triplet.texcoord = 0;
+            triplet.normal = 0;
+
+            if (text < lineEnd && *text == '/')
+            {
+              if (++text < lineEnd && isDigit(*text))
+                triplet.texcoord = parseInteger(&text, lineEnd);
+
+              if (text < lineEnd && *text == '/')
+              {
+                if (++text < lineEnd && isDigit(*text))
+                  triplet.normal = parseInteger(&text, lineEnd);
+              }
+            }
+
+            skipSpace(&text, lineEnd);
+          }
+
+          for (size_t i = 2;  i < triplets.size();  i++)
+          {
+            faces.push_back(Face());
+            Face& face = faces.back();
+
+            face.p[0] = triplets[0];
+            face.p[1] = triplets[i - 1];
+            face.p[2] = triplets[i];
+          }
+        }
+        else
+        {
+          chunk.warnings.push_back(ObjWarning());
+          chunk.warnings.back().command.assign(command, length);
+          chunk.warnings.back().line = lineNumber;
+        }
+      }
+      catch (Exception& e)
+      {
+        chunk.error = e.what();
+        chunk.errorLine = lineNumber;
+        chunk.failed = true;
+        return;
+      }
+    }
+
+    text = lineEnd;
+    if (text < chunk.end)
+      text++;
+  }
+
+  chunk.lineCount = lineNumber;
+}
+
+// Vertex cache optimization using Tom Forsyth's linear-speed algorithm,
+// simulating an LRU cache and repeatedly emitting the triangle whose vertices
+// score highest, favoring vertices recently used and vertices with few
+// remaining triangles
+
+const uint FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+// The FIFO cache size used for the cache statistics and overdraw clustering
+
+const uint FIFO_CACHE_SIZE = 16;
+
+float calculateVertexScore(int cachePosition, uint remainingTriangles)
+{
+  if (!remainingTriangles)
+    return -1.f;
+
+  float score = 0.f;
+
+  if (cachePosition >= 0)
+  {
+    if (cachePosition < 3)
+      score = FORSYTH_LAST_TRIANGLE_SCORE;
+    else
+    {
+      const float scale = 1.f / (FORSYTH_CACHE_SIZE - 3);
+      score = std::pow(1.f - (cachePosition - 3) * scale, FORSYTH_CACHE_DECAY_POWER);
+    }
+  }
+
+  score += FORSYTH_VALENCE_BOOST_SCALE *
+           std::pow(float(remainingTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+
+  return score;
+}
+
+void optimizeTriangleOrder(std::vector<MeshTriangle>& triangles, size_t vertexCount)
+{
+  if (triangles.empty())
+    return;
+
+  struct VertexData
+  {
+    uint firstTriangle;
+    uint triangleCount;
+    uint remainingTriangles;
+    int cachePosition;
+    float score;
+  };
+
+  std::vector<VertexData> data(vertexCount);
+
+  for (size_t i = 0;  i < vertexCount;  i++)
+  {
+    data[i].firstTriangle = 0;
+    data[i].triangleCount = 0;
+    data[i].remainingTriangles = 0;
+    data[i].cachePosition = -1;
+  }
+
+  for (auto t = triangles.begin();  t != triangles.end();  t++)
+  {
+    for (size_t k = 0;  k < 3;  k++)
+      data[t->indices[k]].triangleCount++;
+  }
+
+  // Build per-vertex lists of the triangles using them
+
+  uint offset = 0;
+
+  for (size_t i = 0;  i < vertexCount;  i++)
+  {
+    data[i].firstTriangle = offset;
+    offset += data[i].triangleCount;
+  }
+
+  std::vector<uint> vertexTriangles(offset);
+
+  for (uint i = 0;  i < triangles.size();  i++)
+  {
+    for (size_t k = 0;  k < 3;  k++)
+    {
+      VertexData& vertex = data[triangles[i].indices[k]];
+      vertexTriangles[vertex.firstTriangle + vertex.remainingTriangles++] = i;
+    }
+  }
+
+  for (size_t i = 0;  i < vertexCount;  i++)
+    data[i].score = calculateVertexScore(-1, data[i].remainingTriangles);
+
+  std::vector<bool> emitted(triangles.size(), false);
+
+  std::vector<MeshTriangle> result;
+  result.reserve(triangles.size());
+
+  std::vector<uint32> cache;
+  cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+  std::vector<uint32> newCache;
+  newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+  size_t cursor = 0;
+  int best = -1;
+
+  while (result.size() < triangles.size())
+  {
+    // Fall back to the first remaining triangle when nothing in the cache
+    // has any triangles left
+
+    if (best == -1)
+    {
+      while (emitted[cursor])
+        cursor++;
+
+      best = int(cursor);
+    }
+
+    const MeshTriangle& triangle = triangles[best];
+    result.push_back(triangle);
+    emitted[best] = true;
+
+    newCache.clear();
+
+    for (size_t k = 0;  k < 3;  k++)
+    {
+      const uint32 index = triangle.indices[k];
+      VertexData& vertex = data[index];
+
+      // Remove the emitted triangle from the list of remaining triangles
+
+      uint* first = &vertexTriangles[vertex.firstTriangle];
+      uint* last = first + vertex.remainingTriangles;
+      *std::find(first, last, uint(best)) = *(last - 1);
+      vertex.remainingTriangles--;
+
+      newCache.push_back(index);
+    }
+
+    for (auto c = cache.begin();  c != cache.end();  c++)
+    {
+      if (*c != triangle.indices[0] &&
+          *c != triangle.indices[1] &&
+          *c != triangle.indices[2])
+      {
+        newCache.push_back(*c);
+      }
+    }
+
+    // Vertices pushed out of the cache lose their cache score
+
+    for (size_t i = FORSYTH_CACHE_SIZE;  i < newCache.size();  i++)
+    {
+      VertexData& vertex = data[newCache[i]];
+      vertex.cachePosition = -1;
+      vertex.score = calculateVertexScore(-1, vertex.remainingTriangles);
+    }
+
+    if (newCache.size() > FORSYTH_CACHE_SIZE)
+      newCache.resize(FORSYTH_CACHE_SIZE);
+
+    cache.swap(newCache);
+
+    for (size_t i = 0;  i < cache.size();  i++)
+    {
+      VertexData& vertex = data[cache[i]];
+      vertex.cachePosition = int(i);
+      vertex.score = calculateVertexScore(int(i), vertex.remainingTriangles);
+    }
+
+    // Rescore the remaining triangles of the vertices in the cache and pick
+    // the best of them as the next one
+
+    best = -1;
+    float bestScore = -1.f;
+
+    for (auto c = cache.begin();  c != cache.end();  c++)
+    {
+      const VertexData& vertex = data[*c];
+
+      for (uint i = 0;  i < vertex.remainingTriangles;  i++)
+      {
+        const uint index = vertexTriangles[vertex.firstTriangle + i];
+        const MeshTriangle& candidate = triangles[index];
+
+        const float score = data[candidate.indices[0]].score +
+                            data[candidate.indices[1]].score +
+                            data[candidate.indices[2]].score;
+
+        if (score > bestScore)
+        {
+          best = int(index);
+          bestScore = score;
+        }
+      }
+    }
+  }
+
+  triangles.swap(result);
+}
+
+// Simulates a FIFO cache and returns the number of misses for a triangle
+
+class FIFOCache
+{
+public:
+  FIFOCache(size_t vertexCount, uint size);
+  uint addTriangle(const MeshTriangle& triangle);
+  void clear();
+private:
+  std::vector<uint> timestamps;
+  uint size;
+  uint time;
+};
+
+FIFOCache::FIFOCache(size_t vertexCount, uint initSize):
+  timestamps(vertexCount, 0),
+  size(initSize),
+  time(initSize + 1)
+{
+}
+
+uint FIFOCache::addTriangle(const MeshTriangle& triangle)
+{
+  uint misses = 0;
+
+  for (size_t k = 0;  k < 3;  k++)
+  {
+    uint& timestamp = timestamps[triangle.indices[k]];
+
+    if (time - timestamp > size)
+    {
+      timestamp = time++;
+      misses++;
+    }
+  }
+
+  return misses;
+}
+
+void FIFOCache::clear()
+{
+  time += size + 1;
+}
+
+struct TriangleCluster
+{
+  size_t start;
+  size_t count;
+  float sortKey;
+};
+
+bool compareClusters(const TriangleCluster& first, const TriangleCluster& second)
+{
+  return first.sortKey > second.sortKey;
+}
+
+// Overdraw optimization following Sander, Nehab and Barczak, 'Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw'.  The cache optimized
+// sequence is split into clusters wherever the cache restarts, and further
+// wherever the ACMR of the cluster so far is within the threshold of that of
+// the whole sequence, after which clusters facing away from the center of the
+// mesh are moved first so that they occlude the others
+
+void optimizeClusterOrder(std::vector<MeshTriangle>& triangles,
+                          const Mesh::VertexList& vertices,
+                          const vec3& center,
+                          float threshold)
+{
+  if (triangles.size() < 2)
+    return;
+
+  FIFOCache cache(vertices.size(), FIFO_CACHE_SIZE);
+
+  std::vector<uint> misses(triangles.size());
+  uint totalMisses = 0;
+
+  for (size_t i = 0;  i < triangles.size();  i++)
+  {
+    misses[i] = cache.addTriangle(triangles[i]);
+    totalMisses += misses[i];
+  }
+
+  const float limit = threshold * float(totalMisses) / triangles.size();
+
+  std::vector<TriangleCluster> clusters;
+
+  {
+    // Each cluster is measured starting from a cold cache, as that is how
+    // it will be rendered once the clusters have been reordered
+
+    FIFOCache clusterCache(vertices.size(), FIFO_CACHE_SIZE);
+
+    TriangleCluster cluster;
+    cluster.start = 0;
+    cluster.count = 0;
+    cluster.sortKey = 0.f;
+
+    uint clusterMisses = 0;
+
+    for (size_t i = 0;  i < triangles.size();  i++)
+    {
+      if (cluster.count && misses[i] == 3)
+      {
+        clusters.push_back(cluster);
+        cluster.start = i;
+        cluster.count = 0;
+        clusterMisses = 0;
+        clusterCache.clear();
+      }
+
+      cluster.count++;
+      clusterMisses += clusterCache.addTriangle(triangles[i]);
+
+      if (i + 1 < triangles.size() && misses[i + 1] != 3 &&
+          clusterMisses <= limit * cluster.count)
+      {
+        clusters.push_back(cluster);
+        cluster.start = i + 1;
+        cluster.count = 0;
+        clusterMisses = 0;
+        clusterCache.clear();
+      }
+    }
+
+    if (cluster.count)
+      clusters.push_back(cluster);
+  }
+
+  if (clusters.size() < 2)
+    return;
+
+  for (auto c = clusters.begin();  c != clusters.end();  c++)
+  {
+    vec3 centroid;
+    vec3 normal;
+    float area = 0.f;
+
+    for (size_t i = c->start;  i < c->start + c->count;  i++)
+    {
+      const vec3& p0 = vertices[triangles[i].indices[0]].position;
+      const vec3& p1 = vertices[triangles[i].indices[1]].position;
+      const vec3& p2 = vertices[triangles[i].indices[2]].position;
+
+      const vec3 product = cross(p1 - p0, p2 - p0);
+      const float weight = length(product);
+
+      centroid += (p0 + p1 + p2) * (weight / 3.f);
+      normal += product;
+      area += weight;
+    }
+
+    if (area > 0.f && length(normal) > 0.f)
+      c->sortKey = dot(centroid / area - center, normalize(normal));
+  }
+
+  std::stable_sort(clusters.begin(), clusters.end(), compareClusters);
+
+  std::vector<MeshTriangle> result;
+  result.reserve(triangles.size());
+
+  for (auto c = clusters.begin();  c != clusters.end();  c++)
+  {
+    result.insert(result.end(),
+                  triangles.begin() + c->start,
+                  triangles.begin() + c->start + c->count);
+  }
+
+  triangles.swap(result);
+}
+
+// Quadric error metric following Garland and Heckbert, 'Surface
+// Simplification Using Quadric Error Metrics', stored as the upper triangle
+// of the symmetric 4x4 matrix
+
+class Quadric
+{
+public:
+  Quadric();
+  void addPlane(const vec3& normal, float distance, float weight);
+  void add(const Quadric& other);
+  double evaluate(const vec3& point) const;
+private:
+  double a2, ab, ac, ad;
+  double b2, bc, bd;
+  double c2, cd;
+  double d2;
+};
+
+Quadric::Quadric():
+  a2(0.0), ab(0.0), ac(0.0), ad(0.0),
+  b2(0.0), bc(0.0), bd(0.0),
+  c2(0.0), cd(0.0),
+  d2(0.0)
+{
+}
+
+void Quadric::addPlane(const vec3& normal, float distance, float weight)
+{
+  const double a = normal.x, b = normal.y, c = normal.z, d = distance;
+
+  a2 += a * a * weight;
+  ab += a * b * weight;
+  ac += a * c * weight;
+  ad += a * d * weight;
+  b2 += b * b * weight;
+  bc += b * c * weight;
+  bd += b * d * weight;
+  c2 += c * c * weight;
+  cd += c * d * weight;
+  d2 += d * d * weight;
+}
+
+void Quadric::add(const Quadric& other)
+{
+  a2 += other.a2;
+  ab += other.ab;
+  ac += other.ac;
+  ad += other.ad;
+  b2 += other.b2;
+  bc += other.bc;
+  bd += other.bd;
+  c2 += other.c2;
+  cd += other.cd;
+  d2 += other.d2;
+}
+
+double Quadric::evaluate(const vec3& point) const
+{
+  const double x = point.x, y = point.y, z = point.z;
+
+  return a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x +
+         b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y +
+         c2 * z * z + 2.0 * cd * z +
+         d2;
+}
+
+struct EdgeCollapse
+{
+  uint32 source;
+  uint32 target;
+  double error;
+};
+
+bool compareCollapses(const EdgeCollapse& first, const EdgeCollapse& second)
+{
+  return first.error < second.error;
+}
+
+inline uint64 createEdgeKey(uint32 a, uint32 b)
+{
+  return a < b ? (uint64(a) << 32) | b : (uint64(b) << 32) | a;
+}
+
+// Returns whether moving the source vertex onto the target would flip,
+// degenerate or sharply rotate any of the triangles around the source not
+// also using the target
+
+bool flipsTriangles(const std::vector<uint32>& indices,
+                    const std::vector<uint32>& offsets,
+                    const std::vector<uint32>& adjacency,
+                    const Mesh::VertexList& vertices,
+                    uint32 source,
+                    uint32 target)
+{
+  for (uint32 i = offsets[source];  i < offsets[source + 1];  i++)
+  {
+    const uint32* triangle = &indices[adjacency[i] * 3];
+
+    if (triangle[0] == target || triangle[1] == target || triangle[2] == target)
+      continue;
+
+    vec3 positions[3];
+
+    for (size_t k = 0;  k < 3;  k++)
+      positions[k] = vertices[triangle[k]].position;
+
+    const vec3 before = cross(positions[1] - positions[0],
+                              positions[2] - positions[0]);
+
+    for (size_t k = 0;  k < 3;  k++)
+    {
+      if (triangle[k] == source)
+        positions[k] = vertices[target].position;
+    }
+
+    const vec3 after = cross(positions[1] - positions[0],
+                             positions[2] - positions[0]);
+
+    // Also reject large rotations, as they tend to fold thin triangles over
+    if (dot(before, after) <= 0.25f * length(before) * length(after))
+      return true;
+  }
+
+  return false;
+}
+
+// Simplification by iterated passes of edge collapses, each pass collapsing
+// the cheapest edges whose neighborhoods do not overlap, onto existing
+// vertices only.  Vertices on mesh or section borders, and vertices sharing
+// their position with others (i.e. on attribute seams), are never moved
+
+void simplifyTriangles(std::vector<uint32>& indices,
+                       std::vector<uint32>& sectionIndices,
+                       const Mesh::VertexList& vertices,
+                       size_t targetCount)
+{
+  const size_t vertexCount = vertices.size();
+  const uint32 none = std::numeric_limits<uint32>::max();
+
+  std::vector<bool> locked(vertexCount, false);
+
+  // Lock vertices sharing their position with another vertex
+
+  {
+    std::unordered_map<WeldKey<3>, uint32, WeldKeyHash<3>> positions;
+
+    for (uint32 i = 0;  i < vertexCount;  i++)
+    {
+      WeldKey<3> key;
+      key.values[0] = quantize(vertices[i].position.x, 1e-6f);
+      key.values[1] = quantize(vertices[i].position.y, 1e-6f);
+      key.values[2] = quantize(vertices[i].position.z, 1e-6f);
+
+      auto entry = positions.insert(std::make_pair(key, i));
+      if (!entry.second)
+      {
+        locked[i] = true;
+        locked[entry.first->second] = true;
+      }
+    }
+  }
+
+  // Lock vertices on border edges and vertices used by several sections
+
+  {
+    std::unordered_map<uint64, uint32> edges;
+    std::vector<uint32> vertexSections(vertexCount, none);
+
+    for (size_t i = 0;  i < sectionIndices.size();  i++)
+    {
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        const uint32 a = indices[i * 3 + k];
+        const uint32 b = indices[i * 3 + (k + 1) % 3];
+
+        edges[createEdgeKey(a, b)]++;
+
+        if (vertexSections[a] == none)
+          vertexSections[a] = sectionIndices[i];
+        else if (vertexSections[a] != sectionIndices[i])
+          locked[a] = true;
+      }
+    }
+
+    for (auto e = edges.begin();  e != edges.end();  e++)
+    {
+      if (e->second == 1)
+      {
+        locked[uint32(e->first >> 32)] = true;
+        locked[uint32(e->first & 0xffffffff)] = true;
+      }
+    }
+  }
+
+  std::vector<Quadric> quadrics(vertexCount);
+
+  for (size_t i = 0;  i < sectionIndices.size();  i++)
+  {
+    const vec3& p0 = vertices[indices[i * 3 + 0]].position;
+    const vec3& p1 = vertices[indices[i * 3 + 1]].position;
+    const vec3& p2 = vertices[indices[i * 3 + 2]].position;
+
+    const vec3 product = cross(p1 - p0, p2 - p0);
+    const float area = length(product);
+    if (area == 0.f)
+      continue;
+
+    const vec3 normal = product / area;
+
+    Quadric quadric;
+    quadric.addPlane(normal, -dot(normal, p0), area);
+
+    for (size_t k = 0;  k < 3;  k++)
+      quadrics[indices[i * 3 + k]].add(quadric);
+  }
+
+  std::vector<uint32> offsets(vertexCount + 1);
+  std::vector<uint32> adjacency;
+  std::vector<EdgeCollapse> collapses;
+  std::vector<uint32> remap(vertexCount);
+  std::vector<bool> touched(vertexCount);
+
+  while (sectionIndices.size() > targetCount)
+  {
+    const size_t triangleCount = sectionIndices.size();
+
+    // Build the vertex to triangle adjacency
+
+    std::fill(offsets.begin(), offsets.end(), 0);
+
+    for (size_t i = 0;  i < indices.size();  i++)
+      offsets[indices[i] + 1]++;
+
+    for (size_t i = 0;  i < vertexCount;  i++)
+      offsets[i + 1] += offsets[i];
+
+    adjacency.resize(indices.size());
+
+    std::vector<uint32> cursors(offsets.begin(), offsets.end() - 1);
+
+    for (size_t i = 0;  i < indices.size();  i++)
+      adjacency[cursors[indices[i]]++] = uint32(i / 3);
+
+    // Find the cost of every possible collapse
+
+    collapses.clear();
+
+    for (size_t i = 0;  i < triangleCount;  i++)
+    {
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        const uint32 a = indices[i * 3 + k];
+        const uint32 b = indices[i * 3 + (k + 1) % 3];
+
+        for (size_t d = 0;  d < 2;  d++)
+        {
+          const uint32 source = d ? b : a;
+          const uint32 target = d ? a : b;
+
+          if (locked[source])
+            continue;
+
+          Quadric quadric = quadrics[source];
+          quadric.add(quadrics[target]);
+
+          EdgeCollapse collapse;
+          collapse.source = source;
+          collapse.target = target;
+          collapse.error = quadric.evaluate(vertices[target].position);
+          collapses.push_back(collapse);
+        }
+      }
+    }
+
+    if (collapses.empty())
+      break;
+
+    std::sort(collapses.begin(), collapses.end(), compareCollapses);
+
+    for (uint32 i = 0;  i < vertexCount;  i++)
+      remap[i] = i;
+
+    std::fill(touched.begin(), touched.end(), false);
+
+    const size_t excess = triangleCount - targetCount;
+    size_t removed = 0;
+
+    for (auto c = collapses.begin();  c != collapses.end();  c++)
+    {
+      if (touched[c->source] || touched[c->target])
+        continue;
+
+      if (flipsTriangles(indices, offsets, adjacency, vertices, c->source, c->target))
+        continue;
+
+      remap[c->source] = c->target;
+      quadrics[c->target].add(quadrics[c->source]);
+
+      // Keep the neighborhood of the collapse fixed for the rest of the pass
+
+      for (uint32 i = offsets[c->source];  i < offsets[c->source + 1];  i++)
+      {
+        const uint32* triangle = &indices[adjacency[i] * 3];
+
+        if (triangle[0] == c->target ||
+            triangle[1] == c->target ||
+            triangle[2] == c->target)
+        {
+          removed++;
+        }
+
+        for (size_t k = 0;  k < 3;  k++)
+          touched[triangle[k]] = true;
+      }
+
+      touched[c->target] = true;
+
+      if (removed >= excess)
+        break;
+    }
+
+    if (!removed)
+      break;
+
+    // Apply the collapses and drop the triangles they degenerated
+
+    size_t count = 0;
+
+    for (size_t i = 0;  i < triangleCount;  i++)
+    {
+      const uint32 a = remap[indices[i * 3 + 0]];
+      const uint32 b = remap[indices[i * 3 + 1]];
+      const uint32 c = remap[indices[i * 3 + 2]];
+
+      if (a == b || b == c || c == a)
+        continue;
+
+      indices[count * 3 + 0] = a;
+      indices[count * 3 + 1] = b;
+      indices[count * 3 + 2] = c;
+      sectionIndices[count] = sectionIndices[i];
+      count++;
+    }
+
+    indices.resize(count * 3);
+    sectionIndices.resize(count);
+  }
+}
+
+// The binary mesh format is laid out as follows, in native byte order:
+//  * The file header, which for cache files also records the size and
+//    modification time of the OBJ file they were written from
+//  * The vertex stream, as an array of MeshVertex
+//  * For each section, a section header followed by the material name,
+//    padded to a multiple of four bytes, and then the triangles of the
+//    section, as an array of MeshTriangle
+//
+// This allows the streams to be copied directly out of a mapped file.
+
+const char BINARY_MESH_MAGIC[] = { 'W', 'M', 'S', 'H' };
+const uint32 BINARY_MESH_VERSION = 4;
+
+struct BinaryMeshHeader
+{
+  char magic[4];
+  uint32 version;
+  uint32 vertexSize;
+  uint32 triangleSize;
+  uint32 vertexCount;
+  uint32 sectionCount;
+  uint64 sourceSize;
+  int64 sourceTime;
+};
+
+struct BinaryMeshSection
+{
+  uint32 triangleCount;
+  uint32 nameLength;
+};
+
+size_t getPaddedLength(size_t length)
+{
+  return (length + 3) & ~size_t(3);
+}
+
+// The glm vector types are not trivially copyable, so vertices and triangles
+// are read from binary meshes one component at a time
+
+static_assert(sizeof(MeshVertex) == 8 * sizeof(float),
+              "MeshVertex must consist of eight packed floats");
+static_assert(sizeof(MeshTriangle) == 3 * sizeof(uint32) + 3 * sizeof(float),
+              "MeshTriangle must consist of three indices and a packed vec3");
+
+void readVertices(MeshVertex* vertices, const char* data, size_t count)
+{
+  for (size_t i = 0;  i < count;  i++)
+  {
+    float values[8];
+    std::memcpy(values, data + i * sizeof(MeshVertex), sizeof(values));
+
+    vertices[i].position = vec3(values[0], values[1], values[2]);
+    vertices[i].normal = vec3(values[3], values[4], values[5]);
+    vertices[i].texcoord = vec2(values[6], values[7]);
+  }
+}
+
+void readTriangles(MeshTriangle* triangles, const char* data, size_t count)
+{
+  for (size_t i = 0;  i < count;  i++)
+  {
+    const char* source = data + i * sizeof(MeshTriangle);
+
+    std::memcpy(triangles[i].indices, source, sizeof(triangles[i].indices));
+
+    float values[3];
+    std::memcpy(values, source + sizeof(triangles[i].indices), sizeof(values));
+    triangles[i].normal = vec3(values[0], values[1], values[2]);
+  }
+}
+
+class MappedFile
+{
+public:
+  MappedFile();
+  ~MappedFile();
+  bool open(const Path& path);
+  const char* getData() const;
+  size_t getSize() const;
+private:
+  MappedFile(const MappedFile& source);
+  MappedFile& operator = (const MappedFile& source);
+  const char* data;
+  size_t size;
+  bool mapped;
+  std::vector<char> buffer;
+};
+
+MappedFile::MappedFile():
+  data(NULL),
+  size(0),
+  mapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+#if WENDY_HAVE_SYS_MMAN_H
+  if (mapped)
+    munmap(const_cast<char*>(data), size);
+#endif
+}
+
+bool MappedFile::open(const Path& path)
+{
+#if WENDY_HAVE_SYS_MMAN_H
+  const int fd = ::open(path.asString().c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat sb;
+
+  if (fstat(fd, &sb) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  size = size_t(sb.st_size);
+  if (size)
+  {
+    void* address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED)
+    {
+      close(fd);
+      return false;
+    }
+
+    data = (const char*) address;
+    mapped = true;
+  }
+
+  close(fd);
+  return true;
+#else
+  std::ifstream stream(path.asString().c_str(), std::ios::in | std::ios::binary);
+  if (stream.fail())
+    return false;
+
+  stream.seekg(0, std::ios::end);
+  buffer.resize(size_t(stream.tellg()));
+  stream.seekg(0, std::ios::beg);
+
+  if (!buffer.empty())
+  {
+    if (!stream.read(&buffer[0], buffer.size()))
+      return false;
+
+    data = &buffer[0];
+  }
+
+  size = buffer.size();
+  return true;
+#endif
+}
+
+const char* MappedFile::getData() const
+{
+  return data;
+}
+
+size_t MappedFile::getSize() const
+{
+  return size;
+}
+
+bool getSourceStamp(const Path& path, uint64& size, int64& time)
+{
+  struct stat sb;
+
+  if (stat(path.asString().c_str(), &sb) != 0)
+    return false;
+
+  size = uint64(sb.st_size);
+  time = int64(sb.st_mtime);
+  return true;
+}
+
+// A cache file is only current if it was written from an OBJ file with the
+// exact size and modification time of the one it is next to, as a source
+// file replaced by an older one or rewritten within the same second would
+// otherwise pass for unchanged
+
+bool isCacheCurrent(const Path& cachePath, uint64 sourceSize, int64 sourceTime)
+{
+  std::ifstream stream(cachePath.asString().c_str(), std::ios::in | std::ios::binary);
+  if (stream.fail())
+    return false;
+
+  BinaryMeshHeader header;
+  if (!stream.read((char*) &header, sizeof(header)))
+    return false;
+
+  return std::memcmp(header.magic, BINARY_MESH_MAGIC, sizeof(header.magic)) == 0 &&
+         header.version == BINARY_MESH_VERSION &&
+         header.sourceSize == sourceSize &&
+         header.sourceTime == sourceTime;
+}
+
+bool writeBinaryMesh(const Path& path,
+                     const Mesh& mesh,
+                     uint64 sourceSize,
+                     int64 sourceTime)
+{
+  std::ofstream stream(path.asString().c_str(), std::ios::out | std::ios::binary);
+  if (!stream.is_open())
+  {
+    logError("Failed to open \'%s\' for writing",
+             path.asString().c_str());
+    return false;
+  }
+
+  BinaryMeshHeader header;
+  std::memcpy(header.magic, BINARY_MESH_MAGIC, sizeof(header.magic));
+  header.version = BINARY_MESH_VERSION;
+  header.vertexSize = sizeof(MeshVertex);
+  header.triangleSize = sizeof(MeshTriangle);
+  header.vertexCount = mesh.vertices.size();
+  header.sectionCount = mesh.sections.size();
+  header.sourceSize = sourceSize;
+  header.sourceTime = sourceTime;
+
+  stream.write((const char*) &header, sizeof(header));
+
+  if (!mesh.vertices.empty())
+  {
+    stream.write((const char*) &mesh.vertices[0],
+                 mesh.vertices.size() * sizeof(MeshVertex));
+  }
+
+  const char padding[4] = { 0, 0, 0, 0 };
+
+  for (auto s = mesh.sections.begin();  s != mesh.sections.end();  s++)
+  {
+    BinaryMeshSection section;
+    section.triangleCount = s->triangles.size();
+    section.nameLength = s->materialName.length();
+
+    stream.write((const char*) &section, sizeof(section));
+    stream.write(s->materialName.c_str(), section.nameLength);
+    stream.write(padding, getPaddedLength(section.nameLength) - section.nameLength);
+
+    if (!s->triangles.empty())
+    {
+      stream.write((const char*) &s->triangles[0],
+                   s->triangles.size() * sizeof(MeshTriangle));
+    }
+  }
+
+  if (stream.fail())
+  {
+    logError("Failed to write binary mesh \'%s\'",
+             path.asString().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+void MeshTriangle::setIndices(uint32 a, uint32 b, uint32 c)
+{
+  indices[0] = a;
+  indices[1] = b;
+  indices[2] = c;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+Mesh::Mesh(const ResourceInfo& info):
+  Resource(info)
+{
+}
+
+void Mesh::mergeSections(const char* materialName)
+{
+  sections[0].materialName = materialName;
+
+  for (size_t i = 1;  i < sections.size();  i++)
+  {
+    sections[0].triangles.insert(sections[0].triangles.end(),
+                                 sections[i].triangles.begin(),
+                                 sections[i].triangles.end());
+  }
+
+  sections.resize(1);
+}
+
+MeshSection* Mesh::findSection(const char* materialName)
+{
+  for (auto s = sections.begin();  s != sections.end();  s++)
+  {
+    if (s->materialName == materialName)
+      return &(*s);
+  }
+
+  return NULL;
+}
+
+void Mesh::weldVertices(float epsilon)
+{
+  typedef WeldKey<8> VertexKey;
+
+  std::unordered_map<VertexKey, uint32, WeldKeyHash<8>> indices;
+  std::vector<uint32> remap(vertices.size());
+
+  VertexList welded;
+
+  for (size_t i = 0;  i < vertices.size();  i++)
+  {
+    const MeshVertex& vertex = vertices[i];
+
+    if (!all(isfinite(vertex.position)) ||
+        !all(isfinite(vertex.normal)) ||
+        !all(isfinite(vertex.texcoord)))
+    {
+      remap[i] = welded.size();
+      welded.push_back(vertex);
+      continue;
+    }
+
+    VertexKey key;
+    key.values[0] = quantize(vertex.position.x, epsilon);
+    key.values[1] = quantize(vertex.position.y, epsilon);
+    key.values[2] = quantize(vertex.position.z, epsilon);
+    key.values[3] = quantize(vertex.normal.x, epsilon);
+    key.values[4] = quantize(vertex.normal.y, epsilon);
+    key.values[5] = quantize(vertex.normal.z, epsilon);
+    key.values[6] = quantize(vertex.texcoord.x, epsilon);
+    key.values[7] = quantize(vertex.texcoord.y, epsilon);
+
+    auto entry = indices.find(key);
+    if (entry == indices.end())
+    {
+      remap[i] = welded.size();
+      indices[key] = remap[i];
+      welded.push_back(vertex);
+    }
+    else
+      remap[i] = entry->second;
+  }
+
+  for (auto s = sections.begin();  s != sections.end();  s++)
+  {
+    for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
+    {
+      for (size_t k = 0;  k < 3;  k++)
+        t->indices[k] = remap[t->indices[k]];
+    }
   }
 
-  return NULL;
+  vertices.swap(welded);
 }
 
 void Mesh::generateNormals(NormalType type)
@@ -373,6 +1903,143 @@ bool Mesh::isValid() const
   return true;
 }
 
+void Mesh::optimize(float overdrawThreshold)
+{
+  optimizeVertexCache();
+  optimizeOverdraw(overdrawThreshold);
+  optimizeVertexFetch();
+}
+
+void Mesh::optimizeVertexCache()
+{
+  for (auto s = sections.begin();  s != sections.end();  s++)
+    optimizeTriangleOrder(s->triangles, vertices.size());
+}
+
+void Mesh::optimizeOverdraw(float threshold)
+{
+  const vec3 center = generateBoundingAABB().center;
+
+  for (auto s = sections.begin();  s != sections.end();  s++)
+    optimizeClusterOrder(s->triangles, vertices, center, threshold);
+}
+
+void Mesh::optimizeVertexFetch()
+{
+  const uint32 unused = std::numeric_limits<uint32>::max();
+
+  std::vector<uint32> remap(vertices.size(), unused);
+  uint32 count = 0;
+
+  for (auto s = sections.begin();  s != sections.end();  s++)
+  {
+    for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
+    {
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        uint32& index = remap[t->indices[k]];
+        if (index == unused)
+          index = count++;
+
+        t->indices[k] = index;
+      }
+    }
+  }
+
+  // Keep vertices not used by any triangle, after all the used ones
+
+  for (size_t i = 0;  i < remap.size();  i++)
+  {
+    if (remap[i] == unused)
+      remap[i] = count++;
+  }
+
+  VertexList reordered(vertices.size());
+
+  for (size_t i = 0;  i < vertices.size();  i++)
+    reordered[remap[i]] = vertices[i];
+
+  vertices.swap(reordered);
+}
+
+void Mesh::calculateCacheStats(float& ACMR, float& ATVR) const
+{
+  FIFOCache cache(vertices.size(), FIFO_CACHE_SIZE);
+
+  std::vector<bool> referenced(vertices.size(), false);
+
+  size_t misses = 0;
+  size_t triangleCount = 0;
+  size_t vertexCount = 0;
+
+  for (auto s = sections.begin();  s != sections.end();  s++)
+  {
+    for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
+    {
+      misses += cache.addTriangle(*t);
+
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        if (!referenced[t->indices[k]])
+        {
+          referenced[t->indices[k]] = true;
+          vertexCount++;
+        }
+      }
+    }
+
+    triangleCount += s->triangles.size();
+  }
+
+  ACMR = triangleCount ? float(misses) / triangleCount : 0.f;
+  ATVR = vertexCount ? float(misses) / vertexCount : 0.f;
+}
+
+void Mesh::simplify(std::vector<MeshSection>& result, size_t targetTriangleCount) const
+{
+  std::vector<uint32> indices;
+  std::vector<uint32> sectionIndices;
+
+  indices.reserve(getTriangleCount() * 3);
+  sectionIndices.reserve(getTriangleCount());
+
+  for (size_t i = 0;  i < sections.size();  i++)
+  {
+    const std::vector<MeshTriangle>& triangles = sections[i].triangles;
+
+    for (auto t = triangles.begin();  t != triangles.end();  t++)
+    {
+      indices.insert(indices.end(), t->indices, t->indices + 3);
+      sectionIndices.push_back(uint32(i));
+    }
+  }
+
+  simplifyTriangles(indices, sectionIndices, vertices, targetTriangleCount);
+
+  result.clear();
+  result.resize(sections.size());
+
+  for (size_t i = 0;  i < sections.size();  i++)
+    result[i].materialName = sections[i].materialName;
+
+  // The relative order of the remaining triangles is preserved, so any
+  // vertex cache optimization of the original mostly carries over
+
+  for (size_t i = 0;  i < sectionIndices.size();  i++)
+  {
+    MeshTriangle triangle;
+    triangle.setIndices(indices[i * 3 + 0], indices[i * 3 + 1], indices[i * 3 + 2]);
+
+    const vec3& p0 = vertices[triangle.indices[0]].position;
+    const vec3& p1 = vertices[triangle.indices[1]].position;
+    const vec3& p2 = vertices[triangle.indices[2]].position;
+
+    triangle.normal = normalize(cross(p1 - p0, p2 - p0));
+
+    result[sectionIndices[i]].triangles.push_back(triangle);
+  }
+}
+
 size_t Mesh::getTriangleCount() const
 {
   size_t count = 0;
@@ -383,171 +2050,276 @@ size_t Mesh::getTriangleCount() const
   return count;
 }
 
-Ref<Mesh> Mesh::read(ResourceCache& cache, const String& name)
+Ref<Mesh> Mesh::read(ResourceCache& cache, const String& name, uint threadCount)
 {
-  MeshReader reader(cache);
+  MeshReader reader(cache, threadCount);
   return reader.read(name);
 }
 
 ///////////////////////////////////////////////////////////////////////
 
-MeshReader::MeshReader(ResourceCache& index):
-  ResourceReader<Mesh>(index)
+MeshReader::MeshReader(ResourceCache& index, uint initThreadCount):
+  ResourceReader<Mesh>(index),
+  threadCount(std::max(initThreadCount, 1u))
 {
 }
 
 Ref<Mesh> MeshReader::read(const String& name, const Path& path)
 {
-  std::ifstream stream(path.asString().c_str(), std::ios::in | std::ios::binary);
-  if (stream.fail())
+  // Accept binary meshes given directly, identified by their magic number
+
   {
-    logError("Failed to open mesh \'%s\'", name.c_str());
+    std::ifstream stream(path.asString().c_str(), std::ios::in | std::ios::binary);
+    if (stream.fail())
+    {
+      logError("Failed to open mesh \'%s\'", name.c_str());
+      return NULL;
+    }
+
+    char magic[sizeof(BINARY_MESH_MAGIC)];
+
+    if (stream.read(magic, sizeof(magic)) &&
+        std::memcmp(magic, BINARY_MESH_MAGIC, sizeof(magic)) == 0)
+    {
+      return readBinary(name, path, path);
+    }
+  }
+
+  const Path cachePath(path.asString() + ".mesh");
+
+  uint64 sourceSize;
+  int64 sourceTime;
+
+  if (!getSourceStamp(path, sourceSize, sourceTime))
+  {
+    logError("Failed to query mesh \'%s\'", name.c_str());
     return NULL;
   }
 
-  String line;
-  uint lineNumber = 0;
+  if (isCacheCurrent(cachePath, sourceSize, sourceTime))
+  {
+    if (Ref<Mesh> mesh = readBinary(name, path, cachePath))
+      return mesh;
 
-  std::vector<vec3> positions;
-  std::vector<vec3> normals;
-  std::vector<vec2> texcoords;
-  std::vector<Triplet> triplets;
+    logWarning("Ignoring invalid cache file for mesh \'%s\'", name.c_str());
+  }
 
-  std::vector<FaceGroup> groups;
-  FaceGroup* group = NULL;
+  Ref<Mesh> mesh = readText(name, path);
+  if (!mesh)
+    return NULL;
 
-  while (std::getline(stream, line))
+  if (!writeBinaryMesh(cachePath, *mesh, sourceSize, sourceTime))
+    logWarning("Failed to write cache file for mesh \'%s\'", name.c_str());
+
+  return mesh;
+}
+
+Ref<Mesh> MeshReader::readBinary(const String& name,
+                                 const Path& path,
+                                 const Path& dataPath)
+{
+  MappedFile file;
+  if (!file.open(dataPath))
   {
-    const char* text = line.c_str();
-    ++lineNumber;
+    logError("Failed to map binary mesh \'%s\'", name.c_str());
+    return NULL;
+  }
 
-    if (!interesting(&text))
-      continue;
+  const char* data = file.getData();
+  const char* end = data + file.getSize();
+
+  if (size_t(end - data) < sizeof(BinaryMeshHeader))
+  {
+    logError("Binary mesh \'%s\' is truncated", name.c_str());
+    return NULL;
+  }
+
+  BinaryMeshHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  data += sizeof(header);
+
+  if (std::memcmp(header.magic, BINARY_MESH_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != BINARY_MESH_VERSION ||
+      header.vertexSize != sizeof(MeshVertex) ||
+      header.triangleSize != sizeof(MeshTriangle))
+  {
+    logError("Binary mesh format mismatch in \'%s\'", name.c_str());
+    return NULL;
+  }
+
+  const size_t vertexBytes = header.vertexCount * sizeof(MeshVertex);
+  if (size_t(end - data) < vertexBytes)
+  {
+    logError("Binary mesh \'%s\' is truncated", name.c_str());
+    return NULL;
+  }
+
+  std::vector<MeshSection> sections(header.sectionCount);
+  const char* vertexData = data;
+  data += vertexBytes;
+
+  for (auto s = sections.begin();  s != sections.end();  s++)
+  {
+    if (size_t(end - data) < sizeof(BinaryMeshSection))
+    {
+      logError("Binary mesh \'%s\' is truncated", name.c_str());
+      return NULL;
+    }
+
+    BinaryMeshSection section;
+    std::memcpy(&section, data, sizeof(section));
+    data += sizeof(section);
 
-    try
+    const size_t nameBytes = getPaddedLength(section.nameLength);
+    const size_t triangleBytes = section.triangleCount * sizeof(MeshTriangle);
+
+    if (size_t(end - data) < nameBytes + triangleBytes)
     {
-      String command = parseName(&text);
+      logError("Binary mesh \'%s\' is truncated", name.c_str());
+      return NULL;
+    }
 
-      if (command == "g")
-      {
-        // Silently ignore group names
-      }
-      else if (command == "o")
-      {
-        // Silently ignore object names
-      }
-      else if (command == "s")
-      {
-        // Silently ignore smoothing
-      }
-      else if (command == "v")
-      {
-        vec3 vertex;
+    s->materialName.assign(data, section.nameLength);
+    data += nameBytes;
 
-        vertex.x = parseFloat(&text);
-        vertex.y = parseFloat(&text);
-        vertex.z = parseFloat(&text);
-        positions.push_back(vertex);
-      }
-      else if (command == "vt")
-      {
-        vec2 texcoord;
+    s->triangles.resize(section.triangleCount);
+    if (triangleBytes)
+      readTriangles(&s->triangles[0], data, section.triangleCount);
 
-        texcoord.x = parseFloat(&text);
-        texcoord.y = parseFloat(&text);
-        texcoords.push_back(texcoord);
-      }
-      else if (command == "vn")
-      {
-        vec3 normal;
+    data += triangleBytes;
+  }
 
-        normal.x = parseFloat(&text);
-        normal.y = parseFloat(&text);
-        normal.z = parseFloat(&text);
-        normals.push_back(normalize(normal));
-      }
-      else if (command == "usemtl")
-      {
-        String materialName = parseName(&text);
+  Ref<Mesh> mesh = new Mesh(ResourceInfo(cache, name, path));
 
-        group = NULL;
+  mesh->vertices.resize(header.vertexCount);
+  if (vertexBytes)
+    readVertices(&mesh->vertices[0], vertexData, header.vertexCount);
 
-        for (auto g = groups.begin();  g != groups.end();  g++)
-        {
-          if (g->name == materialName)
-            group = &(*g);
-        }
+  mesh->sections.swap(sections);
+  return mesh;
+}
 
-        if (!group)
-        {
-          groups.push_back(FaceGroup());
-          groups.back().name = materialName;
-          group = &(groups.back());
-        }
-      }
-      else if (command == "mtllib")
-      {
-        // Silently ignore .mtl material files
-      }
-      else if (command == "f")
-      {
-        if (!group)
-          throw Exception("Expected \'usemtl\' before \'f\'");
+Ref<Mesh> MeshReader::readText(const String& name, const Path& path)
+{
+  MappedFile file;
+  if (!file.open(path))
+  {
+    logError("Failed to open mesh \'%s\'", name.c_str());
+    return NULL;
+  }
 
-        triplets.clear();
+  const char* start = file.getData();
+  const char* end = start + file.getSize();
 
-        while (*text != '\0')
-        {
-          triplets.push_back(Triplet());
-          Triplet& triplet = triplets.back();
+  // Split the file into chunks at line boundaries and parse them in parallel
 
-          triplet.vertex = parseInteger(&text);
-          triplet.texcoord = 0;
-          triplet.normal = 0;
+  std::vector<ObjChunk> chunks;
 
-          if (*text == '/')
-          {
-            if (std::isdigit(*(++text)))
-              triplet.texcoord = parseInteger(&text);
+  {
+    const size_t size = end - start;
+    size_t chunkCount = threadCount;
+    chunkCount = std::min(chunkCount, size / OBJ_MIN_CHUNK_SIZE + 1);
 
-            if (*text == '/')
-            {
-              if (std::isdigit(*(++text)))
-                triplet.normal = parseInteger(&text);
-            }
-          }
+    chunks.resize(chunkCount);
 
-          while (std::isspace(*text))
-            text++;
-        }
+    const char* chunkStart = start;
 
-        for (size_t i = 2;  i < triplets.size();  i++)
-        {
-          group->faces.push_back(Face());
-          Face& face = group->faces.back();
+    for (size_t i = 0;  i < chunkCount;  i++)
+    {
+      const char* chunkEnd = end;
 
-          face.p[0] = triplets[0];
-          face.p[1] = triplets[i - 1];
-          face.p[2] = triplets[i];
-        }
-      }
-      else
+      if (i + 1 < chunkCount)
       {
-        logWarning("Unknown command \'%s\' in mesh \'%s\' line %d",
-                   command.c_str(),
-                   name.c_str(),
-                   lineNumber);
+        chunkEnd = std::max(chunkStart, start + size * (i + 1) / chunkCount);
+        chunkEnd = std::find(chunkEnd, end, '\n');
+        if (chunkEnd != end)
+          chunkEnd++;
       }
+
+      chunks[i].start = chunkStart;
+      chunks[i].end = chunkEnd;
+      chunkStart = chunkEnd;
+    }
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1;  i < chunkCount;  i++)
+      threads.push_back(std::thread(parseObjChunk, std::ref(chunks[i])));
+
+    parseObjChunk(chunks[0]);
+
+    for (auto t = threads.begin();  t != threads.end();  t++)
+      t->join();
+  }
+
+  // Merge the chunks in file order
+
+  std::vector<vec3> positions;
+  std::vector<vec3> normals;
+  std::vector<vec2> texcoords;
+
+  std::vector<FaceGroup> groups;
+  std::unordered_map<String, size_t> groupIndices;
+  FaceGroup* group = NULL;
+
+  uint lineBase = 0;
+
+  for (auto c = chunks.begin();  c != chunks.end();  c++)
+  {
+    uint errorLine = c->errorLine;
+    const char* error = c->failed ? c->error.c_str() : NULL;
+
+    if (!group && !c->runs.empty() && !c->runs.front().named)
+    {
+      errorLine = c->runs.front().firstLine;
+      error = "Expected \'usemtl\' before \'f\'";
+    }
+
+    for (auto w = c->warnings.begin();  w != c->warnings.end();  w++)
+    {
+      if (error && w->line >= errorLine)
+        break;
+
+      logWarning("Unknown command \'%s\' in mesh \'%s\' line %d",
+                 w->command.c_str(),
+                 name.c_str(),
+                 lineBase + w->line);
     }
-    catch (Exception& e)
+
+    if (error)
     {
       logError("%s in mesh \'%s\' line %d",
-               e.what(),
+               error,
                name.c_str(),
-               lineNumber);
+               lineBase + errorLine);
 
       return NULL;
     }
+
+    positions.insert(positions.end(), c->positions.begin(), c->positions.end());
+    normals.insert(normals.end(), c->normals.begin(), c->normals.end());
+    texcoords.insert(texcoords.end(), c->texcoords.begin(), c->texcoords.end());
+
+    for (auto r = c->runs.begin();  r != c->runs.end();  r++)
+    {
+      if (r->named)
+      {
+        auto entry = groupIndices.find(r->name);
+        if (entry == groupIndices.end())
+        {
+          groupIndices[r->name] = groups.size();
+          groups.push_back(FaceGroup());
+          groups.back().name = r->name;
+          group = &(groups.back());
+        }
+        else
+          group = &groups[entry->second];
+      }
+
+      group->faces.insert(group->faces.end(), r->faces.begin(), r->faces.end());
+    }
+
+    lineBase += c->lineCount;
   }
 
   Ref<Mesh> mesh = new Mesh(ResourceInfo(cache, name, path));
@@ -595,57 +2367,6 @@ Ref<Mesh> MeshReader::read(const String& name, const Path& path)
   return mesh;
 }
 
-String MeshReader::parseName(const char** text)
-{
-  while (std::isspace(**text))
-    (*text)++;
-
-  String result;
-
-  while (std::isalnum(**text) || **text == '_')
-  {
-    result.append(1, **text);
-    (*text)++;
-  }
-
-  if (!result.size())
-    throw Exception("Expected but missing name");
-
-  return result;
-}
-
-int MeshReader::parseInteger(const char** text)
-{
-  char* end;
-
-  const int result = std::strtol(*text, &end, 0);
-  if (end == *text)
-    throw Exception("Expected but missing integer value");
-
-  *text = end;
-  return result;
-}
-
-float MeshReader::parseFloat(const char** text)
-{
-  char* end;
-
-  const float result = float(std::strtod(*text, &end));
-  if (end == *text)
-    throw Exception("Expected but missing float value");
-
-  *text = end;
-  return result;
-}
-
-bool MeshReader::interesting(const char** text)
-{
-  if (std::isspace(**text) || **text == '#' || **text == '\0' || **text == '\r')
-    return false;
-
-  return true;
-}
-
 ///////////////////////////////////////////////////////////////////////
 
 bool MeshWriter::write(const Path& path, const Mesh& mesh)
@@ -689,6 +2410,11 @@ bool MeshWriter::write(const Path& path, const Mesh& mesh)
   return true;
 }
 
+bool MeshWriter::writeBinary(const Path& path, const Mesh& mesh)
+{
+  return writeBinaryMesh(path, mesh, 0, 0);
+}
+
 ///////////////////////////////////////////////////////////////////////
 
 } /*namespace wendy*/
@@ -0,0 +1,416 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy core library
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+#include <wendy/Occlusion.h>
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define WENDY_USE_SSE 1
+#endif
+
+///////////////////////////////////////////////////////////////////////
+
+namespace wendy
+{
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const uint TILE_SIZE = 8;
+
+// Edge function of the directed edge from p to q, which is positive to the
+// left of it, i.e. inside counter-clockwise triangles
+struct Edge
+{
+  Edge(const vec3& p, const vec3& q):
+    a(p.y - q.y),
+    b(q.x - p.x),
+    c(p.x * q.y - p.y * q.x)
+  {
+  }
+  float a;
+  float b;
+  float c;
+};
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+OcclusionBuffer::OcclusionBuffer(uint initWidth, uint initHeight):
+  width((initWidth + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE),
+  height((initHeight + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE),
+  testCount(0),
+  culledCount(0)
+{
+  assert(width > 0);
+  assert(height > 0);
+
+  depths.resize(width * height, 1.f);
+  tileDepths.resize((width / TILE_SIZE) * (height / TILE_SIZE), 1.f);
+}
+
+void OcclusionBuffer::clear(const Camera& camera)
+{
+  const mat4 view = camera.getViewTransform();
+  viewProjection = camera.getProjectionMatrix() * view;
+
+  std::fill(depths.begin(), depths.end(), 1.f);
+  std::fill(tileDepths.begin(), tileDepths.end(), 1.f);
+
+  testCount = 0;
+  culledCount = 0;
+}
+
+void OcclusionBuffer::addOccluder(const Mesh& mesh, const Transform3& transform)
+{
+  const mat4 model = transform;
+  const mat4 matrix = viewProjection * model;
+
+  positions.resize(mesh.vertices.size());
+
+  for (size_t i = 0;  i < mesh.vertices.size();  i++)
+    positions[i] = matrix * vec4(mesh.vertices[i].position, 1.f);
+
+  for (auto s = mesh.sections.begin();  s != mesh.sections.end();  s++)
+  {
+    for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
+    {
+      const vec4 vertices[3] =
+      {
+        positions[t->indices[0]],
+        positions[t->indices[1]],
+        positions[t->indices[2]]
+      };
+
+      // Reject triangles entirely outside a single clip plane
+      uint outside = 0x3f;
+
+      for (uint i = 0;  i < 3;  i++)
+      {
+        const vec4& v = vertices[i];
+
+        uint code = 0;
+        if (v.x < -v.w)
+          code |= 1;
+        if (v.x > v.w)
+          code |= 2;
+        if (v.y < -v.w)
+          code |= 4;
+        if (v.y > v.w)
+          code |= 8;
+        if (v.z < -v.w)
+          code |= 16;
+        if (v.z > v.w)
+          code |= 32;
+
+        outside &= code;
+      }
+
+      if (!outside)
+        addPolygon(vertices, 3);
+    }
+  }
+}
+
+void OcclusionBuffer::buildHierarchy()
+{
+  const uint tileCountX = width / TILE_SIZE;
+  const uint tileCountY = height / TILE_SIZE;
+
+  for (uint ty = 0;  ty < tileCountY;  ty++)
+  {
+    for (uint tx = 0;  tx < tileCountX;  tx++)
+    {
+      float farthest = 0.f;
+
+      for (uint y = ty * TILE_SIZE;  y < (ty + 1) * TILE_SIZE;  y++)
+      {
+        const float* row = &depths[y * width + tx * TILE_SIZE];
+
+        for (uint x = 0;  x < TILE_SIZE;  x++)
+          farthest = max(farthest, row[x]);
+      }
+
+      tileDepths[ty * tileCountX + tx] = farthest;
+    }
+  }
+}
+
+bool OcclusionBuffer::isVisible(const AABB& box) const
+{
+  testCount++;
+
+  float minX, minY, minZ, maxX, maxY, maxZ;
+  box.getBounds(minX, minY, minZ, maxX, maxY, maxZ);
+
+  vec2 minimum(FLT_MAX), maximum(-FLT_MAX);
+  float nearest = FLT_MAX;
+
+  for (uint i = 0;  i < 8;  i++)
+  {
+    const vec4 corner((i & 1) ? maxX : minX,
+                      (i & 2) ? maxY : minY,
+                      (i & 4) ? maxZ : minZ,
+                      1.f);
+
+    const vec4 clip = viewProjection * corner;
+    if (clip.z < -clip.w)
+      return true;
+
+    const vec3 position(clip.x / clip.w * 0.5f + 0.5f,
+                        clip.y / clip.w * 0.5f + 0.5f,
+                        clip.z / clip.w);
+
+    minimum = min(minimum, vec2(position.x * width, position.y * height));
+    maximum = max(maximum, vec2(position.x * width, position.y * height));
+    nearest = min(nearest, position.z);
+  }
+
+  // Volumes outside the viewport are left to frustum culling
+  if (maximum.x < 0.f || minimum.x >= width ||
+      maximum.y < 0.f || minimum.y >= height)
+  {
+    return true;
+  }
+
+  const uint x0 = uint(max(minimum.x, 0.f));
+  const uint y0 = uint(max(minimum.y, 0.f));
+  const uint x1 = uint(min(maximum.x, width - 1.f));
+  const uint y1 = uint(min(maximum.y, height - 1.f));
+
+  const uint tileCountX = width / TILE_SIZE;
+
+  for (uint ty = y0 / TILE_SIZE;  ty <= y1 / TILE_SIZE;  ty++)
+  {
+    for (uint tx = x0 / TILE_SIZE;  tx <= x1 / TILE_SIZE;  tx++)
+    {
+      // Every occluder in this tile is nearer than the nearest point
+      if (tileDepths[ty * tileCountX + tx] < nearest)
+        continue;
+
+      const uint startX = max(x0, tx * TILE_SIZE);
+      const uint startY = max(y0, ty * TILE_SIZE);
+      const uint endX = min(x1, (tx + 1) * TILE_SIZE - 1);
+      const uint endY = min(y1, (ty + 1) * TILE_SIZE - 1);
+
+      for (uint y = startY;  y <= endY;  y++)
+      {
+        for (uint x = startX;  x <= endX;  x++)
+        {
+          if (depths[y * width + x] >= nearest)
+            return true;
+        }
+      }
+    }
+  }
+
+  culledCount++;
+  return false;
+}
+
+bool OcclusionBuffer::isVisible(const Sphere& sphere) const
+{
+  return isVisible(AABB(sphere.center, vec3(sphere.radius)));
+}
+
+float OcclusionBuffer::getDepth(uint x, uint y) const
+{
+  assert(x < width);
+  assert(y < height);
+
+  return depths[y * width + x];
+}
+
+uint OcclusionBuffer::getWidth() const
+{
+  return width;
+}
+
+uint OcclusionBuffer::getHeight() const
+{
+  return height;
+}
+
+uint OcclusionBuffer::getTestCount() const
+{
+  return testCount;
+}
+
+uint OcclusionBuffer::getCulledCount() const
+{
+  return culledCount;
+}
+
+void OcclusionBuffer::addPolygon(const vec4* vertices, uint count)
+{
+  // Clip against the near plane, which may add one vertex per triangle
+  vec4 clipped[4];
+  uint clippedCount = 0;
+
+  for (uint i = 0;  i < count;  i++)
+  {
+    const vec4& v = vertices[i];
+    const vec4& n = vertices[(i + 1) % count];
+
+    const float vd = v.z + v.w;
+    const float nd = n.z + n.w;
+
+    if (vd >= 0.f)
+      clipped[clippedCount++] = v;
+
+    if ((vd >= 0.f) != (nd >= 0.f))
+      clipped[clippedCount++] = mix(v, n, vd / (vd - nd));
+  }
+
+  if (clippedCount < 3)
+    return;
+
+  vec3 points[4];
+
+  for (uint i = 0;  i < clippedCount;  i++)
+  {
+    const vec4& v = clipped[i];
+
+    points[i] = vec3((v.x / v.w * 0.5f + 0.5f) * width,
+                     (v.y / v.w * 0.5f + 0.5f) * height,
+                     v.z / v.w);
+  }
+
+  for (uint i = 2;  i < clippedCount;  i++)
+    addTriangle(points[0], points[i - 1], points[i]);
+}
+
+void OcclusionBuffer::addTriangle(const vec3& a, const vec3& b, const vec3& c)
+{
+  const float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  if (area <= 0.f)
+    return;
+
+  // Pixel centers lie at half-integer coordinates
+  const int x0 = max(int(ceil(min(a.x, min(b.x, c.x)) - 0.5f)), 0);
+  const int y0 = max(int(ceil(min(a.y, min(b.y, c.y)) - 0.5f)), 0);
+  const int x1 = min(int(floor(max(a.x, max(b.x, c.x)) - 0.5f)), int(width) - 1);
+  const int y1 = min(int(floor(max(a.y, max(b.y, c.y)) - 0.5f)), int(height) - 1);
+
+  if (x0 > x1 || y0 > y1)
+    return;
+
+  const Edge ab(a, b), bc(b, c), ca(c, a);
+
+  // Depth is interpolated with the barycentric weights given by the edge
+  // functions opposite each vertex
+  const float za = (bc.a * a.z + ca.a * b.z + ab.a * c.z) / area;
+  const float zb = (bc.b * a.z + ca.b * b.z + ab.b * c.z) / area;
+  const float zc = (bc.c * a.z + ca.c * b.z + ab.c * c.z) / area;
+
+#if WENDY_USE_SSE
+  const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  const __m128 zero = _mm_setzero_ps();
+
+  // The width is a whole number of tiles, so aligning the start to four
+  // pixels never runs past the end of a row
+  const int start = x0 & ~3;
+
+  for (int y = y0;  y <= y1;  y++)
+  {
+    const float py = y + 0.5f;
+
+    const __m128 rowAB = _mm_set1_ps(ab.b * py + ab.c);
+    const __m128 rowBC = _mm_set1_ps(bc.b * py + bc.c);
+    const __m128 rowCA = _mm_set1_ps(ca.b * py + ca.c);
+    const __m128 rowZ = _mm_set1_ps(zb * py + zc);
+
+    float* row = &depths[y * width];
+
+    for (int x = start;  x <= x1;  x += 4)
+    {
+      const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+
+      const __m128 eab = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ab.a), px), rowAB);
+      const __m128 ebc = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(bc.a), px), rowBC);
+      const __m128 eca = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ca.a), px), rowCA);
+
+      __m128 mask = _mm_cmpge_ps(eab, zero);
+      mask = _mm_and_ps(mask, _mm_cmpge_ps(ebc, zero));
+      mask = _mm_and_ps(mask, _mm_cmpge_ps(eca, zero));
+
+      if (!_mm_movemask_ps(mask))
+        continue;
+
+      const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), rowZ);
+      const __m128 previous = _mm_loadu_ps(row + x);
+      const __m128 nearest = _mm_min_ps(previous, z);
+
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, nearest),
+                                       _mm_andnot_ps(mask, previous)));
+    }
+  }
+#else
+  for (int y = y0;  y <= y1;  y++)
+  {
+    const float py = y + 0.5f;
+
+    float* row = &depths[y * width];
+
+    for (int x = x0;  x <= x1;  x++)
+    {
+      const float px = x + 0.5f;
+
+      if (ab.a * px + ab.b * py + ab.c < 0.f ||
+          bc.a * px + bc.b * py + bc.c < 0.f ||
+          ca.a * px + ca.b * py + ca.c < 0.f)
+      {
+        continue;
+      }
+
+      row[x] = min(row[x], za * px + zb * py + zc);
+    }
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////
+
+} /*namespace wendy*/
+
+///////////////////////////////////////////////////////////////////////
@@ -220,6 +220,23 @@ bool Path::isDirectory() const
   return S_ISDIR(sb.st_mode) ? true : false;
 }
 
+Time Path::getModificationTime() const
+{
+#if WENDY_SYSTEM_WIN32
+  struct _stati64 sb;
+
+  if (_stati64(path.c_str(), &sb) != 0)
+    return 0.0;
+#else
+  struct stat64 sb;
+
+  if (stat64(path.c_str(), &sb) != 0)
+    return 0.0;
+#endif
+
+  return Time(sb.st_mtime);
+}
+
 Path Path::getParent() const
 {
   // TODO: Fix this.
@@ -134,65 +134,83 @@ void Font::drawText(const vec2& penPosition, const vec4& color, const char* text
     return;
 
   GL::VertexRange vertexRange;
-  if (!pool->allocateVertices(vertexRange, length * 6, Vertex2ft2fv::format))
+
+  Vertex2ft2fv* vertices = (Vertex2ft2fv*) pool->lockVertices(vertexRange,
+                                                              length * 6,
+                                                              Vertex2ft2fv::format);
+  if (!vertices)
   {
     logError("Failed to allocate vertices for text drawing");
     return;
   }
 
-  uint count = 0;
+  const uint count = realizeVertices(vertices, penPosition, text);
 
-  // Realize vertices for glyphs
-  {
-    vec2 roundedPen;
-    roundedPen.x = floor(penPosition.x + 0.5f);
-    roundedPen.y = floor(penPosition.y + 0.5f);
+  vertexRange.unlock();
 
-    vertices.resize(length * 6);
+  if (!count)
+    return;
 
-    Layout layout;
+  drawVertices(GL::PrimitiveRange(GL::TRIANGLE_LIST,
+                                  *vertexRange.getVertexBuffer(),
+                                  vertexRange.getStart(),
+                                  count),
+               color);
+}
+
+uint Font::realizeVertices(Vertex2ft2fv* vertices,
+                           const vec2& penPosition,
+                           const char* text) const
+{
+  uint count = 0;
+
+  vec2 roundedPen;
+  roundedPen.x = floor(penPosition.x + 0.5f);
+  roundedPen.y = floor(penPosition.y + 0.5f);
 
-    for (const char* c = text;  *c != '\0';  c++)
+  Layout layout;
+  Vertex2ft2fv quad[4];
+
+  for (const char* c = text;  *c != '\0';  c++)
+  {
+    if (const Glyph* glyph = findGlyph(*c))
     {
-      if (const Glyph* glyph = findGlyph(*c))
-      {
-        getGlyphLayout(layout, *glyph, *c);
-        layout.area.position += roundedPen;
-        roundedPen += layout.advance;
-
-        const Rect& pa = layout.area;
-        const Rect& ta = glyph->area;
-
-        vertices[count + 0].texCoord = ta.position;
-        vertices[count + 0].position = pa.position;
-        vertices[count + 1].texCoord = ta.position + vec2(ta.size.x, 0.f);
-        vertices[count + 1].position = pa.position + vec2(pa.size.x, 0.f);
-        vertices[count + 2].texCoord = ta.position + ta.size;
-        vertices[count + 2].position = pa.position + pa.size;
-
-        vertices[count + 3] = vertices[count + 2];
-        vertices[count + 4].texCoord = ta.position + vec2(0.f, ta.size.y);
-        vertices[count + 4].position = pa.position + vec2(0.f, pa.size.y);
-        vertices[count + 5] = vertices[count + 0];
-
-        count += 6;
-      }
+      getGlyphLayout(layout, *glyph, *c);
+      layout.area.position += roundedPen;
+      roundedPen += layout.advance;
+
+      const Rect& pa = layout.area;
+      const Rect& ta = glyph->area;
+
+      quad[0].texCoord = ta.position;
+      quad[0].position = pa.position;
+      quad[1].texCoord = ta.position + vec2(ta.size.x, 0.f);
+      quad[1].position = pa.position + vec2(pa.size.x, 0.f);
+      quad[2].texCoord = ta.position + ta.size;
+      quad[2].position = pa.position + pa.size;
+      quad[3].texCoord = ta.position + vec2(0.f, ta.size.y);
+      quad[3].position = pa.position + vec2(0.f, pa.size.y);
+
+      vertices[count + 0] = quad[0];
+      vertices[count + 1] = quad[1];
+      vertices[count + 2] = quad[2];
+      vertices[count + 3] = quad[2];
+      vertices[count + 4] = quad[3];
+      vertices[count + 5] = quad[0];
+
+      count += 6;
     }
-
-    vertexRange.copyFrom(&vertices[0]);
   }
 
-  if (!count)
-    return;
+  return count;
+}
 
+void Font::drawVertices(const GL::PrimitiveRange& range, const vec4& color)
+{
   pass.setUniformState(colorIndex, color);
   pass.apply();
 
-  GL::Context& context = pool->getContext();
-  context.render(GL::PrimitiveRange(GL::TRIANGLE_LIST,
-                                    *vertexRange.getVertexBuffer(),
-                                    vertexRange.getStart(),
-                                    count));
+  pool->getContext().render(range);
 }
 
 float Font::getWidth() const
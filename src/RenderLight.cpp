@@ -26,10 +26,26 @@
 #include <wendy/Config.h>
 
 #include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Rect.h>
+#include <wendy/Pixel.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Image.h>
+
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
 
 #include <wendy/RenderLight.h>
 
 #include <algorithm>
+#include <cfloat>
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -40,6 +56,21 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+namespace
+{
+
+// Width of the light and index textures, in texels, which must match the one
+// in wendy/LightGrid.glsl
+const uint TEXTURE_WIDTH = 1024;
+
+// Smallest ratio of the first slice depth to the far plane depth, keeping the
+// slices of orthographic cameras with a near plane at or behind the eye sane
+const float MIN_SLICE_RATIO = 0.001f;
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
 Light::Light():
   type(DIRECTIONAL),
   radius(10.f),
@@ -98,6 +129,456 @@ void Light::setDirection(const vec3& newDirection)
   direction = newDirection;
 }
 
+///////////////////////////////////////////////////////////////////////
+
+LightClusters::LightClusters(uint initCountX, uint initCountY, uint initCountZ):
+  countX(initCountX),
+  countY(initCountY),
+  countZ(initCountZ),
+  depthScale(0.f),
+  depthBias(0.f),
+  farZ(0.f)
+{
+  assert(countX);
+  assert(countY);
+  assert(countZ);
+
+  offsets.assign(countX * countY * countZ + 1, 0);
+}
+
+void LightClusters::assign(const LightList& lights, const Camera& camera)
+{
+  float nearZ, newFarZ;
+
+  if (camera.isPerspective())
+  {
+    nearZ = camera.getNearZ();
+    newFarZ = camera.getFarZ();
+  }
+  else
+  {
+    float minX, minY, maxX, maxY;
+    camera.getOrthoVolume().getBounds(minX, minY, nearZ, maxX, maxY, newFarZ);
+  }
+
+  const float sliceNearZ = max(nearZ, newFarZ * MIN_SLICE_RATIO);
+  const mat4 newProjection = camera.getProjectionMatrix();
+
+  if (newProjection != projection || newFarZ != farZ || minimums.empty())
+  {
+    depthScale = countZ / glm::log(newFarZ / sliceNearZ);
+    depthBias = -glm::log(sliceNearZ) * depthScale;
+
+    updateClusterBounds(newProjection, nearZ, sliceNearZ, newFarZ);
+  }
+
+  const uint clusterCount = countX * countY * countZ;
+  const mat4 view = camera.getViewTransform();
+  const bool perspective = camera.isPerspective();
+
+  lightData.clear();
+  pairs.clear();
+
+  for (auto l = lights.begin();  l != lights.end();  l++)
+  {
+    const Light& light = **l;
+    if (light.getType() == Light::DIRECTIONAL)
+      continue;
+
+    const vec3 center = vec3(view * vec4(light.getPosition(), 1.f));
+    const float radius = light.getRadius();
+
+    const float minDepth = -center.z - radius;
+    const float maxDepth = -center.z + radius;
+    if (maxDepth < nearZ || minDepth > farZ)
+      continue;
+
+    // Find the window space bounds of the light from the corners of its view
+    // space bounding box
+    vec2 minNDC(-1.f), maxNDC(1.f);
+
+    if (!perspective || minDepth > nearZ)
+    {
+      minNDC = vec2(FLT_MAX);
+      maxNDC = vec2(-FLT_MAX);
+
+      for (uint i = 0;  i < 8;  i++)
+      {
+        const vec4 corner(center.x + ((i & 1) ? radius : -radius),
+                          center.y + ((i & 2) ? radius : -radius),
+                          center.z + ((i & 4) ? radius : -radius),
+                          1.f);
+
+        const vec4 clip = projection * corner;
+        const vec2 ndc = vec2(clip) / clip.w;
+
+        minNDC = min(minNDC, ndc);
+        maxNDC = max(maxNDC, ndc);
+      }
+
+      if (maxNDC.x < -1.f || minNDC.x > 1.f || maxNDC.y < -1.f || minNDC.y > 1.f)
+        continue;
+    }
+
+    const uint x0 = uint(clamp(int((minNDC.x + 1.f) * 0.5f * countX), 0, int(countX) - 1));
+    const uint x1 = uint(clamp(int((maxNDC.x + 1.f) * 0.5f * countX), 0, int(countX) - 1));
+    const uint y0 = uint(clamp(int((minNDC.y + 1.f) * 0.5f * countY), 0, int(countY) - 1));
+    const uint y1 = uint(clamp(int((maxNDC.y + 1.f) * 0.5f * countY), 0, int(countY) - 1));
+
+    // The slice of a depth in front of the first slice is clamped to it, the
+    // same as in the shader
+    const float logMin = glm::log(max(minDepth, sliceNearZ));
+    const float logMax = glm::log(max(maxDepth, sliceNearZ));
+    const uint z0 = uint(clamp(int(logMin * depthScale + depthBias), 0, int(countZ) - 1));
+    const uint z1 = uint(clamp(int(logMax * depthScale + depthBias), 0, int(countZ) - 1));
+
+    const uint index = (uint) lightData.size() / 3;
+    const float radiusSquared = radius * radius;
+    bool assigned = false;
+
+    for (uint z = z0;  z <= z1;  z++)
+    {
+      for (uint y = y0;  y <= y1;  y++)
+      {
+        for (uint x = x0;  x <= x1;  x++)
+        {
+          const uint cluster = (z * countY + y) * countX + x;
+
+          // Squared distance from the light to the cluster bounds
+          const vec3 nearest = clamp(center, minimums[cluster], maximums[cluster]);
+          const vec3 offset = nearest - center;
+          if (dot(offset, offset) > radiusSquared)
+            continue;
+
+          pairs.push_back(cluster);
+          pairs.push_back(index);
+          assigned = true;
+        }
+      }
+    }
+
+    if (!assigned)
+      continue;
+
+    const vec3 direction = vec3(view * vec4(light.getDirection(), 0.f));
+
+    lightData.push_back(vec4(center, radius));
+    lightData.push_back(vec4(light.getColor(), float(light.getType())));
+    lightData.push_back(vec4(direction, 0.f));
+  }
+
+  // Sort the (cluster, light) pairs by cluster with a counting sort, which
+  // keeps the lights of each cluster in order
+
+  offsets.assign(clusterCount + 1, 0);
+
+  for (size_t i = 0;  i < pairs.size();  i += 2)
+    offsets[pairs[i] + 1]++;
+
+  for (uint i = 0;  i < clusterCount;  i++)
+    offsets[i + 1] += offsets[i];
+
+  indices.resize(pairs.size() / 2);
+
+  for (size_t i = 0;  i < pairs.size();  i += 2)
+    indices[offsets[pairs[i]]++] = pairs[i + 1];
+
+  // Each offset now points to the end of its cluster, i.e. the start of the
+  // next one
+
+  for (uint i = clusterCount;  i > 0;  i--)
+    offsets[i] = offsets[i - 1];
+
+  offsets[0] = 0;
+}
+
+uint LightClusters::getCountX() const
+{
+  return countX;
+}
+
+uint LightClusters::getCountY() const
+{
+  return countY;
+}
+
+uint LightClusters::getCountZ() const
+{
+  return countZ;
+}
+
+uint LightClusters::getLightCount() const
+{
+  return (uint) lightData.size() / 3;
+}
+
+uint LightClusters::getIndexCount() const
+{
+  return (uint) indices.size();
+}
+
+uint LightClusters::getClusterLightCount(uint x, uint y, uint z) const
+{
+  assert(x < countX);
+  assert(y < countY);
+  assert(z < countZ);
+
+  const uint cluster = (z * countY + y) * countX + x;
+  return offsets[cluster + 1] - offsets[cluster];
+}
+
+const uint32* LightClusters::getClusterLights(uint x, uint y, uint z) const
+{
+  assert(x < countX);
+  assert(y < countY);
+  assert(z < countZ);
+
+  const uint cluster = (z * countY + y) * countX + x;
+  if (offsets[cluster] == offsets[cluster + 1])
+    return NULL;
+
+  return &indices[offsets[cluster]];
+}
+
+float LightClusters::getDepthScale() const
+{
+  return depthScale;
+}
+
+float LightClusters::getDepthBias() const
+{
+  return depthBias;
+}
+
+void LightClusters::updateClusterBounds(const mat4& newProjection,
+                                        float nearZ,
+                                        float sliceNearZ,
+                                        float newFarZ)
+{
+  projection = newProjection;
+  farZ = newFarZ;
+
+  // Find the view space lines through the corners of the clusters, given by
+  // their points on the near and far planes
+
+  const mat4 inverse = glm::inverse(projection);
+
+  std::vector<vec3> nearPoints((countX + 1) * (countY + 1));
+  std::vector<vec3> farPoints((countX + 1) * (countY + 1));
+
+  for (uint y = 0;  y <= countY;  y++)
+  {
+    for (uint x = 0;  x <= countX;  x++)
+    {
+      const vec2 ndc(x * 2.f / countX - 1.f, y * 2.f / countY - 1.f);
+
+      const vec4 nearPoint = inverse * vec4(ndc, -1.f, 1.f);
+      const vec4 farPoint = inverse * vec4(ndc, 1.f, 1.f);
+
+      nearPoints[y * (countX + 1) + x] = vec3(nearPoint) / nearPoint.w;
+      farPoints[y * (countX + 1) + x] = vec3(farPoint) / farPoint.w;
+    }
+  }
+
+  const uint clusterCount = countX * countY * countZ;
+
+  minimums.resize(clusterCount);
+  maximums.resize(clusterCount);
+
+  for (uint z = 0;  z < countZ;  z++)
+  {
+    // The first slice also covers everything in front of it
+    float depths[2];
+    depths[0] = z ? sliceNearZ * glm::pow(farZ / sliceNearZ, float(z) / countZ) : nearZ;
+    depths[1] = sliceNearZ * glm::pow(farZ / sliceNearZ, float(z + 1) / countZ);
+
+    for (uint y = 0;  y < countY;  y++)
+    {
+      for (uint x = 0;  x < countX;  x++)
+      {
+        vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+
+        for (uint i = 0;  i < 8;  i++)
+        {
+          const uint line = (y + ((i >> 1) & 1)) * (countX + 1) + x + (i & 1);
+
+          const vec3& n = nearPoints[line];
+          const vec3& f = farPoints[line];
+
+          const float t = (-depths[i >> 2] - n.z) / (f.z - n.z);
+          const vec3 point = n + (f - n) * t;
+
+          minimum = min(minimum, point);
+          maximum = max(maximum, point);
+        }
+
+        const uint cluster = (z * countY + y) * countX + x;
+        minimums[cluster] = minimum;
+        maximums[cluster] = maximum;
+      }
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+
+bool LightGrid::upload()
+{
+  // The light data is stored three texels per light, in rows of fixed width
+  {
+    const uint texelCount = (uint) lightData.size();
+    const uint height = max((texelCount + TEXTURE_WIDTH - 1) / TEXTURE_WIDTH, 1u);
+
+    lightData.resize(TEXTURE_WIDTH * height);
+
+    const bool result = updateTexture(lightTexture,
+                                      PixelFormat::RGBA32F,
+                                      TEXTURE_WIDTH,
+                                      height,
+                                      &lightData[0]);
+
+    lightData.resize(texelCount);
+
+    if (!result)
+      return false;
+  }
+
+  // The cluster texture holds the index list offset and light count of each
+  // cluster, with the slices stacked vertically
+  {
+    const uint clusterCount = getCountX() * getCountY() * getCountZ();
+
+    staging.resize(clusterCount * 2);
+
+    for (uint i = 0;  i < clusterCount;  i++)
+    {
+      staging[i * 2 + 0] = float(offsets[i]);
+      staging[i * 2 + 1] = float(offsets[i + 1] - offsets[i]);
+    }
+
+    if (!updateTexture(clusterTexture,
+                       PixelFormat::LA32F,
+                       getCountX(),
+                       getCountY() * getCountZ(),
+                       &staging[0]))
+    {
+      return false;
+    }
+  }
+
+  // The index list is stored one index per texel, in rows of fixed width
+  {
+    const uint height = max(((uint) indices.size() + TEXTURE_WIDTH - 1) / TEXTURE_WIDTH, 1u);
+
+    staging.assign(TEXTURE_WIDTH * height, 0.f);
+    std::copy(indices.begin(), indices.end(), staging.begin());
+
+    if (!updateTexture(indexTexture,
+                       PixelFormat::L32F,
+                       TEXTURE_WIDTH,
+                       height,
+                       &staging[0]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+GL::Texture* LightGrid::getLightTexture() const
+{
+  return lightTexture;
+}
+
+GL::Texture* LightGrid::getClusterTexture() const
+{
+  return clusterTexture;
+}
+
+GL::Texture* LightGrid::getIndexTexture() const
+{
+  return indexTexture;
+}
+
+GL::Context& LightGrid::getContext() const
+{
+  return context;
+}
+
+Ref<LightGrid> LightGrid::create(GL::Context& context,
+                                 uint countX,
+                                 uint countY,
+                                 uint countZ)
+{
+  if (!countX || !countY || !countZ)
+  {
+    logError("Cannot create light grid with no clusters");
+    return NULL;
+  }
+
+  return new LightGrid(context, countX, countY, countZ);
+}
+
+LightGrid::LightGrid(GL::Context& initContext,
+                     uint countX,
+                     uint countY,
+                     uint countZ):
+  LightClusters(countX, countY, countZ),
+  context(initContext)
+{
+}
+
+bool LightGrid::updateTexture(Ref<GL::Texture>& texture,
+                              const PixelFormat& format,
+                              uint width,
+                              uint height,
+                              const void* data)
+{
+  ResourceCache& cache = context.getCache();
+
+  Ref<Image> image = Image::create(ResourceInfo(cache), format, width, height, 1, data);
+  if (!image)
+    return false;
+
+  // Textures are only recreated when they grow, at which point their height
+  // is doubled to make that rare
+
+  if (texture && texture->getWidth() == width && texture->getHeight() >= height)
+    return texture->getImage().copyFrom(*image);
+
+  uint capacity = 1;
+  while (capacity < height)
+    capacity *= 2;
+
+  if (capacity != height)
+  {
+    image = Image::create(ResourceInfo(cache), format, width, capacity);
+    if (!image)
+      return false;
+  }
+
+  GL::TextureParams params(GL::TEXTURE_RECT);
+  params.mipmapped = false;
+
+  texture = GL::Texture::create(ResourceInfo(cache), context, params, *image);
+  if (!texture)
+    return false;
+
+  texture->setFilterMode(GL::FILTER_NEAREST);
+
+  if (capacity != height)
+  {
+    image = Image::create(ResourceInfo(cache), format, width, height, 1, data);
+    if (!image)
+      return false;
+
+    return texture->getImage().copyFrom(*image);
+  }
+
+  return true;
+}
+
 ///////////////////////////////////////////////////////////////////////
 
   } /*namespace render*/
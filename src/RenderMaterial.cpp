@@ -139,6 +139,7 @@ void initializeMaps()
   if (systemTypeMap.isEmpty())
   {
     systemTypeMap["forward"] = System::FORWARD;
+    systemTypeMap["deferred"] = System::DEFERRED;
   }
 
   if (phaseMap.isEmpty())
@@ -149,6 +150,38 @@ void initializeMaps()
   }
 }
 
+// Loads the specified material file and checks its version, returning its
+// root element, or an empty node if this failed
+pugi::xml_node loadMaterialDocument(pugi::xml_document& document,
+                                    const String& name,
+                                    const Path& path)
+{
+  std::ifstream stream(path.asString().c_str());
+  if (stream.fail())
+  {
+    logError("Failed to open material \'%s\'", name.c_str());
+    return pugi::xml_node();
+  }
+
+  const pugi::xml_parse_result result = document.load(stream);
+  if (!result)
+  {
+    logError("Failed to load material \'%s\': %s",
+             name.c_str(),
+             result.description());
+    return pugi::xml_node();
+  }
+
+  pugi::xml_node root = document.child("material");
+  if (!root || root.attribute("version").as_uint() != MATERIAL_XML_VERSION)
+  {
+    logError("Material file format mismatch in \'%s\'", name.c_str());
+    return pugi::xml_node();
+  }
+
+  return root;
+}
+
 } /*namespace*/
 
 ///////////////////////////////////////////////////////////////////////
@@ -502,6 +535,69 @@ Ref<Material> Material::read(System& system, const String& name)
   return reader.read(name);
 }
 
+ResourceLoader::JobList Material::prefetchImages(ResourceLoader& loader,
+                                                 System& system,
+                                                 const String& name)
+{
+  initializeMaps();
+
+  ResourceLoader::JobList jobs;
+
+  ResourceCache& cache = loader.getCache();
+
+  // Any errors are left for the reading of the material to report
+
+  if (cache.find<Material>(name))
+    return jobs;
+
+  const Path path = cache.findFile(name);
+  if (path.isEmpty())
+    return jobs;
+
+  pugi::xml_document document;
+
+  pugi::xml_node root = loadMaterialDocument(document, name, path);
+  if (!root)
+    return jobs;
+
+  // The techniques are selected the same way as when reading the material
+
+  std::vector<bool> phases(2, false);
+
+  for (pugi::xml_node t = root.child("technique");  t;  t = t.next_sibling("technique"))
+  {
+    const String phaseName(t.attribute("phase").value());
+    if (!phaseMap.hasKey(phaseName))
+      continue;
+
+    const Phase phase = phaseMap[phaseName];
+    if (phases[phase])
+      continue;
+
+    const String typeName(t.attribute("type").value());
+    if (!systemTypeMap.hasKey(typeName))
+      continue;
+
+    if (system.getType() != systemTypeMap[typeName])
+      continue;
+
+    for (pugi::xml_node p = t.child("pass");  p;  p = p.next_sibling("pass"))
+    {
+      pugi::xml_node program = p.child("program");
+
+      for (pugi::xml_node s = program.child("sampler");  s;  s = s.next_sibling("sampler"))
+      {
+        if (pugi::xml_attribute a = s.attribute("image"))
+          jobs.push_back(loader.prefetch<Image>(a.value()));
+      }
+
+      phases[phase] = true;
+    }
+  }
+
+  return jobs;
+}
+
 Material::Material(const ResourceInfo& info):
   Resource(info)
 {
@@ -518,30 +614,11 @@ MaterialReader::MaterialReader(System& initSystem):
 
 Ref<Material> MaterialReader::read(const String& name, const Path& path)
 {
-  std::ifstream stream(path.asString().c_str());
-  if (stream.fail())
-  {
-    logError("Failed to open material \'%s\'", name.c_str());
-    return NULL;
-  }
-
   pugi::xml_document document;
 
-  const pugi::xml_parse_result result = document.load(stream);
-  if (!result)
-  {
-    logError("Failed to load material \'%s\': %s",
-             name.c_str(),
-             result.description());
-    return NULL;
-  }
-
-  pugi::xml_node root = document.child("material");
-  if (!root || root.attribute("version").as_uint() != MATERIAL_XML_VERSION)
-  {
-    logError("Material file format mismatch in \'%s\'", name.c_str());
+  pugi::xml_node root = loadMaterialDocument(document, name, path);
+  if (!root)
     return NULL;
-  }
 
   std::vector<bool> phases(2, false);
 
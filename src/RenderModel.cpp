@@ -45,6 +45,9 @@
 #include <wendy/RenderScene.h>
 #include <wendy/RenderModel.h>
 
+#include <algorithm>
+#include <thread>
+
 #include <pugixml.hpp>
 
 ///////////////////////////////////////////////////////////////////////
@@ -61,20 +64,95 @@ namespace
 
 const uint MODEL_XML_VERSION = 3;
 
+// Levels of detail are generated down to this number of triangles
+const size_t MIN_LEVEL_TRIANGLE_COUNT = 64;
+
+// The fraction of the viewport height below which the first simplified level
+// is used, with each following level used below half the previous fraction
+const float LEVEL_SIZE_THRESHOLD = 0.5f;
+
+// The fraction of a level boundary that the projected size must move past it
+// before a different level is selected
+const float LEVEL_HYSTERESIS = 0.1f;
+
+// Loads the specified model file and checks its version and mesh, returning
+// its root element, or an empty node if this failed
+pugi::xml_node loadModelDocument(pugi::xml_document& document,
+                                 const String& name,
+                                 const Path& path)
+{
+  std::ifstream stream(path.asString().c_str());
+  if (stream.fail())
+  {
+    logError("Failed to open model \'%s\'", name.c_str());
+    return pugi::xml_node();
+  }
+
+  const pugi::xml_parse_result result = document.load(stream);
+  if (!result)
+  {
+    logError("Failed to load model \'%s\': %s",
+             name.c_str(),
+             result.description());
+    return pugi::xml_node();
+  }
+
+  pugi::xml_node root = document.child("model");
+  if (!root || root.attribute("version").as_uint() != MODEL_XML_VERSION)
+  {
+    logError("Model file format mismatch in \'%s\'", name.c_str());
+    return pugi::xml_node();
+  }
+
+  if (!*root.attribute("mesh").value())
+  {
+    logError("No mesh for model \'%s\'", name.c_str());
+    return pugi::xml_node();
+  }
+
+  return root;
+}
+
+template <typename T>
+bool copyIndices(GL::IndexRange& range, const std::vector<MeshTriangle>& triangles)
+{
+  GL::IndexRangeLock<T> indices(range);
+  if (!indices)
+    return false;
+
+  size_t index = 0;
+
+  for (auto t = triangles.begin();  t != triangles.end();  t++)
+  {
+    indices[index++] = T(t->indices[0]);
+    indices[index++] = T(t->indices[1]);
+    indices[index++] = T(t->indices[2]);
+  }
+
+  return true;
+}
+
 } /*namespace*/
 
 ///////////////////////////////////////////////////////////////////////
 
-ModelSection::ModelSection(const GL::IndexRange& initRange,
+ModelSection::ModelSection(uint initStart,
+                           uint initCount,
                            Material* initMaterial):
-  range(initRange),
+  start(initStart),
+  count(initCount),
   material(initMaterial)
 {
 }
 
-const GL::IndexRange& ModelSection::getIndexRange() const
+uint ModelSection::getStart() const
+{
+  return start;
+}
+
+uint ModelSection::getCount() const
 {
-  return range;
+  return count;
 }
 
 Material* ModelSection::getMaterial() const
@@ -89,20 +167,95 @@ void ModelSection::setMaterial(Material* newMaterial)
 
 ///////////////////////////////////////////////////////////////////////
 
+Model::~Model()
+{
+  if (block)
+    arena->release(block);
+}
+
 void Model::enqueue(Scene& scene, const Camera& camera, const Transform3& transform) const
 {
+  uint level = 0;
+  enqueue(scene, camera, transform, level);
+}
+
+void Model::enqueue(Scene& scene,
+                    const Camera& camera,
+                    const Transform3& transform,
+                    uint& level) const
+{
+  level = selectLevel(camera, transform, level);
+
+  const ModelSectionList& sections = levels[level];
+
+  const GL::VertexRange vertexRange = arena->getVertexRange(block);
+  const GL::IndexRange indexRange = arena->getIndexRange(block);
+
+  // Apply the decoding of vertex positions before the model transform
+  const Transform3 vertexToWorld(transform * vertexTransform.position,
+                                 transform.rotation,
+                                 transform.scale * vertexTransform.scale);
+
   for (auto s = sections.begin();  s != sections.end();  s++)
   {
     Material* material = s->getMaterial();
     if (!material)
       continue;
 
-    GL::PrimitiveRange range(GL::TRIANGLE_LIST, *vertexBuffer, s->getIndexRange());
+    GL::PrimitiveRange range(GL::TRIANGLE_LIST,
+                             *vertexRange.getVertexBuffer(),
+                             *indexRange.getIndexBuffer(),
+                             indexRange.getStart() + s->getStart(),
+                             s->getCount(),
+                             vertexRange.getStart());
 
     float depth = camera.getNormalizedDepth(transform.position + boundingSphere.center);
 
-    scene.createOperations(transform, range, *material, depth);
+    scene.createOperations(vertexToWorld, range, *material, depth);
+  }
+}
+
+uint Model::selectLevel(const Camera& camera,
+                        const Transform3& transform,
+                        uint previousLevel) const
+{
+  const uint count = uint(levels.size());
+  if (count == 1)
+    return 0;
+
+  const vec3 center = transform * boundingSphere.center;
+  const float radius = boundingSphere.radius * transform.scale;
+
+  float size;
+
+  if (camera.isPerspective())
+  {
+    const float distance = length(center - camera.getTransform().position);
+    if (distance <= radius)
+      return 0;
+
+    size = radius / (distance * std::tan(radians(camera.getFOV()) / 2.f));
+  }
+  else
+    size = radius / (camera.getOrthoVolume().size.y / 2.f);
+
+  // The boundary between levels i and i + 1 lies at LEVEL_SIZE_THRESHOLD / 2^i
+
+  uint level = std::min(previousLevel, count - 1);
+
+  while (level + 1 < count &&
+         size < LEVEL_SIZE_THRESHOLD / float(1 << level) * (1.f - LEVEL_HYSTERESIS))
+  {
+    level++;
+  }
+
+  while (level > 0 &&
+         size > LEVEL_SIZE_THRESHOLD / float(1 << (level - 1)) * (1.f + LEVEL_HYSTERESIS))
+  {
+    level--;
   }
+
+  return level;
 }
 
 const AABB& Model::getBoundingAABB() const
@@ -115,45 +268,49 @@ const Sphere& Model::getBoundingSphere() const
   return boundingSphere;
 }
 
-const ModelSectionList& Model::getSections()
+uint Model::getLevelCount() const
 {
-  return sections;
+  return uint(levels.size());
 }
 
-GL::VertexBuffer& Model::getVertexBuffer()
+const ModelSectionList& Model::getSections(uint level) const
 {
-  return *vertexBuffer;
+  return levels[level];
 }
 
-const GL::VertexBuffer& Model::getVertexBuffer() const
+const Transform3& Model::getVertexTransform() const
 {
-  return *vertexBuffer;
+  return vertexTransform;
 }
 
-GL::IndexBuffer& Model::getIndexBuffer()
+GL::VertexRange Model::getVertexRange() const
 {
-  return *indexBuffer;
+  return arena->getVertexRange(block);
 }
 
-const GL::IndexBuffer& Model::getIndexBuffer() const
+GL::IndexRange Model::getIndexRange() const
 {
-  return *indexBuffer;
+  return arena->getIndexRange(block);
 }
 
 Ref<Model> Model::create(const ResourceInfo& info,
                          System& system,
                          const Mesh& data,
-                         const MaterialMap& materials)
+                         const MaterialMap& materials,
+                         uint levelCount,
+                         bool compressed,
+                         bool optimized)
 {
   Ref<Model> model(new Model(info));
-  if (!model->init(system, data, materials))
+  if (!model->init(system, data, materials, levelCount, compressed, optimized))
     return NULL;
 
   return model;
 }
 
 Model::Model(const ResourceInfo& info):
-  Resource(info)
+  Resource(info),
+  block(0)
 {
 }
 
@@ -168,17 +325,22 @@ Model& Model::operator = (const Model& source)
   panic("Models may not be assigned");
 }
 
-bool Model::init(System& system, const Mesh& data, const MaterialMap& materials)
+bool Model::init(System& system,
+                 const Mesh& mesh,
+                 const MaterialMap& materials,
+                 uint levelCount,
+                 bool compressed,
+                 bool optimized)
 {
-  if (!data.isValid())
+  if (!mesh.isValid())
   {
     logError("Mesh \'%s\' for model \'%s\' is not valid",
-             data.getName().c_str(),
+             mesh.getName().c_str(),
              getName().c_str());
     return false;
   }
 
-  for (auto s = data.sections.begin();  s != data.sections.end();  s++)
+  for (auto s = mesh.sections.begin();  s != mesh.sections.end();  s++)
   {
     if (materials.find(s->materialName) == materials.end())
     {
@@ -189,98 +351,159 @@ bool Model::init(System& system, const Mesh& data, const MaterialMap& materials)
     }
   }
 
-  GL::Context& context = system.getContext();
+  // The mesh may be shared with other models, so it is optimized as a copy
 
-  VertexFormat format;
-  if (!format.createComponents("3f:vPosition 3f:vNormal 2f:vTexCoord"))
-    return false;
+  Ref<Mesh> optimizedMesh;
 
-  vertexBuffer = GL::VertexBuffer::create(context,
-                                          data.vertices.size(),
-                                          format,
-                                          GL::VertexBuffer::STATIC);
-  if (!vertexBuffer)
-    return false;
+  if (optimized)
+  {
+    optimizedMesh = new Mesh(mesh);
+
+    float oldACMR, oldATVR;
+    optimizedMesh->calculateCacheStats(oldACMR, oldATVR);
+
+    optimizedMesh->optimize();
+
+    float newACMR, newATVR;
+    optimizedMesh->calculateCacheStats(newACMR, newATVR);
+
+    log("Optimized mesh for model \'%s\': ACMR %.3f to %.3f, ATVR %.3f to %.3f",
+        getName().c_str(),
+        oldACMR, newACMR,
+        oldATVR, newATVR);
+  }
+
+  const Mesh& data = optimized ? *optimizedMesh : mesh;
+
+  boundingAABB = data.generateBoundingAABB();
+  boundingSphere = data.generateBoundingSphere();
+
+  // Each level of detail is simplified from the full detail mesh, and shares
+  // its vertices
+
+  std::vector<std::vector<MeshSection>> meshLevels(1, data.sections);
 
-  vertexBuffer->copyFrom(&data.vertices[0], data.vertices.size());
+  size_t triangleCount = data.getTriangleCount();
+  size_t indexCount = triangleCount * 3;
 
-  const size_t indexCount = data.getTriangleCount() * 3;
+  while (meshLevels.size() < levelCount)
+  {
+    const size_t targetCount = triangleCount / 2;
+    if (targetCount < MIN_LEVEL_TRIANGLE_COUNT)
+      break;
+
+    std::vector<MeshSection> sections;
+    data.simplify(sections, targetCount);
+
+    size_t count = 0;
+
+    for (auto s = sections.begin();  s != sections.end();  s++)
+      count += s->triangles.size();
+
+    // Stop if the simplifier is blocked by borders and seams
+    if (count > targetCount + targetCount / 2)
+      break;
+
+    meshLevels.push_back(sections);
+    triangleCount = count;
+    indexCount += count * 3;
+  }
+
+  const size_t vertexCount = data.vertices.size();
+
+  // The index type only needs to be wide enough for the largest index
 
   GL::IndexBuffer::Type indexType;
-  if (indexCount <= (1 << 8))
+  if (vertexCount <= (1 << 8))
     indexType = GL::IndexBuffer::UINT8;
-  else if (indexCount <= (1 << 16))
+  else if (vertexCount <= (1 << 16))
     indexType = GL::IndexBuffer::UINT16;
   else
     indexType = GL::IndexBuffer::UINT32;
 
-  indexBuffer = GL::IndexBuffer::create(context,
-                                        indexCount,
-                                        indexType,
-                                        GL::IndexBuffer::STATIC);
-  if (!indexBuffer)
+  VertexFormat format;
+  if (compressed)
+    format = Vertex2sn2ht4sv::format;
+  else if (!format.createComponents("3f:vPosition 3f:vNormal 2f:vTexCoord"))
+    return false;
+
+  arena = &system.getGeometryArena();
+
+  block = arena->allocate(format, uint(vertexCount), indexType, uint(indexCount));
+  if (!block)
     return false;
 
-  size_t start = 0;
+  GL::VertexRange vertexRange = arena->getVertexRange(block);
 
-  for (auto s = data.sections.begin();  s != data.sections.end();  s++)
+  if (compressed)
   {
-    const size_t count = s->triangles.size() * 3;
-    GL::IndexRange range(*indexBuffer, start, count);
+    // Positions are stored relative to the bounding box, uniformly scaled to
+    // fit, so that decoding them is a part of the model transform
 
-    sections.push_back(ModelSection(range, materials.find(s->materialName)->second));
+    const vec3& size = boundingAABB.size;
 
-    if (indexType == GL::IndexBuffer::UINT8)
-    {
-      GL::IndexRangeLock<uint8> indices(range);
-      if (!indices)
-        return false;
+    float extent = std::max(size.x, std::max(size.y, size.z)) / 2.f;
+    if (extent == 0.f)
+      extent = 1.f;
 
-      size_t index = 0;
+    vertexTransform.set(boundingAABB.center, quat(), extent);
 
-      for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
-      {
-        indices[index++] = t->indices[0];
-        indices[index++] = t->indices[1];
-        indices[index++] = t->indices[2];
-      }
-    }
-    else if (indexType == GL::IndexBuffer::UINT16)
-    {
-      GL::IndexRangeLock<uint16> indices(range);
-      if (!indices)
-        return false;
+    std::vector<Vertex2sn2ht4sv> vertices(vertexCount);
 
-      size_t index = 0;
+    for (size_t i = 0;  i < vertexCount;  i++)
+    {
+      const MeshVertex& source = data.vertices[i];
 
-      for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
-      {
-        indices[index++] = t->indices[0];
-        indices[index++] = t->indices[1];
-        indices[index++] = t->indices[2];
-      }
+      vertices[i].normal = Vertex2sn2ht4sv::encodeNormal(source.normal);
+      vertices[i].texCoord = hvec2(source.texcoord);
+      vertices[i].position = Vertex2sn2ht4sv::encodePosition((source.position - boundingAABB.center) / extent);
     }
-    else
+
+    vertexRange.copyFrom(&vertices[0]);
+  }
+  else
+  {
+    vertexTransform.setIdentity();
+    vertexRange.copyFrom(&data.vertices[0]);
+  }
+
+  const GL::IndexRange indexRange = arena->getIndexRange(block);
+
+  levels.resize(meshLevels.size());
+
+  uint start = 0;
+
+  for (size_t i = 0;  i < meshLevels.size();  i++)
+  {
+    for (auto s = meshLevels[i].begin();  s != meshLevels[i].end();  s++)
     {
-      GL::IndexRangeLock<uint32> indices(range);
-      if (!indices)
-        return false;
+      const uint count = uint(s->triangles.size() * 3);
+      GL::IndexRange range(*indexRange.getIndexBuffer(),
+                           indexRange.getStart() + start,
+                           count);
 
-      size_t index = 0;
+      levels[i].push_back(ModelSection(start, count, materials.find(s->materialName)->second));
 
-      for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
+      if (indexType == GL::IndexBuffer::UINT8)
       {
-        indices[index++] = t->indices[0];
-        indices[index++] = t->indices[1];
-        indices[index++] = t->indices[2];
+        if (!copyIndices<uint8>(range, s->triangles))
+          return false;
+      }
+      else if (indexType == GL::IndexBuffer::UINT16)
+      {
+        if (!copyIndices<uint16>(range, s->triangles))
+          return false;
+      }
+      else
+      {
+        if (!copyIndices<uint32>(range, s->triangles))
+          return false;
       }
-    }
 
-    start += count;
+      start += count;
+    }
   }
 
-  boundingAABB = data.generateBoundingAABB();
-  boundingSphere = data.generateBoundingSphere();
   return true;
 }
 
@@ -290,6 +513,56 @@ Ref<Model> Model::read(System& system, const String& name)
   return reader.read(name);
 }
 
+ResourceLoader::JobID Model::readAsync(ResourceLoader& loader,
+                                       System& system,
+                                       const String& name,
+                                       const std::function<void (Model&)>& callback)
+{
+  ResourceCache& cache = loader.getCache();
+
+  ResourceLoader::JobList dependencies;
+
+  // The model file is parsed here to find the mesh and material images to
+  // decode, leaving any errors for the reading of the model to report
+
+  const Path path = cache.findFile(name);
+
+  if (!cache.find<Model>(name) && !path.isEmpty())
+  {
+    pugi::xml_document document;
+
+    if (pugi::xml_node root = loadModelDocument(document, name, path))
+    {
+      dependencies.push_back(loader.prefetch<Mesh>(root.attribute("mesh").value()));
+
+      for (pugi::xml_node m = root.child("material");  m;  m = m.next_sibling("material"))
+      {
+        const ResourceLoader::JobList images =
+          Material::prefetchImages(loader, system, m.attribute("name").value());
+
+        dependencies.insert(dependencies.end(), images.begin(), images.end());
+      }
+    }
+  }
+
+  // The mesh and images are now decoded and cached, so reading only creates
+  // the model and the GL objects of its materials
+
+  auto finish = [&system, name, callback](Resource*) -> bool
+  {
+    Ref<Model> model = read(system, name);
+    if (!model)
+      return false;
+
+    if (callback)
+      callback(*model);
+
+    return true;
+  };
+
+  return loader.addJob(ResourceLoader::DecodeFunc(), finish, dependencies);
+}
+
 ///////////////////////////////////////////////////////////////////////
 
 ModelReader::ModelReader(System& initSystem):
@@ -300,39 +573,19 @@ ModelReader::ModelReader(System& initSystem):
 
 Ref<Model> ModelReader::read(const String& name, const Path& path)
 {
-  std::ifstream stream(path.asString().c_str());
-  if (stream.fail())
-  {
-    logError("Failed to open model \'%s\'", name.c_str());
-    return NULL;
-  }
-
   pugi::xml_document document;
 
-  const pugi::xml_parse_result result = document.load(stream);
-  if (!result)
-  {
-    logError("Failed to load model \'%s\': %s",
-             name.c_str(),
-             result.description());
-    return NULL;
-  }
-
-  pugi::xml_node root = document.child("model");
-  if (!root || root.attribute("version").as_uint() != MODEL_XML_VERSION)
-  {
-    logError("Model file format mismatch in \'%s\'", name.c_str());
+  pugi::xml_node root = loadModelDocument(document, name, path);
+  if (!root)
     return NULL;
-  }
 
   const String meshName(root.attribute("mesh").value());
-  if (meshName.empty())
-  {
-    logError("No mesh for model \'%s\'", name.c_str());
-    return NULL;
-  }
 
-  Ref<Mesh> mesh = Mesh::read(cache, meshName);
+  // Models are read on the calling thread, which may then use every hardware
+  // thread to parse the mesh
+  const uint threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+  Ref<Mesh> mesh = Mesh::read(cache, meshName, threadCount);
   if (!mesh)
   {
     logError("Failed to load mesh for model \'%s\'", name.c_str());
@@ -370,7 +623,17 @@ Ref<Model> ModelReader::read(const String& name, const Path& path)
     materials[materialAlias] = material;
   }
 
-  return Model::create(ResourceInfo(cache, name, path), system, *mesh, materials);
+  const uint levelCount = root.attribute("levels").as_uint(1);
+  const bool compressed = root.attribute("compressed").as_bool();
+  const bool optimized = root.attribute("optimize").as_bool();
+
+  return Model::create(ResourceInfo(cache, name, path),
+                       system,
+                       *mesh,
+                       materials,
+                       levelCount,
+                       compressed,
+                       optimized);
 }
 
 ///////////////////////////////////////////////////////////////////////
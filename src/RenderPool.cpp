@@ -32,6 +32,10 @@
 
 #include <wendy/RenderPool.h>
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
 ///////////////////////////////////////////////////////////////////////
 
 namespace wendy
@@ -41,6 +45,30 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+namespace
+{
+
+// The number of frames the GPU may lag behind before the pool blocks
+const uint FRAME_COUNT = 3;
+
+const uint NO_REGION = UINT_MAX;
+
+template <typename T>
+bool compareVertexStarts(const T* first, const T* second)
+{
+  return first->vertexStart < second->vertexStart;
+}
+
+template <typename T>
+bool compareIndexStarts(const T* first, const T* second)
+{
+  return first->indexStart < second->indexStart;
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
 bool GeometryPool::allocateIndices(GL::IndexRange& range,
                                    uint count,
                                    GL::IndexBuffer::Type type)
@@ -51,44 +79,15 @@ bool GeometryPool::allocateIndices(GL::IndexRange& range,
     return true;
   }
 
-  IndexBufferSlot* slot = NULL;
+  IndexRing* ring = findIndexRing(count, type);
+  if (!ring)
+    return false;
 
-  for (auto i = indexBufferPool.begin();  i != indexBufferPool.end();  i++)
-  {
-    if (i->indexBuffer->getType() == type && i->available >= count)
-    {
-      slot = &(*i);
-      break;
-    }
-  }
-
-  if (!slot)
-  {
-    indexBufferPool.push_back(IndexBufferSlot());
-    slot = &(indexBufferPool.back());
-
-    const uint actualCount = granularity * ((count + granularity - 1) / granularity);
-
-    slot->indexBuffer = GL::IndexBuffer::create(context,
-                                                actualCount,
-                                                type,
-                                                GL::IndexBuffer::DYNAMIC);
-    if (!slot->indexBuffer)
-    {
-      indexBufferPool.pop_back();
-      return false;
-    }
-
-    log("Allocated index pool of size %u", actualCount);
-
-    slot->available = slot->indexBuffer->getCount();
-  }
-
-  range = GL::IndexRange(*(slot->indexBuffer),
-                         slot->indexBuffer->getCount() - slot->available,
+  range = GL::IndexRange(*(ring->indexBuffer),
+                         frame * ring->capacity + ring->used,
                          count);
 
-  slot->available -= count;
+  ring->used += count;
   return true;
 }
 
@@ -102,47 +101,56 @@ bool GeometryPool::allocateVertices(GL::VertexRange& range,
     return true;
   }
 
-  VertexBufferSlot* slot = NULL;
+  VertexRing* ring = findVertexRing(count, format);
+  if (!ring)
+    return false;
 
-  for (auto i = vertexBufferPool.begin();  i != vertexBufferPool.end();  i++)
-  {
-    if (i->vertexBuffer->getFormat() == format && i->available >= count)
-    {
-      slot = &(*i);
-      break;
-    }
-  }
+  range = GL::VertexRange(*(ring->vertexBuffer),
+                          frame * ring->capacity + ring->used,
+                          count);
 
-  if (!slot)
-  {
-    vertexBufferPool.push_back(VertexBufferSlot());
-    slot = &(vertexBufferPool.back());
+  ring->used += count;
+  return true;
+}
 
-    const uint actualCount = granularity * ((count + granularity - 1) / granularity);
+void* GeometryPool::lockIndices(GL::IndexRange& range,
+                                uint count,
+                                GL::IndexBuffer::Type type)
+{
+  if (!count)
+  {
+    logError("Cannot lock empty index range");
+    return NULL;
+  }
 
-    slot->vertexBuffer = GL::VertexBuffer::create(context,
-                                                  actualCount,
-                                                  format,
-                                                  GL::VertexBuffer::DYNAMIC);
-    if (!slot->vertexBuffer)
-    {
-      vertexBufferPool.pop_back();
-      return false;
-    }
+  if (!allocateIndices(range, count, type))
+    return NULL;
 
-    log("Allocated vertex pool of size %u format \'%s\'",
-        actualCount,
-        format.asString().c_str());
+  // The GPU is done with the region, so there is nothing to wait for
+  return range.getIndexBuffer()->lock(GL::LOCK_WRITE_ONLY,
+                                      range.getStart(),
+                                      count,
+                                      false);
+}
 
-    slot->available = slot->vertexBuffer->getCount();
+void* GeometryPool::lockVertices(GL::VertexRange& range,
+                                 uint count,
+                                 const VertexFormat& format)
+{
+  if (!count)
+  {
+    logError("Cannot lock empty vertex range");
+    return NULL;
   }
 
-  range = GL::VertexRange(*(slot->vertexBuffer),
-                          slot->vertexBuffer->getCount() - slot->available,
-                          count);
+  if (!allocateVertices(range, count, format))
+    return NULL;
 
-  slot->available -= count;
-  return true;
+  // The GPU is done with the region, so there is nothing to wait for
+  return range.getVertexBuffer()->lock(GL::LOCK_WRITE_ONLY,
+                                       range.getStart(),
+                                       count,
+                                       false);
 }
 
 GL::Context& GeometryPool::getContext() const
@@ -161,24 +169,467 @@ Ref<GeometryPool> GeometryPool::create(GL::Context& context, size_t granularity)
 
 GeometryPool::GeometryPool(GL::Context& initContext):
   context(initContext),
-  granularity(0)
+  granularity(0),
+  fenced(false),
+  frame(0)
 {
+  for (size_t i = 0;  i <= GL::IndexBuffer::UINT32;  i++)
+  {
+    indexRings[i].capacity = 0;
+    indexRings[i].used = 0;
+  }
+
   context.getFinishSignal().connect(*this, &GeometryPool::onContextFinish);
 }
 
 bool GeometryPool::init(size_t initGranularity)
 {
   granularity = initGranularity;
+  fenced = GL::Fence::isSupported();
+  fences.resize(FRAME_COUNT);
+
+  if (!fenced)
+    log("Fences not supported; geometry pool will orphan its buffers");
+
   return true;
 }
 
+GeometryPool::IndexRing* GeometryPool::findIndexRing(uint count,
+                                                     GL::IndexBuffer::Type type)
+{
+  IndexRing& ring = indexRings[type];
+  if (ring.used + count <= ring.capacity)
+    return &ring;
+
+  // Earlier allocations this frame still refer to the old buffer
+  if (ring.indexBuffer)
+    retiredIndexBuffers.push_back(ring.indexBuffer);
+
+  const uint capacity = getRingCapacity(ring.capacity, count);
+
+  ring.indexBuffer = GL::IndexBuffer::create(context,
+                                             capacity * FRAME_COUNT,
+                                             type,
+                                             GL::IndexBuffer::STREAM);
+  if (!ring.indexBuffer)
+  {
+    ring.capacity = ring.used = 0;
+    return NULL;
+  }
+
+  log("Allocated index ring of size %u", capacity);
+
+  ring.capacity = capacity;
+  ring.used = 0;
+  return &ring;
+}
+
+GeometryPool::VertexRing* GeometryPool::findVertexRing(uint count,
+                                                       const VertexFormat& format)
+{
+  const uint32 hash = format.getHash();
+
+  VertexRing* ring = NULL;
+
+  for (auto r = vertexRings.begin();  r != vertexRings.end();  r++)
+  {
+    if (r->hash == hash && r->vertexBuffer->getFormat() == format)
+    {
+      ring = &(*r);
+      break;
+    }
+  }
+
+  if (ring)
+  {
+    if (ring->used + count <= ring->capacity)
+      return ring;
+
+    // Earlier allocations this frame still refer to the old buffer
+    retiredVertexBuffers.push_back(ring->vertexBuffer);
+  }
+
+  const uint capacity = getRingCapacity(ring ? ring->capacity : 0, count);
+
+  Ref<GL::VertexBuffer> vertexBuffer = GL::VertexBuffer::create(context,
+                                                                capacity * FRAME_COUNT,
+                                                                format,
+                                                                GL::VertexBuffer::STREAM);
+  if (!vertexBuffer)
+  {
+    if (ring)
+      vertexRings.erase(vertexRings.begin() + (ring - &vertexRings[0]));
+
+    return NULL;
+  }
+
+  log("Allocated vertex ring of size %u format \'%s\'",
+      capacity,
+      format.asString().c_str());
+
+  if (!ring)
+  {
+    vertexRings.push_back(VertexRing());
+    ring = &(vertexRings.back());
+    ring->hash = hash;
+  }
+
+  ring->vertexBuffer = vertexBuffer;
+  ring->capacity = capacity;
+  ring->used = 0;
+  return ring;
+}
+
+uint GeometryPool::getRingCapacity(uint current, uint count) const
+{
+  const uint required = granularity * ((count + granularity - 1) / granularity);
+  return max(current * 2, required);
+}
+
 void GeometryPool::onContextFinish()
 {
-  for (auto i = indexBufferPool.begin();  i != indexBufferPool.end();  i++)
-    i->available = i->indexBuffer->getCount();
+  if (fenced)
+    fences[frame] = GL::Fence::create(context);
+
+  frame = (frame + 1) % FRAME_COUNT;
+
+  if (fenced)
+  {
+    // Only blocks if the GPU is more than FRAME_COUNT - 1 frames behind
+    if (fences[frame])
+    {
+      fences[frame]->wait();
+      fences[frame] = NULL;
+    }
+  }
+  else
+  {
+    for (size_t i = 0;  i <= GL::IndexBuffer::UINT32;  i++)
+    {
+      if (indexRings[i].indexBuffer)
+        indexRings[i].indexBuffer->discard();
+    }
+
+    for (auto r = vertexRings.begin();  r != vertexRings.end();  r++)
+      r->vertexBuffer->discard();
+  }
+
+  for (size_t i = 0;  i <= GL::IndexBuffer::UINT32;  i++)
+    indexRings[i].used = 0;
+
+  for (auto r = vertexRings.begin();  r != vertexRings.end();  r++)
+    r->used = 0;
+
+  retiredIndexBuffers.clear();
+  retiredVertexBuffers.clear();
+}
+
+///////////////////////////////////////////////////////////////////////
+
+uint GeometryArena::allocate(const VertexFormat& format,
+                             uint vertexCount,
+                             GL::IndexBuffer::Type indexType,
+                             uint indexCount)
+{
+  if (!vertexCount)
+  {
+    logError("Cannot allocate empty geometry block");
+    return 0;
+  }
+
+  const uint vertexRegion = findVertexRegion(format, vertexCount);
+  if (vertexRegion == NO_REGION)
+    return 0;
+
+  uint indexRegion = NO_REGION;
 
-  for (auto i = vertexBufferPool.begin();  i != vertexBufferPool.end();  i++)
-    i->available = i->vertexBuffer->getCount();
+  if (indexCount)
+  {
+    indexRegion = findIndexRegion(indexType, indexCount);
+    if (indexRegion == NO_REGION)
+      return 0;
+  }
+
+  Block block;
+  block.vertexRegion = vertexRegion;
+  block.vertexStart = vertexRegions[vertexRegion].used;
+  block.vertexCount = vertexCount;
+  block.indexRegion = indexRegion;
+  block.indexStart = 0;
+  block.indexCount = indexCount;
+  block.allocated = true;
+
+  vertexRegions[vertexRegion].used += vertexCount;
+
+  if (indexRegion != NO_REGION)
+  {
+    block.indexStart = indexRegions[indexRegion].used;
+    indexRegions[indexRegion].used += indexCount;
+  }
+
+  if (freeBlocks.empty())
+  {
+    blocks.push_back(block);
+    return uint(blocks.size());
+  }
+
+  const uint index = freeBlocks.back();
+  freeBlocks.pop_back();
+
+  blocks[index] = block;
+  return index + 1;
+}
+
+void GeometryArena::release(uint ID)
+{
+  assert(ID > 0 && ID <= blocks.size());
+
+  Block& block = blocks[ID - 1];
+  assert(block.allocated);
+
+  block.allocated = false;
+  freeBlocks.push_back(ID - 1);
+
+  // Moving the remaining blocks is left for the end of the frame, as render
+  // operations already queued may refer to their current ranges
+
+  VertexRegion& vertexRegion = vertexRegions[block.vertexRegion];
+  vertexRegion.released += block.vertexCount;
+
+  if (vertexRegion.released == vertexRegion.used)
+    vertexRegion.used = vertexRegion.released = 0;
+
+  if (block.indexRegion != NO_REGION)
+  {
+    IndexRegion& indexRegion = indexRegions[block.indexRegion];
+    indexRegion.released += block.indexCount;
+
+    if (indexRegion.released == indexRegion.used)
+      indexRegion.used = indexRegion.released = 0;
+  }
+}
+
+void GeometryArena::defragment()
+{
+  defragment(true);
+}
+
+GL::VertexRange GeometryArena::getVertexRange(uint ID) const
+{
+  const Block& block = blocks[ID - 1];
+  const VertexRegion& region = vertexRegions[block.vertexRegion];
+
+  return GL::VertexRange(*region.vertexBuffer, block.vertexStart, block.vertexCount);
+}
+
+GL::IndexRange GeometryArena::getIndexRange(uint ID) const
+{
+  const Block& block = blocks[ID - 1];
+  if (block.indexRegion == NO_REGION)
+    return GL::IndexRange();
+
+  const IndexRegion& region = indexRegions[block.indexRegion];
+
+  return GL::IndexRange(*region.indexBuffer, block.indexStart, block.indexCount);
+}
+
+GL::Context& GeometryArena::getContext() const
+{
+  return context;
+}
+
+Ref<GeometryArena> GeometryArena::create(GL::Context& context, size_t bufferSize)
+{
+  return new GeometryArena(context, bufferSize);
+}
+
+GeometryArena::GeometryArena(GL::Context& initContext, size_t initBufferSize):
+  context(initContext),
+  bufferSize(initBufferSize)
+{
+  context.getFinishSignal().connect(*this, &GeometryArena::onContextFinish);
+}
+
+void GeometryArena::defragment(bool all)
+{
+  for (size_t i = 0;  i < vertexRegions.size();  i++)
+  {
+    const VertexRegion& region = vertexRegions[i];
+
+    if (region.released && (all || region.released >= region.used / 2))
+      compactVertexRegion(uint(i));
+  }
+
+  for (size_t i = 0;  i < indexRegions.size();  i++)
+  {
+    const IndexRegion& region = indexRegions[i];
+
+    if (region.released && (all || region.released >= region.used / 2))
+      compactIndexRegion(uint(i));
+  }
+}
+
+uint GeometryArena::findVertexRegion(const VertexFormat& format, uint count)
+{
+  const uint32 hash = format.getHash();
+
+  for (size_t i = 0;  i < vertexRegions.size();  i++)
+  {
+    const VertexRegion& region = vertexRegions[i];
+
+    if (region.hash == hash && region.vertexBuffer->getFormat() == format)
+    {
+      if (region.used + count <= region.vertexBuffer->getCount())
+        return uint(i);
+    }
+  }
+
+  const uint capacity = max(uint(bufferSize / format.getSize()), count);
+
+  Ref<GL::VertexBuffer> vertexBuffer = GL::VertexBuffer::create(context,
+                                                                capacity,
+                                                                format,
+                                                                GL::VertexBuffer::STATIC);
+  if (!vertexBuffer)
+    return NO_REGION;
+
+  log("Allocated static vertex buffer of size %u format \'%s\'",
+      capacity,
+      format.asString().c_str());
+
+  VertexRegion region;
+  region.hash = hash;
+  region.vertexBuffer = vertexBuffer;
+  region.used = 0;
+  region.released = 0;
+
+  vertexRegions.push_back(region);
+  return uint(vertexRegions.size() - 1);
+}
+
+uint GeometryArena::findIndexRegion(GL::IndexBuffer::Type type, uint count)
+{
+  for (size_t i = 0;  i < indexRegions.size();  i++)
+  {
+    const IndexRegion& region = indexRegions[i];
+
+    if (region.indexBuffer->getType() == type)
+    {
+      if (region.used + count <= region.indexBuffer->getCount())
+        return uint(i);
+    }
+  }
+
+  const size_t typeSize = GL::IndexBuffer::getTypeSize(type);
+  const uint capacity = max(uint(bufferSize / typeSize), count);
+
+  Ref<GL::IndexBuffer> indexBuffer = GL::IndexBuffer::create(context,
+                                                             capacity,
+                                                             type,
+                                                             GL::IndexBuffer::STATIC);
+  if (!indexBuffer)
+    return NO_REGION;
+
+  log("Allocated static index buffer of size %u", capacity);
+
+  IndexRegion region;
+  region.indexBuffer = indexBuffer;
+  region.used = 0;
+  region.released = 0;
+
+  indexRegions.push_back(region);
+  return uint(indexRegions.size() - 1);
+}
+
+bool GeometryArena::compactVertexRegion(uint index)
+{
+  VertexRegion& region = vertexRegions[index];
+
+  std::vector<Block*> moved;
+
+  for (auto b = blocks.begin();  b != blocks.end();  b++)
+  {
+    if (b->allocated && b->vertexRegion == index)
+      moved.push_back(&(*b));
+  }
+
+  std::sort(moved.begin(), moved.end(), compareVertexStarts<Block>);
+
+  // Blocks may overlap their new ranges, so they are copied into a fresh
+  // buffer rather than moved within the old one
+
+  Ref<GL::VertexBuffer> vertexBuffer =
+    GL::VertexBuffer::create(context,
+                             region.vertexBuffer->getCount(),
+                             region.vertexBuffer->getFormat(),
+                             GL::VertexBuffer::STATIC);
+  if (!vertexBuffer)
+    return false;
+
+  uint used = 0;
+
+  for (auto b = moved.begin();  b != moved.end();  b++)
+  {
+    vertexBuffer->copyFrom(*region.vertexBuffer,
+                           (*b)->vertexCount,
+                           (*b)->vertexStart,
+                           used);
+
+    (*b)->vertexStart = used;
+    used += (*b)->vertexCount;
+  }
+
+  region.vertexBuffer = vertexBuffer;
+  region.used = used;
+  region.released = 0;
+  return true;
+}
+
+bool GeometryArena::compactIndexRegion(uint index)
+{
+  IndexRegion& region = indexRegions[index];
+
+  std::vector<Block*> moved;
+
+  for (auto b = blocks.begin();  b != blocks.end();  b++)
+  {
+    if (b->allocated && b->indexRegion == index)
+      moved.push_back(&(*b));
+  }
+
+  std::sort(moved.begin(), moved.end(), compareIndexStarts<Block>);
+
+  Ref<GL::IndexBuffer> indexBuffer =
+    GL::IndexBuffer::create(context,
+                            region.indexBuffer->getCount(),
+                            region.indexBuffer->getType(),
+                            GL::IndexBuffer::STATIC);
+  if (!indexBuffer)
+    return false;
+
+  uint used = 0;
+
+  for (auto b = moved.begin();  b != moved.end();  b++)
+  {
+    indexBuffer->copyFrom(*region.indexBuffer,
+                          (*b)->indexCount,
+                          (*b)->indexStart,
+                          used);
+
+    (*b)->indexStart = used;
+    used += (*b)->indexCount;
+  }
+
+  region.indexBuffer = indexBuffer;
+  region.used = used;
+  region.released = 0;
+  return true;
+}
+
+void GeometryArena::onContextFinish()
+{
+  // Only buffers with enough released space are worth copying every frame
+  defragment(false);
 }
 
 ///////////////////////////////////////////////////////////////////////
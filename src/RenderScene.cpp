@@ -51,6 +51,29 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+namespace
+{
+
+// Number of bits of a sort key actually used by the key layout
+const uint SORT_KEY_BITS = 48;
+
+// Queue size below which radix sorting isn't worth the histogram setup
+const size_t MIN_RADIX_SORT_SIZE = 64;
+
+// Returns true if the operation at index a should be ordered before the one
+// at index b, breaking ties by insertion order as a stable sort would
+bool isOrderedBefore(const SortKeyList& keys, uint32 a, uint32 b)
+{
+  if (keys[a] != keys[b])
+    return keys[a] < keys[b];
+
+  return a < b;
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
 SortKey SortKey::makeOpaqueKey(uint8 layer, uint16 state, float depth)
 {
   SortKey key;
@@ -86,19 +109,34 @@ Queue::Queue():
 
 void Queue::addOperation(const Operation& operation, SortKey key)
 {
-  key.index = (uint16) operations.size();
   keys.push_back(key);
-
   operations.push_back(operation);
 
   sorted = false;
 }
 
+void Queue::addOperations(const Queue& other)
+{
+  if (other.operations.empty())
+    return;
+
+  operations.insert(operations.end(),
+                    other.operations.begin(),
+                    other.operations.end());
+
+  keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+
+  sorted = false;
+}
+
 void Queue::removeOperations()
 {
+  // The sorted indices are left as they are, to be used as a starting point
+  // for sorting the operations of the next frame
+
   operations.clear();
   keys.clear();
-  sorted = true;
+  sorted = false;
 }
 
 const OperationList& Queue::getOperations() const
@@ -107,14 +145,114 @@ const OperationList& Queue::getOperations() const
 }
 
 const SortKeyList& Queue::getSortKeys() const
+{
+  return keys;
+}
+
+const OperationIndexList& Queue::getSortedIndices() const
 {
   if (!sorted)
   {
-    std::sort(keys.begin(), keys.end());
+    if (!refineOrder())
+      radixSort();
+
     sorted = true;
   }
 
-  return keys;
+  return order;
+}
+
+bool Queue::refineOrder() const
+{
+  // If the queue has the same size as when it was last sorted, the previous
+  // order is likely to be nearly correct, so attempt an insertion sort with
+  // a linear budget of moves before giving up
+
+  const size_t count = keys.size();
+
+  if (order.size() != count)
+  {
+    if (count >= MIN_RADIX_SORT_SIZE)
+      return false;
+
+    order.resize(count);
+
+    for (size_t i = 0;  i < count;  i++)
+      order[i] = uint32(i);
+  }
+
+  size_t budget = count;
+
+  for (size_t i = 1;  i < count;  i++)
+  {
+    const uint32 index = order[i];
+    size_t j = i;
+
+    while (j > 0 && isOrderedBefore(keys, index, order[j - 1]))
+    {
+      if (!budget--)
+        return false;
+
+      order[j] = order[j - 1];
+      j--;
+    }
+
+    order[j] = index;
+  }
+
+  return true;
+}
+
+void Queue::radixSort() const
+{
+  // LSD radix sort of the operation indices by key, one byte per pass.  The
+  // histograms of all passes are built up front, so passes where every key
+  // has the same digit can be skipped entirely.
+
+  const size_t count = keys.size();
+  const uint passCount = SORT_KEY_BITS / 8;
+
+  std::vector<uint32> histograms(passCount * 256, 0);
+
+  for (size_t i = 0;  i < count;  i++)
+  {
+    const uint64 key = keys[i];
+
+    for (uint p = 0;  p < passCount;  p++)
+      histograms[p * 256 + ((key >> (p * 8)) & 0xff)]++;
+  }
+
+  order.resize(count);
+  scratch.resize(count);
+
+  for (size_t i = 0;  i < count;  i++)
+    order[i] = uint32(i);
+
+  for (uint p = 0;  p < passCount;  p++)
+  {
+    uint32* counts = &histograms[p * 256];
+    const uint shift = p * 8;
+
+    if (counts[(keys[order[0]] >> shift) & 0xff] == count)
+      continue;
+
+    uint32 offset = 0;
+
+    for (uint i = 0;  i < 256;  i++)
+    {
+      const uint32 size = counts[i];
+      counts[i] = offset;
+      offset += size;
+    }
+
+    for (size_t i = 0;  i < count;  i++)
+    {
+      const uint32 index = order[i];
+      scratch[counts[(keys[index] >> shift) & 0xff]++] = index;
+    }
+
+    order.swap(scratch);
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -125,6 +263,11 @@ Scene::Scene(GeometryPool& initPool, Phase initPhase):
 {
 }
 
+Scene::Scene(Phase initPhase):
+  phase(initPhase)
+{
+}
+
 void Scene::addOperation(const Operation& operation, float depth, uint8 layer)
 {
   if (operation.state->isBlending())
@@ -139,6 +282,15 @@ void Scene::addOperation(const Operation& operation, float depth, uint8 layer)
   }
 }
 
+void Scene::addScene(const Scene& other)
+{
+  opaqueQueue.addOperations(other.opaqueQueue);
+  blendedQueue.addOperations(other.blendedQueue);
+
+  for (auto l = other.lights.begin();  l != other.lights.end();  l++)
+    attachLight(**l);
+}
+
 void Scene::createOperations(const mat4& transform,
                              const GL::PrimitiveRange& range,
                              const Material& material,
@@ -166,7 +318,9 @@ void Scene::removeOperations()
 
 void Scene::attachLight(Light& light)
 {
-  if (std::find(lights.begin(), lights.end(), &light) != lights.end())
+  // The set makes duplicate checks constant time while the list keeps the
+  // lights in a deterministic order
+  if (!lightSet.insert(&light).second)
     return;
 
   lights.push_back(&light);
@@ -175,6 +329,7 @@ void Scene::attachLight(Light& light)
 void Scene::detachLights()
 {
   lights.clear();
+  lightSet.clear();
 }
 
 const LightList& Scene::getLights() const
@@ -192,8 +347,14 @@ void Scene::setAmbientIntensity(const vec3& newIntensity)
   ambient = newIntensity;
 }
 
+bool Scene::hasGeometryPool() const
+{
+  return pool;
+}
+
 GeometryPool& Scene::getGeometryPool() const
 {
+  assert(pool);
   return *pool;
 }
 
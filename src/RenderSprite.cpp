@@ -43,6 +43,8 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/norm.hpp>
 
+#include <cstring>
+
 ///////////////////////////////////////////////////////////////////////
 
 namespace wendy
@@ -134,10 +136,13 @@ void Sprite2::render(GeometryPool& pool) const
   realizeVertices(vertices);
 
   GL::VertexRange range;
-  if (!pool.allocateVertices(range, 4, Vertex2ft2fv::format))
+
+  void* target = pool.lockVertices(range, 4, Vertex2ft2fv::format);
+  if (!target)
     return;
 
-  range.copyFrom(vertices);
+  std::memcpy(target, vertices, sizeof(vertices));
+  range.unlock();
 
   pool.getContext().render(GL::PrimitiveRange(GL::TRIANGLE_FAN, range));
 }
@@ -184,7 +189,9 @@ void Sprite3::enqueue(Scene& scene,
   }
 
   GL::VertexRange range;
-  if (!scene.getGeometryPool().allocateVertices(range, 4, Vertex2ft3fv::format))
+
+  void* target = scene.getGeometryPool().lockVertices(range, 4, Vertex2ft3fv::format);
+  if (!target)
     return;
 
   const vec3 cameraPos = camera.getTransform().position;
@@ -192,7 +199,9 @@ void Sprite3::enqueue(Scene& scene,
 
   Vertex2ft3fv vertices[4];
   realizeSpriteVertices(vertices, cameraPos, spritePos, size, angle, type);
-  range.copyFrom(vertices);
+
+  std::memcpy(target, vertices, sizeof(vertices));
+  range.unlock();
 
   scene.createOperations(Transform3::IDENTITY,
                          GL::PrimitiveRange(GL::TRIANGLE_FAN, range),
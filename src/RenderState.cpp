@@ -64,27 +64,33 @@ SharedProgramState::SharedProgramState():
   viewportHeight(0.f),
   time(0.f)
 {
+  for (uint i = 0;  i < SHARED_STATE_CUSTOM_BASE;  i++)
+    generations[i] = allocateGeneration();
 }
 
 bool SharedProgramState::reserveSupported(GL::Context& context) const
 {
+  // Per-object state changes with every draw, so it stays in plain uniforms
   context.createSharedUniform("wyM", GL::UNIFORM_MAT4, SHARED_MODEL_MATRIX);
-  context.createSharedUniform("wyV", GL::UNIFORM_MAT4, SHARED_VIEW_MATRIX);
-  context.createSharedUniform("wyP", GL::UNIFORM_MAT4, SHARED_PROJECTION_MATRIX);
   context.createSharedUniform("wyMV", GL::UNIFORM_MAT4, SHARED_MODELVIEW_MATRIX);
-  context.createSharedUniform("wyVP", GL::UNIFORM_MAT4, SHARED_VIEWPROJECTION_MATRIX);
   context.createSharedUniform("wyMVP", GL::UNIFORM_MAT4, SHARED_MODELVIEWPROJECTION_MATRIX);
 
-  context.createSharedUniform("wyCameraNearZ", GL::UNIFORM_FLOAT, SHARED_CAMERA_NEAR_Z);
-  context.createSharedUniform("wyCameraFarZ", GL::UNIFORM_FLOAT, SHARED_CAMERA_FAR_Z);
-  context.createSharedUniform("wyCameraAspectRatio", GL::UNIFORM_FLOAT, SHARED_CAMERA_ASPECT_RATIO);
-  context.createSharedUniform("wyCameraFOV", GL::UNIFORM_FLOAT, SHARED_CAMERA_FOV);
-  context.createSharedUniform("wyCameraPosition", GL::UNIFORM_VEC3, SHARED_CAMERA_POSITION);
+  // Per-camera and per-frame state is shared by all programs through the
+  // shared uniform block
+  context.createSharedBlockUniform("wyV", GL::UNIFORM_MAT4, SHARED_VIEW_MATRIX);
+  context.createSharedBlockUniform("wyP", GL::UNIFORM_MAT4, SHARED_PROJECTION_MATRIX);
+  context.createSharedBlockUniform("wyVP", GL::UNIFORM_MAT4, SHARED_VIEWPROJECTION_MATRIX);
 
-  context.createSharedUniform("wyViewportWidth", GL::UNIFORM_FLOAT, SHARED_VIEWPORT_WIDTH);
-  context.createSharedUniform("wyViewportHeight", GL::UNIFORM_FLOAT, SHARED_VIEWPORT_HEIGHT);
+  context.createSharedBlockUniform("wyCameraPosition", GL::UNIFORM_VEC3, SHARED_CAMERA_POSITION);
+  context.createSharedBlockUniform("wyCameraNearZ", GL::UNIFORM_FLOAT, SHARED_CAMERA_NEAR_Z);
+  context.createSharedBlockUniform("wyCameraFarZ", GL::UNIFORM_FLOAT, SHARED_CAMERA_FAR_Z);
+  context.createSharedBlockUniform("wyCameraAspectRatio", GL::UNIFORM_FLOAT, SHARED_CAMERA_ASPECT_RATIO);
+  context.createSharedBlockUniform("wyCameraFOV", GL::UNIFORM_FLOAT, SHARED_CAMERA_FOV);
 
-  context.createSharedUniform("wyTime", GL::UNIFORM_FLOAT, SHARED_TIME);
+  context.createSharedBlockUniform("wyViewportWidth", GL::UNIFORM_FLOAT, SHARED_VIEWPORT_WIDTH);
+  context.createSharedBlockUniform("wyViewportHeight", GL::UNIFORM_FLOAT, SHARED_VIEWPORT_HEIGHT);
+
+  context.createSharedBlockUniform("wyTime", GL::UNIFORM_FLOAT, SHARED_TIME);
 
   return true;
 }
@@ -136,24 +142,36 @@ void SharedProgramState::setModelMatrix(const mat4& newMatrix)
 {
   modelMatrix = newMatrix;
   dirtyModelView = dirtyModelViewProj = true;
+
+  invalidate(SHARED_MODEL_MATRIX);
+  invalidate(SHARED_MODELVIEW_MATRIX);
+  invalidate(SHARED_MODELVIEWPROJECTION_MATRIX);
 }
 
 void SharedProgramState::setViewMatrix(const mat4& newMatrix)
 {
   viewMatrix = newMatrix;
   dirtyModelView = dirtyViewProj = dirtyModelViewProj = true;
+
+  invalidate(SHARED_VIEW_MATRIX);
+  invalidate(SHARED_MODELVIEW_MATRIX);
+  invalidate(SHARED_VIEWPROJECTION_MATRIX);
+  invalidate(SHARED_MODELVIEWPROJECTION_MATRIX);
+  invalidateBlock();
 }
 
 void SharedProgramState::setProjectionMatrix(const mat4& newMatrix)
 {
   projectionMatrix = newMatrix;
   dirtyViewProj = dirtyModelViewProj = true;
+  invalidateProjection();
 }
 
 void SharedProgramState::setOrthoProjectionMatrix(float width, float height)
 {
   projectionMatrix = ortho(0.f, width, 0.f, height);
   dirtyViewProj = dirtyModelViewProj = true;
+  invalidateProjection();
 }
 
 void SharedProgramState::setOrthoProjectionMatrix(const AABB& volume)
@@ -163,6 +181,7 @@ void SharedProgramState::setOrthoProjectionMatrix(const AABB& volume)
 
   projectionMatrix = ortho(minX, maxX, minY, maxY, minZ, maxZ);
   dirtyViewProj = dirtyModelViewProj = true;
+  invalidateProjection();
 }
 
 void SharedProgramState::setPerspectiveProjectionMatrix(float FOV,
@@ -172,6 +191,7 @@ void SharedProgramState::setPerspectiveProjectionMatrix(float FOV,
 {
   projectionMatrix = perspective(FOV, aspect, nearZ, farZ);
   dirtyViewProj = dirtyModelViewProj = true;
+  invalidateProjection();
 }
 
 void SharedProgramState::setCameraProperties(const vec3& position,
@@ -185,17 +205,31 @@ void SharedProgramState::setCameraProperties(const vec3& position,
   cameraAspect = aspect;
   cameraNearZ = nearZ;
   cameraFarZ = farZ;
+
+  invalidate(SHARED_CAMERA_POSITION);
+  invalidate(SHARED_CAMERA_FOV);
+  invalidate(SHARED_CAMERA_ASPECT_RATIO);
+  invalidate(SHARED_CAMERA_NEAR_Z);
+  invalidate(SHARED_CAMERA_FAR_Z);
+  invalidateBlock();
 }
 
 void SharedProgramState::setViewportSize(float newWidth, float newHeight)
 {
   viewportWidth = newWidth;
   viewportHeight = newHeight;
+
+  invalidate(SHARED_VIEWPORT_WIDTH);
+  invalidate(SHARED_VIEWPORT_HEIGHT);
+  invalidateBlock();
 }
 
 void SharedProgramState::setTime(float newTime)
 {
   time = newTime;
+
+  invalidate(SHARED_TIME);
+  invalidateBlock();
 }
 
 void SharedProgramState::updateTo(GL::Sampler& sampler)
@@ -206,23 +240,13 @@ void SharedProgramState::updateTo(GL::Sampler& sampler)
 
 void SharedProgramState::updateTo(GL::Uniform& uniform)
 {
-  switch (uniform.getSharedID())
+  const int ID = uniform.getSharedID();
+
+  switch (ID)
   {
     case SHARED_MODEL_MATRIX:
     {
-      uniform.copyFrom(value_ptr(modelMatrix));
-      return;
-    }
-
-    case SHARED_VIEW_MATRIX:
-    {
-      uniform.copyFrom(value_ptr(viewMatrix));
-      return;
-    }
-
-    case SHARED_PROJECTION_MATRIX:
-    {
-      uniform.copyFrom(value_ptr(projectionMatrix));
+      uniform.copyFrom(value_ptr(modelMatrix), generations[ID]);
       return;
     }
 
@@ -235,20 +259,7 @@ void SharedProgramState::updateTo(GL::Uniform& uniform)
         dirtyModelView = false;
       }
 
-      uniform.copyFrom(value_ptr(modelViewMatrix));
-      return;
-    }
-
-    case SHARED_VIEWPROJECTION_MATRIX:
-    {
-      if (dirtyViewProj)
-      {
-        viewProjMatrix = projectionMatrix;
-        viewProjMatrix *= viewMatrix;
-        dirtyViewProj = false;
-      }
-
-      uniform.copyFrom(value_ptr(viewProjMatrix));
+      uniform.copyFrom(value_ptr(modelViewMatrix), generations[ID]);
       return;
     }
 
@@ -268,63 +279,84 @@ void SharedProgramState::updateTo(GL::Uniform& uniform)
         dirtyModelViewProj = false;
       }
 
-      uniform.copyFrom(value_ptr(modelViewProjMatrix));
+      uniform.copyFrom(value_ptr(modelViewProjMatrix), generations[ID]);
       return;
     }
+  }
 
-    case SHARED_CAMERA_POSITION:
-    {
-      uniform.copyFrom(value_ptr(cameraPos));
-      return;
-    }
+  logError("Unknown shared uniform \'%s\' requested",
+           uniform.getName().c_str());
+}
 
-    case SHARED_CAMERA_NEAR_Z:
-    {
-      uniform.copyFrom(&cameraNearZ);
-      return;
-    }
+void SharedProgramState::updateBlock(GL::Context& context)
+{
+  if (dirtyViewProj)
+  {
+    viewProjMatrix = projectionMatrix;
+    viewProjMatrix *= viewMatrix;
+    dirtyViewProj = false;
+  }
 
-    case SHARED_CAMERA_FAR_Z:
-    {
-      uniform.copyFrom(&cameraFarZ);
-      return;
-    }
+  context.setSharedBlockUniform(SHARED_VIEW_MATRIX,
+                                value_ptr(viewMatrix),
+                                generations[SHARED_VIEW_MATRIX]);
+  context.setSharedBlockUniform(SHARED_PROJECTION_MATRIX,
+                                value_ptr(projectionMatrix),
+                                generations[SHARED_PROJECTION_MATRIX]);
+  context.setSharedBlockUniform(SHARED_VIEWPROJECTION_MATRIX,
+                                value_ptr(viewProjMatrix),
+                                generations[SHARED_VIEWPROJECTION_MATRIX]);
 
-    case SHARED_CAMERA_ASPECT_RATIO:
-    {
-      uniform.copyFrom(&cameraAspect);
-      return;
-    }
+  context.setSharedBlockUniform(SHARED_CAMERA_POSITION,
+                                value_ptr(cameraPos),
+                                generations[SHARED_CAMERA_POSITION]);
+  context.setSharedBlockUniform(SHARED_CAMERA_NEAR_Z,
+                                &cameraNearZ,
+                                generations[SHARED_CAMERA_NEAR_Z]);
+  context.setSharedBlockUniform(SHARED_CAMERA_FAR_Z,
+                                &cameraFarZ,
+                                generations[SHARED_CAMERA_FAR_Z]);
+  context.setSharedBlockUniform(SHARED_CAMERA_ASPECT_RATIO,
+                                &cameraAspect,
+                                generations[SHARED_CAMERA_ASPECT_RATIO]);
+  context.setSharedBlockUniform(SHARED_CAMERA_FOV,
+                                &cameraFOV,
+                                generations[SHARED_CAMERA_FOV]);
 
-    case SHARED_CAMERA_FOV:
-    {
-      uniform.copyFrom(&cameraFOV);
-      return;
-    }
+  context.setSharedBlockUniform(SHARED_VIEWPORT_WIDTH,
+                                &viewportWidth,
+                                generations[SHARED_VIEWPORT_WIDTH]);
+  context.setSharedBlockUniform(SHARED_VIEWPORT_HEIGHT,
+                                &viewportHeight,
+                                generations[SHARED_VIEWPORT_HEIGHT]);
 
-    case SHARED_VIEWPORT_WIDTH:
-    {
-      uniform.copyFrom(&viewportWidth);
-      return;
-    }
+  context.setSharedBlockUniform(SHARED_TIME, &time, generations[SHARED_TIME]);
+}
 
-    case SHARED_VIEWPORT_HEIGHT:
-    {
-      uniform.copyFrom(&viewportHeight);
-      return;
-    }
+void SharedProgramState::invalidate(int ID)
+{
+  generations[ID] = allocateGeneration();
+}
 
-    case SHARED_TIME:
-    {
-      uniform.copyFrom(&time);
-      return;
-    }
-  }
+void SharedProgramState::invalidateProjection()
+{
+  invalidate(SHARED_PROJECTION_MATRIX);
+  invalidate(SHARED_VIEWPROJECTION_MATRIX);
+  invalidate(SHARED_MODELVIEWPROJECTION_MATRIX);
+  invalidateBlock();
+}
 
-  logError("Unknown shared uniform \'%s\' requested",
-           uniform.getName().c_str());
+uint SharedProgramState::allocateGeneration()
+{
+  // Zero is reserved for uniforms not holding any shared value
+  if (!++nextGeneration)
+    nextGeneration++;
+
+  return nextGeneration;
 }
 
+uint SharedProgramState::nextGeneration = 0;
+
 ///////////////////////////////////////////////////////////////////////
 
 UniformStateIndex::UniformStateIndex():
@@ -57,6 +57,11 @@ GeometryPool& System::getGeometryPool() const
   return *pool;
 }
 
+GeometryArena& System::getGeometryArena() const
+{
+  return *arena;
+}
+
 System::Type System::getType() const
 {
   return type;
@@ -64,6 +69,7 @@ System::Type System::getType() const
 
 System::System(GeometryPool& initPool, Type initType):
   pool(&initPool),
+  arena(GeometryArena::create(initPool.getContext())),
   type(initType)
 {
 }
@@ -38,6 +38,54 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+namespace
+{
+
+// Job identifiers hold the generation of the slot in the upper half, and
+// the slot index plus one in the lower half, so that zero is never valid
+
+ResourceLoader::JobID makeJobID(uint index, uint generation)
+{
+  return (ResourceLoader::JobID(generation) << 32) | (index + 1);
+}
+
+uint getJobIndex(ResourceLoader::JobID ID)
+{
+  return uint(ID & 0xffffffff) - 1;
+}
+
+uint getJobGeneration(ResourceLoader::JobID ID)
+{
+  return uint(ID >> 32);
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+ResourceHandle::ResourceHandle():
+  index(0),
+  generation(0)
+{
+}
+
+bool ResourceHandle::operator == (const ResourceHandle& other) const
+{
+  return index == other.index && generation == other.generation;
+}
+
+bool ResourceHandle::operator != (const ResourceHandle& other) const
+{
+  return index != other.index || generation != other.generation;
+}
+
+bool ResourceHandle::isNull() const
+{
+  return generation == 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+
 ResourceInfo::ResourceInfo(ResourceCache& initCache,
                            const String& initName,
                            const Path& initPath):
@@ -55,12 +103,7 @@ Resource::Resource(const ResourceInfo& info):
   path(info.path)
 {
   if (!name.empty())
-  {
-    if (cache.findResource(name))
-      panic("Duplicate name for resource \'%s\'", name.c_str());
-
-    cache.resources.push_back(this);
-  }
+    handle = cache.addResource(*this);
 }
 
 Resource::Resource(const Resource& source):
@@ -71,11 +114,7 @@ Resource::Resource(const Resource& source):
 Resource::~Resource()
 {
   if (!name.empty())
-  {
-    cache.resources.erase(std::find(cache.resources.begin(),
-                                    cache.resources.end(),
-                                    this));
-  }
+    cache.removeResource(*this);
 }
 
 Resource& Resource::operator = (const Resource& source)
@@ -98,11 +137,16 @@ const Path& Resource::getPath() const
   return path;
 }
 
+ResourceHandle Resource::getHandle() const
+{
+  return handle;
+}
+
 ///////////////////////////////////////////////////////////////////////
 
 ResourceCache::~ResourceCache()
 {
-  if (!resources.empty())
+  if (!names.empty())
     panic("Resource cache destroyed with attached resources");
 }
 
@@ -128,13 +172,65 @@ void ResourceCache::removeSearchPath(const Path& path)
 
 Resource* ResourceCache::findResource(const String& name) const
 {
-  for (auto r = resources.begin();  r != resources.end();  r++)
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto entry = names.find(name);
+  if (entry == names.end())
+    return NULL;
+
+  return slots[entry->second].resource;
+}
+
+Resource* ResourceCache::findResource(ResourceHandle handle) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (handle.index >= slots.size())
+    return NULL;
+
+  const Slot& slot = slots[handle.index];
+  if (slot.generation != handle.generation)
+    return NULL;
+
+  return slot.resource;
+}
+
+ResourceHandle ResourceCache::findHandle(const String& name) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto entry = names.find(name);
+  if (entry == names.end())
+    return ResourceHandle();
+
+  return slots[entry->second].resource->getHandle();
+}
+
+Ref<Resource> ResourceCache::findOrReserve(const String& name)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  reservedCondition.wait(lock, [this, &name]() { return !reserved.count(name); });
+
+  // The reference is added while the cache is locked, as the resource cannot
+  // be removed from the cache before then
+
+  auto entry = names.find(name);
+  if (entry != names.end())
+    return slots[entry->second].resource;
+
+  reserved.insert(name);
+  return NULL;
+}
+
+void ResourceCache::releaseReservation(const String& name)
+{
   {
-    if ((*r)->getName() == name)
-      return *r;
+    std::lock_guard<std::mutex> lock(mutex);
+    reserved.erase(name);
   }
 
-  return NULL;
+  reservedCondition.notify_all();
 }
 
 Path ResourceCache::findFile(const String& name) const
@@ -163,6 +259,432 @@ const PathList& ResourceCache::getSearchPaths() const
   return paths;
 }
 
+ResourceHandle ResourceCache::addResource(Resource& resource)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  uint index;
+
+  if (freeSlots.empty())
+  {
+    index = slots.size();
+
+    Slot slot;
+    slot.resource = NULL;
+    slot.generation = 1;
+    slots.push_back(slot);
+  }
+  else
+    index = freeSlots.back();
+
+  if (!names.insert(std::make_pair(resource.getName(), index)).second)
+    panic("Duplicate name for resource \'%s\'", resource.getName().c_str());
+
+  if (!freeSlots.empty())
+    freeSlots.pop_back();
+
+  Slot& slot = slots[index];
+  slot.resource = &resource;
+
+  ResourceHandle handle;
+  handle.index = index;
+  handle.generation = slot.generation;
+  return handle;
+}
+
+void ResourceCache::removeResource(Resource& resource)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  const ResourceHandle handle = resource.getHandle();
+
+  Slot& slot = slots[handle.index];
+  slot.resource = NULL;
+
+  // Retire the slot so that outstanding handles stop resolving to it
+
+  if (++slot.generation == 0)
+    slot.generation = 1;
+
+  freeSlots.push_back(handle.index);
+  names.erase(resource.getName());
+}
+
+///////////////////////////////////////////////////////////////////////
+
+ResourceLoader::ResourceLoader(ResourceCache& initCache, uint threadCount):
+  cache(initCache),
+  pending(0),
+  stopping(false)
+{
+  for (uint i = 0;  i < threadCount;  i++)
+    threads.push_back(std::thread(&ResourceLoader::work, this));
+}
+
+ResourceLoader::~ResourceLoader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+
+  queuedCondition.notify_all();
+
+  for (auto t = threads.begin();  t != threads.end();  t++)
+    t->join();
+}
+
+ResourceLoader::JobID ResourceLoader::addJob(const DecodeFunc& decode,
+                                             const FinishFunc& finish,
+                                             const JobList& dependencies)
+{
+  return addJob(String(), decode, finish, dependencies);
+}
+
+ResourceLoader::JobID ResourceLoader::addJob(const String& name,
+                                             const DecodeFunc& decode,
+                                             const FinishFunc& finish,
+                                             const JobList& dependencies)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  if (!name.empty())
+  {
+    auto entry = named.find(name);
+    if (entry != named.end())
+      return entry->second;
+  }
+
+  uint index;
+
+  if (freeJobs.empty())
+  {
+    index = jobs.size();
+
+    Job job;
+    job.generation = 1;
+    jobs.push_back(job);
+  }
+  else
+  {
+    index = freeJobs.back();
+    freeJobs.pop_back();
+  }
+
+  const JobID ID = makeJobID(index, jobs[index].generation);
+
+  if (!name.empty())
+    named[name] = ID;
+
+  Job& job = jobs[index];
+  job.name = name;
+  job.decode = decode;
+  job.finish = finish;
+  job.state = JOB_BLOCKED;
+  job.blockers = 0;
+  job.holders = 0;
+  job.succeeded = false;
+
+  pending++;
+
+  bool failed = false;
+
+  for (auto d = dependencies.begin();  d != dependencies.end();  d++)
+  {
+    if (*d == ID)
+      panic("Resource loading job %u depends on itself", index);
+
+    const Job* dependency = findJob(*d);
+
+    // A retired dependency finished successfully, and may already have
+    // released its resource, so there is nothing left to hold on to
+    if (!dependency)
+      continue;
+
+    if (dependency->state == JOB_FINISHED)
+    {
+      if (!dependency->succeeded)
+        failed = true;
+    }
+    else
+    {
+      getJob(*d).dependents.push_back(ID);
+      getJob(*d).holders++;
+      jobs[index].dependencies.push_back(*d);
+      jobs[index].blockers++;
+    }
+  }
+
+  if (failed)
+  {
+    lock.unlock();
+    logError("Dependency failed for resource loading job %u", index);
+    lock.lock();
+
+    jobs[index].blockers = 0;
+    complete(ID, false);
+  }
+  else if (jobs[index].blockers == 0)
+    schedule(ID);
+
+  return ID;
+}
+
+void ResourceLoader::update()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // Without worker threads, decoding is done here on the calling thread
+
+  while (threads.empty() && !queued.empty())
+  {
+    const JobID ID = queued.front();
+    queued.erase(queued.begin());
+
+    DecodeFunc decode;
+    decode.swap(getJob(ID).decode);
+
+    lock.unlock();
+    Ref<Resource> resource = decode();
+    lock.lock();
+
+    getJob(ID).resource = resource;
+    getJob(ID).succeeded = resource != NULL;
+    getJob(ID).state = JOB_DECODED;
+    decoded.push_back(ID);
+  }
+
+  while (!decoded.empty())
+  {
+    const JobID ID = decoded.front();
+    decoded.erase(decoded.begin());
+
+    Job& job = getJob(ID);
+
+    bool succeeded = job.succeeded;
+
+    if (succeeded && job.finish)
+    {
+      FinishFunc finish;
+      finish.swap(job.finish);
+      Resource* resource = job.resource;
+
+      lock.unlock();
+      succeeded = finish(resource);
+      lock.lock();
+    }
+
+    complete(ID, succeeded);
+  }
+}
+
+bool ResourceLoader::wait(JobID ID)
+{
+  for (;;)
+  {
+    update();
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    const Job* job = findJob(ID);
+    if (!job)
+      return true;
+
+    if (job->state == JOB_FINISHED)
+      return job->succeeded;
+
+    if (!threads.empty())
+    {
+      decodedCondition.wait(lock, [this]() { return !decoded.empty(); });
+    }
+  }
+}
+
+void ResourceLoader::waitAll()
+{
+  for (;;)
+  {
+    update();
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (!pending)
+      return;
+
+    if (!threads.empty())
+    {
+      decodedCondition.wait(lock, [this]() { return !decoded.empty(); });
+    }
+  }
+}
+
+bool ResourceLoader::isFinished(JobID ID) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  const Job* job = findJob(ID);
+  return !job || job->state == JOB_FINISHED;
+}
+
+bool ResourceLoader::hasSucceeded(JobID ID) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  const Job* job = findJob(ID);
+  return !job || (job->state == JOB_FINISHED && job->succeeded);
+}
+
+uint ResourceLoader::getPendingCount() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return pending;
+}
+
+ResourceCache& ResourceLoader::getCache() const
+{
+  return cache;
+}
+
+void ResourceLoader::work()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;)
+  {
+    queuedCondition.wait(lock, [this]() { return stopping || !queued.empty(); });
+    if (stopping)
+      return;
+
+    const JobID ID = queued.front();
+    queued.erase(queued.begin());
+
+    DecodeFunc decode;
+    decode.swap(getJob(ID).decode);
+
+    lock.unlock();
+    Ref<Resource> resource = decode();
+    lock.lock();
+
+    // The job list may have been reallocated while decoding
+
+    getJob(ID).resource = resource;
+    getJob(ID).succeeded = resource != NULL;
+    getJob(ID).state = JOB_DECODED;
+    decoded.push_back(ID);
+
+    decodedCondition.notify_all();
+  }
+}
+
+ResourceLoader::Job& ResourceLoader::getJob(JobID ID)
+{
+  return jobs[getJobIndex(ID)];
+}
+
+const ResourceLoader::Job* ResourceLoader::findJob(JobID ID) const
+{
+  const uint index = getJobIndex(ID);
+  const uint generation = getJobGeneration(ID);
+
+  if (ID == 0 || index >= jobs.size() || generation > jobs[index].generation)
+    panic("Invalid resource loading job %u", index);
+
+  // Older generations of a slot were retired after finishing successfully
+  if (generation < jobs[index].generation)
+    return NULL;
+
+  return &jobs[index];
+}
+
+void ResourceLoader::schedule(JobID ID)
+{
+  Job& job = getJob(ID);
+
+  if (job.decode)
+  {
+    job.state = JOB_QUEUED;
+    queued.push_back(ID);
+    queuedCondition.notify_one();
+  }
+  else
+  {
+    job.state = JOB_DECODED;
+    job.succeeded = true;
+    decoded.push_back(ID);
+    decodedCondition.notify_all();
+  }
+}
+
+void ResourceLoader::complete(JobID ID, bool succeeded)
+{
+  JobList dependents;
+  JobList dependencies;
+
+  {
+    Job& job = getJob(ID);
+    job.state = JOB_FINISHED;
+    job.succeeded = succeeded;
+
+    if (!job.name.empty())
+      named.erase(job.name);
+
+    job.decode = DecodeFunc();
+    job.finish = FinishFunc();
+    dependents.swap(job.dependents);
+    dependencies.swap(job.dependencies);
+  }
+
+  pending--;
+
+  // This job no longer needs the resources of its dependencies
+
+  for (auto d = dependencies.begin();  d != dependencies.end();  d++)
+  {
+    getJob(*d).holders--;
+    release(*d);
+  }
+
+  release(ID);
+
+  for (auto d = dependents.begin();  d != dependents.end();  d++)
+  {
+    Job& dependent = getJob(*d);
+    if (dependent.state == JOB_FINISHED)
+      continue;
+
+    if (succeeded)
+    {
+      if (--dependent.blockers == 0)
+        schedule(*d);
+    }
+    else
+    {
+      dependent.blockers = 0;
+      complete(*d, false);
+    }
+  }
+}
+
+void ResourceLoader::release(JobID ID)
+{
+  Job& job = getJob(ID);
+
+  if (job.state != JOB_FINISHED || job.holders > 0)
+    return;
+
+  job.resource = NULL;
+
+  // No unfinished job refers to this one any more, so unless its failure
+  // must be remembered its slot can be reused
+  if (job.succeeded)
+  {
+    job.name.clear();
+    job.generation++;
+    freeJobs.push_back(getJobIndex(ID));
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////
 
 } /*namespace wendy*/
@@ -33,7 +33,12 @@
 #include <wendy/Plane.h>
 #include <wendy/Frustum.h>
 #include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+#include <wendy/Occlusion.h>
 
+#include <wendy/GLQuery.h>
 #include <wendy/GLTexture.h>
 #include <wendy/GLBuffer.h>
 #include <wendy/GLProgram.h>
@@ -41,6 +46,7 @@
 
 #include <wendy/RenderPool.h>
 #include <wendy/RenderState.h>
+#include <wendy/RenderSystem.h>
 #include <wendy/RenderMaterial.h>
 #include <wendy/RenderLight.h>
 #include <wendy/RenderScene.h>
@@ -48,7 +54,11 @@
 
 #include <wendy/SceneGraph.h>
 
+#include <glm/gtx/norm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
 #include <algorithm>
+#include <thread>
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -59,12 +69,69 @@ namespace wendy
 
 ///////////////////////////////////////////////////////////////////////
 
+namespace
+{
+
+// Fraction of its radius by which each leaf box is enlarged
+const float PROXY_MARGIN = 0.1f;
+
+// Minimum number of visible root nodes worth handing to a separate thread
+const size_t MIN_NODES_PER_THREAD = 64;
+
+// Base number of frames between occlusion queries for visible nodes
+const uint VISIBLE_QUERY_INTERVAL = 8;
+
+// Unit box as a single triangle strip, used as occlusion query proxy
+const vec3 boxStrip[] =
+{
+  vec3(-1.f,  1.f,  1.f),
+  vec3( 1.f,  1.f,  1.f),
+  vec3(-1.f, -1.f,  1.f),
+  vec3( 1.f, -1.f,  1.f),
+  vec3( 1.f, -1.f, -1.f),
+  vec3( 1.f,  1.f,  1.f),
+  vec3( 1.f,  1.f, -1.f),
+  vec3(-1.f,  1.f,  1.f),
+  vec3(-1.f,  1.f, -1.f),
+  vec3(-1.f, -1.f,  1.f),
+  vec3(-1.f, -1.f, -1.f),
+  vec3( 1.f, -1.f, -1.f),
+  vec3(-1.f,  1.f, -1.f),
+  vec3( 1.f,  1.f, -1.f)
+};
+
+bool isSamePool(const render::Scene& first, const render::Scene& second)
+{
+  if (!first.hasGeometryPool() || !second.hasGeometryPool())
+    return first.hasGeometryPool() == second.hasGeometryPool();
+
+  return &first.getGeometryPool() == &second.getGeometryPool();
+}
+
+float surfaceArea(const vec3& minimum, const vec3& maximum)
+{
+  const vec3 size = maximum - minimum;
+  return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
 Node::Node(bool initNeedsUpdate):
   needsUpdate(initNeedsUpdate),
   parent(NULL),
   graph(NULL),
   dirtyWorld(false),
-  dirtyBounds(false)
+  worldGeneration(0),
+  dirtyBounds(false),
+  queryPending(false),
+  occluded(false),
+  queryFrame(0),
+  nextQueryFrame(0),
+  proxy(-1),
+  dirtyProxy(false),
+  slot(-1)
 {
 }
 
@@ -108,6 +175,16 @@ void Node::removeFromParent()
     {
       List& roots = graph->roots;
       roots.erase(std::find(roots.begin(), roots.end(), this));
+
+      if (dirtyProxy)
+      {
+        List& invalidated = graph->invalidated;
+        invalidated.erase(std::find(invalidated.begin(), invalidated.end(), this));
+        dirtyProxy = false;
+      }
+
+      graph->index.destroyProxy(proxy);
+      proxy = -1;
     }
 
     setGraph(NULL);
@@ -155,12 +232,15 @@ const Node::List& Node::getChildren() const
 
 const Transform3& Node::getLocalTransform() const
 {
+  if (slot != -1)
+    return graph->transforms->getLocalTransform(slot);
+
   return local;
 }
 
 void Node::setLocalTransform(const Transform3& newTransform)
 {
-  local = newTransform;
+  editLocalTransform() = newTransform;
 
   if (parent)
     parent->invalidateBounds();
@@ -170,7 +250,7 @@ void Node::setLocalTransform(const Transform3& newTransform)
 
 void Node::setLocalPosition(const vec3& newPosition)
 {
-  local.position = newPosition;
+  editLocalTransform().position = newPosition;
 
   if (parent)
     parent->invalidateBounds();
@@ -180,7 +260,7 @@ void Node::setLocalPosition(const vec3& newPosition)
 
 void Node::setLocalRotation(const quat& newRotation)
 {
-  local.rotation = newRotation;
+  editLocalTransform().rotation = newRotation;
 
   if (parent)
     parent->invalidateBounds();
@@ -190,7 +270,7 @@ void Node::setLocalRotation(const quat& newRotation)
 
 void Node::setLocalScale(float newScale)
 {
-  local.scale = newScale;
+  editLocalTransform().scale = newScale;
 
   if (parent)
     parent->invalidateBounds();
@@ -200,6 +280,30 @@ void Node::setLocalScale(float newScale)
 
 const Transform3& Node::getWorldTransform() const
 {
+  if (slot != -1)
+  {
+    const TransformHierarchy& transforms = *graph->transforms;
+
+    if (!transforms.isChanged())
+      return transforms.getWorldTransform(slot);
+
+    // The flat hierarchy is only brought up to date by Graph::update, so
+    // until then world transforms are computed on demand and cached for the
+    // current generation, computing each node of a chain only once
+
+    if (worldGeneration != transforms.getGeneration())
+    {
+      if (parent)
+        world = parent->getWorldTransform() * transforms.getLocalTransform(slot);
+      else
+        world = transforms.getLocalTransform(slot);
+
+      worldGeneration = transforms.getGeneration();
+    }
+
+    return world;
+  }
+
   if (dirtyWorld)
   {
     if (parent)
@@ -224,6 +328,21 @@ void Node::setLocalBounds(const Sphere& newBounds)
   invalidateBounds();
 }
 
+Mesh* Node::getOccluder() const
+{
+  return occluder;
+}
+
+void Node::setOccluder(Mesh* newOccluder)
+{
+  occluder = newOccluder;
+}
+
+bool Node::isConcurrent() const
+{
+  return false;
+}
+
 const Sphere& Node::getTotalBounds() const
 {
   if (dirtyBounds)
@@ -256,14 +375,25 @@ void Node::enqueue(render::Scene& scene, const Camera& camera) const
   const Frustum& frustum = camera.getFrustum();
 
   const List& children = getChildren();
+  if (children.empty())
+    return;
+
+  SphereBatch batch;
 
   for (auto c = children.begin();  c != children.end();  c++)
   {
     Sphere worldBounds = (*c)->getTotalBounds();
     worldBounds.transformBy((*c)->getWorldTransform());
+    batch.add(worldBounds);
+  }
+
+  std::vector<uint32> masks;
+  frustum.intersects(batch, masks);
 
-    if (frustum.intersects(worldBounds))
-      (*c)->enqueue(scene, camera);
+  for (size_t i = 0;  i < children.size();  i++)
+  {
+    if (masks[i / 32] & (1u << (i % 32)))
+      children[i]->enqueue(scene, camera);
   }
 }
 
@@ -277,20 +407,55 @@ Node& Node::operator = (const Node& source)
   panic("Scene graph nodes may not be assigned");
 }
 
+Transform3& Node::editLocalTransform()
+{
+  if (slot != -1)
+    return graph->transforms->getLocalTransform(slot);
+
+  return local;
+}
+
 void Node::invalidateBounds()
 {
-  for (Node* node = this;  node;  node = node->getParent())
+  Node* node = this;
+
+  for (;;)
+  {
     node->dirtyBounds = true;
+
+    if (!node->parent)
+      break;
+
+    node = node->parent;
+  }
+
+  node->invalidateProxy();
 }
 
 void Node::invalidateWorldTransform()
 {
   dirtyWorld = true;
 
+  if (!parent)
+    invalidateProxy();
+
+  if (slot != -1)
+  {
+    // Descendants are brought up to date by the linear pass
+    graph->transforms->invalidate(slot);
+    return;
+  }
+
   for (auto c = children.begin();  c != children.end();  c++)
     (*c)->invalidateWorldTransform();
 }
 
+void Node::invalidateProxy()
+{
+  if (graph && proxy != -1)
+    graph->invalidateProxy(*this);
+}
+
 void Node::setGraph(Graph* newGraph)
 {
   if (graph && needsUpdate)
@@ -299,6 +464,12 @@ void Node::setGraph(Graph* newGraph)
     updated.erase(std::find(updated.begin(), updated.end(), this));
   }
 
+  if (slot != -1)
+  {
+    graph->transforms->destroySlot(slot);
+    dirtyWorld = true;
+  }
+
   graph = newGraph;
 
   if (graph && needsUpdate)
@@ -307,155 +478,1291 @@ void Node::setGraph(Graph* newGraph)
     updated.push_back(this);
   }
 
+  if (graph && graph->transforms)
+  {
+    if (parent)
+      slot = graph->transforms->createSlot(*this, parent->slot);
+    else
+      slot = graph->transforms->createSlot(*this, -1);
+  }
+
   for (auto c = children.begin();  c != children.end();  c++)
     (*c)->setGraph(graph);
 }
 
 ///////////////////////////////////////////////////////////////////////
 
-Graph::~Graph()
+SpatialIndex::SpatialIndex():
+  root(-1),
+  unused(-1)
 {
-  destroyRootNodes();
 }
 
-void Graph::update()
+int SpatialIndex::createProxy(Node& node, const Sphere& bounds)
 {
-  for (auto n = updated.begin();  n != updated.end();  n++)
-    (*n)->update();
+  const int id = allocateProxy();
+
+  Proxy& proxy = proxies[id];
+  proxy.node = &node;
+  proxy.bounds = bounds;
+
+  const float margin = bounds.radius * (1.f + PROXY_MARGIN);
+  proxy.minimum = bounds.center - vec3(margin);
+  proxy.maximum = bounds.center + vec3(margin);
+
+  insertLeaf(id);
+  return id;
 }
 
-void Graph::enqueue(render::Scene& scene, const Camera& camera) const
+void SpatialIndex::destroyProxy(int id)
 {
-  ProfileNodeCall call("scene::Graph::enqueue");
+  assert(id >= 0 && id < int(proxies.size()));
+  assert(proxies[id].isLeaf());
 
-  const Frustum& frustum = camera.getFrustum();
+  removeLeaf(id);
+  freeProxy(id);
+}
 
-  for (auto r = roots.begin();  r != roots.end();  r++)
-  {
-    Sphere worldBounds = (*r)->getTotalBounds();
-    worldBounds.transformBy((*r)->getWorldTransform());
+void SpatialIndex::moveProxy(int id, const Sphere& bounds)
+{
+  assert(id >= 0 && id < int(proxies.size()));
+  assert(proxies[id].isLeaf());
+
+  Proxy& proxy = proxies[id];
+  proxy.bounds = bounds;
 
-    if (frustum.intersects(worldBounds))
-      (*r)->enqueue(scene, camera);
+  const vec3 minimum = bounds.center - vec3(bounds.radius);
+  const vec3 maximum = bounds.center + vec3(bounds.radius);
+
+  if (all(lessThanEqual(proxy.minimum, minimum)) &&
+      all(lessThanEqual(maximum, proxy.maximum)))
+  {
+    return;
   }
+
+  removeLeaf(id);
+
+  const float margin = bounds.radius * PROXY_MARGIN;
+  proxy.minimum = minimum - vec3(margin);
+  proxy.maximum = maximum + vec3(margin);
+
+  insertLeaf(id);
 }
 
-void Graph::query(const Sphere& sphere, Node::List& nodes) const
+void SpatialIndex::query(const Sphere& sphere, Node::List& nodes) const
 {
-  for (auto r = roots.begin();  r != roots.end();  r++)
+  if (root == -1)
+    return;
+
+  std::vector<int> stack;
+  stack.push_back(root);
+
+  while (!stack.empty())
   {
-    Sphere worldBounds = (*r)->getTotalBounds();
-    worldBounds.transformBy((*r)->getWorldTransform());
+    const Proxy& proxy = proxies[stack.back()];
+    stack.pop_back();
+
+    const vec3 closest = clamp(sphere.center, proxy.minimum, proxy.maximum);
+    if (length2(closest - sphere.center) > sphere.radius * sphere.radius)
+      continue;
 
-    if (sphere.intersects(worldBounds))
-      nodes.push_back(*r);
+    if (proxy.isLeaf())
+    {
+      if (sphere.intersects(proxy.bounds))
+        nodes.push_back(proxy.node);
+    }
+    else
+    {
+      stack.push_back(proxy.left);
+      stack.push_back(proxy.right);
+    }
   }
 }
 
-void Graph::query(const Frustum& frustum, Node::List& nodes) const
+void SpatialIndex::query(const Frustum& frustum, Node::List& nodes) const
 {
-  for (auto r = roots.begin();  r != roots.end();  r++)
+  if (root == -1)
+    return;
+
+  // Each entry carries the planes its parent straddles, as children of a box
+  // entirely inside a plane are entirely inside it as well
+  std::vector<std::pair<int, uint>> stack;
+  stack.push_back(std::make_pair(root, ALL_FRUSTUM_PLANES));
+
+  SphereBatch leaves;
+  Node::List candidates;
+
+  while (!stack.empty())
   {
-    Sphere worldBounds = (*r)->getTotalBounds();
-    worldBounds.transformBy((*r)->getWorldTransform());
+    const int id = stack.back().first;
+    uint planeMask = stack.back().second;
+    stack.pop_back();
+
+    const Proxy& proxy = proxies[id];
 
-    if (frustum.intersects(worldBounds))
-      nodes.push_back(*r);
+    const AABB box((proxy.minimum + proxy.maximum) / 2.f,
+                   (proxy.maximum - proxy.minimum) / 2.f);
+
+    if (!frustum.intersects(box, planeMask, proxy.firstPlane))
+      continue;
+
+    if (!planeMask)
+    {
+      collect(id, nodes);
+      continue;
+    }
+
+    if (proxy.isLeaf())
+    {
+      leaves.add(proxy.bounds);
+      candidates.push_back(proxy.node);
+      continue;
+    }
+
+    // Only boxes straddling more than one plane can be accepted by the plane
+    // tests while being outside, so only those need the exact test
+    if ((planeMask & (planeMask - 1)) && !frustum.intersectsExactly(box))
+      continue;
+
+    stack.push_back(std::make_pair(proxy.left, planeMask));
+    stack.push_back(std::make_pair(proxy.right, planeMask));
+  }
+
+  std::vector<uint32> masks;
+  frustum.intersects(leaves, masks);
+
+  for (size_t i = 0;  i < candidates.size();  i++)
+  {
+    if (masks[i / 32] & (1u << (i % 32)))
+      nodes.push_back(candidates[i]);
   }
 }
 
-void Graph::addRootNode(Node& node)
+int SpatialIndex::getHeight() const
 {
-  node.removeFromParent();
-  roots.push_back(&node);
-  node.setGraph(this);
+  if (root == -1)
+    return 0;
+
+  return proxies[root].height;
 }
 
-void Graph::destroyRootNodes()
+int SpatialIndex::allocateProxy()
 {
-  while (!roots.empty())
-    delete roots.back();
+  int id;
+
+  if (unused == -1)
+  {
+    id = int(proxies.size());
+    proxies.push_back(Proxy());
+  }
+  else
+  {
+    id = unused;
+    unused = proxies[id].parent;
+  }
+
+  Proxy& proxy = proxies[id];
+  proxy.node = NULL;
+  proxy.parent = -1;
+  proxy.left = -1;
+  proxy.right = -1;
+  proxy.height = 0;
+  proxy.firstPlane = 0;
+
+  return id;
 }
 
-const Node::List& Graph::getNodes() const
+void SpatialIndex::freeProxy(int id)
 {
-  return roots;
-}
+  Proxy& proxy = proxies[id];
+  proxy.node = NULL;
+  proxy.parent = unused;
+  proxy.height = -1;
 
-///////////////////////////////////////////////////////////////////////
+  unused = id;
+}
 
-LightNode::LightNode():
-  Node(true)
+void SpatialIndex::insertLeaf(int leaf)
 {
+  if (root == -1)
+  {
+    root = leaf;
+    proxies[root].parent = -1;
+    return;
+  }
+
+  const vec3 leafMinimum = proxies[leaf].minimum;
+  const vec3 leafMaximum = proxies[leaf].maximum;
+
+  // Find the cheapest sibling by descending on the surface area heuristic
+
+  int sibling = root;
+
+  while (!proxies[sibling].isLeaf())
+  {
+    const Proxy& proxy = proxies[sibling];
+
+    const float area = surfaceArea(proxy.minimum, proxy.maximum);
+    const float combinedArea = surfaceArea(min(proxy.minimum, leafMinimum),
+                                           max(proxy.maximum, leafMaximum));
+
+    // Cost of making a new parent for this proxy and the leaf
+    const float cost = 2.f * combinedArea;
+
+    // Minimum cost of pushing the leaf further down the tree
+    const float inheritanceCost = 2.f * (combinedArea - area);
+
+    float childCosts[2];
+    const int children[2] = { proxy.left, proxy.right };
+
+    for (int i = 0;  i < 2;  i++)
+    {
+      const Proxy& child = proxies[children[i]];
+
+      const float childArea = surfaceArea(min(child.minimum, leafMinimum),
+                                          max(child.maximum, leafMaximum));
+
+      if (child.isLeaf())
+        childCosts[i] = childArea + inheritanceCost;
+      else
+      {
+        childCosts[i] = childArea + inheritanceCost -
+                        surfaceArea(child.minimum, child.maximum);
+      }
+    }
+
+    if (cost < childCosts[0] && cost < childCosts[1])
+      break;
+
+    if (childCosts[0] < childCosts[1])
+      sibling = children[0];
+    else
+      sibling = children[1];
+  }
+
+  // Create a new parent for the sibling and the leaf
+
+  const int oldParent = proxies[sibling].parent;
+  const int newParent = allocateProxy();
+
+  proxies[newParent].parent = oldParent;
+  proxies[newParent].left = sibling;
+  proxies[newParent].right = leaf;
+  proxies[sibling].parent = newParent;
+  proxies[leaf].parent = newParent;
+
+  if (oldParent == -1)
+    root = newParent;
+  else
+  {
+    if (proxies[oldParent].left == sibling)
+      proxies[oldParent].left = newParent;
+    else
+      proxies[oldParent].right = newParent;
+  }
+
+  refit(newParent);
 }
 
-render::Light* LightNode::getLight() const
+void SpatialIndex::removeLeaf(int leaf)
 {
-  return light;
+  if (leaf == root)
+  {
+    root = -1;
+    return;
+  }
+
+  const int parent = proxies[leaf].parent;
+  const int grandParent = proxies[parent].parent;
+
+  int sibling;
+  if (proxies[parent].left == leaf)
+    sibling = proxies[parent].right;
+  else
+    sibling = proxies[parent].left;
+
+  freeProxy(parent);
+
+  if (grandParent == -1)
+  {
+    root = sibling;
+    proxies[sibling].parent = -1;
+    return;
+  }
+
+  if (proxies[grandParent].left == parent)
+    proxies[grandParent].left = sibling;
+  else
+    proxies[grandParent].right = sibling;
+
+  proxies[sibling].parent = grandParent;
+
+  refit(grandParent);
 }
 
-void LightNode::setLight(render::Light* newLight)
+void SpatialIndex::refit(int id)
 {
-  light = newLight;
+  while (id != -1)
+  {
+    id = balance(id);
+
+    Proxy& proxy = proxies[id];
+    const Proxy& left = proxies[proxy.left];
+    const Proxy& right = proxies[proxy.right];
+
+    proxy.height = 1 + max(left.height, right.height);
+    proxy.minimum = min(left.minimum, right.minimum);
+    proxy.maximum = max(left.maximum, right.maximum);
+
+    id = proxy.parent;
+  }
 }
 
-void LightNode::update()
+int SpatialIndex::balance(int a)
 {
-  Node::update();
+  // Performs a left or right rotation if the subtree rooted at a is
+  // imbalanced, returning the root of the resulting subtree
 
-  if (light)
+  Proxy& A = proxies[a];
+  if (A.isLeaf() || A.height < 2)
+    return a;
+
+  const int b = A.left;
+  const int c = A.right;
+  Proxy& B = proxies[b];
+  Proxy& C = proxies[c];
+
+  const int difference = C.height - B.height;
+
+  if (difference > 1)
   {
-    const Transform3& world = getWorldTransform();
+    // Rotate C up
 
-    if (light->getType() == render::Light::DIRECTIONAL ||
-        light->getType() == render::Light::SPOTLIGHT)
+    const int f = C.left;
+    const int g = C.right;
+    Proxy& F = proxies[f];
+    Proxy& G = proxies[g];
+
+    C.left = a;
+    C.parent = A.parent;
+    A.parent = c;
+
+    if (C.parent == -1)
+      root = c;
+    else if (proxies[C.parent].left == a)
+      proxies[C.parent].left = c;
+    else
+      proxies[C.parent].right = c;
+
+    if (F.height > G.height)
     {
-      vec3 direction(0.f, 0.f, -1.f);
-      world.rotateVector(direction);
-      light->setDirection(direction);
+      C.right = f;
+      A.right = g;
+      G.parent = a;
+      A.minimum = min(B.minimum, G.minimum);
+      A.maximum = max(B.maximum, G.maximum);
+      C.minimum = min(A.minimum, F.minimum);
+      C.maximum = max(A.maximum, F.maximum);
+      A.height = 1 + max(B.height, G.height);
+      C.height = 1 + max(A.height, F.height);
+    }
+    else
+    {
+      C.right = g;
+      A.right = f;
+      F.parent = a;
+      A.minimum = min(B.minimum, F.minimum);
+      A.maximum = max(B.maximum, F.maximum);
+      C.minimum = min(A.minimum, G.minimum);
+      C.maximum = max(A.maximum, G.maximum);
+      A.height = 1 + max(B.height, F.height);
+      C.height = 1 + max(A.height, G.height);
     }
 
-    if (light->getType() == render::Light::POINT ||
-        light->getType() == render::Light::SPOTLIGHT)
+    return c;
+  }
+
+  if (difference < -1)
+  {
+    // Rotate B up
+
+    const int d = B.left;
+    const int e = B.right;
+    Proxy& D = proxies[d];
+    Proxy& E = proxies[e];
+
+    B.left = a;
+    B.parent = A.parent;
+    A.parent = b;
+
+    if (B.parent == -1)
+      root = b;
+    else if (proxies[B.parent].left == a)
+      proxies[B.parent].left = b;
+    else
+      proxies[B.parent].right = b;
+
+    if (D.height > E.height)
     {
-      light->setPosition(world.position);
+      B.right = d;
+      A.left = e;
+      E.parent = a;
+      A.minimum = min(C.minimum, E.minimum);
+      A.maximum = max(C.maximum, E.maximum);
+      B.minimum = min(A.minimum, D.minimum);
+      B.maximum = max(A.maximum, D.maximum);
+      A.height = 1 + max(C.height, E.height);
+      B.height = 1 + max(A.height, D.height);
+    }
+    else
+    {
+      B.right = e;
+      A.left = d;
+      D.parent = a;
+      A.minimum = min(C.minimum, D.minimum);
+      A.maximum = max(C.maximum, D.maximum);
+      B.minimum = min(A.minimum, E.minimum);
+      B.maximum = max(A.maximum, E.maximum);
+      A.height = 1 + max(C.height, D.height);
+      B.height = 1 + max(A.height, E.height);
     }
 
-    setLocalBounds(Sphere(vec3(), light->getRadius()));
+    return b;
   }
-  else
-    setLocalBounds(Sphere());
+
+  return a;
 }
 
-void LightNode::enqueue(render::Scene& scene, const Camera& camera) const
+void SpatialIndex::collect(int id, Node::List& nodes) const
 {
-  Node::enqueue(scene, camera);
+  const Proxy& proxy = proxies[id];
 
-  if (light)
-    scene.attachLight(*light);
+  if (proxy.isLeaf())
+    nodes.push_back(proxy.node);
+  else
+  {
+    collect(proxy.left, nodes);
+    collect(proxy.right, nodes);
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////
 
-ModelNode::ModelNode():
-  shadowCaster(false)
+TransformHierarchy::TransformHierarchy():
+  unused(0),
+  first(0),
+  changed(false),
+  generation(1)
 {
 }
 
-bool ModelNode::isShadowCaster() const
+int TransformHierarchy::createSlot(Node& node, int parent)
 {
-  return shadowCaster;
-}
+  assert(parent < int(nodes.size()));
 
-void ModelNode::setCastsShadows(bool enabled)
-{
-  shadowCaster = enabled;
-}
+  // Appending keeps the arrays in topological order, as the parent slot
+  // always exists before its children are attached
 
-render::Model* ModelNode::getModel() const
-{
-  return model;
-}
+  nodes.push_back(&node);
+  parents.push_back(parent);
+  locals.push_back(node.local);
+  worlds.push_back(Transform3());
+  dirty.push_back(true);
+
+  node.worldGeneration = 0;
+  generation++;
+
+  if (!changed)
+  {
+    first = nodes.size() - 1;
+    changed = true;
+  }
+
+  return int(nodes.size()) - 1;
+}
+
+void TransformHierarchy::destroySlot(int slot)
+{
+  assert(slot >= 0 && slot < int(nodes.size()));
+
+  Node* node = nodes[slot];
+  node->local = locals[slot];
+  node->slot = -1;
+
+  nodes[slot] = NULL;
+  unused++;
+}
+
+void TransformHierarchy::invalidate(int slot)
+{
+  dirty[slot] = true;
+  generation++;
+
+  if (!changed || size_t(slot) < first)
+    first = slot;
+
+  changed = true;
+}
+
+void TransformHierarchy::update()
+{
+  if (unused * 2 > nodes.size())
+    compact();
+
+  if (!changed)
+    return;
+
+  // Nothing before the first invalidated slot can have changed
+
+  const size_t count = nodes.size();
+
+  for (size_t i = first;  i < count;  i++)
+  {
+    if (!nodes[i])
+      continue;
+
+    const int parent = parents[i];
+
+    if (parent == -1)
+    {
+      if (dirty[i])
+        worlds[i] = locals[i];
+    }
+    else if (dirty[i] || dirty[parent])
+    {
+      worlds[i] = worlds[parent] * locals[i];
+      dirty[i] = true;
+    }
+  }
+
+  std::fill(dirty.begin() + first, dirty.end(), false);
+  changed = false;
+}
+
+bool TransformHierarchy::isDirty(int slot) const
+{
+  if (!changed)
+    return false;
+
+  for (int i = slot;  i != -1;  i = parents[i])
+  {
+    if (dirty[i])
+      return true;
+  }
+
+  return false;
+}
+
+Transform3& TransformHierarchy::getLocalTransform(int slot)
+{
+  return locals[slot];
+}
+
+bool TransformHierarchy::isChanged() const
+{
+  return changed;
+}
+
+uint TransformHierarchy::getGeneration() const
+{
+  return generation;
+}
+
+const Transform3& TransformHierarchy::getLocalTransform(int slot) const
+{
+  return locals[slot];
+}
+
+const Transform3& TransformHierarchy::getWorldTransform(int slot) const
+{
+  return worlds[slot];
+}
+
+size_t TransformHierarchy::getSlotCount() const
+{
+  return nodes.size();
+}
+
+void TransformHierarchy::compact()
+{
+  // Removing unused slots preserves the relative order of the remaining ones,
+  // and thus the topological order
+
+  std::vector<int> remap(nodes.size(), -1);
+  size_t count = 0;
+
+  for (size_t i = 0;  i < nodes.size();  i++)
+  {
+    if (!nodes[i])
+      continue;
+
+    remap[i] = int(count);
+
+    nodes[count] = nodes[i];
+    nodes[count]->slot = int(count);
+
+    if (parents[i] == -1)
+      parents[count] = -1;
+    else
+      parents[count] = remap[parents[i]];
+
+    locals[count] = locals[i];
+    worlds[count] = worlds[i];
+    dirty[count] = dirty[i];
+
+    count++;
+  }
+
+  nodes.resize(count);
+  parents.resize(count);
+  locals.resize(count);
+  worlds.resize(count);
+  dirty.resize(count);
+
+  unused = 0;
+  first = 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+Graph::Workers::Workers(uint count):
+  tasks(NULL),
+  next(0),
+  remaining(0),
+  stopping(false)
+{
+  for (uint i = 0;  i < count;  i++)
+    threads.push_back(std::thread(&Workers::work, this));
+}
+
+Graph::Workers::~Workers()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+
+  started.notify_all();
+
+  for (auto t = threads.begin();  t != threads.end();  t++)
+    t->join();
+}
+
+void Graph::Workers::run(const TaskList& newTasks)
+{
+  if (newTasks.empty())
+    return;
+
+  std::unique_lock<std::mutex> lock(mutex);
+
+  tasks = &newTasks;
+  next = 0;
+  remaining = newTasks.size();
+
+  started.notify_all();
+
+  // The calling thread performs tasks as well instead of just waiting
+
+  while (next < tasks->size())
+    perform(lock);
+
+  finished.wait(lock, [this]() { return remaining == 0; });
+
+  tasks = NULL;
+}
+
+void Graph::Workers::work()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;)
+  {
+    started.wait(lock, [this]()
+    {
+      return stopping || (tasks && next < tasks->size());
+    });
+
+    if (stopping)
+      return;
+
+    perform(lock);
+  }
+}
+
+void Graph::Workers::perform(std::unique_lock<std::mutex>& lock)
+{
+  const Task& task = (*tasks)[next++];
+
+  lock.unlock();
+  task();
+  lock.lock();
+
+  if (--remaining == 0)
+    finished.notify_all();
+}
+
+///////////////////////////////////////////////////////////////////////
+
+Graph::Graph(bool flatTransforms):
+  threadCount(1),
+  queries(false),
+  queryFrame(0)
+{
+  if (flatTransforms)
+    transforms = new TransformHierarchy();
+}
+
+Graph::~Graph()
+{
+  destroyRootNodes();
+}
+
+void Graph::update()
+{
+  if (transforms)
+    transforms->update();
+
+  for (auto n = updated.begin();  n != updated.end();  n++)
+    (*n)->update();
+}
+
+void Graph::enqueue(render::Scene& scene, const Camera& camera) const
+{
+  ProfileNodeCall call("scene::Graph::enqueue");
+
+  Node::List visible;
+  query(camera.getFrustum(), visible);
+
+  if (occlusion)
+  {
+    ProfileNodeCall call("scene::Graph::enqueue::occlusion");
+
+    occlusion->clear(camera);
+
+    for (auto v = visible.begin();  v != visible.end();  v++)
+    {
+      if (Mesh* occluder = (*v)->getOccluder())
+        occlusion->addOccluder(*occluder, (*v)->getWorldTransform());
+    }
+
+    occlusion->buildHierarchy();
+
+    auto last = visible.begin();
+
+    for (auto v = visible.begin();  v != visible.end();  v++)
+    {
+      Sphere bounds = (*v)->getTotalBounds();
+      bounds.transformBy((*v)->getWorldTransform());
+
+      if (occlusion->isVisible(bounds))
+        *last++ = *v;
+    }
+
+    visible.erase(last, visible.end());
+  }
+
+  if (queries)
+  {
+    // Only trust results for nodes that were tested during the last frame,
+    // as the rest have just entered the frustum
+    auto last = visible.begin();
+
+    for (auto v = visible.begin();  v != visible.end();  v++)
+    {
+      if (!(*v)->occluded || (*v)->queryFrame != queryFrame)
+        *last++ = *v;
+    }
+
+    visible.erase(last, visible.end());
+  }
+
+  if (threadCount < 2)
+  {
+    enqueueNodes(visible.begin(), visible.end(), scene, camera);
+    return;
+  }
+
+  std::vector<bool> concurrent(visible.size());
+  size_t concurrentCount = 0;
+
+  for (size_t i = 0;  i < visible.size();  i++)
+  {
+    concurrent[i] = isConcurrentTree(*visible[i]);
+    if (concurrent[i])
+      concurrentCount++;
+  }
+
+  const size_t count = min(size_t(threadCount),
+                           concurrentCount / MIN_NODES_PER_THREAD);
+  if (count < 2)
+  {
+    enqueueNodes(visible.begin(), visible.end(), scene, camera);
+    return;
+  }
+
+  // The visible root nodes are split into contiguous ranges, each either
+  // entirely concurrent or entirely not, keeping their original order so
+  // that the merged operations are added in the same order as on the serial
+  // path.  Runs of concurrent nodes are further split into ranges of about
+  // equal size for the workers
+
+  const size_t rangeSize = (concurrentCount + count - 1) / count;
+
+  std::vector<Range> ranges;
+
+  for (size_t first = 0;  first < visible.size();  )
+  {
+    size_t last = first + 1;
+
+    while (last < visible.size() && concurrent[last] == concurrent[first])
+      last++;
+
+    if (concurrent[first])
+    {
+      const size_t pieces = (last - first + rangeSize - 1) / rangeSize;
+
+      for (size_t i = 0;  i < pieces;  i++)
+      {
+        Range range;
+        range.first = visible.begin() + first + (last - first) * i / pieces;
+        range.last = visible.begin() + first + (last - first) * (i + 1) / pieces;
+        range.concurrent = true;
+        ranges.push_back(range);
+      }
+    }
+    else
+    {
+      Range range;
+      range.first = visible.begin() + first;
+      range.last = visible.begin() + last;
+      range.concurrent = false;
+      ranges.push_back(range);
+    }
+
+    first = last;
+  }
+
+  // The first range is enqueued directly into the target scene, while each
+  // of the others gets a scene of its own
+
+  for (size_t i = 0;  i < ranges.size() - 1;  i++)
+  {
+    if (i == scenes.size() || !isSamePool(scenes[i], scene))
+    {
+      render::Scene range = scene.hasGeometryPool() ?
+        render::Scene(scene.getGeometryPool(), scene.getPhase()) :
+        render::Scene(scene.getPhase());
+
+      if (i == scenes.size())
+        scenes.push_back(range);
+      else
+        scenes[i] = range;
+    }
+
+    scenes[i].removeOperations();
+    scenes[i].detachLights();
+    scenes[i].setPhase(scene.getPhase());
+  }
+
+  // The lazily computed state of the camera is computed here, as the
+  // workers would otherwise all race to compute it
+  camera.getFrustum();
+  camera.getViewTransform();
+
+  if (!workers)
+    workers = new Workers(threadCount - 1);
+
+  Workers::TaskList tasks;
+
+  for (size_t i = 0;  i < ranges.size();  i++)
+  {
+    const Range& range = ranges[i];
+    render::Scene& target = i ? scenes[i - 1] : scene;
+
+    if (range.concurrent)
+    {
+      tasks.push_back([range, &target, &camera]()
+      {
+        enqueueNodes(range.first, range.last, target, camera);
+      });
+    }
+    else
+      enqueueNodes(range.first, range.last, target, camera);
+  }
+
+  workers->run(tasks);
+
+  for (size_t i = 1;  i < ranges.size();  i++)
+    scene.addScene(scenes[i - 1]);
+}
+
+void Graph::query(const Sphere& sphere, Node::List& nodes) const
+{
+  updateProxies();
+  index.query(sphere, nodes);
+}
+
+void Graph::query(const Frustum& frustum, Node::List& nodes) const
+{
+  updateProxies();
+  index.query(frustum, nodes);
+}
+
+void Graph::addRootNode(Node& node)
+{
+  node.removeFromParent();
+  roots.push_back(&node);
+  node.setGraph(this);
+
+  Sphere worldBounds = node.getTotalBounds();
+  worldBounds.transformBy(node.getWorldTransform());
+
+  node.proxy = index.createProxy(node, worldBounds);
+}
+
+void Graph::destroyRootNodes()
+{
+  while (!roots.empty())
+    delete roots.back();
+}
+
+const Node::List& Graph::getNodes() const
+{
+  return roots;
+}
+
+bool Graph::initQueries(render::System& system)
+{
+  GL::Context& context = system.getContext();
+
+  Ref<GL::Program> program = GL::Program::read(context,
+                                               "wendy/OcclusionQuery.vs",
+                                               "wendy/OcclusionQuery.fs");
+  if (!program)
+  {
+    logError("Failed to load occlusion query program");
+    return false;
+  }
+
+  GL::ProgramInterface interface;
+  interface.addAttributes(Vertex3fv::format);
+
+  if (!interface.matches(*program, true))
+  {
+    logError("Occlusion query program \'%s\' does not conform to the required interface",
+             program->getName().c_str());
+    return false;
+  }
+
+  Ref<render::SharedProgramState> state = new render::SharedProgramState();
+  if (!state->reserveSupported(context))
+    return false;
+
+  Ref<GL::VertexBuffer> box = GL::VertexBuffer::create(context,
+                                                       sizeof(boxStrip) / sizeof(boxStrip[0]),
+                                                       Vertex3fv::format,
+                                                       GL::VertexBuffer::STATIC);
+  if (!box)
+    return false;
+
+  box->copyFrom(boxStrip, box->getCount());
+
+  queryPass.setProgram(program);
+  queryPass.setCullMode(GL::CULL_NONE);
+  queryPass.setDepthWriting(false);
+  queryPass.setColorWriting(false);
+  queryPass.setMultisampling(false);
+
+  queryState = state;
+  queryBox = box;
+  return true;
+}
+
+bool Graph::isConcurrentTree(const Node& node)
+{
+  if (!node.isConcurrent())
+    return false;
+
+  const Node::List& children = node.getChildren();
+
+  for (auto c = children.begin();  c != children.end();  c++)
+  {
+    if (!isConcurrentTree(**c))
+      return false;
+  }
+
+  return true;
+}
+
+void Graph::enqueueNodes(Node::List::const_iterator first,
+                         Node::List::const_iterator last,
+                         render::Scene& scene,
+                         const Camera& camera)
+{
+  for (auto n = first;  n != last;  n++)
+    (*n)->enqueue(scene, camera);
+}
+
+uint Graph::getThreadCount() const
+{
+  return threadCount;
+}
+
+void Graph::setThreadCount(uint newCount)
+{
+  newCount = max(newCount, 1u);
+  if (newCount == threadCount)
+    return;
+
+  // The workers are started again by the next call to enqueue
+  workers = NULL;
+  threadCount = newCount;
+}
+
+bool Graph::hasOcclusionCulling() const
+{
+  return occlusion;
+}
+
+void Graph::setOcclusionCulling(bool enabled)
+{
+  if (enabled)
+  {
+    if (!occlusion)
+      occlusion = new OcclusionBuffer();
+  }
+  else
+    occlusion = NULL;
+}
+
+const OcclusionBuffer* Graph::getOcclusionBuffer() const
+{
+  return occlusion;
+}
+
+bool Graph::hasOcclusionQueries() const
+{
+  return queries;
+}
+
+void Graph::setOcclusionQueries(bool enabled)
+{
+  if (queries == enabled)
+    return;
+
+  queries = enabled;
+
+  for (auto r = roots.begin();  r != roots.end();  r++)
+  {
+    (*r)->queryPending = false;
+    (*r)->occluded = false;
+  }
+}
+
+bool Graph::issueOcclusionQueries(render::System& system, const Camera& camera)
+{
+  ProfileNodeCall call("scene::Graph::issueOcclusionQueries");
+
+  if (!queries)
+    return true;
+
+  if (!queryBox)
+  {
+    if (!initQueries(system))
+      return false;
+  }
+
+  GL::Context& context = system.getContext();
+
+  queryFrame++;
+
+  Node::List candidates;
+  query(camera.getFrustum(), candidates);
+
+  queryState->setProjectionMatrix(camera.getProjectionMatrix());
+  queryState->setViewMatrix(camera.getViewTransform());
+
+  context.setCurrentSharedProgramState(queryState);
+  queryPass.apply();
+
+  const GL::PrimitiveRange range(GL::TRIANGLE_STRIP, *queryBox);
+
+  // Boxes reaching the near plane would be clipped and may falsely report
+  // their node as hidden, so those nodes are never queried
+  const Frustum& frustum = camera.getFrustum();
+  const vec3 origin = camera.getTransform().position;
+  const float margin = length(frustum.corners[0] - origin);
+
+  for (auto c = candidates.begin();  c != candidates.end();  c++)
+  {
+    Node& node = **c;
+
+    const bool entering = node.queryFrame + 1 != queryFrame;
+    node.queryFrame = queryFrame;
+
+    if (entering)
+    {
+      node.occluded = false;
+      node.nextQueryFrame = queryFrame;
+    }
+
+    if (node.queryPending)
+    {
+      // Never wait for a result, as that would stall the pipeline
+      if (!node.query->hasResultAvailable())
+        continue;
+
+      const uint samples = node.query->getResult();
+      node.queryPending = false;
+
+      // Results from before the node left the frustum are stale
+      if (!entering)
+        node.occluded = (samples == 0);
+    }
+
+    if (!node.occluded && queryFrame < node.nextQueryFrame)
+      continue;
+
+    // Visible nodes are staggered to spread their queries over several frames
+    node.nextQueryFrame = queryFrame + VISIBLE_QUERY_INTERVAL +
+                          uint(node.proxy) % VISIBLE_QUERY_INTERVAL;
+
+    Sphere bounds = node.getTotalBounds();
+    bounds.transformBy(node.getWorldTransform());
+
+    if (all(lessThanEqual(abs(origin - bounds.center),
+                          vec3(bounds.radius + margin))))
+    {
+      node.occluded = false;
+      continue;
+    }
+
+    if (!node.query)
+    {
+      node.query = GL::OcclusionQuery::create(context);
+      if (!node.query)
+      {
+        context.setCurrentSharedProgramState(NULL);
+        return false;
+      }
+    }
+
+    queryState->setModelMatrix(scale(translate(mat4(), bounds.center), vec3(bounds.radius)));
+
+    node.query->begin();
+    context.render(range);
+    node.query->end();
+
+    node.queryPending = true;
+  }
+
+  context.setCurrentSharedProgramState(NULL);
+  return true;
+}
+
+void Graph::invalidateProxy(Node& node)
+{
+  if (node.dirtyProxy)
+    return;
+
+  node.dirtyProxy = true;
+  invalidated.push_back(&node);
+}
+
+void Graph::updateProxies() const
+{
+  for (auto n = invalidated.begin();  n != invalidated.end();  n++)
+  {
+    Sphere worldBounds = (*n)->getTotalBounds();
+    worldBounds.transformBy((*n)->getWorldTransform());
+
+    index.moveProxy((*n)->proxy, worldBounds);
+    (*n)->dirtyProxy = false;
+  }
+
+  invalidated.clear();
+}
+
+///////////////////////////////////////////////////////////////////////
+
+LightNode::LightNode():
+  Node(true)
+{
+}
+
+render::Light* LightNode::getLight() const
+{
+  return light;
+}
+
+void LightNode::setLight(render::Light* newLight)
+{
+  light = newLight;
+}
+
+bool LightNode::isConcurrent() const
+{
+  return true;
+}
+
+void LightNode::update()
+{
+  Node::update();
+
+  if (light)
+  {
+    const Transform3& world = getWorldTransform();
+
+    if (light->getType() == render::Light::DIRECTIONAL ||
+        light->getType() == render::Light::SPOTLIGHT)
+    {
+      vec3 direction(0.f, 0.f, -1.f);
+      world.rotateVector(direction);
+      light->setDirection(direction);
+    }
+
+    if (light->getType() == render::Light::POINT ||
+        light->getType() == render::Light::SPOTLIGHT)
+    {
+      light->setPosition(world.position);
+    }
+
+    setLocalBounds(Sphere(vec3(), light->getRadius()));
+  }
+  else
+    setLocalBounds(Sphere());
+}
+
+void LightNode::enqueue(render::Scene& scene, const Camera& camera) const
+{
+  Node::enqueue(scene, camera);
+
+  if (light)
+    scene.attachLight(*light);
+}
+
+///////////////////////////////////////////////////////////////////////
+
+ModelNode::ModelNode():
+  shadowCaster(false),
+  level(0)
+{
+}
+
+bool ModelNode::isShadowCaster() const
+{
+  return shadowCaster;
+}
+
+void ModelNode::setCastsShadows(bool enabled)
+{
+  shadowCaster = enabled;
+}
+
+render::Model* ModelNode::getModel() const
+{
+  return model;
+}
 
 void ModelNode::setModel(render::Model* newModel)
 {
@@ -467,16 +1774,28 @@ void ModelNode::setModel(render::Model* newModel)
     setLocalBounds(Sphere());
 }
 
+bool ModelNode::isConcurrent() const
+{
+  return true;
+}
+
 void ModelNode::enqueue(render::Scene& scene, const Camera& camera) const
 {
   Node::enqueue(scene, camera);
 
   if (model)
   {
-    if (scene.getPhase() == render::PHASE_SHADOWMAP && !shadowCaster)
-      return;
+    if (scene.getPhase() == render::PHASE_SHADOWMAP)
+    {
+      if (!shadowCaster)
+        return;
 
-    model->enqueue(scene, camera, getWorldTransform());
+      // Shadow map cameras are not the ones the level of detail is selected
+      // for, so don't let them affect it
+      model->enqueue(scene, camera, getWorldTransform());
+    }
+    else
+      model->enqueue(scene, camera, getWorldTransform(), level);
   }
 }
 
@@ -59,10 +59,11 @@ void Canvas::draw() const
   Recti oldViewport = context.getViewportArea();
   Recti oldScissor = context.getScissorArea();
 
+  drawer.end();
+
   context.setViewportArea(area);
   context.setScissorArea(area);
 
-  drawer.end();
   drawSignal(*this);
   drawer.begin();
 
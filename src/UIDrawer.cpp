@@ -32,6 +32,8 @@
 
 #include <pugixml.hpp>
 
+#include <cstring>
+
 ///////////////////////////////////////////////////////////////////////
 
 namespace wendy
@@ -46,22 +48,45 @@ namespace
 
 Bimap<String, WidgetState> widgetStateMap;
 
-class ElementVertex
+// These are the scaling factors used when realizing UI widget elements, per
+// grid line along each axis
+//
+// There are three kinds:
+//  * The size scale, which when multiplied by the screen space size of the
+//    element places the grid line at the closest edge
+//  * The offset scale, which when multiplied by the texture space size of the
+//    element pulls the grid lines defining its inner edges towards the center
+//    of the element
+//  * The texture coordinate scale, which when multiplied by the texture space
+//    size of the element becomes the relative texture coordinate of that grid
+//    line
+//
+// The same factors apply to both axes.
+
+const float elementSizeScales[] = { 0.f, 0.f, 1.f, 1.f };
+const float elementOffsetScales[] = { 0.f, 0.5f, -0.5f, 0.f };
+const float elementTexScales[] = { 0.f, 0.5f, 0.5f, 1.f };
+
+bool uploadVertices(render::GeometryPool& pool,
+                    GL::VertexRange& range,
+                    const void* vertices,
+                    size_t count,
+                    const VertexFormat& format)
 {
-public:
-  inline void set(const vec2& newSizeScale, const vec2& newOffsetScale, const vec2& newTexScale)
+  if (!count)
+    return false;
+
+  void* target = pool.lockVertices(range, count, format);
+  if (!target)
   {
-    sizeScale = newSizeScale;
-    offsetScale = newOffsetScale;
-    texScale = newTexScale;
+    logError("Failed to allocate vertices for UI drawing");
+    return false;
   }
-  vec2 sizeScale;
-  vec2 offsetScale;
-  vec2 texScale;
-  static VertexFormat format;
-};
 
-VertexFormat ElementVertex::format("2f:vSizeScale 2f:vOffsetScale 2f:vTexScale");
+  std::memcpy(target, vertices, count * format.getSize());
+  range.unlock();
+  return true;
+}
 
 const uint THEME_XML_VERSION = 3;
 
@@ -230,14 +255,101 @@ void Drawer::begin()
 
 void Drawer::end()
 {
+  flush();
+
   getContext().setCurrentSharedProgramState(NULL);
 }
 
+void Drawer::flush()
+{
+  if (batchType == BATCH_NONE)
+    return;
+
+  GL::Context& context = getContext();
+  GL::VertexRange range;
+
+  switch (batchType)
+  {
+    case BATCH_POINTS:
+    case BATCH_LINES:
+    case BATCH_TRIANGLES:
+    {
+      if (!uploadVertices(*pool, range,
+                          &solidVertices[0], solidVertices.size(),
+                          Vertex4fc2fv::format))
+      {
+        break;
+      }
+
+      GL::PrimitiveType type;
+
+      if (batchType == BATCH_POINTS)
+        type = GL::POINT_LIST;
+      else if (batchType == BATCH_LINES)
+        type = GL::LINE_LIST;
+      else
+        type = GL::TRIANGLE_LIST;
+
+      drawPass.apply();
+      context.render(GL::PrimitiveRange(type, range));
+      break;
+    }
+
+    case BATCH_ELEMENTS:
+    case BATCH_BLIT:
+    case BATCH_TEXT:
+    {
+      if (!uploadVertices(*pool, range,
+                          &mappedVertices[0], mappedVertices.size(),
+                          Vertex2ft2fv::format))
+      {
+        break;
+      }
+
+      if (batchType == BATCH_ELEMENTS)
+      {
+        elementPass.apply();
+        context.render(GL::PrimitiveRange(GL::TRIANGLE_LIST, range));
+      }
+      else if (batchType == BATCH_BLIT)
+      {
+        if (batchTexture->getFormat().getSemantic() == PixelFormat::RGBA)
+          blitPass.setBlendFactors(GL::BLEND_SRC_ALPHA, GL::BLEND_ONE_MINUS_SRC_ALPHA);
+        else
+          blitPass.setBlendFactors(GL::BLEND_ONE, GL::BLEND_ZERO);
+
+        blitPass.setSamplerState("image", batchTexture);
+        blitPass.apply();
+
+        context.render(GL::PrimitiveRange(GL::TRIANGLE_LIST, range));
+
+        blitPass.setSamplerState("image", NULL);
+      }
+      else
+        batchFont->drawVertices(GL::PrimitiveRange(GL::TRIANGLE_LIST, range), batchColor);
+
+      break;
+    }
+
+    default:
+      panic("Invalid batch type %u", batchType);
+  }
+
+  solidVertices.clear();
+  mappedVertices.clear();
+
+  batchType = BATCH_NONE;
+  batchTexture = NULL;
+  batchFont = NULL;
+}
+
 bool Drawer::pushClipArea(const Rect& area)
 {
   if (!clipAreaStack.push(area))
     return false;
 
+  flush();
+
   const Rect& total = clipAreaStack.getTotal();
 
   GL::Context& context = getContext();
@@ -248,6 +360,8 @@ bool Drawer::pushClipArea(const Rect& area)
 
 void Drawer::popClipArea()
 {
+  flush();
+
   clipAreaStack.pop();
 
   GL::Context& context = getContext();
@@ -268,53 +382,33 @@ void Drawer::popClipArea()
 
 void Drawer::drawPoint(const vec2& point, const vec4& color)
 {
-  Vertex2fv vertex;
-  vertex.position = point;
-
-  GL::VertexRange range;
-  if (!getGeometryPool().allocateVertices(range, 1, Vertex2fv::format))
-    return;
-
-  range.copyFrom(&vertex);
+  Vertex4fc2fv* vertex = allocateSolid(BATCH_POINTS, 1);
 
-  setDrawingState(color, true);
-
-  getContext().render(GL::PrimitiveRange(GL::POINT_LIST, range));
+  vertex->color = color;
+  vertex->position = point;
 }
 
 void Drawer::drawLine(const Segment2& segment, const vec4& color)
 {
-  Vertex2fv vertices[2];
+  Vertex4fc2fv* vertices = allocateSolid(BATCH_LINES, 2);
+
+  vertices[0].color = color;
   vertices[0].position = segment.start;
+  vertices[1].color = color;
   vertices[1].position = segment.end;
-
-  GL::VertexRange range;
-  if (!getGeometryPool().allocateVertices(range, 2, Vertex2fv::format))
-    return;
-
-  range.copyFrom(vertices);
-
-  setDrawingState(color, true);
-
-  getContext().render(GL::PrimitiveRange(GL::LINE_LIST, range));
 }
 
 void Drawer::drawTriangle(const Triangle2& triangle, const vec4& color)
 {
-  Vertex2fv vertices[3];
-  vertices[0].position = triangle.P[0];
-  vertices[1].position = triangle.P[1];
-  vertices[2].position = triangle.P[2];
-
-  GL::VertexRange range;
-  if (!getGeometryPool().allocateVertices(range, 3, Vertex2fv::format))
-    return;
-
-  range.copyFrom(vertices);
+  Vertex4fc2fv* vertices = allocateSolid(BATCH_LINES, 6);
 
-  setDrawingState(color, true);
-
-  getContext().render(GL::PrimitiveRange(GL::TRIANGLE_LIST, range));
+  for (uint i = 0;  i < 3;  i++)
+  {
+    vertices[i * 2 + 0].color = color;
+    vertices[i * 2 + 0].position = triangle.P[i];
+    vertices[i * 2 + 1].color = color;
+    vertices[i * 2 + 1].position = triangle.P[(i + 1) % 3];
+  }
 }
 
 void Drawer::drawBezier(const BezierCurve2& spline, const vec4& color)
@@ -322,21 +416,19 @@ void Drawer::drawBezier(const BezierCurve2& spline, const vec4& color)
   BezierCurve2::PointList points;
   spline.tessellate(points);
 
-  GL::VertexRange range;
-  if (!getGeometryPool().allocateVertices(range, points.size(), Vertex2fv::format))
+  if (points.size() < 2)
     return;
 
-  // Realize vertices
-  {
-    GL::VertexRangeLock<Vertex2fv> vertices(range);
+  Vertex4fc2fv* vertices = allocateSolid(BATCH_LINES, (points.size() - 1) * 2);
 
-    for (uint i = 0;  i < points.size();  i++)
-      vertices[i].position = points[i];
+  for (uint i = 1;  i < points.size();  i++)
+  {
+    vertices[0].color = color;
+    vertices[0].position = points[i - 1];
+    vertices[1].color = color;
+    vertices[1].position = points[i];
+    vertices += 2;
   }
-
-  setDrawingState(color, true);
-
-  getContext().render(GL::PrimitiveRange(GL::LINE_STRIP, range));
 }
 
 void Drawer::drawRectangle(const Rect& rectangle, const vec4& color)
@@ -347,39 +439,34 @@ void Drawer::drawRectangle(const Rect& rectangle, const vec4& color)
   if (maxX - minX < 1.f || maxY - minY < 1.f)
     return;
 
-  Vertex2fv vertices[4];
-  vertices[0].position = vec2(minX, minY);
-  vertices[1].position = vec2(maxX, minY);
-  vertices[2].position = vec2(maxX, maxY);
-  vertices[3].position = vec2(minX, maxY);
-
-  GL::VertexRange range;
-  if (!getGeometryPool().allocateVertices(range, 4, Vertex2fv::format))
-    return;
-
-  range.copyFrom(vertices);
+  const vec2 corners[] =
+  {
+    vec2(minX, minY),
+    vec2(maxX, minY),
+    vec2(maxX, maxY),
+    vec2(minX, maxY)
+  };
 
-  setDrawingState(color, true);
+  Vertex4fc2fv* vertices = allocateSolid(BATCH_LINES, 8);
 
-  getContext().render(GL::PrimitiveRange(GL::LINE_LOOP, range));
+  for (uint i = 0;  i < 4;  i++)
+  {
+    vertices[i * 2 + 0].color = color;
+    vertices[i * 2 + 0].position = corners[i];
+    vertices[i * 2 + 1].color = color;
+    vertices[i * 2 + 1].position = corners[(i + 1) % 4];
+  }
 }
 
 void Drawer::fillTriangle(const Triangle2& triangle, const vec4& color)
 {
-  Vertex2fv vertices[3];
-  vertices[0].position = triangle.P[0];
-  vertices[1].position = triangle.P[1];
-  vertices[2].position = triangle.P[2];
-
-  GL::VertexRange range;
-  if (!getGeometryPool().allocateVertices(range, 3, Vertex2fv::format))
-    return;
+  Vertex4fc2fv* vertices = allocateSolid(BATCH_TRIANGLES, 3);
 
-  range.copyFrom(vertices);
-
-  setDrawingState(color, false);
-
-  getContext().render(GL::PrimitiveRange(GL::TRIANGLE_LIST, range));
+  for (uint i = 0;  i < 3;  i++)
+  {
+    vertices[i].color = color;
+    vertices[i].position = triangle.P[i];
+  }
 }
 
 void Drawer::fillRectangle(const Rect& rectangle, const vec4& color)
@@ -390,21 +477,17 @@ void Drawer::fillRectangle(const Rect& rectangle, const vec4& color)
   if (maxX - minX < 1.f || maxY - minY < 1.f)
     return;
 
-  Vertex2fv vertices[4];
+  Vertex4fc2fv* vertices = allocateSolid(BATCH_TRIANGLES, 6);
+
+  for (uint i = 0;  i < 6;  i++)
+    vertices[i].color = color;
+
   vertices[0].position = vec2(minX, minY);
   vertices[1].position = vec2(maxX, minY);
   vertices[2].position = vec2(maxX, maxY);
-  vertices[3].position = vec2(minX, maxY);
-
-  GL::VertexRange range;
-  if (!getGeometryPool().allocateVertices(range, 4, Vertex2fv::format))
-    return;
-
-  range.copyFrom(vertices);
-
-  setDrawingState(color, false);
-
-  getContext().render(GL::PrimitiveRange(GL::TRIANGLE_FAN, range));
+  vertices[3].position = vec2(maxX, maxY);
+  vertices[4].position = vec2(minX, maxY);
+  vertices[5].position = vec2(minX, minY);
 }
 
 void Drawer::blitTexture(const Rect& area, GL::Texture& texture)
@@ -415,33 +498,18 @@ void Drawer::blitTexture(const Rect& area, GL::Texture& texture)
   if (maxX - minX < 1.f || maxY - minY < 1.f)
     return;
 
-  Vertex2ft2fv vertices[4];
+  Vertex2ft2fv* vertices = allocateMapped(BATCH_BLIT, 6, &texture, NULL, vec4());
+
   vertices[0].texCoord = vec2(0.f, 0.f);
   vertices[0].position = vec2(minX, minY);
   vertices[1].texCoord = vec2(1.f, 0.f);
   vertices[1].position = vec2(maxX, minY);
   vertices[2].texCoord = vec2(1.f, 1.f);
   vertices[2].position = vec2(maxX, maxY);
-  vertices[3].texCoord = vec2(0.f, 1.f);
-  vertices[3].position = vec2(minX, maxY);
-
-  GL::VertexRange range;
-  if (!getGeometryPool().allocateVertices(range, 4, Vertex2ft2fv::format))
-    return;
-
-  range.copyFrom(vertices);
-
-  if (texture.getFormat().getSemantic() == PixelFormat::RGBA)
-    blitPass.setBlendFactors(GL::BLEND_SRC_ALPHA, GL::BLEND_ONE_MINUS_SRC_ALPHA);
-  else
-    blitPass.setBlendFactors(GL::BLEND_ONE, GL::BLEND_ZERO);
-
-  blitPass.setSamplerState("image", &texture);
-  blitPass.apply();
-
-  getContext().render(GL::PrimitiveRange(GL::TRIANGLE_FAN, range));
-
-  blitPass.setSamplerState("image", NULL);
+  vertices[3] = vertices[2];
+  vertices[4].texCoord = vec2(0.f, 1.f);
+  vertices[4].position = vec2(minX, maxY);
+  vertices[5] = vertices[0];
 }
 
 void Drawer::drawText(const Rect& area,
@@ -485,7 +553,18 @@ void Drawer::drawText(const Rect& area,
       panic("Invalid vertical alignment");
   }
 
-  currentFont->drawText(penPosition, vec4(color, 1.f), text);
+  const size_t length = std::strlen(text);
+  if (!length)
+    return;
+
+  Vertex2ft2fv* vertices = allocateMapped(BATCH_TEXT,
+                                          length * 6,
+                                          NULL,
+                                          currentFont,
+                                          vec4(color, 1.f));
+
+  const uint count = currentFont->realizeVertices(vertices, penPosition, text);
+  mappedVertices.resize(mappedVertices.size() - (length * 6 - count));
 }
 
 void Drawer::drawText(const Rect& area,
@@ -577,6 +656,7 @@ Ref<Drawer> Drawer::create(render::GeometryPool& pool)
 }
 
 Drawer::Drawer(render::GeometryPool& initPool):
+  batchType(BATCH_NONE),
   pool(&initPool)
 {
 }
@@ -589,78 +669,6 @@ bool Drawer::init()
   if (!state->reserveSupported(context))
     return false;
 
-  // Set up element geometry
-  {
-    vertexBuffer = GL::VertexBuffer::create(context, 16, ElementVertex::format, GL::VertexBuffer::STATIC);
-    if (!vertexBuffer)
-      return false;
-
-    ElementVertex* vertices = (ElementVertex*) vertexBuffer->lock();
-
-    // These are scaling factors used when rendering UI widget elements
-    //
-    // There are three kinds:
-    //  * The size scale, which when multiplied by the screen space size
-    //    of the element places vertices in the closest corner
-    //  * The offset scale, which when multiplied by the texture space size of
-    //    the element pulls the vertices defining its inner edges towards the
-    //    center of the element
-    //  * The texture coordinate scale, which when multiplied by the texture
-    //    space size of the element becomes the relative texture coordinate
-    //    of that vertex
-    //
-    // This allows rendering of UI elements by changing only four uniforms: the
-    // position and size of the element in screen and texture space.
-
-    vertices[0x0].set(vec2(0.f, 0.f), vec2(  0.f,   0.f), vec2( 0.f,  0.f));
-    vertices[0x1].set(vec2(0.f, 0.f), vec2( 0.5f,   0.f), vec2(0.5f,  0.f));
-    vertices[0x2].set(vec2(1.f, 0.f), vec2(-0.5f,   0.f), vec2(0.5f,  0.f));
-    vertices[0x3].set(vec2(1.f, 0.f), vec2(  0.f,   0.f), vec2( 1.f,  0.f));
-
-    vertices[0x4].set(vec2(0.f, 0.f), vec2(  0.f,  0.5f), vec2( 0.f, 0.5f));
-    vertices[0x5].set(vec2(0.f, 0.f), vec2( 0.5f,  0.5f), vec2(0.5f, 0.5f));
-    vertices[0x6].set(vec2(1.f, 0.f), vec2(-0.5f,  0.5f), vec2(0.5f, 0.5f));
-    vertices[0x7].set(vec2(1.f, 0.f), vec2(  0.f,  0.5f), vec2( 1.f, 0.5f));
-
-    vertices[0x8].set(vec2(0.f, 1.f), vec2(  0.f, -0.5f), vec2( 0.f, 0.5f));
-    vertices[0x9].set(vec2(0.f, 1.f), vec2( 0.5f, -0.5f), vec2(0.5f, 0.5f));
-    vertices[0xa].set(vec2(1.f, 1.f), vec2(-0.5f, -0.5f), vec2(0.5f, 0.5f));
-    vertices[0xb].set(vec2(1.f, 1.f), vec2(  0.f, -0.5f), vec2( 1.f, 0.5f));
-
-    vertices[0xc].set(vec2(0.f, 1.f), vec2(  0.f,   0.f), vec2( 0.f,  1.f));
-    vertices[0xd].set(vec2(0.f, 1.f), vec2( 0.5f,   0.f), vec2(0.5f,  1.f));
-    vertices[0xe].set(vec2(1.f, 1.f), vec2(-0.5f,   0.f), vec2(0.5f,  1.f));
-    vertices[0xf].set(vec2(1.f, 1.f), vec2(  0.f,   0.f), vec2( 1.f,  1.f));
-
-    vertexBuffer->unlock();
-
-    indexBuffer = GL::IndexBuffer::create(context, 54, GL::IndexBuffer::UINT8, GL::IndexBuffer::STATIC);
-    if (!indexBuffer)
-      return false;
-
-    uint8* indices = (uint8*) indexBuffer->lock();
-
-    // This is a perfectly normal indexed triangle list using the vertices above
-
-    for (int y = 0;  y < 3;  y++)
-    {
-      for (int x = 0;  x < 3;  x++)
-      {
-        *indices++ = x + y * 4;
-        *indices++ = (x + 1) + (y + 1) * 4;
-        *indices++ = x + (y + 1) * 4;
-
-        *indices++ = x + y * 4;
-        *indices++ = (x + 1) + y * 4;
-        *indices++ = (x + 1) + (y + 1) * 4;
-      }
-    }
-
-    indexBuffer->unlock();
-
-    range = GL::PrimitiveRange(GL::TRIANGLE_LIST, *vertexBuffer, *indexBuffer);
-  }
-
   // Load default theme
   {
     const String themeName("wendy/UIDefault.theme");
@@ -675,7 +683,7 @@ bool Drawer::init()
     currentFont = theme->font;
   }
 
-  // Set up solid pass
+  // Set up element pass
   {
     Ref<GL::Program> program = GL::Program::read(context,
                                                  "wendy/UIElement.vs",
@@ -687,12 +695,8 @@ bool Drawer::init()
     }
 
     GL::ProgramInterface interface;
-    interface.addUniform("elementPos", GL::UNIFORM_VEC2);
-    interface.addUniform("elementSize", GL::UNIFORM_VEC2);
-    interface.addUniform("texPos", GL::UNIFORM_VEC2);
-    interface.addUniform("texSize", GL::UNIFORM_VEC2);
     interface.addSampler("image", GL::SAMPLER_RECT);
-    interface.addAttributes(ElementVertex::format);
+    interface.addAttributes(Vertex2ft2fv::format);
 
     if (!interface.matches(*program, true))
     {
@@ -707,11 +711,6 @@ bool Drawer::init()
     elementPass.setSamplerState("image", theme->texture);
     elementPass.setBlendFactors(GL::BLEND_SRC_ALPHA, GL::BLEND_ONE_MINUS_SRC_ALPHA);
     elementPass.setMultisampling(false);
-
-    elementPosIndex = elementPass.getUniformStateIndex("elementPos");
-    elementSizeIndex = elementPass.getUniformStateIndex("elementSize");
-    texPosIndex = elementPass.getUniformStateIndex("texPos");
-    texSizeIndex = elementPass.getUniformStateIndex("texSize");
   }
 
   // Set up solid pass
@@ -726,8 +725,7 @@ bool Drawer::init()
     }
 
     GL::ProgramInterface interface;
-    interface.addUniform("color", GL::UNIFORM_VEC4);
-    interface.addAttributes(Vertex2fv::format);
+    interface.addAttributes(Vertex4fc2fv::format);
 
     if (!interface.matches(*program, true))
     {
@@ -740,6 +738,7 @@ bool Drawer::init()
     drawPass.setCullMode(GL::CULL_NONE);
     drawPass.setDepthTesting(false);
     drawPass.setDepthWriting(false);
+    drawPass.setBlendFactors(GL::BLEND_SRC_ALPHA, GL::BLEND_ONE_MINUS_SRC_ALPHA);
     drawPass.setMultisampling(false);
   }
 
@@ -777,26 +776,78 @@ bool Drawer::init()
 
 void Drawer::drawElement(const Rect& area, const Rect& mapping)
 {
-  elementPass.setUniformState(elementPosIndex, area.position);
-  elementPass.setUniformState(elementSizeIndex, area.size);
-  elementPass.setUniformState(texPosIndex, mapping.position);
-  elementPass.setUniformState(texSizeIndex, mapping.size);
-  elementPass.apply();
+  vec2 positions[4];
+  vec2 texCoords[4];
+
+  for (uint i = 0;  i < 4;  i++)
+  {
+    positions[i] = area.position +
+                   area.size * elementSizeScales[i] +
+                   mapping.size * elementOffsetScales[i];
+    texCoords[i] = mapping.position + mapping.size * elementTexScales[i];
+  }
 
-  getContext().render(range);
+  // This is a perfectly normal triangle list over the 4x4 grid of vertices
+  // defined by the grid lines above
+
+  Vertex2ft2fv* vertices = allocateMapped(BATCH_ELEMENTS, 54, NULL, NULL, vec4());
+
+  for (uint y = 0;  y < 3;  y++)
+  {
+    for (uint x = 0;  x < 3;  x++)
+    {
+      const uint corners[][2] =
+      {
+        { x, y }, { x + 1, y + 1 }, { x, y + 1 },
+        { x, y }, { x + 1, y }, { x + 1, y + 1 }
+      };
+
+      for (uint i = 0;  i < 6;  i++)
+      {
+        vertices->position = vec2(positions[corners[i][0]].x,
+                                  positions[corners[i][1]].y);
+        vertices->texCoord = vec2(texCoords[corners[i][0]].x,
+                                  texCoords[corners[i][1]].y);
+        vertices++;
+      }
+    }
+  }
 }
 
-void Drawer::setDrawingState(const vec4& color, bool wireframe)
+Vertex4fc2fv* Drawer::allocateSolid(BatchType type, uint count)
 {
-  drawPass.setUniformState("color", color);
+  if (batchType != type)
+  {
+    flush();
+    batchType = type;
+  }
 
-  if (color.a == 1.f)
-    drawPass.setBlendFactors(GL::BLEND_ONE, GL::BLEND_ZERO);
-  else
-    drawPass.setBlendFactors(GL::BLEND_SRC_ALPHA, GL::BLEND_ONE_MINUS_SRC_ALPHA);
+  const size_t start = solidVertices.size();
+  solidVertices.resize(start + count);
+  return &solidVertices[start];
+}
+
+Vertex2ft2fv* Drawer::allocateMapped(BatchType type,
+                                     uint count,
+                                     GL::Texture* texture,
+                                     render::Font* font,
+                                     const vec4& color)
+{
+  if (batchType != type ||
+      batchTexture != texture ||
+      batchFont != font ||
+      batchColor != color)
+  {
+    flush();
+    batchType = type;
+    batchTexture = texture;
+    batchFont = font;
+    batchColor = color;
+  }
 
-  drawPass.setWireframe(wireframe);
-  drawPass.apply();
+  const size_t start = mappedVertices.size();
+  mappedVertices.resize(start + count);
+  return &mappedVertices[start];
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -62,6 +62,9 @@ size_t VertexComponent::getSize() const
   {
     case FLOAT32:
       return 4 * count;
+    case FLOAT16:
+    case SNORM16:
+      return 2 * count;
     default:
       panic("Invalid vertex component type");
   }
@@ -87,13 +90,28 @@ size_t VertexComponent::getElementCount() const
   return count;
 }
 
+bool VertexComponent::isReadAsFloat() const
+{
+  switch (type)
+  {
+    case FLOAT32:
+    case FLOAT16:
+    case SNORM16:
+      return true;
+  }
+
+  return false;
+}
+
 ///////////////////////////////////////////////////////////////////////
 
-VertexFormat::VertexFormat()
+VertexFormat::VertexFormat():
+  hash(hashString(""))
 {
 }
 
-VertexFormat::VertexFormat(const char* specification)
+VertexFormat::VertexFormat(const char* specification):
+  hash(hashString(""))
 {
   if (!createComponents(specification))
     throw Exception("Invalid vertex format specification");
@@ -122,6 +140,8 @@ bool VertexFormat::createComponent(const char* name,
   components.push_back(VertexComponent(name, count, type));
   VertexComponent& component = components.back();
   component.offset = size;
+
+  hash = hashString(asString());
   return true;
 }
 
@@ -151,6 +171,12 @@ bool VertexFormat::createComponents(const char* specification)
       case 'f':
         type = VertexComponent::FLOAT32;
         break;
+      case 'h':
+        type = VertexComponent::FLOAT16;
+        break;
+      case 's':
+        type = VertexComponent::SNORM16;
+        break;
       default:
         if (std::isgraph(*c))
           logError("Invalid vertex component type \'%c\'", *c);
@@ -189,6 +215,7 @@ bool VertexFormat::createComponents(const char* specification)
 void VertexFormat::destroyComponents()
 {
   components.clear();
+  hash = hashString("");
 }
 
 const VertexComponent* VertexFormat::findComponent(const char* name) const
@@ -207,12 +234,12 @@ const VertexComponent& VertexFormat::operator [] (size_t index) const
 
 bool VertexFormat::operator == (const VertexFormat& other) const
 {
-  return components == other.components;
+  return hash == other.hash && components == other.components;
 }
 
 bool VertexFormat::operator != (const VertexFormat& other) const
 {
-  return !(components == other.components);
+  return !(*this == other);
 }
 
 size_t VertexFormat::getSize() const
@@ -230,6 +257,11 @@ size_t VertexFormat::getComponentCount() const
   return (size_t) components.size();
 }
 
+uint32 VertexFormat::getHash() const
+{
+  return hash;
+}
+
 String VertexFormat::asString() const
 {
   std::ostringstream result;
@@ -243,6 +275,12 @@ String VertexFormat::asString() const
       case VertexComponent::FLOAT32:
         result << 'f';
         break;
+      case VertexComponent::FLOAT16:
+        result << 'h';
+        break;
+      case VertexComponent::SNORM16:
+        result << 's';
+        break;
       default:
         panic("Invalid vertex component type");
     }
@@ -267,6 +305,10 @@ const VertexFormat Vertex2fv::format("2f:vPosition");
 
 ///////////////////////////////////////////////////////////////////////
 
+const VertexFormat Vertex4fc2fv::format("4f:vColor 2f:vPosition");
+
+///////////////////////////////////////////////////////////////////////
+
 const VertexFormat Vertex2ft2fv::format("2f:vTexCoord 2f:vPosition");
 
 ///////////////////////////////////////////////////////////////////////
@@ -283,6 +325,34 @@ const VertexFormat Vertex3fn2ft3fv::format("3f:vNormal 2f:vTexCoord 3f:vPosition
 
 ///////////////////////////////////////////////////////////////////////
 
+i16vec2 Vertex2sn2ht4sv::encodeNormal(const vec3& normal)
+{
+  const float sum = abs(normal.x) + abs(normal.y) + abs(normal.z);
+  if (sum == 0.f)
+    return i16vec2(0, 0);
+
+  // Project onto the octahedron and fold the lower half over the upper
+
+  vec2 result = vec2(normal) / sum;
+
+  if (normal.z < 0.f)
+  {
+    const vec2 signs(result.x >= 0.f ? 1.f : -1.f, result.y >= 0.f ? 1.f : -1.f);
+    result = (vec2(1.f) - abs(vec2(result.y, result.x))) * signs;
+  }
+
+  return i16vec2(round(clamp(result, -1.f, 1.f) * 32767.f));
+}
+
+i16vec4 Vertex2sn2ht4sv::encodePosition(const vec3& position)
+{
+  return i16vec4(i16vec3(round(clamp(position, -1.f, 1.f) * 32767.f)), 32767);
+}
+
+const VertexFormat Vertex2sn2ht4sv::format("2s:vNormal 2h:vTexCoord 4s:vPosition");
+
+///////////////////////////////////////////////////////////////////////
+
 } /*namespace wendy*/
 
 ///////////////////////////////////////////////////////////////////////
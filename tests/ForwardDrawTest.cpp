@@ -0,0 +1,302 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy forward renderer draw call test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
+
+#include <wendy/RenderPool.h>
+#include <wendy/RenderState.h>
+#include <wendy/RenderSystem.h>
+#include <wendy/RenderMaterial.h>
+#include <wendy/RenderLight.h>
+#include <wendy/RenderScene.h>
+
+#include <wendy/Forward.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+// The exit status CTest reports as a skipped test
+const int SKIPPED = 77;
+
+const uint NODE_COUNT = 100;
+
+const char* PLAIN_VERTEX_SHADER =
+  "#version 150\n"
+  "in vec3 vPosition;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_Position = wyMVP * vec4(vPosition, 1.0);\n"
+  "}\n";
+
+const char* FRAGMENT_SHADER =
+  "#version 150\n"
+  "out vec4 color;\n"
+  "void main()\n"
+  "{\n"
+  "  color = vec4(1.0);\n"
+  "}\n";
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+struct Vertex
+{
+  vec3 position;
+  vec3 normal;
+  vec2 texCoord;
+};
+
+// Holds two triangles in the same vertex and index buffers
+class Geometry
+{
+public:
+  bool init(GL::Context& context)
+  {
+    const VertexFormat format("3f:vPosition 3f:vNormal 2f:vTexCoord");
+
+    const Vertex vertices[] =
+    {
+      { vec3(-1.f, -1.f, 0.f), vec3(0.f, 0.f, 1.f), vec2(0.f, 0.f) },
+      { vec3( 1.f, -1.f, 0.f), vec3(0.f, 0.f, 1.f), vec2(1.f, 0.f) },
+      { vec3( 0.f,  1.f, 0.f), vec3(0.f, 0.f, 1.f), vec2(0.5f, 1.f) },
+      { vec3(-1.f,  1.f, 0.f), vec3(0.f, 0.f, 1.f), vec2(0.f, 1.f) }
+    };
+
+    const uint16 indices[] = { 0, 1, 2, 0, 2, 3 };
+
+    vertexBuffer = GL::VertexBuffer::create(context, 4, format, GL::VertexBuffer::STATIC);
+    if (!vertexBuffer)
+      return false;
+
+    vertexBuffer->copyFrom(vertices, 4);
+
+    indexBuffer = GL::IndexBuffer::create(context, 6, GL::IndexBuffer::UINT16,
+                                          GL::IndexBuffer::STATIC);
+    if (!indexBuffer)
+      return false;
+
+    indexBuffer->copyFrom(indices, 6);
+    return true;
+  }
+  GL::PrimitiveRange getRange(uint index) const
+  {
+    return GL::PrimitiveRange(GL::TRIANGLE_LIST, *vertexBuffer, *indexBuffer, index * 3, 3);
+  }
+  Ref<GL::VertexBuffer> vertexBuffer;
+  Ref<GL::IndexBuffer> indexBuffer;
+};
+
+Ref<GL::Program> createProgram(GL::Context& context, const char* name, Ref<GL::Shader> vertexShader)
+{
+  ResourceCache& cache = context.getCache();
+
+  Ref<GL::Shader> fragmentShader = GL::Shader::create(ResourceInfo(cache),
+                                                      context,
+                                                      GL::FRAGMENT_SHADER,
+                                                      FRAGMENT_SHADER);
+  if (!vertexShader || !fragmentShader)
+    return NULL;
+
+  return GL::Program::create(ResourceInfo(cache, name),
+                             context,
+                             *vertexShader,
+                             *fragmentShader);
+}
+
+// Renders a node per operation with the specified pass, alternating between
+// the specified number of ranges, and returns the number of draw calls made
+uint renderNodes(forward::Renderer& renderer,
+                 render::GeometryPool& pool,
+                 const render::Pass& pass,
+                 const Geometry& geometry,
+                 uint rangeCount)
+{
+  GL::Context& context = pool.getContext();
+  GL::Stats* stats = context.getStats();
+
+  Camera camera;
+  camera.setFOV(60.f);
+  camera.setAspectRatio(1.f);
+
+  render::Scene scene(pool);
+
+  for (uint i = 0;  i < NODE_COUNT;  i++)
+  {
+    render::Operation operation;
+    operation.range = geometry.getRange(i % rangeCount);
+    operation.state = &pass;
+    operation.transform[3] = vec4(float(i % 10) - 5.f, float(i / 10) - 5.f, -20.f, 1.f);
+
+    // Identical depths keep the operations in the order they were added
+    scene.addOperation(operation, 0.5f);
+  }
+
+  renderer.render(scene, camera);
+
+  const uint count = stats->getCurrentFrame().drawCallCount;
+
+  // This also starts a new frame of statistics
+  context.update();
+
+  return count;
+}
+
+void testDrawCalls(GL::Context& context, const Path& mediaPath)
+{
+  context.getCache().addSearchPath(mediaPath);
+
+  GL::Stats stats;
+  context.setStats(&stats);
+
+  Ref<render::GeometryPool> pool = render::GeometryPool::create(context);
+  check(pool != NULL, "geometry pool is created");
+  if (!pool)
+    return;
+
+  // The renderer declares the shared program state used by the shaders
+  Ref<forward::Renderer> renderer = forward::Renderer::create(forward::Config(*pool));
+  check(renderer != NULL, "forward renderer is created");
+  if (!renderer)
+    return;
+
+  Geometry geometry;
+  check(geometry.init(context), "geometry is created");
+
+  Ref<GL::Program> instancedProgram =
+    createProgram(context, "instanced",
+                  GL::Shader::read(context, GL::VERTEX_SHADER, "wendy/InstancedModel.vs"));
+  check(instancedProgram && instancedProgram->isInstanced(),
+        "shipped instanced model shader is instanced");
+
+  Ref<GL::Program> plainProgram =
+    createProgram(context, "plain",
+                  GL::Shader::create(ResourceInfo(context.getCache()),
+                                     context,
+                                     GL::VERTEX_SHADER,
+                                     PLAIN_VERTEX_SHADER));
+  check(plainProgram && !plainProgram->isInstanced(), "plain shader is not instanced");
+
+  if (!instancedProgram || !plainProgram)
+    return;
+
+  render::Pass instancedPass;
+  instancedPass.setProgram(instancedProgram);
+
+  render::Pass plainPass;
+  plainPass.setProgram(plainProgram);
+
+  const uint plainCount = renderNodes(*renderer, *pool, plainPass, geometry, 1);
+  check(plainCount == NODE_COUNT, "plain nodes are drawn one at a time");
+
+  const uint instancedCount = renderNodes(*renderer, *pool, instancedPass, geometry, 1);
+
+  if (context.isInstancingSupported())
+    check(instancedCount == 1, "identical instanced nodes are drawn with a single call");
+  else
+    check(instancedCount == NODE_COUNT, "instanced nodes fall back to one call each");
+
+  // Alternating ranges break every run unless they are merged by multi-draw
+  const uint multipleCount = renderNodes(*renderer, *pool, instancedPass, geometry, 2);
+
+  if (context.isMultiDrawSupported())
+    check(multipleCount == 1, "nodes sharing buffers are drawn with a single call");
+  else
+    check(multipleCount == NODE_COUNT, "alternating ranges are drawn one run at a time");
+
+  std::printf("Draw calls for %u nodes: %u plain, %u instanced, %u with two ranges\n",
+              NODE_COUNT, plainCount, instancedCount, multipleCount);
+
+  context.setStats(NULL);
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+  if (argc != 2)
+  {
+    std::fprintf(stderr, "Usage: %s <media path>\n", argv[0]);
+    std::exit(EXIT_FAILURE);
+  }
+
+  ResourceCache cache;
+
+  // Without a display there is no context to render with, not even a
+  // software one such as llvmpipe
+  if (!GL::Context::createSingleton(cache, GL::WindowConfig("ForwardDrawTest", 64, 64, GL::WINDOWED)))
+  {
+    std::printf("No OpenGL context available, skipping\n");
+    std::exit(SKIPPED);
+  }
+
+  testDrawCalls(*GL::Context::getSingleton(), Path(argv[1]));
+
+  GL::Context::destroySingleton();
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
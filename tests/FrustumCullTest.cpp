@@ -0,0 +1,275 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy frustum culling test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+
+#include <glm/gtx/quaternion.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+// Not a multiple of four, so the scalar remainder of the batch tests is
+// exercised as well
+const uint VOLUME_COUNT = 1003;
+const uint FRUSTUM_COUNT = 40;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+class Random
+{
+public:
+  Random(): state(12345) { }
+  uint next()
+  {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return uint(state >> 33);
+  }
+  float next(float minimum, float maximum)
+  {
+    return minimum + (maximum - minimum) * (next() / float(1u << 31));
+  }
+  vec3 nextPoint(float extent)
+  {
+    return vec3(next(-extent, extent), next(-extent, extent), next(-extent, extent));
+  }
+private:
+  uint64 state;
+};
+
+// Alternates between perspective and orthographic frustums, moved and
+// rotated into the volume the tested bounds are spread over
+Frustum createFrustum(Random& random, uint index)
+{
+  Frustum frustum;
+
+  if (index % 2)
+    frustum.setOrtho(AABB(random.nextPoint(5.f), vec3(random.next(5.f, 30.f))));
+  else
+    frustum.setPerspective(random.next(30.f, 90.f), random.next(0.5f, 2.f), 0.1f, 80.f);
+
+  frustum.transformBy(Transform3(random.nextPoint(40.f),
+                                 angleAxis(random.next(0.f, 360.f),
+                                           normalize(random.nextPoint(1.f) + vec3(0.f, 0.f, 0.01f)))));
+  return frustum;
+}
+
+bool isSet(const std::vector<uint32>& masks, uint index)
+{
+  return (masks[index / 32] & (1u << (index % 32))) != 0;
+}
+
+void testBatches()
+{
+  Random random;
+
+  std::vector<Sphere> spheres;
+  SphereBatch sphereBatch;
+
+  std::vector<AABB> boxes;
+  AABBBatch boxBatch;
+
+  for (uint i = 0;  i < VOLUME_COUNT;  i++)
+  {
+    spheres.push_back(Sphere(random.nextPoint(100.f), random.next(0.1f, 10.f)));
+    sphereBatch.add(spheres.back());
+
+    boxes.push_back(AABB(random.nextPoint(100.f),
+                         vec3(random.next(0.1f, 10.f),
+                              random.next(0.1f, 10.f),
+                              random.next(0.1f, 10.f))));
+    boxBatch.add(boxes.back());
+  }
+
+  bool spheresMatch = true;
+  bool boxesMatch = true;
+  uint visibleCount = 0;
+
+  for (uint f = 0;  f < FRUSTUM_COUNT;  f++)
+  {
+    const Frustum frustum = createFrustum(random, f);
+
+    std::vector<uint32> masks;
+    frustum.intersects(sphereBatch, masks);
+
+    if (masks.size() != (VOLUME_COUNT + 31) / 32)
+      spheresMatch = false;
+    else
+    {
+      for (uint i = 0;  i < VOLUME_COUNT;  i++)
+      {
+        if (isSet(masks, i) != frustum.intersects(spheres[i]))
+          spheresMatch = false;
+
+        if (isSet(masks, i))
+          visibleCount++;
+      }
+    }
+
+    frustum.intersects(boxBatch, masks);
+
+    if (masks.size() != (VOLUME_COUNT + 31) / 32)
+      boxesMatch = false;
+    else
+    {
+      for (uint i = 0;  i < VOLUME_COUNT;  i++)
+      {
+        if (isSet(masks, i) != frustum.intersects(boxes[i]))
+          boxesMatch = false;
+      }
+    }
+  }
+
+  check(spheresMatch, "sphere batch test matches scalar test");
+  check(boxesMatch, "box batch test matches scalar test");
+  check(visibleCount > 0, "batch tests find some visible spheres");
+
+  std::vector<uint32> masks(3, ~0u);
+  createFrustum(random, 0).intersects(SphereBatch(), masks);
+  check(masks.empty(), "empty batch gives no masks");
+}
+
+void testPlaneMasks()
+{
+  Random random;
+
+  bool matches = true;
+  bool straddled = true;
+  bool coherent = true;
+
+  for (uint f = 0;  f < FRUSTUM_COUNT;  f++)
+  {
+    const Frustum frustum = createFrustum(random, f);
+
+    for (uint i = 0;  i < VOLUME_COUNT;  i++)
+    {
+      const AABB box(random.nextPoint(100.f), vec3(random.next(0.1f, 20.f)));
+
+      uint planeMask = ALL_FRUSTUM_PLANES;
+      uint firstPlane = 0;
+
+      const bool result = frustum.intersects(box, planeMask, firstPlane);
+
+      if (result != frustum.intersects(box))
+        matches = false;
+
+      // A box straddling no plane is inside all of them
+      if (result && !planeMask && !frustum.contains(box))
+        straddled = false;
+
+      // Starting at the rejecting plane gives the same answer
+      planeMask = ALL_FRUSTUM_PLANES;
+
+      if (frustum.intersects(box, planeMask, firstPlane) != result)
+        coherent = false;
+    }
+  }
+
+  check(matches, "plane-coherent box test matches scalar test");
+  check(straddled, "boxes straddling no plane are inside the frustum");
+  check(coherent, "plane-coherent box test does not depend on the first plane");
+}
+
+void testExact()
+{
+  Random random;
+
+  bool conservative = true;
+  bool complete = true;
+  uint rejectedCount = 0;
+
+  for (uint f = 0;  f < FRUSTUM_COUNT;  f++)
+  {
+    const Frustum frustum = createFrustum(random, f);
+
+    for (uint i = 0;  i < VOLUME_COUNT;  i++)
+    {
+      const AABB box(random.nextPoint(100.f), vec3(random.next(0.1f, 20.f)));
+
+      const bool exact = frustum.intersectsExactly(box);
+
+      if (exact && !frustum.intersects(box))
+        conservative = false;
+
+      // Any box holding a point inside the frustum must intersect it
+      if (!exact && (frustum.contains(box.center) || frustum.contains(box)))
+        complete = false;
+
+      if (!exact && frustum.intersects(box))
+        rejectedCount++;
+    }
+  }
+
+  check(conservative, "exact test only accepts boxes the plane tests accept");
+  check(complete, "exact test accepts boxes overlapping the frustum");
+
+  std::printf("Exact test rejected %u boxes accepted by the plane tests\n", rejectedCount);
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  testBatches();
+  testPlaneMasks();
+  testExact();
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,394 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy light cluster test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+
+#include <wendy/GLQuery.h>
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
+
+#include <wendy/RenderPool.h>
+#include <wendy/RenderState.h>
+#include <wendy/RenderSystem.h>
+#include <wendy/RenderMaterial.h>
+#include <wendy/RenderLight.h>
+#include <wendy/RenderScene.h>
+
+#include <glm/gtx/quaternion.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const uint LIGHT_COUNT = 300;
+const uint SAMPLE_COUNT = 100;
+
+// The clusters a light was assigned to, by their index in the grid
+typedef std::vector<uint> ClusterList;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+class Random
+{
+public:
+  Random(): state(12345) { }
+  uint next()
+  {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return uint(state >> 33);
+  }
+  uint next(uint limit)
+  {
+    return next() % limit;
+  }
+  float next(float minimum, float maximum)
+  {
+    return minimum + (maximum - minimum) * (next() / float(1u << 31));
+  }
+  vec3 nextPoint(float extent)
+  {
+    return vec3(next(-extent, extent), next(-extent, extent), next(-extent, extent));
+  }
+private:
+  uint64 state;
+};
+
+// Creates point lights and spotlights all around the camera, many of them
+// partly or entirely outside its frustum, mixed with directional lights
+render::LightList createLights(Random& random, const Camera& camera)
+{
+  render::LightList lights;
+
+  for (uint i = 0;  i < LIGHT_COUNT;  i++)
+  {
+    Ref<render::Light> light = new render::Light();
+
+    if (i % 10 == 9)
+      light->setType(render::Light::DIRECTIONAL);
+    else if (i % 3)
+      light->setType(render::Light::POINT);
+    else
+      light->setType(render::Light::SPOTLIGHT);
+
+    // Place the lights in view space, in front of and around the camera
+    vec3 position(random.next(-40.f, 40.f),
+                  random.next(-30.f, 30.f),
+                  random.next(-70.f, 10.f));
+    camera.getTransform().transformVector(position);
+
+    light->setPosition(position);
+    light->setRadius(random.next(0.1f, 8.f));
+    lights.push_back(light);
+  }
+
+  return lights;
+}
+
+// Finds the cluster of a view space point in the same way as
+// wendy/LightGrid.glsl, or returns false if the point is outside the frustum
+bool findCluster(const render::LightClusters& clusters,
+                 const Camera& camera,
+                 const vec3& point,
+                 uint& cluster)
+{
+  float nearZ = camera.getNearZ(), farZ = camera.getFarZ();
+
+  if (camera.isOrtho())
+  {
+    float minX, minY, maxX, maxY;
+    camera.getOrthoVolume().getBounds(minX, minY, nearZ, maxX, maxY, farZ);
+  }
+
+  const float depth = -point.z;
+  if (depth < nearZ || depth > farZ)
+    return false;
+
+  const vec4 clip = camera.getProjectionMatrix() * vec4(point, 1.f);
+  const vec2 ndc = vec2(clip) / clip.w;
+  if (abs(ndc.x) > 1.f || abs(ndc.y) > 1.f)
+    return false;
+
+  const int countX = clusters.getCountX();
+  const int countY = clusters.getCountY();
+  const int countZ = clusters.getCountZ();
+
+  const int x = int(std::floor((ndc.x + 1.f) * 0.5f * countX));
+  const int y = int(std::floor((ndc.y + 1.f) * 0.5f * countY));
+  const int z = int(std::floor(std::log(max(depth, 1e-6f)) * clusters.getDepthScale() +
+                               clusters.getDepthBias()));
+
+  cluster = (clamp(z, 0, countZ - 1) * countY + clamp(y, 0, countY - 1)) * countX +
+            clamp(x, 0, countX - 1);
+  return true;
+}
+
+ClusterList getClusters(const render::LightClusters& clusters, uint light)
+{
+  ClusterList result;
+
+  for (uint z = 0;  z < clusters.getCountZ();  z++)
+  {
+    for (uint y = 0;  y < clusters.getCountY();  y++)
+    {
+      for (uint x = 0;  x < clusters.getCountX();  x++)
+      {
+        const uint32* indices = clusters.getClusterLights(x, y, z);
+        const uint count = clusters.getClusterLightCount(x, y, z);
+
+        for (uint i = 0;  i < count;  i++)
+        {
+          if (indices[i] == light)
+            result.push_back((z * clusters.getCountY() + y) * clusters.getCountX() + x);
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+// Assigns each light on its own, checking that every cluster reached by a
+// point within its radius holds it, then assigns them all at once and checks
+// that this gives the same clusters as assigning them one by one, with the
+// lights of each cluster in order
+void testAssign(const Camera& camera, const char* label)
+{
+  Random random;
+
+  const render::LightList lights = createLights(random, camera);
+  const mat4 view = camera.getViewTransform();
+
+  render::LightClusters clusters;
+
+  // A directional light around each light checks that they are left out
+  Ref<render::Light> directional = new render::Light();
+
+  std::vector<ClusterList> expected;
+
+  bool covered = true;
+  bool culled = true;
+  bool tight = true;
+  uint sampledCount = 0;
+
+  for (uint i = 0;  i < LIGHT_COUNT;  i++)
+  {
+    const render::Light& light = *lights[i];
+
+    render::LightList single;
+    single.push_back(directional);
+    single.push_back(lights[i]);
+    single.push_back(directional);
+
+    clusters.assign(single, camera);
+
+    if (light.getType() == render::Light::DIRECTIONAL)
+    {
+      if (clusters.getLightCount() || clusters.getIndexCount())
+        culled = false;
+
+      continue;
+    }
+
+    const ClusterList assigned = getClusters(clusters, 0);
+
+    if (clusters.getIndexCount() != assigned.size() ||
+        clusters.getLightCount() != (assigned.empty() ? 0u : 1u))
+    {
+      culled = false;
+    }
+
+    const vec3 center = vec3(view * vec4(light.getPosition(), 1.f));
+    const float radius = light.getRadius();
+
+    for (uint s = 0;  s < SAMPLE_COUNT;  s++)
+    {
+      vec3 offset;
+      do
+        offset = random.nextPoint(radius);
+      while (length(offset) > radius);
+
+      uint cluster;
+      if (!findCluster(clusters, camera, center + offset, cluster))
+        continue;
+
+      if (std::find(assigned.begin(), assigned.end(), cluster) == assigned.end())
+        covered = false;
+
+      sampledCount++;
+    }
+
+    if (assigned.empty())
+      continue;
+
+    // Small lights only reach the clusters around them
+    if (radius < 1.f && assigned.size() > 27)
+      tight = false;
+
+    expected.push_back(assigned);
+  }
+
+  check(sampledCount > 0, "some sampled points are inside the frustum");
+  check(covered, "every cluster reached by a light holds it");
+  check(culled, "lights outside the frustum and directional lights are left out");
+  check(tight, "small lights are only assigned to nearby clusters");
+  check(expected.size() < LIGHT_COUNT * 9 / 10, "some lights are outside the frustum");
+
+  clusters.assign(lights, camera);
+
+  check(clusters.getLightCount() == expected.size(),
+        "every light reaching a cluster is assigned");
+
+  bool same = true;
+
+  for (uint i = 0;  i < expected.size();  i++)
+  {
+    if (getClusters(clusters, i) != expected[i])
+      same = false;
+  }
+
+  check(same, "lights get the same clusters when assigned together");
+
+  bool ordered = true;
+  uint total = 0;
+
+  for (uint z = 0;  z < clusters.getCountZ();  z++)
+  {
+    for (uint y = 0;  y < clusters.getCountY();  y++)
+    {
+      for (uint x = 0;  x < clusters.getCountX();  x++)
+      {
+        const uint32* indices = clusters.getClusterLights(x, y, z);
+        const uint count = clusters.getClusterLightCount(x, y, z);
+
+        for (uint i = 1;  i < count;  i++)
+        {
+          if (indices[i - 1] >= indices[i])
+            ordered = false;
+        }
+
+        total += count;
+      }
+    }
+  }
+
+  check(ordered, "the lights of each cluster are in order");
+  check(total == clusters.getIndexCount(), "cluster light counts add up to the index count");
+
+  std::printf("%s: %u of %u lights assigned to %u clusters\n",
+              label, uint(expected.size()), LIGHT_COUNT, total);
+}
+
+void testScene()
+{
+  Ref<render::Light> first = new render::Light();
+  Ref<render::Light> second = new render::Light();
+
+  render::Scene scene;
+  scene.attachLight(*first);
+  scene.attachLight(*second);
+  scene.attachLight(*first);
+  scene.attachLight(*second);
+
+  const render::LightList& lights = scene.getLights();
+
+  check(lights.size() == 2 && lights[0] == first && lights[1] == second,
+        "attaching a light again does not duplicate it");
+
+  scene.detachLights();
+  check(scene.getLights().empty(), "detaching lights removes them all");
+
+  scene.attachLight(*second);
+  scene.attachLight(*first);
+
+  check(lights.size() == 2 && lights[0] == second && lights[1] == first,
+        "detached lights can be attached again");
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  {
+    Camera camera;
+    camera.setFOV(60.f);
+    camera.setAspectRatio(1.5f);
+    camera.setNearZ(0.5f);
+    camera.setFarZ(50.f);
+    camera.setTransform(Transform3(vec3(3.f, 2.f, 10.f),
+                                   angleAxis(30.f, vec3(0.f, 1.f, 0.f))));
+
+    testAssign(camera, "Perspective");
+
+    camera.setMode(Camera::ORTHOGRAPHIC);
+    camera.setOrthoVolume(AABB(vec3(0.f, 0.f, 25.f), vec3(20.f, 15.f, 24.5f)));
+
+    testAssign(camera, "Orthographic");
+
+    testScene();
+  }
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,312 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy mesh optimization test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const uint RING_COUNT = 64;
+const uint SEGMENT_COUNT = 128;
+
+// A triangle as the positions of its corners, rotated so that the smallest
+// comes first, so that triangles can be compared across vertex reorderings
+// while still respecting their winding
+typedef std::vector<float> TriangleKey;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+Ref<Mesh> createTriangles(ResourceCache& cache, const uint32* indices, size_t count, size_t vertexCount)
+{
+  Ref<Mesh> mesh = new Mesh(ResourceInfo(cache));
+
+  mesh->vertices.resize(vertexCount);
+  for (size_t i = 0;  i < vertexCount;  i++)
+    mesh->vertices[i].position = vec3(float(i), float(i % 2), 0.f);
+
+  mesh->sections.push_back(MeshSection());
+  mesh->sections.back().materialName = "test";
+
+  for (size_t i = 0;  i < count;  i++)
+  {
+    MeshTriangle triangle;
+    triangle.setIndices(indices[i * 3 + 0], indices[i * 3 + 1], indices[i * 3 + 2]);
+    mesh->sections.back().triangles.push_back(triangle);
+  }
+
+  return mesh;
+}
+
+// Creates a sphere whose triangles have been shuffled with a fixed seed, so
+// that it starts out with close to the worst possible vertex cache use
+Ref<Mesh> createShuffledSphere(ResourceCache& cache)
+{
+  Ref<Mesh> mesh = new Mesh(ResourceInfo(cache));
+
+  for (uint r = 0;  r <= RING_COUNT;  r++)
+  {
+    const float theta = float(M_PI) * r / RING_COUNT;
+
+    for (uint s = 0;  s <= SEGMENT_COUNT;  s++)
+    {
+      const float phi = 2.f * float(M_PI) * s / SEGMENT_COUNT;
+
+      MeshVertex vertex;
+      vertex.position = vec3(std::sin(theta) * std::cos(phi),
+                             std::cos(theta),
+                             std::sin(theta) * std::sin(phi));
+      vertex.normal = vertex.position;
+      vertex.texcoord = vec2(float(s) / SEGMENT_COUNT, float(r) / RING_COUNT);
+      mesh->vertices.push_back(vertex);
+    }
+  }
+
+  mesh->sections.push_back(MeshSection());
+  MeshSection& section = mesh->sections.back();
+  section.materialName = "test";
+
+  const uint stride = SEGMENT_COUNT + 1;
+
+  for (uint r = 0;  r < RING_COUNT;  r++)
+  {
+    for (uint s = 0;  s < SEGMENT_COUNT;  s++)
+    {
+      const uint32 a = r * stride + s;
+      const uint32 b = a + 1;
+      const uint32 c = a + stride;
+      const uint32 d = c + 1;
+
+      MeshTriangle triangle;
+      triangle.setIndices(a, c, b);
+      section.triangles.push_back(triangle);
+      triangle.setIndices(b, c, d);
+      section.triangles.push_back(triangle);
+    }
+  }
+
+  uint64 state = 12345;
+
+  for (size_t i = section.triangles.size() - 1;  i > 0;  i--)
+  {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    std::swap(section.triangles[i], section.triangles[size_t(state >> 33) % (i + 1)]);
+  }
+
+  mesh->generateTriangleNormals();
+  return mesh;
+}
+
+std::vector<TriangleKey> getTriangleKeys(const Mesh& mesh)
+{
+  std::vector<TriangleKey> keys;
+
+  for (auto s = mesh.sections.begin();  s != mesh.sections.end();  s++)
+  {
+    for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
+    {
+      TriangleKey corners[3];
+
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        const vec3& position = mesh.vertices[t->indices[k]].position;
+        corners[k].push_back(position.x);
+        corners[k].push_back(position.y);
+        corners[k].push_back(position.z);
+      }
+
+      const size_t first = std::min_element(corners, corners + 3) - corners;
+
+      TriangleKey key;
+
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        const TriangleKey& corner = corners[(first + k) % 3];
+        key.insert(key.end(), corner.begin(), corner.end());
+      }
+
+      keys.push_back(key);
+    }
+  }
+
+  std::sort(keys.begin(), keys.end());
+  return keys;
+}
+
+bool isFirstUseOrder(const Mesh& mesh)
+{
+  uint32 next = 0;
+
+  for (auto s = mesh.sections.begin();  s != mesh.sections.end();  s++)
+  {
+    for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
+    {
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        if (t->indices[k] > next)
+          return false;
+
+        if (t->indices[k] == next)
+          next++;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool isSameTriangleOrder(const Mesh& first, const Mesh& second)
+{
+  const std::vector<MeshTriangle>& a = first.sections.front().triangles;
+  const std::vector<MeshTriangle>& b = second.sections.front().triangles;
+
+  if (a.size() != b.size())
+    return false;
+
+  for (size_t i = 0;  i < a.size();  i++)
+  {
+    for (size_t k = 0;  k < 3;  k++)
+    {
+      if (a[i].indices[k] != b[i].indices[k])
+        return false;
+    }
+  }
+
+  return true;
+}
+
+void testCacheStats(ResourceCache& cache)
+{
+  float ACMR, ATVR;
+
+  // A single triangle misses on all three of its vertices
+  const uint32 single[] = { 0, 1, 2 };
+  createTriangles(cache, single, 1, 3)->calculateCacheStats(ACMR, ATVR);
+  check(ACMR == 3.f && ATVR == 1.f, "single triangle has ACMR 3 and ATVR 1");
+
+  // A quad shares an edge, so its second triangle misses only once
+  const uint32 quad[] = { 0, 1, 2, 2, 1, 3 };
+  createTriangles(cache, quad, 2, 4)->calculateCacheStats(ACMR, ATVR);
+  check(ACMR == 2.f && ATVR == 1.f, "quad has ACMR 2 and ATVR 1");
+
+  // Repeating a triangle hits the cache every time
+  const uint32 repeated[] = { 0, 1, 2, 0, 1, 2, 0, 1, 2 };
+  createTriangles(cache, repeated, 3, 3)->calculateCacheStats(ACMR, ATVR);
+  check(ACMR == 1.f && ATVR == 1.f, "repeated triangle has ACMR 1 and ATVR 1");
+}
+
+void testOptimize(ResourceCache& cache)
+{
+  Ref<Mesh> original = createShuffledSphere(cache);
+
+  float shuffledACMR, shuffledATVR;
+  original->calculateCacheStats(shuffledACMR, shuffledATVR);
+
+  check(shuffledACMR > 2.5f, "shuffled sphere starts with poor cache use");
+
+  Ref<Mesh> cached = new Mesh(*original);
+  cached->optimizeVertexCache();
+
+  float cachedACMR, cachedATVR;
+  cached->calculateCacheStats(cachedACMR, cachedATVR);
+
+  check(cachedACMR < 0.8f, "vertex cache pass brings ACMR below 0.8");
+  check(cachedATVR < 1.4f, "vertex cache pass brings ATVR below 1.4");
+  check(getTriangleKeys(*cached) == getTriangleKeys(*original),
+        "vertex cache pass keeps every triangle and its winding");
+
+  Ref<Mesh> optimized = new Mesh(*original);
+  optimized->optimize();
+
+  float optimizedACMR, optimizedATVR;
+  optimized->calculateCacheStats(optimizedACMR, optimizedATVR);
+
+  // Overdraw clustering may only give up cache use within its threshold
+  check(optimizedACMR <= cachedACMR * 1.05f + 0.01f,
+        "overdraw pass keeps ACMR within its threshold");
+  check(optimizedATVR >= 1.f, "ATVR is never below one");
+  check(getTriangleKeys(*optimized) == getTriangleKeys(*original),
+        "optimization keeps every triangle and its winding");
+  check(optimized->vertices.size() == original->vertices.size(),
+        "optimization keeps every vertex");
+  check(isFirstUseOrder(*optimized), "vertex fetch pass orders vertices by first use");
+
+  Ref<Mesh> repeated = new Mesh(*original);
+  repeated->optimize();
+
+  check(isSameTriangleOrder(*optimized, *repeated), "optimization is deterministic");
+
+  std::printf("ACMR %.3f to %.3f, ATVR %.3f to %.3f\n",
+              shuffledACMR, optimizedACMR,
+              shuffledATVR, optimizedATVR);
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  {
+    ResourceCache cache;
+
+    testCacheStats(cache);
+    testOptimize(cache);
+  }
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,333 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy mesh reader test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <utime.h>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const char* const MESH_NAME = "MeshReaderTest.obj";
+
+// Enough vertices for the file to be split into several chunks
+const size_t VERTEX_COUNT = 60000;
+
+// A vertex as the bit patterns of its components, so that comparisons are
+// exact and distinguish between positive and negative zero
+typedef std::vector<uint32> VertexBits;
+
+class Random
+{
+public:
+  Random(): state(12345) { }
+  uint next()
+  {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return uint(state >> 33);
+  }
+  uint next(uint limit)
+  {
+    return next() % limit;
+  }
+private:
+  uint64 state;
+};
+
+// Formats a number in one of the many ways OBJ exporters write them,
+// covering both the fast path of the reader and its C library fallback
+String generateNumber(Random& random)
+{
+  const double magnitude = std::pow(10.0, int(random.next(13)) - 6);
+  const double value = (random.next() / double(1u << 31) - 0.5) * magnitude;
+  const int precision = random.next(20);
+
+  char buffer[128];
+
+  switch (random.next(9))
+  {
+    case 0:
+      std::snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
+      break;
+    case 1:
+      std::snprintf(buffer, sizeof(buffer), "%.*e", precision, value);
+      break;
+    case 2:
+      std::snprintf(buffer, sizeof(buffer), "%.*E", precision, value);
+      break;
+    case 3:
+      std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+      break;
+    case 4:
+      std::snprintf(buffer, sizeof(buffer), "%d", int(random.next(200000)) - 100000);
+      break;
+    case 5:
+      // Leading plus sign and no integer digits
+      std::snprintf(buffer, sizeof(buffer), "+.%u", random.next(1000000));
+      break;
+    case 6:
+      // Trailing decimal point and zero variants
+      std::snprintf(buffer, sizeof(buffer), "%s", random.next(2) ? "-0" : "0.");
+      break;
+    case 7:
+      // More significant digits than a double holds
+      std::snprintf(buffer, sizeof(buffer), "%u%u%u.%u%u",
+                    random.next(), random.next(), random.next(),
+                    random.next(), random.next());
+      break;
+    case 8:
+      // Explicit exponents, including ones outside the exact range
+      std::snprintf(buffer, sizeof(buffer), "%u.%ue%+d",
+                    random.next(10), random.next(100000),
+                    int(random.next(80)) - 40);
+      break;
+  }
+
+  return buffer;
+}
+
+float parseReference(const String& text)
+{
+  return float(std::strtod(text.c_str(), NULL));
+}
+
+uint32 getBits(float value)
+{
+  uint32 bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+bool writeCorpus(std::vector<VertexBits>& expected)
+{
+  std::FILE* file = std::fopen(MESH_NAME, "wb");
+  if (!file)
+  {
+    std::fprintf(stderr, "Failed to create %s\n", MESH_NAME);
+    return false;
+  }
+
+  Random random;
+
+  std::fprintf(file, "# Generated by MeshReaderTest\nusemtl test\n");
+
+  for (size_t i = 0;  i < VERTEX_COUNT;  i++)
+  {
+    String numbers[8];
+    VertexBits bits(8);
+
+    for (size_t j = 0;  j < 8;  j++)
+    {
+      numbers[j] = generateNumber(random);
+      bits[j] = getBits(parseReference(numbers[j]));
+    }
+
+    // The reader normalizes normals as it parses them
+    const vec3 normal = normalize(vec3(parseReference(numbers[3]),
+                                       parseReference(numbers[4]),
+                                       parseReference(numbers[5])));
+    bits[3] = getBits(normal.x);
+    bits[4] = getBits(normal.y);
+    bits[5] = getBits(normal.z);
+
+    // Stored in the order of MeshVertex: position, normal, texcoord
+    expected.push_back(bits);
+
+    std::fprintf(file, "v %s %s %s\n",
+                 numbers[0].c_str(), numbers[1].c_str(), numbers[2].c_str());
+    std::fprintf(file, "vn %s %s %s\n",
+                 numbers[3].c_str(), numbers[4].c_str(), numbers[5].c_str());
+    std::fprintf(file, "vt %s %s\n",
+                 numbers[6].c_str(), numbers[7].c_str());
+
+    if (i % 3 == 2)
+    {
+      std::fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n",
+                   uint(i - 1), uint(i - 1), uint(i - 1),
+                   uint(i), uint(i), uint(i),
+                   uint(i + 1), uint(i + 1), uint(i + 1));
+    }
+  }
+
+  std::fclose(file);
+
+  std::sort(expected.begin(), expected.end());
+  return true;
+}
+
+bool checkMesh(uint threadCount, const std::vector<VertexBits>& expected, const char* label)
+{
+  ResourceCache cache;
+
+  Ref<Mesh> mesh = Mesh::read(cache, MESH_NAME, threadCount);
+  if (!mesh)
+  {
+    std::fprintf(stderr, "%s: failed to read mesh\n", label);
+    return false;
+  }
+
+  std::vector<VertexBits> actual;
+
+  for (auto v = mesh->vertices.begin();  v != mesh->vertices.end();  v++)
+  {
+    VertexBits bits(8);
+    bits[0] = getBits(v->position.x);
+    bits[1] = getBits(v->position.y);
+    bits[2] = getBits(v->position.z);
+    bits[3] = getBits(v->normal.x);
+    bits[4] = getBits(v->normal.y);
+    bits[5] = getBits(v->normal.z);
+    bits[6] = getBits(v->texcoord.x);
+    bits[7] = getBits(v->texcoord.y);
+    actual.push_back(bits);
+  }
+
+  std::sort(actual.begin(), actual.end());
+
+  if (actual.size() != expected.size())
+  {
+    std::fprintf(stderr, "%s: expected %u vertices but got %u\n",
+                 label, uint(expected.size()), uint(actual.size()));
+    return false;
+  }
+
+  size_t mismatches = 0;
+
+  for (size_t i = 0;  i < actual.size();  i++)
+  {
+    if (actual[i] != expected[i])
+      mismatches++;
+  }
+
+  if (mismatches)
+  {
+    std::fprintf(stderr, "%s: %u vertices differ from strtod\n",
+                 label, uint(mismatches));
+    return false;
+  }
+
+  if (mesh->getTriangleCount() != VERTEX_COUNT / 3)
+  {
+    std::fprintf(stderr, "%s: expected %u triangles but got %u\n",
+                 label, uint(VERTEX_COUNT / 3), uint(mesh->getTriangleCount()));
+    return false;
+  }
+
+  return true;
+}
+
+// Replaces the OBJ file with a single triangle and backdates it to before
+// its cache was written, as copying a file along with its timestamps would,
+// and checks that the cache is not mistaken for current
+bool checkReplaced()
+{
+  std::FILE* file = std::fopen(MESH_NAME, "wb");
+  if (!file)
+  {
+    std::fprintf(stderr, "Failed to create %s\n", MESH_NAME);
+    return false;
+  }
+
+  std::fprintf(file, "v 0 0 0\nv 1 0 0\nv 0 1 0\nusemtl test\nf 1 2 3\n");
+  std::fclose(file);
+
+  utimbuf times;
+  times.actime = times.modtime = std::time(NULL) - 3600;
+
+  if (utime(MESH_NAME, &times) != 0)
+  {
+    std::fprintf(stderr, "Failed to backdate %s\n", MESH_NAME);
+    return false;
+  }
+
+  for (uint i = 0;  i < 2;  i++)
+  {
+    ResourceCache cache;
+
+    Ref<Mesh> mesh = Mesh::read(cache, MESH_NAME);
+    if (!mesh || mesh->getTriangleCount() != 1 || mesh->vertices.size() != 3)
+    {
+      std::fprintf(stderr, "replaced: read the outdated cache\n");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  const String cacheName = String(MESH_NAME) + ".mesh";
+
+  std::remove(cacheName.c_str());
+
+  std::vector<VertexBits> expected;
+  if (!writeCorpus(expected))
+    std::exit(EXIT_FAILURE);
+
+  // The first two reads parse the OBJ file, serially and in parallel, while
+  // the third one loads the binary cache written by the second
+
+  bool succeeded = checkMesh(1, expected, "serial");
+
+  std::remove(cacheName.c_str());
+
+  succeeded = checkMesh(4, expected, "parallel") && succeeded;
+  succeeded = checkMesh(1, expected, "cached") && succeeded;
+  succeeded = checkReplaced() && succeeded;
+
+  std::remove(cacheName.c_str());
+  std::remove(MESH_NAME);
+
+  if (!succeeded)
+    std::exit(EXIT_FAILURE);
+
+  std::printf("All %u vertices match strtod\n", uint(VERTEX_COUNT));
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,384 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy mesh simplification test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const uint RING_COUNT = 64;
+const uint SEGMENT_COUNT = 128;
+
+// The largest reduction possible before the vertices locked along the poles,
+// the texture seam and the equator stop the simplification
+const uint MAX_DIVISOR = 16;
+
+// An edge as the positions of its ends, smallest first, so that edges can be
+// matched across the vertices duplicated along attribute seams
+typedef std::pair<std::vector<float>, std::vector<float>> EdgeKey;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+// Creates a unit sphere split into a top and a bottom section at its
+// equator.  The first and last segment of each ring, as well as the vertices
+// at the poles, are exact copies of each other, so that the sphere is closed
+// but has attribute seams
+Ref<Mesh> createSphere(ResourceCache& cache)
+{
+  Ref<Mesh> mesh = new Mesh(ResourceInfo(cache));
+
+  for (uint r = 0;  r <= RING_COUNT;  r++)
+  {
+    const float theta = float(M_PI) * r / RING_COUNT;
+
+    for (uint s = 0;  s <= SEGMENT_COUNT;  s++)
+    {
+      const float phi = 2.f * float(M_PI) * s / SEGMENT_COUNT;
+
+      MeshVertex vertex;
+
+      if (r == 0)
+        vertex.position = vec3(0.f, 1.f, 0.f);
+      else if (r == RING_COUNT)
+        vertex.position = vec3(0.f, -1.f, 0.f);
+      else if (s == SEGMENT_COUNT)
+        vertex.position = mesh->vertices[r * (SEGMENT_COUNT + 1)].position;
+      else
+      {
+        vertex.position = vec3(std::sin(theta) * std::cos(phi),
+                               std::cos(theta),
+                               std::sin(theta) * std::sin(phi));
+      }
+
+      vertex.normal = vertex.position;
+      vertex.texcoord = vec2(float(s) / SEGMENT_COUNT, float(r) / RING_COUNT);
+      mesh->vertices.push_back(vertex);
+    }
+  }
+
+  mesh->sections.resize(2);
+  mesh->sections[0].materialName = "top";
+  mesh->sections[1].materialName = "bottom";
+
+  const uint stride = SEGMENT_COUNT + 1;
+
+  for (uint r = 0;  r < RING_COUNT;  r++)
+  {
+    MeshSection& section = mesh->sections[r < RING_COUNT / 2 ? 0 : 1];
+
+    for (uint s = 0;  s < SEGMENT_COUNT;  s++)
+    {
+      const uint32 a = r * stride + s;
+      const uint32 b = a + 1;
+      const uint32 c = a + stride;
+      const uint32 d = c + 1;
+
+      // Skip the triangles collapsed into the poles
+      MeshTriangle triangle;
+      if (r > 0)
+      {
+        triangle.setIndices(a, b, c);
+        section.triangles.push_back(triangle);
+      }
+      if (r < RING_COUNT - 1)
+      {
+        triangle.setIndices(b, d, c);
+        section.triangles.push_back(triangle);
+      }
+    }
+  }
+
+  mesh->generateTriangleNormals();
+  return mesh;
+}
+
+size_t getTriangleCount(const std::vector<MeshSection>& sections)
+{
+  size_t count = 0;
+
+  for (auto s = sections.begin();  s != sections.end();  s++)
+    count += s->triangles.size();
+
+  return count;
+}
+
+std::vector<float> getPositionKey(const Mesh& mesh, uint32 index)
+{
+  const vec3& position = mesh.vertices[index].position;
+
+  std::vector<float> key;
+  key.push_back(position.x);
+  key.push_back(position.y);
+  key.push_back(position.z);
+  return key;
+}
+
+// Checks that every edge of the sphere, matched by position, is shared by
+// exactly two triangles, i.e. that the surface is still closed and manifold
+bool isClosed(const Mesh& mesh, const std::vector<MeshSection>& sections)
+{
+  std::map<EdgeKey, uint> edges;
+
+  for (auto s = sections.begin();  s != sections.end();  s++)
+  {
+    for (auto t = s->triangles.begin();  t != s->triangles.end();  t++)
+    {
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        std::vector<float> a = getPositionKey(mesh, t->indices[k]);
+        std::vector<float> b = getPositionKey(mesh, t->indices[(k + 1) % 3]);
+        if (b < a)
+          a.swap(b);
+
+        edges[EdgeKey(a, b)]++;
+      }
+    }
+  }
+
+  for (auto e = edges.begin();  e != edges.end();  e++)
+  {
+    if (e->second != 2)
+      return false;
+  }
+
+  return true;
+}
+
+void testSimplify(ResourceCache& cache)
+{
+  const Ref<Mesh> sphere = createSphere(cache);
+  const size_t fullCount = sphere->getTriangleCount();
+
+  check(isClosed(*sphere, sphere->sections), "test sphere is closed");
+
+  std::vector<MeshSection> unchanged;
+  sphere->simplify(unchanged, fullCount);
+
+  bool same = unchanged.size() == sphere->sections.size();
+
+  for (size_t s = 0;  same && s < unchanged.size();  s++)
+  {
+    const std::vector<MeshTriangle>& before = sphere->sections[s].triangles;
+    const std::vector<MeshTriangle>& after = unchanged[s].triangles;
+
+    if (before.size() != after.size())
+    {
+      same = false;
+      break;
+    }
+
+    for (size_t t = 0;  t < before.size();  t++)
+    {
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        if (before[t].indices[k] != after[t].indices[k])
+          same = false;
+      }
+    }
+  }
+
+  check(same, "simplifying to the full triangle count changes nothing");
+
+  for (uint divisor = 2;  divisor <= 64;  divisor *= 2)
+  {
+    const size_t targetCount = fullCount / divisor;
+
+    std::vector<MeshSection> sections;
+    sphere->simplify(sections, targetCount);
+
+    const size_t count = getTriangleCount(sections);
+
+    // Beyond this the locked vertices leave only slivers along the seams, so
+    // only the topology of the result is checked
+    const bool reachable = divisor <= MAX_DIVISOR;
+
+    if (reachable)
+    {
+      check(count <= targetCount, "simplification reaches the target count");
+      check(count >= targetCount * 3 / 4, "simplification stops close to the target count");
+    }
+    else
+      check(count > targetCount, "simplification stops at the locked vertices");
+
+    check(sections.size() == 2 &&
+          sections[0].materialName == "top" &&
+          sections[1].materialName == "bottom",
+          "simplification keeps the sections in order");
+    check(isClosed(*sphere, sections), "simplification keeps the surface closed");
+
+    bool valid = true;
+    bool facing = true;
+    bool sided = true;
+    float minRadius = 1.f;
+
+    std::vector<bool> used(sphere->vertices.size(), false);
+
+    for (size_t s = 0;  s < sections.size();  s++)
+    {
+      const std::vector<MeshTriangle>& triangles = sections[s].triangles;
+
+      for (auto t = triangles.begin();  t != triangles.end();  t++)
+      {
+        if (t->indices[0] == t->indices[1] ||
+            t->indices[1] == t->indices[2] ||
+            t->indices[2] == t->indices[0])
+        {
+          valid = false;
+          continue;
+        }
+
+        vec3 centroid;
+
+        for (size_t k = 0;  k < 3;  k++)
+        {
+          if (t->indices[k] >= sphere->vertices.size())
+          {
+            valid = false;
+            break;
+          }
+
+          used[t->indices[k]] = true;
+          centroid += sphere->vertices[t->indices[k]].position / 3.f;
+        }
+
+        if (!valid)
+          break;
+
+        if (dot(t->normal, centroid) <= 0.f)
+          facing = false;
+
+        // Triangles stay in the hemisphere of their section
+        if ((s == 0 && centroid.y < 0.f) || (s == 1 && centroid.y > 0.f))
+          sided = false;
+
+        minRadius = std::min(minRadius, length(centroid));
+      }
+    }
+
+    check(valid, "simplified triangles refer to distinct existing vertices");
+    check(sided, "simplification keeps triangles in their sections");
+
+    if (reachable)
+    {
+      check(facing, "simplification flips no triangles");
+      check(minRadius > 0.85f, "simplified sphere stays close to the original");
+    }
+
+    // Poles, the texture seam and the equator between the sections are all
+    // locked, so every vertex on them is still used
+    bool locked = true;
+    const uint stride = SEGMENT_COUNT + 1;
+
+    for (uint r = 0;  r <= RING_COUNT;  r++)
+    {
+      for (uint s = 0;  s <= SEGMENT_COUNT;  s++)
+      {
+        const bool seam = r == 0 || r == RING_COUNT || r == RING_COUNT / 2 ||
+                          s == 0 || s == SEGMENT_COUNT;
+
+        // The first and last vertex of each pole are only used by one
+        // triangle each, which may collapse
+        if (seam && (r == 0 || r == RING_COUNT))
+          continue;
+
+        if (seam && !used[r * stride + s])
+          locked = false;
+      }
+    }
+
+    check(locked, "simplification keeps seam and section border vertices");
+
+    std::vector<MeshSection> repeated;
+    sphere->simplify(repeated, targetCount);
+
+    bool deterministic = getTriangleCount(repeated) == count;
+
+    for (size_t s = 0;  deterministic && s < sections.size();  s++)
+    {
+      for (size_t t = 0;  t < sections[s].triangles.size();  t++)
+      {
+        for (size_t k = 0;  k < 3;  k++)
+        {
+          if (sections[s].triangles[t].indices[k] != repeated[s].triangles[t].indices[k])
+            deterministic = false;
+        }
+      }
+    }
+
+    check(deterministic, "simplification is deterministic");
+
+    std::printf("1/%u of %u triangles: %u left, minimum radius %.4f\n",
+                divisor, uint(fullCount), uint(count), minRadius);
+  }
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  {
+    ResourceCache cache;
+
+    testSimplify(cache);
+  }
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,390 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy mesh welding test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const float EPSILON = 0.001f;
+const uint POOL_SIZE = 500;
+const uint VERTEX_COUNT = 6000;
+const uint TRIANGLE_COUNT = 4000;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+class Random
+{
+public:
+  Random(): state(12345) { }
+  uint next()
+  {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return uint(state >> 33);
+  }
+  uint next(uint limit)
+  {
+    return next() % limit;
+  }
+  float next(float minimum, float maximum)
+  {
+    return minimum + (maximum - minimum) * (next() / float(1u << 31));
+  }
+private:
+  uint64 state;
+};
+
+// Places every component on a multiple of the epsilon, so that distinct
+// pool vertices always fall into distinct cells
+MeshVertex createPoolVertex(Random& random)
+{
+  MeshVertex vertex;
+  vertex.position = vec3(float(int(random.next(2000)) - 1000),
+                         float(int(random.next(2000)) - 1000),
+                         float(int(random.next(4)))) * EPSILON;
+  vertex.normal = vec3(float(random.next(3)), float(random.next(3)), 1.f) * 0.25f;
+  vertex.texcoord = vec2(float(random.next(8)), float(random.next(8))) * 0.125f;
+  return vertex;
+}
+
+// Moves every component by at most a quarter of the epsilon, so the vertex
+// stays well inside the cell of the pool vertex it was made from
+MeshVertex jitter(Random& random, MeshVertex vertex)
+{
+  const float offset = EPSILON / 4.f;
+
+  for (uint i = 0;  i < 3;  i++)
+  {
+    vertex.position[i] += random.next(-offset, offset);
+    vertex.normal[i] += random.next(-offset, offset);
+  }
+
+  for (uint i = 0;  i < 2;  i++)
+    vertex.texcoord[i] += random.next(-offset, offset);
+
+  return vertex;
+}
+
+bool isSameVertex(const MeshVertex& first, const MeshVertex& second)
+{
+  return std::memcmp(&first.position, &second.position, sizeof(vec3)) == 0 &&
+         std::memcmp(&first.normal, &second.normal, sizeof(vec3)) == 0 &&
+         std::memcmp(&first.texcoord, &second.texcoord, sizeof(vec2)) == 0;
+}
+
+void testWeld(ResourceCache& cache)
+{
+  Random random;
+
+  std::vector<MeshVertex> pool;
+  for (uint i = 0;  i < POOL_SIZE;  i++)
+    pool.push_back(createPoolVertex(random));
+
+  Ref<Mesh> mesh = new Mesh(ResourceInfo(cache));
+
+  // The expected result is the first vertex made from each pool vertex, in
+  // the order they were added, plus every vertex with a NaN in it
+  std::vector<uint32> kept(POOL_SIZE, ~0u);
+  std::vector<uint32> remap;
+  Mesh::VertexList expected;
+
+  for (uint i = 0;  i < VERTEX_COUNT;  i++)
+  {
+    const uint source = random.next(POOL_SIZE);
+
+    MeshVertex vertex = jitter(random, pool[source]);
+
+    if (random.next(100) == 0)
+    {
+      vertex.normal.y = std::numeric_limits<float>::quiet_NaN();
+      remap.push_back(expected.size());
+      expected.push_back(vertex);
+    }
+    else if (kept[source] == ~0u)
+    {
+      kept[source] = expected.size();
+      remap.push_back(expected.size());
+      expected.push_back(vertex);
+    }
+    else
+      remap.push_back(kept[source]);
+
+    mesh->vertices.push_back(vertex);
+  }
+
+  for (uint s = 0;  s < 2;  s++)
+  {
+    mesh->sections.push_back(MeshSection());
+    mesh->sections.back().materialName = s ? "second" : "first";
+
+    for (uint i = 0;  i < TRIANGLE_COUNT / 2;  i++)
+    {
+      MeshTriangle triangle;
+      triangle.setIndices(random.next(VERTEX_COUNT),
+                          random.next(VERTEX_COUNT),
+                          random.next(VERTEX_COUNT));
+      mesh->sections.back().triangles.push_back(triangle);
+    }
+  }
+
+  const Ref<Mesh> original = new Mesh(*mesh);
+
+  mesh->weldVertices(EPSILON);
+
+  bool sameVertices = mesh->vertices.size() == expected.size();
+
+  for (size_t i = 0;  sameVertices && i < expected.size();  i++)
+  {
+    if (!isSameVertex(mesh->vertices[i], expected[i]))
+      sameVertices = false;
+  }
+
+  check(sameVertices, "welding keeps the first vertex of each cell, in order");
+  check(expected.size() < VERTEX_COUNT / 2, "welding merges most vertices");
+
+  bool sameTriangles = true;
+
+  for (size_t s = 0;  s < original->sections.size();  s++)
+  {
+    const std::vector<MeshTriangle>& before = original->sections[s].triangles;
+    const std::vector<MeshTriangle>& after = mesh->sections[s].triangles;
+
+    if (before.size() != after.size())
+    {
+      sameTriangles = false;
+      break;
+    }
+
+    for (size_t t = 0;  t < before.size();  t++)
+    {
+      for (size_t k = 0;  k < 3;  k++)
+      {
+        if (after[t].indices[k] != remap[before[t].indices[k]])
+          sameTriangles = false;
+      }
+    }
+  }
+
+  check(sameTriangles, "welding points triangles at the merged vertices");
+
+  const Ref<Mesh> rewelded = new Mesh(*mesh);
+  rewelded->weldVertices(EPSILON);
+
+  check(rewelded->vertices.size() == mesh->vertices.size(),
+        "welding a welded mesh changes nothing");
+
+  std::printf("Welded %u vertices to %u\n",
+              uint(original->vertices.size()),
+              uint(mesh->vertices.size()));
+}
+
+// Creates a unit cube from eight shared corners, so that every corner is
+// used by three faces with different normals
+Ref<Mesh> createCube(ResourceCache& cache)
+{
+  Ref<Mesh> mesh = new Mesh(ResourceInfo(cache));
+
+  for (uint i = 0;  i < 8;  i++)
+  {
+    MeshVertex vertex;
+    vertex.position = vec3(float(i & 1), float((i >> 1) & 1), float((i >> 2) & 1)) * 2.f - 1.f;
+    mesh->vertices.push_back(vertex);
+  }
+
+  const uint32 faces[6][4] =
+  {
+    { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+    { 0, 1, 5, 4 }, { 2, 6, 7, 3 },
+    { 0, 2, 3, 1 }, { 4, 5, 7, 6 }
+  };
+
+  mesh->sections.push_back(MeshSection());
+  mesh->sections.back().materialName = "cube";
+
+  for (uint f = 0;  f < 6;  f++)
+  {
+    MeshTriangle triangle;
+    triangle.setIndices(faces[f][0], faces[f][1], faces[f][2]);
+    mesh->sections.back().triangles.push_back(triangle);
+    triangle.setIndices(faces[f][0], faces[f][2], faces[f][3]);
+    mesh->sections.back().triangles.push_back(triangle);
+  }
+
+  return mesh;
+}
+
+// Creates two triangles hinged along a shared edge, with the second one
+// bent by the specified height, so that their normals differ mostly along x
+Ref<Mesh> createHinge(ResourceCache& cache, float height)
+{
+  Ref<Mesh> mesh = new Mesh(ResourceInfo(cache));
+
+  const vec3 positions[] =
+  {
+    vec3(-1.f, 0.f, 0.f), vec3(0.f, -1.f, 0.f),
+    vec3(0.f, 1.f, 0.f), vec3(1.f, 0.f, height)
+  };
+
+  for (uint i = 0;  i < 4;  i++)
+  {
+    MeshVertex vertex;
+    vertex.position = positions[i];
+    mesh->vertices.push_back(vertex);
+  }
+
+  mesh->sections.push_back(MeshSection());
+  mesh->sections.back().materialName = "hinge";
+
+  MeshTriangle triangle;
+  triangle.setIndices(0, 1, 2);
+  mesh->sections.back().triangles.push_back(triangle);
+  triangle.setIndices(1, 3, 2);
+  mesh->sections.back().triangles.push_back(triangle);
+
+  return mesh;
+}
+
+void testNormals(ResourceCache& cache)
+{
+  Ref<Mesh> separate = createCube(cache);
+  separate->generateNormals(Mesh::SEPARATE_FACES);
+
+  check(separate->vertices.size() == 24,
+        "separate normals give each corner a vertex per face");
+
+  bool faceNormals = true;
+
+  const std::vector<MeshTriangle>& triangles = separate->sections.front().triangles;
+
+  for (auto t = triangles.begin();  t != triangles.end();  t++)
+  {
+    for (size_t k = 0;  k < 3;  k++)
+    {
+      if (separate->vertices[t->indices[k]].normal != t->normal)
+        faceNormals = false;
+    }
+  }
+
+  check(faceNormals, "separate normals use the normal of the face");
+
+  Ref<Mesh> smooth = createCube(cache);
+  smooth->generateNormals(Mesh::SMOOTH_FACES);
+
+  check(smooth->vertices.size() == 8, "smooth normals keep the shared corners");
+
+  bool cornerNormals = true;
+
+  for (auto v = smooth->vertices.begin();  v != smooth->vertices.end();  v++)
+  {
+    if (length(v->normal - normalize(v->position)) > 0.0001f)
+      cornerNormals = false;
+  }
+
+  check(cornerNormals, "smooth normals average each face once");
+
+  // Splitting the texture coordinates of one face gives its corners
+  // vertices of their own, but the corners still share their normal
+  Ref<Mesh> seamed = createCube(cache);
+
+  for (uint i = 0;  i < 8;  i++)
+  {
+    MeshVertex vertex = seamed->vertices[i];
+    vertex.texcoord = vec2(0.5f);
+    seamed->vertices.push_back(vertex);
+  }
+
+  std::vector<MeshTriangle>& seam = seamed->sections.front().triangles;
+  for (uint i = 0;  i < 2;  i++)
+  {
+    for (size_t k = 0;  k < 3;  k++)
+      seam[i].indices[k] += 8;
+  }
+
+  seamed->generateNormals(Mesh::SMOOTH_FACES);
+
+  check(seamed->vertices.size() == 12, "smooth normals split texture seams");
+
+  Ref<Mesh> flat = createHinge(cache, 0.f);
+  flat->generateNormals(Mesh::SEPARATE_FACES);
+
+  check(flat->vertices.size() == 4, "coplanar faces share their vertices");
+
+  // The normals differ by ten epsilons along x but by less than one along z
+  Ref<Mesh> bent = createHinge(cache, 0.01f);
+  bent->generateNormals(Mesh::SEPARATE_FACES);
+
+  check(bent->vertices.size() == 6, "slightly bent faces get vertices of their own");
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  {
+    ResourceCache cache;
+
+    testWeld(cache);
+    testNormals(cache);
+  }
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
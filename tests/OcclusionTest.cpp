@@ -0,0 +1,218 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy occlusion buffer test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+#include <wendy/Occlusion.h>
+
+#include <glm/gtx/quaternion.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+// Creates a counter-clockwise 4 by 4 quad in the XY plane, facing +Z
+Ref<Mesh> createQuad(ResourceCache& cache)
+{
+  Ref<Mesh> mesh = new Mesh(ResourceInfo(cache));
+
+  const vec3 positions[] =
+  {
+    vec3(-2.f, -2.f, 0.f),
+    vec3( 2.f, -2.f, 0.f),
+    vec3( 2.f,  2.f, 0.f),
+    vec3(-2.f,  2.f, 0.f)
+  };
+
+  mesh->vertices.resize(4);
+  for (size_t i = 0;  i < 4;  i++)
+    mesh->vertices[i].position = positions[i];
+
+  mesh->sections.push_back(MeshSection());
+  mesh->sections.back().materialName = "test";
+
+  MeshTriangle triangle;
+  triangle.setIndices(0, 1, 2);
+  mesh->sections.back().triangles.push_back(triangle);
+  triangle.setIndices(0, 2, 3);
+  mesh->sections.back().triangles.push_back(triangle);
+
+  return mesh;
+}
+
+uint countCoveredPixels(const OcclusionBuffer& buffer)
+{
+  uint count = 0;
+
+  for (uint y = 0;  y < buffer.getHeight();  y++)
+  {
+    for (uint x = 0;  x < buffer.getWidth();  x++)
+    {
+      if (buffer.getDepth(x, y) < 1.f)
+        count++;
+    }
+  }
+
+  return count;
+}
+
+void testFrontFacing(OcclusionBuffer& buffer, const Camera& camera, const Mesh& quad)
+{
+  // The quad is ten units ahead of the camera, covering a fifth of the
+  // height and a tenth of the width of the 256 by 128 buffer
+  Transform3 transform;
+  transform.position = vec3(0.f, 0.f, -10.f);
+
+  buffer.clear(camera);
+  buffer.addOccluder(quad, transform);
+  buffer.buildHierarchy();
+
+  check(countCoveredPixels(buffer) == 26 * 26, "quad covers 26 by 26 pixels");
+  check(buffer.getDepth(128, 64) < 1.f, "center pixel is covered");
+  check(buffer.getDepth(0, 0) == 1.f, "corner pixel is at the far plane");
+
+  check(!buffer.isVisible(Sphere(vec3(0.f, 0.f, -20.f), 0.5f)),
+        "sphere behind the quad is hidden");
+  check(!buffer.isVisible(Sphere(vec3(1.5f, 1.5f, -20.f), 0.3f)),
+        "sphere behind a corner of the quad is hidden");
+  check(!buffer.isVisible(AABB(vec3(0.f, 0.f, -30.f), vec3(1.f))),
+        "box behind the quad is hidden");
+
+  check(buffer.isVisible(Sphere(vec3(0.f, 0.f, -5.f), 0.5f)),
+        "sphere in front of the quad is visible");
+  check(buffer.isVisible(Sphere(vec3(0.f, 0.f, -10.f), 0.5f)),
+        "sphere intersecting the quad is visible");
+  check(buffer.isVisible(Sphere(vec3(12.f, 0.f, -20.f), 0.5f)),
+        "sphere beside the quad is visible");
+  check(buffer.isVisible(Sphere(vec3(4.f, 0.f, -20.f), 0.5f)),
+        "sphere straddling the silhouette is visible");
+  check(buffer.isVisible(AABB(vec3(0.f, 0.f, -30.f), vec3(8.f))),
+        "box larger than the quad is visible");
+  check(buffer.isVisible(Sphere(vec3(0.f), 1.f)),
+        "sphere crossing the near plane is visible");
+
+  check(buffer.getTestCount() == 9, "every test is counted");
+  check(buffer.getCulledCount() == 3, "every hidden volume is counted");
+}
+
+void testBackFacing(OcclusionBuffer& buffer, const Camera& camera, const Mesh& quad)
+{
+  Transform3 transform;
+  transform.position = vec3(0.f, 0.f, -10.f);
+  transform.rotation = angleAxis(180.f, 0.f, 1.f, 0.f);
+
+  buffer.clear(camera);
+  buffer.addOccluder(quad, transform);
+  buffer.buildHierarchy();
+
+  check(countCoveredPixels(buffer) == 0, "back facing quad covers no pixels");
+  check(buffer.isVisible(Sphere(vec3(0.f, 0.f, -20.f), 0.5f)),
+        "sphere behind a back facing quad is visible");
+  check(buffer.getTestCount() == 1 && buffer.getCulledCount() == 0,
+        "clearing resets the counters");
+}
+
+void testOutsideFrustum(OcclusionBuffer& buffer, const Camera& camera, const Mesh& quad)
+{
+  Transform3 transform;
+  transform.position = vec3(0.f, 0.f, 10.f);
+
+  buffer.clear(camera);
+  buffer.addOccluder(quad, transform);
+  buffer.buildHierarchy();
+
+  check(countCoveredPixels(buffer) == 0, "quad behind the camera covers no pixels");
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  {
+    ResourceCache cache;
+
+    Ref<Mesh> quad = createQuad(cache);
+
+    Camera camera;
+    camera.setFOV(90.f);
+    camera.setAspectRatio(2.f);
+    camera.setNearZ(0.1f);
+    camera.setFarZ(100.f);
+
+    OcclusionBuffer buffer(256, 128);
+    check(buffer.getWidth() == 256 && buffer.getHeight() == 128,
+          "buffer keeps a size made of whole tiles");
+
+    testFrontFacing(buffer, camera, *quad);
+    testBackFacing(buffer, camera, *quad);
+    testOutsideFrustum(buffer, camera, *quad);
+
+    OcclusionBuffer rounded(250, 100);
+    check(rounded.getWidth() == 256 && rounded.getHeight() == 104,
+          "buffer size is rounded up to whole tiles");
+  }
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::printf("All occlusion checks passed\n");
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,219 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy render queue sort test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
+
+#include <wendy/RenderPool.h>
+#include <wendy/RenderState.h>
+#include <wendy/RenderSystem.h>
+#include <wendy/RenderMaterial.h>
+#include <wendy/RenderLight.h>
+#include <wendy/RenderScene.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+class Random
+{
+public:
+  Random(): state(12345) { }
+  uint next()
+  {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return uint(state >> 33);
+  }
+  uint next(uint limit)
+  {
+    return next() % limit;
+  }
+private:
+  uint64 state;
+};
+
+// Makes keys like those of a scene, with a few layers and states and many
+// depths, so that there are runs of equal keys as well as bytes shared by
+// every key
+render::SortKeyList createKeys(Random& random, size_t count, uint depthCount)
+{
+  render::SortKeyList keys;
+
+  for (size_t i = 0;  i < count;  i++)
+  {
+    render::SortKey key;
+    key.layer = random.next(2);
+    key.state = random.next(8) * 257;
+    key.depth = random.next(depthCount) * 4099;
+    keys.push_back(key.value & 0xffffffffffffull);
+  }
+
+  return keys;
+}
+
+void fillQueue(render::Queue& queue, const render::SortKeyList& keys)
+{
+  queue.removeOperations();
+
+  for (size_t i = 0;  i < keys.size();  i++)
+    queue.addOperation(render::Operation(), keys[i]);
+}
+
+bool isStablySorted(const render::Queue& queue)
+{
+  const render::SortKeyList& keys = queue.getSortKeys();
+
+  render::OperationIndexList expected(keys.size());
+
+  for (size_t i = 0;  i < expected.size();  i++)
+    expected[i] = uint32(i);
+
+  std::stable_sort(expected.begin(), expected.end(), [&keys](uint32 a, uint32 b)
+  {
+    return keys[a] < keys[b];
+  });
+
+  return queue.getSortedIndices() == expected;
+}
+
+void testSizes()
+{
+  Random random;
+
+  const size_t sizes[] = { 0, 1, 2, 17, 63, 64, 65, 1000, 50000 };
+
+  bool sorted = true;
+
+  for (size_t i = 0;  i < sizeof(sizes) / sizeof(sizes[0]);  i++)
+  {
+    // A new queue for each size, so no earlier order is refined
+    render::Queue queue;
+    fillQueue(queue, createKeys(random, sizes[i], 1000));
+
+    if (!isStablySorted(queue))
+      sorted = false;
+
+    // Few distinct keys give long runs that must keep their order
+    fillQueue(queue, createKeys(random, sizes[i], 3));
+
+    if (!isStablySorted(queue))
+      sorted = false;
+  }
+
+  check(sorted, "queues of every size match a stable sort");
+}
+
+void testFrames()
+{
+  Random random;
+  render::Queue queue;
+
+  render::SortKeyList keys = createKeys(random, 10000, 1000);
+  fillQueue(queue, keys);
+
+  check(isStablySorted(queue), "first frame matches a stable sort");
+
+  bool nearlySame = true;
+
+  // A few changed keys per frame are handled by refining the last order
+  for (uint frame = 0;  frame < 10;  frame++)
+  {
+    for (uint i = 0;  i < 10;  i++)
+    {
+      render::SortKey key(keys[random.next(uint(keys.size()))]);
+      key.depth = random.next(1000) * 4099;
+      keys[random.next(uint(keys.size()))] = key.value & 0xffffffffffffull;
+    }
+
+    fillQueue(queue, keys);
+
+    if (!isStablySorted(queue))
+      nearlySame = false;
+  }
+
+  check(nearlySame, "nearly unchanged frames match a stable sort");
+
+  // Too many changes exhaust the refinement budget
+  fillQueue(queue, createKeys(random, keys.size(), 1000));
+  check(isStablySorted(queue), "reshuffled frame matches a stable sort");
+
+  fillQueue(queue, createKeys(random, keys.size() / 2, 1000));
+  check(isStablySorted(queue), "resized frame matches a stable sort");
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  testSizes();
+  testFrames();
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
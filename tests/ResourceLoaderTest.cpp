@@ -0,0 +1,243 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy resource loader test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const char* const MESH_NAME = "ResourceLoaderTest.obj";
+
+const uint THREAD_COUNT = 4;
+const uint JOB_COUNT = 64;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+bool writeMesh()
+{
+  std::FILE* file = std::fopen(MESH_NAME, "wb");
+  if (!file)
+  {
+    std::fprintf(stderr, "Failed to create %s\n", MESH_NAME);
+    return false;
+  }
+
+  std::fprintf(file, "usemtl test\n");
+
+  // Large enough that reading it takes a while, so that the reads overlap
+  for (uint i = 0;  i < 3000;  i++)
+  {
+    std::fprintf(file, "v %u.0 %u.5 0.25\n", i, i % 7);
+    std::fprintf(file, "vn 0.0 0.0 1.0\n");
+    std::fprintf(file, "vt 0.%u 0.5\n", i);
+
+    if (i % 3 == 2)
+    {
+      std::fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n",
+                   i - 1, i - 1, i - 1,
+                   i, i, i,
+                   i + 1, i + 1, i + 1);
+    }
+  }
+
+  std::fclose(file);
+  return true;
+}
+
+// Reads the same mesh from many jobs at once, which must all get the single
+// cached instance rather than creating duplicates
+void testConcurrentReads(ResourceCache& cache)
+{
+  ResourceLoader loader(cache, THREAD_COUNT);
+
+  // The references taken by the finish stages keep the mesh cached from the
+  // first finished job on, while the loader holds it until then
+  std::vector<Ref<Mesh>> meshes(JOB_COUNT);
+
+  for (uint i = 0;  i < JOB_COUNT;  i++)
+  {
+    Ref<Mesh>* target = &meshes[i];
+
+    auto decode = [&cache]() -> Ref<Resource>
+    {
+      return Mesh::read(cache, MESH_NAME).getObject();
+    };
+
+    auto finish = [target](Resource* resource) -> bool
+    {
+      *target = dynamic_cast<Mesh*>(resource);
+      return *target != NULL;
+    };
+
+    loader.addJob(decode, finish);
+  }
+
+  loader.waitAll();
+
+  const Ref<Mesh> mesh = meshes.front();
+
+  bool same = true;
+
+  for (uint i = 0;  i < JOB_COUNT;  i++)
+  {
+    if (meshes[i] != mesh)
+      same = false;
+  }
+
+  check(mesh != NULL, "reads succeed");
+  check(same, "every read returns the same mesh");
+  check(mesh && mesh->getTriangleCount() == 1000, "mesh has all its triangles");
+}
+
+void testPrefetchMerging(ResourceCache& cache)
+{
+  ResourceLoader loader(cache, 0);
+
+  const ResourceLoader::JobID first = loader.prefetch<Mesh>(MESH_NAME);
+  const ResourceLoader::JobID second = loader.prefetch<Mesh>(MESH_NAME);
+
+  check(first == second, "unfinished prefetches of a name are merged");
+  check(loader.getPendingCount() == 1, "merged prefetches make a single job");
+
+  check(loader.wait(first), "prefetch succeeds");
+
+  const ResourceLoader::JobID third = loader.prefetch<Mesh>(MESH_NAME);
+
+  check(third != first, "finished prefetches are not merged");
+  check(loader.wait(third), "repeated prefetch succeeds");
+}
+
+// Finished jobs give up their slots to later jobs, while their identifiers
+// keep reporting how they went
+void testJobRecycling(ResourceCache& cache)
+{
+  ResourceLoader loader(cache, 0);
+
+  auto succeed = [](Resource*) -> bool { return true; };
+  auto fail = [](Resource*) -> bool { return false; };
+
+  const ResourceLoader::JobID failed = loader.addJob(ResourceLoader::DecodeFunc(), fail);
+  check(!loader.wait(failed), "failing job fails");
+
+  const ResourceLoader::JobID first = loader.addJob(ResourceLoader::DecodeFunc(), succeed);
+  check(loader.wait(first), "succeeding job succeeds");
+
+  std::vector<ResourceLoader::JobID> IDs;
+
+  for (uint i = 0;  i < JOB_COUNT;  i++)
+  {
+    IDs.push_back(loader.addJob(ResourceLoader::DecodeFunc(), succeed));
+    check(loader.wait(IDs.back()), "recycled job succeeds");
+  }
+
+  bool unique = std::find(IDs.begin(), IDs.end(), first) == IDs.end();
+
+  for (uint i = 0;  i < JOB_COUNT;  i++)
+  {
+    if (std::count(IDs.begin(), IDs.end(), IDs[i]) != 1)
+      unique = false;
+  }
+
+  check(unique, "recycled jobs get new identifiers");
+  check(loader.isFinished(first) && loader.hasSucceeded(first),
+        "identifier of a recycled job reports success");
+  check(loader.isFinished(failed) && !loader.hasSucceeded(failed),
+        "identifier of a failed job keeps reporting failure");
+
+  ResourceLoader::JobList dependencies;
+  dependencies.push_back(first);
+
+  check(loader.wait(loader.addJob(ResourceLoader::DecodeFunc(), succeed, dependencies)),
+        "job depending on a recycled job runs");
+
+  dependencies.push_back(failed);
+
+  check(!loader.wait(loader.addJob(ResourceLoader::DecodeFunc(), succeed, dependencies)),
+        "job depending on a failed job fails");
+  check(loader.getPendingCount() == 0, "no jobs are left pending");
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  const String cacheName = String(MESH_NAME) + ".mesh";
+
+  std::remove(cacheName.c_str());
+
+  if (!writeMesh())
+    std::exit(EXIT_FAILURE);
+
+  {
+    ResourceCache cache;
+
+    testConcurrentReads(cache);
+
+    std::remove(cacheName.c_str());
+
+    testPrefetchMerging(cache);
+    testJobRecycling(cache);
+  }
+
+  std::remove(cacheName.c_str());
+  std::remove(MESH_NAME);
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::printf("All resource loader checks passed\n");
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
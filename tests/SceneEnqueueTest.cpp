@@ -0,0 +1,266 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy scene graph enqueue test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+#include <wendy/Occlusion.h>
+
+#include <wendy/GLQuery.h>
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
+
+#include <wendy/RenderPool.h>
+#include <wendy/RenderState.h>
+#include <wendy/RenderSystem.h>
+#include <wendy/RenderMaterial.h>
+#include <wendy/RenderLight.h>
+#include <wendy/RenderScene.h>
+#include <wendy/RenderModel.h>
+
+#include <wendy/SceneGraph.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const uint GRID_SIZE = 64;
+const uint THREAD_COUNT = 4;
+const uint BENCHMARK_FRAMES = 20;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+// Adds an operation per pass, identified by the number of the node in its
+// transform.  Every other node uses a fixed depth, so that many operations
+// share a sort key and are only ordered by when they were added
+class TestNode : public scene::Node
+{
+public:
+  TestNode(uint number, const std::vector<render::Pass>& passes, bool concurrent):
+    number(number),
+    passes(passes),
+    concurrent(concurrent)
+  {
+  }
+  bool isConcurrent() const
+  {
+    return concurrent;
+  }
+protected:
+  void enqueue(render::Scene& scene, const Camera& camera) const
+  {
+    Node::enqueue(scene, camera);
+
+    render::Operation operation;
+    operation.transform[3][0] = float(number);
+
+    float depth = 0.5f;
+    if (number % 2)
+      depth = camera.getNormalizedDepth(getWorldTransform().position);
+
+    for (uint i = 0;  i < 2;  i++)
+    {
+      operation.state = &passes[(number + i) % passes.size()];
+      scene.addOperation(operation, depth, uint8(i));
+    }
+  }
+private:
+  uint number;
+  const std::vector<render::Pass>& passes;
+  bool concurrent;
+};
+
+// Builds a grid of root nodes in front of the camera, with runs of nodes
+// that may not be enqueued concurrently mixed in, some of them only because
+// of one of their children
+void createNodes(scene::Graph& graph, const std::vector<render::Pass>& passes)
+{
+  uint number = 0;
+
+  for (uint y = 0;  y < GRID_SIZE;  y++)
+  {
+    for (uint x = 0;  x < GRID_SIZE;  x++)
+    {
+      const bool concurrent = (number / 50) % 4 != 3;
+
+      TestNode* node = new TestNode(number++, passes, concurrent);
+      node->setLocalPosition(vec3(float(x) - GRID_SIZE / 2.f,
+                                  float(y) - GRID_SIZE / 2.f,
+                                  -10.f - float(x + y)));
+      node->setLocalBounds(Sphere(vec3(0.f), 0.5f));
+
+      if (number % 97 == 0)
+      {
+        TestNode* child = new TestNode(number++, passes, false);
+        child->setLocalBounds(Sphere(vec3(0.f), 0.5f));
+        node->addChild(*child);
+      }
+
+      graph.addRootNode(*node);
+    }
+  }
+}
+
+// Collects the node numbers and states of the operations of a queue, in the
+// order they would be rendered
+std::vector<float> getSortedOperations(const render::Queue& queue)
+{
+  std::vector<float> result;
+
+  const render::OperationList& operations = queue.getOperations();
+  const render::OperationIndexList& indices = queue.getSortedIndices();
+
+  for (auto i = indices.begin();  i != indices.end();  i++)
+  {
+    const render::Operation& operation = operations[*i];
+    result.push_back(operation.transform[3][0]);
+    result.push_back(float(operation.state->getID()));
+  }
+
+  return result;
+}
+
+void testEnqueueOrder(scene::Graph& graph, const Camera& camera)
+{
+  render::Scene serial;
+  graph.setThreadCount(1);
+  graph.enqueue(serial, camera);
+
+  check(!serial.getOpaqueQueue().getOperations().empty(), "serial enqueue adds operations");
+  check(!serial.getBlendedQueue().getOperations().empty(), "serial enqueue adds blended operations");
+
+  render::Scene parallel;
+  graph.setThreadCount(THREAD_COUNT);
+
+  // Repeated to also exercise the reuse of the workers and their scenes
+  for (uint i = 0;  i < 3;  i++)
+  {
+    parallel.removeOperations();
+    graph.enqueue(parallel, camera);
+
+    check(parallel.getOpaqueQueue().getSortKeys() == serial.getOpaqueQueue().getSortKeys(),
+          "parallel enqueue adds opaque operations in serial order");
+    check(parallel.getBlendedQueue().getSortKeys() == serial.getBlendedQueue().getSortKeys(),
+          "parallel enqueue adds blended operations in serial order");
+    check(getSortedOperations(parallel.getOpaqueQueue()) ==
+          getSortedOperations(serial.getOpaqueQueue()),
+          "parallel enqueue gives the serial opaque draw order");
+    check(getSortedOperations(parallel.getBlendedQueue()) ==
+          getSortedOperations(serial.getBlendedQueue()),
+          "parallel enqueue gives the serial blended draw order");
+  }
+}
+
+// Timer uses GLFW, which needs a display, so the standard clock is used
+double measureEnqueue(scene::Graph& graph, const Camera& camera, uint threadCount)
+{
+  typedef std::chrono::steady_clock Clock;
+
+  graph.setThreadCount(threadCount);
+
+  render::Scene scene;
+
+  // The first call starts any workers
+  graph.enqueue(scene, camera);
+
+  const Clock::time_point start = Clock::now();
+
+  for (uint i = 0;  i < BENCHMARK_FRAMES;  i++)
+  {
+    scene.removeOperations();
+    graph.enqueue(scene, camera);
+  }
+
+  const std::chrono::duration<double> elapsed = Clock::now() - start;
+  return elapsed.count() / BENCHMARK_FRAMES;
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  {
+    std::vector<render::Pass> passes(4);
+    passes[3].setBlendFactors(GL::BLEND_ONE, GL::BLEND_ONE);
+
+    Camera camera;
+    camera.setFOV(90.f);
+    camera.setAspectRatio(1.f);
+    camera.setNearZ(0.1f);
+    camera.setFarZ(1000.f);
+
+    scene::Graph graph;
+    createNodes(graph, passes);
+
+    testEnqueueOrder(graph, camera);
+
+    const double serial = measureEnqueue(graph, camera, 1);
+    const double parallel = measureEnqueue(graph, camera, THREAD_COUNT);
+
+    std::printf("Enqueue %.3f ms serial, %.3f ms on %u threads\n",
+                serial * 1000.0, parallel * 1000.0, THREAD_COUNT);
+  }
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,153 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy shared program state test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
+
+#include <wendy/RenderState.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const uint DRAW_COUNT = 1000;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+void testGenerations()
+{
+  render::SharedProgramState state;
+  uint generation = state.getBlockGeneration();
+
+  state.setModelMatrix(mat4(1.f));
+  check(state.getBlockGeneration() == generation,
+        "model matrix is not a member of the shared block");
+
+  state.setViewMatrix(mat4(2.f));
+  check(state.getBlockGeneration() != generation, "view matrix invalidates the block");
+  generation = state.getBlockGeneration();
+
+  state.setPerspectiveProjectionMatrix(90.f, 1.f, 0.1f, 100.f);
+  check(state.getBlockGeneration() != generation, "projection invalidates the block");
+  generation = state.getBlockGeneration();
+
+  state.setCameraProperties(vec3(0.f), 90.f, 1.f, 0.1f, 100.f);
+  check(state.getBlockGeneration() != generation, "camera invalidates the block");
+  generation = state.getBlockGeneration();
+
+  state.setViewportSize(640.f, 480.f);
+  check(state.getBlockGeneration() != generation, "viewport invalidates the block");
+  generation = state.getBlockGeneration();
+
+  state.setTime(1.f);
+  check(state.getBlockGeneration() != generation, "time invalidates the block");
+
+  render::SharedProgramState other;
+  check(other.getBlockGeneration() != state.getBlockGeneration(),
+        "states never share a block generation");
+}
+
+// Counts the shared block updates of a frame the way the context decides
+// them before each draw, compared to updating it for every draw
+void measureUpdates()
+{
+  render::SharedProgramState state;
+
+  uint lastGeneration = 0;
+  uint updateCount = 0;
+
+  for (uint frame = 0;  frame < 2;  frame++)
+  {
+    state.setViewMatrix(mat4(1.f));
+    state.setPerspectiveProjectionMatrix(90.f, 1.f, 0.1f, 100.f);
+    state.setCameraProperties(vec3(0.f), 90.f, 1.f, 0.1f, 100.f);
+    state.setViewportSize(640.f, 480.f);
+    state.setTime(float(frame));
+
+    for (uint i = 0;  i < DRAW_COUNT;  i++)
+    {
+      state.setModelMatrix(mat4(float(i)));
+
+      if (state.getBlockGeneration() != lastGeneration)
+      {
+        lastGeneration = state.getBlockGeneration();
+        updateCount++;
+      }
+    }
+  }
+
+  check(updateCount == 2, "shared block is updated once per frame");
+
+  std::printf("Shared block updates for %u draws: %u before, %u after\n",
+              DRAW_COUNT * 2, DRAW_COUNT * 2, updateCount);
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  testGenerations();
+  measureUpdates();
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,265 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy spatial index test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+#include <wendy/Occlusion.h>
+
+#include <wendy/GLQuery.h>
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
+
+#include <wendy/RenderPool.h>
+#include <wendy/RenderState.h>
+#include <wendy/RenderSystem.h>
+#include <wendy/RenderMaterial.h>
+#include <wendy/RenderLight.h>
+#include <wendy/RenderScene.h>
+#include <wendy/RenderModel.h>
+
+#include <wendy/SceneGraph.h>
+
+#include <glm/gtx/quaternion.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const uint NODE_COUNT = 2000;
+const uint QUERY_COUNT = 50;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+class Random
+{
+public:
+  Random(): state(12345) { }
+  uint next()
+  {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return uint(state >> 33);
+  }
+  float next(float minimum, float maximum)
+  {
+    return minimum + (maximum - minimum) * (next() / float(1u << 31));
+  }
+  vec3 nextPoint(float extent)
+  {
+    return vec3(next(-extent, extent), next(-extent, extent), next(-extent, extent));
+  }
+private:
+  uint64 state;
+};
+
+// The nodes of a spatial index along with the bounds they were last given
+class Proxies
+{
+public:
+  std::vector<scene::Node*> nodes;
+  std::vector<Sphere> bounds;
+  std::vector<int> IDs;
+};
+
+scene::Node::List sorted(scene::Node::List nodes)
+{
+  std::sort(nodes.begin(), nodes.end());
+  return nodes;
+}
+
+scene::Node::List querySpheres(const Proxies& proxies, const Sphere& sphere)
+{
+  scene::Node::List nodes;
+
+  for (size_t i = 0;  i < proxies.nodes.size();  i++)
+  {
+    if (proxies.IDs[i] != -1 && sphere.intersects(proxies.bounds[i]))
+      nodes.push_back(proxies.nodes[i]);
+  }
+
+  return nodes;
+}
+
+scene::Node::List queryFrustum(const Proxies& proxies, const Frustum& frustum)
+{
+  scene::Node::List nodes;
+
+  for (size_t i = 0;  i < proxies.nodes.size();  i++)
+  {
+    if (proxies.IDs[i] != -1 && frustum.intersects(proxies.bounds[i]))
+      nodes.push_back(proxies.nodes[i]);
+  }
+
+  return nodes;
+}
+
+// The index rejects inner boxes with an exact test, so it may leave out
+// spheres the plane tests accept, but only those that are actually outside
+bool isOutside(const Frustum& frustum, const Sphere& sphere)
+{
+  return !frustum.intersectsExactly(AABB(sphere.center, vec3(sphere.radius)));
+}
+
+void checkQueries(const scene::SpatialIndex& index, const Proxies& proxies, Random& random)
+{
+  bool sphereMatches = true;
+  bool frustumSubset = true;
+  bool frustumComplete = true;
+  size_t visibleCount = 0;
+
+  for (uint i = 0;  i < QUERY_COUNT;  i++)
+  {
+    const Sphere sphere(random.nextPoint(100.f), random.next(1.f, 40.f));
+
+    scene::Node::List nodes;
+    index.query(sphere, nodes);
+
+    if (sorted(nodes) != sorted(querySpheres(proxies, sphere)))
+      sphereMatches = false;
+
+    Frustum frustum(random.next(30.f, 90.f), random.next(0.5f, 2.f), 0.1f, 150.f);
+    frustum.transformBy(Transform3(random.nextPoint(50.f),
+                                   angleAxis(random.next(0.f, 360.f),
+                                             normalize(random.nextPoint(1.f) + vec3(0.f, 0.f, 0.01f)))));
+
+    nodes.clear();
+    index.query(frustum, nodes);
+    nodes = sorted(nodes);
+    visibleCount += nodes.size();
+
+    const scene::Node::List expected = sorted(queryFrustum(proxies, frustum));
+
+    if (!std::includes(expected.begin(), expected.end(), nodes.begin(), nodes.end()))
+      frustumSubset = false;
+
+    for (size_t j = 0;  j < proxies.nodes.size();  j++)
+    {
+      if (proxies.IDs[j] == -1)
+        continue;
+
+      if (std::binary_search(nodes.begin(), nodes.end(), proxies.nodes[j]))
+        continue;
+
+      if (std::binary_search(expected.begin(), expected.end(), proxies.nodes[j]) &&
+          !isOutside(frustum, proxies.bounds[j]))
+      {
+        frustumComplete = false;
+      }
+    }
+  }
+
+  check(sphereMatches, "sphere queries match brute force");
+  check(frustumSubset, "frustum queries only find nodes brute force finds");
+  check(frustumComplete, "frustum queries find every node inside the frustum");
+  check(visibleCount > 0, "frustum queries find some nodes");
+}
+
+void testQueries()
+{
+  Random random;
+  scene::SpatialIndex index;
+  Proxies proxies;
+
+  for (uint i = 0;  i < NODE_COUNT;  i++)
+  {
+    proxies.nodes.push_back(new scene::Node());
+    proxies.bounds.push_back(Sphere(random.nextPoint(100.f), random.next(0.1f, 5.f)));
+    proxies.IDs.push_back(index.createProxy(*proxies.nodes.back(), proxies.bounds.back()));
+  }
+
+  checkQueries(index, proxies, random);
+
+  // Small moves stay within the enlarged boxes, large ones reinsert
+  for (uint i = 0;  i < NODE_COUNT;  i += 3)
+  {
+    const float distance = (i % 2) ? 0.05f : 30.f;
+    proxies.bounds[i].center += random.nextPoint(distance);
+    index.moveProxy(proxies.IDs[i], proxies.bounds[i]);
+  }
+
+  checkQueries(index, proxies, random);
+
+  for (uint i = 0;  i < NODE_COUNT;  i += 5)
+  {
+    index.destroyProxy(proxies.IDs[i]);
+    proxies.IDs[i] = -1;
+  }
+
+  checkQueries(index, proxies, random);
+
+  check(index.getHeight() < 40, "tree stays balanced");
+
+  for (uint i = 0;  i < NODE_COUNT;  i++)
+    delete proxies.nodes[i];
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  testQueries();
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,324 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy transform hierarchy test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Transform.h>
+#include <wendy/AABB.h>
+#include <wendy/Sphere.h>
+#include <wendy/Plane.h>
+#include <wendy/Frustum.h>
+#include <wendy/Camera.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+#include <wendy/Mesh.h>
+#include <wendy/Occlusion.h>
+
+#include <wendy/GLQuery.h>
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+#include <wendy/GLContext.h>
+
+#include <wendy/RenderPool.h>
+#include <wendy/RenderState.h>
+#include <wendy/RenderSystem.h>
+#include <wendy/RenderMaterial.h>
+#include <wendy/RenderLight.h>
+#include <wendy/RenderScene.h>
+#include <wendy/RenderModel.h>
+
+#include <wendy/SceneGraph.h>
+
+#include <glm/gtx/quaternion.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const uint ROOT_COUNT = 20;
+const uint NODE_COUNT = 600;
+const uint ROUND_COUNT = 10;
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+class Random
+{
+public:
+  Random(): state(12345) { }
+  uint next()
+  {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return uint(state >> 33);
+  }
+  uint next(uint limit)
+  {
+    return next() % limit;
+  }
+  float next(float minimum, float maximum)
+  {
+    return minimum + (maximum - minimum) * (next() / float(1u << 31));
+  }
+  vec3 nextPoint(float extent)
+  {
+    return vec3(next(-extent, extent), next(-extent, extent), next(-extent, extent));
+  }
+  quat nextRotation()
+  {
+    return angleAxis(next(0.f, 360.f), normalize(nextPoint(1.f) + vec3(0.f, 0.01f, 0.f)));
+  }
+private:
+  uint64 state;
+};
+
+// The same tree of nodes in a graph using the flat transform hierarchy and
+// in one propagating transforms through the nodes
+class Trees
+{
+public:
+  Trees():
+    flat(true),
+    recursive(false)
+  {
+  }
+  void addNode(Random& random)
+  {
+    const Transform3 local(random.nextPoint(10.f),
+                           random.nextRotation(),
+                           random.next(0.5f, 2.f));
+
+    scene::Node* flatNode = new scene::Node();
+    flatNode->setLocalTransform(local);
+
+    scene::Node* recursiveNode = new scene::Node();
+    recursiveNode->setLocalTransform(local);
+
+    if (flatNodes.size() < ROOT_COUNT)
+    {
+      flat.addRootNode(*flatNode);
+      recursive.addRootNode(*recursiveNode);
+    }
+    else
+    {
+      const uint parent = random.next(uint(flatNodes.size()));
+      flatNodes[parent]->addChild(*flatNode);
+      recursiveNodes[parent]->addChild(*recursiveNode);
+    }
+
+    flatNodes.push_back(flatNode);
+    recursiveNodes.push_back(recursiveNode);
+  }
+  void changeTransforms(Random& random)
+  {
+    for (uint i = 0;  i < flatNodes.size() / 4;  i++)
+    {
+      const uint index = random.next(uint(flatNodes.size()));
+
+      switch (random.next(3))
+      {
+        case 0:
+        {
+          const vec3 position = random.nextPoint(10.f);
+          flatNodes[index]->setLocalPosition(position);
+          recursiveNodes[index]->setLocalPosition(position);
+          break;
+        }
+
+        case 1:
+        {
+          const quat rotation = random.nextRotation();
+          flatNodes[index]->setLocalRotation(rotation);
+          recursiveNodes[index]->setLocalRotation(rotation);
+          break;
+        }
+
+        case 2:
+        {
+          const float scale = random.next(0.5f, 2.f);
+          flatNodes[index]->setLocalScale(scale);
+          recursiveNodes[index]->setLocalScale(scale);
+          break;
+        }
+      }
+    }
+  }
+  // Moves non-root nodes to other parents, which adds new slots after those
+  // of their new parents
+  bool changeParents(Random& random)
+  {
+    bool same = true;
+
+    for (uint i = 0;  i < 20;  i++)
+    {
+      const uint child = ROOT_COUNT + random.next(uint(flatNodes.size()) - ROOT_COUNT);
+      const uint parent = random.next(uint(flatNodes.size()));
+
+      if (flatNodes[parent]->addChild(*flatNodes[child]) !=
+          recursiveNodes[parent]->addChild(*recursiveNodes[child]))
+      {
+        same = false;
+      }
+    }
+
+    return same;
+  }
+  // Destroys a non-root node and its descendants, which leaves unused slots
+  void destroyNode(Random& random)
+  {
+    const uint index = ROOT_COUNT + random.next(uint(flatNodes.size()) - ROOT_COUNT);
+
+    scene::Node* flatNode = flatNodes[index];
+    scene::Node* recursiveNode = recursiveNodes[index];
+
+    size_t count = 0;
+
+    for (size_t i = 0;  i < flatNodes.size();  i++)
+    {
+      if (flatNodes[i] == flatNode || flatNodes[i]->isChildOf(*flatNode))
+        continue;
+
+      flatNodes[count] = flatNodes[i];
+      recursiveNodes[count] = recursiveNodes[i];
+      count++;
+    }
+
+    flatNodes.resize(count);
+    recursiveNodes.resize(count);
+
+    delete flatNode;
+    delete recursiveNode;
+  }
+  // Checks the world transforms of both trees against each other
+  bool matches() const
+  {
+    for (size_t i = 0;  i < flatNodes.size();  i++)
+    {
+      const Transform3& first = flatNodes[i]->getWorldTransform();
+      const Transform3& second = recursiveNodes[i]->getWorldTransform();
+
+      const float tolerance = 1e-4f * max(1.f, length(second.position));
+
+      if (length(first.position - second.position) > tolerance ||
+          std::abs(std::abs(dot(first.rotation, second.rotation)) - 1.f) > 1e-4f ||
+          std::abs(first.scale - second.scale) > 1e-4f * second.scale)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+  scene::Graph flat;
+  scene::Graph recursive;
+  std::vector<scene::Node*> flatNodes;
+  std::vector<scene::Node*> recursiveNodes;
+};
+
+void testTransforms()
+{
+  Random random;
+  Trees trees;
+
+  for (uint i = 0;  i < NODE_COUNT;  i++)
+    trees.addNode(random);
+
+  check(trees.matches(), "world transforms of new nodes match");
+
+  trees.flat.update();
+  trees.recursive.update();
+
+  check(trees.matches(), "world transforms of new nodes match after update");
+
+  bool sameParents = true;
+  bool matchesBefore = true;
+  bool matchesAfter = true;
+
+  for (uint i = 0;  i < ROUND_COUNT;  i++)
+  {
+    trees.changeTransforms(random);
+
+    if (!trees.changeParents(random))
+      sameParents = false;
+
+    for (uint j = 0;  j < 5;  j++)
+      trees.destroyNode(random);
+
+    for (uint j = 0;  j < 20;  j++)
+      trees.addNode(random);
+
+    // Before the update, world transforms are computed on demand
+    if (!trees.matches())
+      matchesBefore = false;
+
+    trees.flat.update();
+    trees.recursive.update();
+
+    if (!trees.matches())
+      matchesAfter = false;
+  }
+
+  check(sameParents, "both trees accept the same parents");
+  check(matchesBefore, "changed world transforms match before update");
+  check(matchesAfter, "changed world transforms match after update");
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  testTransforms();
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////
@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////
+// Wendy vertex format test
+// Copyright (c) 2012 Camilla Berglund <elmindreda@elmindreda.org>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any
+// damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any
+// purpose, including commercial applications, and to alter it and
+// redistribute it freely, subject to the following restrictions:
+//
+//  1. The origin of this software must not be misrepresented; you
+//     must not claim that you wrote the original software. If you use
+//     this software in a product, an acknowledgment in the product
+//     documentation would be appreciated but is not required.
+//
+//  2. Altered source versions must be plainly marked as such, and
+//     must not be misrepresented as being the original software.
+//
+//  3. This notice may not be removed or altered from any source
+//     distribution.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <wendy/Config.h>
+
+#include <wendy/Core.h>
+#include <wendy/Path.h>
+#include <wendy/Resource.h>
+
+#include <wendy/GLTexture.h>
+#include <wendy/GLBuffer.h>
+#include <wendy/GLProgram.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+///////////////////////////////////////////////////////////////////////
+
+using namespace wendy;
+
+///////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+uint failures = 0;
+
+void check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failures++;
+  }
+}
+
+void testLayout()
+{
+  const VertexFormat format("3h:vPosition 4s:vColor 2f:vTexCoord");
+
+  check(format.getComponentCount() == 3, "every component is parsed");
+  check(format.getSize() == 6 + 8 + 8, "components are tightly packed");
+
+  const VertexComponent* position = format.findComponent("vPosition");
+  const VertexComponent* color = format.findComponent("vColor");
+  const VertexComponent* texCoord = format.findComponent("vTexCoord");
+
+  check(position && position->getType() == VertexComponent::FLOAT16 &&
+        position->getOffset() == 0 && position->getSize() == 6,
+        "half component has two bytes per element");
+  check(color && color->getType() == VertexComponent::SNORM16 &&
+        color->getOffset() == 6 && color->getSize() == 8,
+        "normalized component has two bytes per element");
+  check(texCoord && texCoord->getType() == VertexComponent::FLOAT32 &&
+        texCoord->getOffset() == 14,
+        "float component follows the packed ones");
+
+  check(position && position->isReadAsFloat() &&
+        color && color->isReadAsFloat() &&
+        texCoord && texCoord->isReadAsFloat(),
+        "every component type is read as floats");
+
+  check(VertexFormat(format.asString().c_str()) == format,
+        "format survives a round trip through its specification");
+}
+
+void testInterface()
+{
+  const VertexFormat format("3h:vPosition 4s:vColor 2f:vTexCoord");
+
+  // Packed components match float attributes of the same width, whatever
+  // their names
+  GL::ProgramInterface matching;
+  matching.addAttribute("vPosition", GL::ATTRIBUTE_VEC3);
+  matching.addAttribute("vColor", GL::ATTRIBUTE_VEC4);
+  matching.addAttribute("vTexCoord", GL::ATTRIBUTE_VEC2);
+
+  check(matching.matches(format), "packed components match float attributes");
+
+  GL::ProgramInterface narrower;
+  narrower.addAttribute("vPosition", GL::ATTRIBUTE_VEC2);
+  narrower.addAttribute("vColor", GL::ATTRIBUTE_VEC4);
+  narrower.addAttribute("vTexCoord", GL::ATTRIBUTE_VEC2);
+
+  check(!narrower.matches(format), "packed components need the same width");
+
+  GL::ProgramInterface added;
+  added.addAttributes(format);
+
+  check(added.matches(format), "interface made from a format matches it");
+}
+
+} /*namespace*/
+
+///////////////////////////////////////////////////////////////////////
+
+int main()
+{
+  testLayout();
+  testInterface();
+
+  if (failures)
+  {
+    std::fprintf(stderr, "%u checks failed\n", failures);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
+
+///////////////////////////////////////////////////////////////////////